@@ -1,11 +1,26 @@
 /*
  * Factorial Recursive Function - C Reference Implementation
- * 
- * This demonstrates a simple recursive function that will be
- * translated to assembly for the Software CPU.
+ *
+ * This demonstrates a simple recursive function. It is written in the C
+ * subset the emulator compiles itself:
+ *
+ *   ./cpu-emulator examples/factorial.c
+ *
+ * compiles it to examples/factorial.s, assembles and runs it. It also
+ * builds with any hosted C compiler once print_char uses putchar.
  */
 
-#include <stdio.h>
+// Writes a character to the emulator's console output port
+void print_char(int c) {
+    *(int *)0xF000 = c;
+}
+
+void print_number(unsigned value) {
+    if (value >= 10) {
+        print_number(value / 10);
+    }
+    print_char('0' + value % 10);
+}
 
 /**
  * Calculate factorial recursively
@@ -17,7 +32,7 @@ int factorial(int n) {
     if (n <= 1) {
         return 1;
     }
-    
+
     // Recursive case: n * factorial(n-1)
     return n * factorial(n - 1);
 }
@@ -28,13 +43,14 @@ int factorial(int n) {
 int main() {
     int n = 5;
     int result;
-    
-    printf("Computing factorial(%d)...\n", n);
+
     result = factorial(n);
-    printf("Result: %d\n", result);
-    
+    print_number(result);
+    print_char('\n');
+
     // Expected output: 120
     // 5! = 5 * 4 * 3 * 2 * 1 = 120
-    
-    return 0;
+    // The value is also left in R0 as main's return value
+
+    return result;
 }
@@ -0,0 +1,49 @@
+/*
+ * Insertion sort over an array - exercises arrays, pointers and loops
+ * in the compiled C subset:
+ *
+ *   ./cpu-emulator examples/sort.c
+ */
+
+int data[10] = {42, -7, 19, 0, 88, 3, -15, 64, 27, 5};
+
+void print_char(int c) {
+    *(int *)0xF000 = c;
+}
+
+void print_number(int value) {
+    unsigned magnitude = value;
+    if (value < 0) {
+        print_char('-');
+        magnitude = -value;
+    }
+    if (magnitude >= 10) {
+        print_number(magnitude / 10);
+    }
+    print_char('0' + magnitude % 10);
+}
+
+void sort(int *a, int n) {
+    for (int i = 1; i < n; i++) {
+        int key = a[i];
+        int j = i - 1;
+        while (j >= 0 && a[j] > key) {
+            a[j + 1] = a[j];
+            j--;
+        }
+        a[j + 1] = key;
+    }
+}
+
+int main(void) {
+    int count = sizeof(data) / sizeof(data[0]);
+
+    sort(data, count);
+    for (int *p = data; p < data + count; p++) {
+        print_number(*p);
+        print_char(p + 1 < data + count ? ' ' : '\n');
+    }
+
+    // Expected output: -15 -7 0 3 5 19 27 42 64 88
+    return data[0];
+}
@@ -0,0 +1,31 @@
+#ifndef ASMCACHE_H
+#define ASMCACHE_H
+
+#include "assembler.h"
+
+#define ASM_CACHE_DEFAULT_MB 64 // Directory size kept after eviction
+#define ASM_CACHE_KEY_LENGTH 32 // Hex digits in a key
+
+// A directory of assembled images named by the hash of what produced them:
+// the source text, ASM_VERSION and the assembler options. Entries are
+// written to a temporary file and renamed into place, so concurrent runs
+// only ever see whole entries; a hit refreshes the entry's modification
+// time, and the oldest entries are removed once the directory grows past
+// max_bytes.
+typedef struct {
+  const char *dir;
+  uint64_t max_bytes;
+} AsmCache;
+
+// Key for a source file under as's options; false if it cannot be read
+bool asm_cache_key(const Assembler *as, const char *source,
+                   char key[ASM_CACHE_KEY_LENGTH + 1]);
+
+// Fill in as->program, program_size and word_lines from the cache
+bool asm_cache_load(const AsmCache *cache, const char *key, Assembler *as);
+
+// Save an assembled image, then evict least recently used entries
+void asm_cache_store(const AsmCache *cache, const char *key,
+                     const Assembler *as);
+
+#endif // ASMCACHE_H
@@ -4,10 +4,43 @@
 #include <stdbool.h>
 #include <stdint.h>
 
-#define MAX_LABELS 256
+#define MAX_LABELS 2048
 #define MAX_LABEL_LENGTH 64
 #define MAX_LINE_LENGTH 256
 #define MAX_PROGRAM_SIZE 32768
+#define MAX_CONSTANTS 256   // Distinct LI values tracked for the pool
+#define MAX_POOL_ENTRIES 127 // Pool sits below 0x0100 so LOADI can address it
+#define MAX_RELOCS 512
+#define ASM_VERSION 1 // Bump when a source would assemble differently
+
+// What an emitted word is, as far as the optimizer is concerned
+typedef enum {
+  WORD_CODE,  // Ordinary instruction
+  WORD_FIXED, // Instruction of an expansion that must stay as emitted
+  WORD_DATA   // Not an instruction
+} WordKind;
+
+// Sites that hold a label's address and are patched when labels move
+typedef enum {
+  RELOC_WORD, // The word is the address
+  RELOC_LI    // LOADI/SHLI/ADDI sequence building the address
+} RelocKind;
+
+typedef struct {
+  uint16_t address;
+  RelocKind kind;
+  uint8_t reg;
+  char label[MAX_LABEL_LENGTH];
+} Reloc;
+
+// A value loaded by LI, keyed by its spelling
+typedef struct {
+  char name[MAX_LABEL_LENGTH];
+  bool is_label;
+  uint16_t value; // Numeric values only
+  int uses;
+  int slot;       // Literal pool slot, or -1 when built inline
+} Constant;
 
 // Label structure
 typedef struct {
@@ -15,6 +48,13 @@ typedef struct {
   uint16_t address;
 } Label;
 
+// Assembly passes; a lone asm_assemble_line call defaults to ASM_PASS_EMIT
+typedef enum {
+  ASM_PASS_EMIT,  // Generate code; every label must be known
+  ASM_PASS_COUNT, // Count LI constants to plan the literal pool
+  ASM_PASS_SIZE   // Lay out labels; forward references are placeholders
+} AsmPass;
+
 // Assembler context
 typedef struct {
   Label labels[MAX_LABELS];
@@ -22,6 +62,20 @@ typedef struct {
   uint8_t program[MAX_PROGRAM_SIZE];
   uint16_t program_size;
   uint16_t current_address;
+  int line_number;                        // Source line being assembled
+  uint16_t word_lines[MAX_PROGRAM_SIZE / 2]; // Source line of each word
+  bool optimize;                          // Run the peephole pass (-O)
+  int rewrites;                           // Rewrites made by the pass
+  AsmPass pass;                           // Current pass
+  bool li_cycles;                         // LI favours cycles over size
+  Constant constants[MAX_CONSTANTS];
+  int constant_count;
+  int pool_count;                         // Literal pool words
+  uint8_t word_kinds[MAX_PROGRAM_SIZE / 2]; // WordKind of each word
+  WordKind emit_kind;                     // Kind given to emitted words
+  bool fixed_layout;                      // .org/.align pinned addresses
+  Reloc relocs[MAX_RELOCS];
+  int reloc_count;
 } Assembler;
 
 // Function prototypes
@@ -31,8 +85,12 @@ bool asm_assemble_line(Assembler *as, const char *line);
 void asm_add_label(Assembler *as, const char *name, uint16_t address);
 int16_t asm_get_label_address(Assembler *as, const char *name);
 bool asm_save_binary(Assembler *as, const char *filename);
+bool asm_optimize(Assembler *as);
+void asm_apply_relocs(Assembler *as);
 void asm_emit_word(Assembler *as, uint16_t word);
+void asm_emit_byte(Assembler *as, uint8_t byte);
+// Operand parsers; a missing operand (NULL) is an error, not a crash
 int asm_parse_register(const char *str);
-int16_t asm_parse_immediate(const char *str);
+bool asm_parse_immediate(const char *str, int16_t *value);
 
 #endif // ASSEMBLER_H
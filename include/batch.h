@@ -0,0 +1,44 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "cpu.h"
+#include "types.h"
+
+// Lane arrays are padded to a multiple of this (one AVX2 vector of 16-bit
+// elements, two SSE2 vectors)
+#define BATCH_VECTOR_LANES 16
+
+// Batched engine: N copies of a program stored as structure-of-arrays.
+// Lanes that share a PC run in lockstep; divergent lanes are masked off and
+// picked up again when the scheduler reaches their PC.
+typedef struct {
+  uint32_t lanes;                     // Number of guest instances
+  uint32_t stride;                    // lanes rounded up to BATCH_VECTOR_LANES
+  uint16_t *registers[NUM_REGISTERS]; // registers[r][lane]
+  uint16_t *pc;                       // pc[lane]
+  uint16_t *flags;                    // flags[lane] (widened for vector ops)
+  uint16_t *active;                   // 0xFFFF while the lane has not halted
+  uint16_t *mask;                     // Lanes executing the current step
+  uint16_t *devices;                  // Lane's timer or interrupts are live
+  uint64_t *cycle_count;              // Per-lane instruction counter
+  CPU *cpus;                          // Per-lane memory and device state
+  uint8_t *banks;                     // Per-lane copies of extended memory
+  uint32_t running;                   // Lanes not yet halted
+  uint64_t steps;                     // Lockstep groups issued
+  uint64_t lane_instructions;         // Instructions retired over all lanes
+} Batch;
+
+// Batch setup and teardown
+bool batch_init(Batch *batch, uint32_t lanes, const CPU *prototype);
+void batch_free(Batch *batch);
+void batch_set_register(Batch *batch, uint32_t lane, uint8_t reg_index,
+                        uint16_t value);
+
+// Execution
+bool batch_step(Batch *batch);
+void batch_run(Batch *batch);
+
+// Copy a lane's architectural state back into its CPU
+CPU *batch_lane_cpu(Batch *batch, uint32_t lane);
+
+#endif // BATCH_H
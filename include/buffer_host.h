@@ -0,0 +1,31 @@
+#ifndef BUFFER_HOST_H
+#define BUFFER_HOST_H
+
+#include "host.h"
+#include "types.h"
+
+// Host services backed by memory, for runs that must be repeatable: console
+// input is a caller's buffer and then ends, so nothing ever blocks, and
+// console output (when connected) is kept in another. The clock and log are
+// left unconnected for the owner to fill in.
+typedef struct {
+  CpuHost host;         // Callbacks; ctx points at this struct
+  const uint8_t *input; // Console input of the current run
+  uint32_t input_len;
+  uint32_t input_pos;
+  uint8_t *output;      // Console output, or NULL to discard it
+  uint32_t output_size;
+  uint32_t output_len;
+  bool truncated;       // Output did not fit in output_size
+} BufferHost;
+
+void buffer_host_init(BufferHost *bh, uint8_t *output, uint32_t output_size);
+
+// Start a run: input is read from its first byte and output starts empty
+void buffer_host_reset(BufferHost *bh, const uint8_t *input,
+                       uint32_t input_len);
+
+// FNV-1a hash of a buffer (program images, fuzz inputs)
+uint64_t buffer_hash(const uint8_t *data, uint32_t len);
+
+#endif // BUFFER_HOST_H
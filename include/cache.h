@@ -0,0 +1,77 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "cpu.h"
+#include "types.h"
+
+#define CACHE_TOP_PCS 10 // Instructions listed per level in the report
+#define CACHE_ERROR_LENGTH 96
+
+// Default geometry: 1KB 2-way L1s with 16-byte lines, no L2
+#define CACHE_DEFAULT_SIZE 1024
+#define CACHE_DEFAULT_WAYS 2
+#define CACHE_DEFAULT_LINE 16
+#define CACHE_DEFAULT_L2_LATENCY 8   // Extra cycles for an L2 hit
+#define CACHE_DEFAULT_MEM_LATENCY 40 // Extra cycles for a trip to memory
+
+typedef enum { CACHE_LRU, CACHE_FIFO, CACHE_RANDOM } CachePolicy;
+
+typedef enum { CACHE_FETCH, CACHE_READ, CACHE_WRITE } CacheAccess;
+
+// Geometry and behaviour of one level
+typedef struct {
+  uint32_t size;      // Capacity in bytes (power of two)
+  uint32_t ways;      // Associativity
+  uint32_t line_size; // Bytes per line (power of two)
+  CachePolicy policy; // Victim selection
+  bool write_back;    // Write-back + write-allocate, else write-through
+  uint32_t latency;   // Extra cycles charged when this level hits
+} CacheConfig;
+
+// One set-associative cache level
+typedef struct Cache {
+  CacheConfig config;
+  const char *name;
+  bool enabled;
+  uint32_t sets;
+  uint32_t line_shift;
+  uint32_t *tags;             // tags[set * ways + way]
+  uint8_t *valid;
+  uint8_t *dirty;
+  uint64_t *stamp;            // Last use (LRU) or fill time (FIFO)
+  struct Cache *next;         // Next level, NULL for memory
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t writebacks;
+  uint32_t (*pc_stats)[2];    // Hits/misses per issuing instruction word
+} Cache;
+
+// Split L1 with an optional unified L2
+typedef struct CacheHierarchy {
+  Cache l1i;
+  Cache l1d;
+  Cache l2;
+  uint32_t memory_latency; // Extra cycles when every level misses
+  uint16_t pc;             // Instruction the accesses belong to
+  uint64_t clock;          // Access counter for LRU/FIFO stamps
+  uint32_t rng;            // Random replacement state
+  uint32_t stall;          // Miss cycles not yet handed to the timing model
+  uint64_t stall_total;    // Miss cycles over the whole run
+  char error[CACHE_ERROR_LENGTH]; // Why cache_init failed
+} CacheHierarchy;
+
+// Setup and teardown. spec may be NULL for the defaults; otherwise it is a
+// comma-separated list such as "l1d=2048/4/16/fifo/wt,l2=8192/8/32,mem=60".
+// On failure nothing is printed and h->error says why.
+bool cache_init(CacheHierarchy *h, const char *spec);
+void cache_free(CacheHierarchy *h);
+
+// Simulate one word access issued by the current instruction
+void cache_access(CacheHierarchy *h, CacheAccess kind, uint16_t address);
+
+// Miss cycles accumulated since the last call
+uint32_t cache_take_stall(CacheHierarchy *h);
+
+void cache_report(const CacheHierarchy *h, const CPU *cpu);
+
+#endif // CACHE_H
@@ -0,0 +1,12 @@
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include <stdbool.h>
+
+// Data stack of compiled programs grows down from here (below the I/O window)
+#define CC_STACK_TOP 0xF000
+
+// Compile a C-subset source file into an assembly file for this CPU
+bool cc_compile_file(const char *source, const char *output);
+
+#endif // COMPILER_H
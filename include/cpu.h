@@ -1,6 +1,7 @@
 #ifndef CPU_H
 #define CPU_H
 
+#include "host.h"
 #include "types.h"
 
 // CPU structure
@@ -8,14 +9,45 @@ struct CPU {
   uint16_t registers[NUM_REGISTERS]; // R0-R7
   uint16_t pc;                       // Program counter
   uint16_t sp;                       // Stack pointer
+  uint16_t stack_limit;              // Lowest address the stack may use
+  uint16_t stack_top;                // Highest address the stack may use
+  uint16_t core_id;                  // Core number (multi-core mode)
+  uint16_t core_count;               // Cores sharing memory
   uint16_t ir;                       // Instruction register
   uint8_t flags;                     // Status flags
-  uint8_t memory[MEMORY_SIZE];       // 64KB memory
+  uint8_t *memory;                   // Active memory: ram, or shared
+  uint8_t *pages[MEM_PAGES];         // Page table: host bytes behind each page
+  uint16_t bank_select[MEM_PAGES];   // Bank mapped at each page (0: memory)
+  uint8_t *banks;                    // Extended memory (host-owned, or NULL)
+  uint16_t bank_count;               // 4KB banks in extended memory
+  uint64_t dirty[MEM_DIRTY_WORDS];   // Pages written since the last checkpoint
   bool halted;                       // Halt flag
   uint64_t cycle_count;              // Instruction cycle counter
   uint16_t timer;                    // Timer value
   bool timer_enabled;                // Timer enable flag
+  uint16_t timer_reload;             // Value the timer restarts from
+  uint16_t irq_enable;               // Enabled interrupt lines
+  uint16_t irq_pending;              // Raised, unacknowledged lines
+  uint16_t irq_vector;               // Interrupt handler address
+  uint16_t dma_src;                  // DMA source address / fill value
+  uint16_t dma_dst;                  // DMA destination address
+  uint16_t dma_len;                  // DMA length in bytes
+  uint16_t dma_status;               // Result of the last DMA transfer
+  uint16_t dma_setup_cycles;         // Cycles charged per DMA transfer
+  uint16_t dma_bytes_per_cycle;      // DMA throughput used for the charge
   bool debug;                        // Debug mode flag
+  CpuFault fault;                    // Last fault taken
+  uint16_t fault_vector;             // Fault handler (0: faults stop the CPU)
+  bool aborted;                      // Executing instruction abandoned
+  bool input_wait;                   // Abandoned to wait for console input
+  CpuStop stop;                      // Why the CPU halted
+  const CpuHost *host;               // Console, clock and log (may be NULL)
+  struct IOTrace *io_trace;          // MMIO record/replay (verification)
+  struct Pipeline *pipeline;         // Timing model (NULL when off)
+  struct CacheHierarchy *cache;      // Cache simulator (NULL when off)
+  struct BranchStudy *predictor;     // Branch predictors (NULL when off)
+  uint8_t *coverage;                 // Edge hit counters (NULL when off)
+  uint8_t ram[MEMORY_SIZE];          // 64KB memory (last: see cpu_restore)
 };
 
 // Function prototypes
@@ -23,15 +55,40 @@ struct CPU {
 // CPU initialization and control
 void cpu_init(CPU *cpu);
 void cpu_reset(CPU *cpu);
-void cpu_load_program(CPU *cpu, const uint8_t *program, uint16_t size,
-                      uint16_t start_addr);
-void cpu_run(CPU *cpu);
+void cpu_clone(CPU *dst, const CPU *src);
+void cpu_restore(CPU *dst, const CPU *src);
+CpuError cpu_load_program(CPU *cpu, const uint8_t *program, uint16_t size,
+                          uint16_t start_addr);
+CpuStop cpu_run(CPU *cpu);
 void cpu_step(CPU *cpu);
 
+// Stack operations (SP points at the last word pushed). On a stack fault SP
+// is left unchanged.
+void cpu_push(CPU *cpu, uint16_t value);
+uint16_t cpu_pop(CPU *cpu);
+
+// Raise a fault from the executing instruction. It is taken, precisely, when
+// the instruction returns to cpu_step.
+void cpu_fault(CPU *cpu, CpuError cause, uint16_t address);
+
+// Abandon the executing instruction until the host has console input; it
+// is retried on the next step
+void cpu_wait_input(CPU *cpu);
+
 // Debugging and utilities
 void cpu_dump_state(CPU *cpu);
 void cpu_dump_registers(CPU *cpu);
 void cpu_dump_memory(CPU *cpu, uint16_t start, uint16_t end);
 const char *cpu_opcode_to_string(Opcode op);
+const char *cpu_error_string(CpuError error);
+
+// Keep the n highest-scoring ids for a report, highest first; returns the
+// new number of entries
+int cpu_top_insert(uint32_t *top, uint64_t *scores, int found, int n,
+                   uint32_t id, uint64_t score);
+
+// Printf-style message to the host's log sink, if any
+void cpu_log(const CPU *cpu, CpuLogLevel level, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
 
 #endif // CPU_H
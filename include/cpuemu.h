@@ -0,0 +1,29 @@
+#ifndef CPUEMU_H
+#define CPUEMU_H
+
+/*
+ * libcpuemu: the CPU core as an embeddable library.
+ *
+ *   CPU *cpu = malloc(sizeof(CPU));
+ *   cpu_init(cpu);
+ *   cpu->host = &my_host;          // Console, clock and log callbacks
+ *   if (cpu_load_program(cpu, image, size, 0) != CPU_OK) ...
+ *   if (cpu_run(cpu) == CPU_STOP_FAULT) ... // Or cpu_step() in a loop
+ *
+ * The library keeps no global state: every CPU is self-contained, so any
+ * number can run concurrently on separate threads. Guest I/O and messages
+ * reach the host only through its CpuHost; errors are returned as codes and
+ * guest faults are recorded in cpu->fault. The dump and *_report helpers
+ * print to stdout and are only run when the host calls them.
+ */
+
+#include "cache.h"
+#include "cpu.h"
+#include "disasm.h"
+#include "host.h"
+#include "memmap.h"
+#include "memory.h"
+#include "pipeline.h"
+#include "predictor.h"
+
+#endif // CPUEMU_H
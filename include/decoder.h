@@ -11,6 +11,7 @@ typedef struct {
   uint8_t rs2;
   int16_t imm9;
   int16_t imm12;
+  int16_t call_offset; // CALL byte offset (11-bit word offset, scaled)
   int8_t offset6;
 } Instruction;
 
@@ -0,0 +1,91 @@
+#ifndef DISASM_H
+#define DISASM_H
+
+#include "types.h"
+#include <stdio.h>
+
+#define DISASM_NONE 0xFFFFFFFFu // No block, loop or successor
+
+typedef enum {
+  DISASM_EDGE_FALL,  // Next instruction (conditional not taken, return site)
+  DISASM_EDGE_TAKEN, // Conditional branch taken
+  DISASM_EDGE_JUMP,  // Unconditional BRANCH
+  DISASM_EDGE_CALL   // CALL; the callee's block is a root
+} DisasmEdgeKind;
+
+typedef struct {
+  uint32_t block; // Successor block index
+  DisasmEdgeKind kind;
+} DisasmEdge;
+
+// A device register access whose address is known statically
+typedef struct {
+  uint16_t pc;      // Accessing instruction
+  uint16_t address; // Register in the IO window
+  bool write;
+} DisasmAccess;
+
+// A straight-line run of instructions with one entry and one exit
+typedef struct {
+  uint16_t start;        // First instruction
+  uint16_t end;          // Address after the last instruction
+  uint32_t insns;        // Static instruction count
+  DisasmEdge succ[2];
+  uint32_t succ_count;
+  uint32_t idom;         // Immediate dominator, DISASM_NONE for roots
+  uint32_t loop;         // Innermost loop containing the block
+  uint32_t loop_depth;   // Loops containing the block
+  uint32_t access_first; // Index of the first entry in DisasmProgram.accesses
+  uint32_t access_count;
+  bool root;             // Entry point, CALL target or handler vector
+} DisasmBlock;
+
+// A natural loop: the blocks that reach a back edge's source without
+// passing through its header
+typedef struct {
+  uint32_t header;    // Block every iteration enters through
+  uint32_t parent;    // Enclosing loop, DISASM_NONE at the outer level
+  uint32_t depth;     // 1 for outermost loops
+  uint32_t blocks;    // Blocks in the body, header included
+  uint32_t insns;     // Static instructions in the body
+  uint32_t latches;   // Back edges into the header
+} DisasmLoop;
+
+// Control-flow graph of a program image
+typedef struct {
+  const uint8_t *image;
+  uint32_t size;
+  uint16_t entry;        // Registers are all zero here, as after reset
+  uint8_t *word_kind;    // Per word: DISASM_WORD_* bits
+  uint32_t *block_of;    // Per word: block holding the instruction
+  DisasmBlock *blocks;   // In address order
+  uint32_t block_count;
+  DisasmLoop *loops;     // Outer loops before the loops they contain
+  uint32_t loop_count;
+  DisasmAccess *accesses;
+  uint32_t access_count;
+} DisasmProgram;
+
+#define DISASM_WORD_CODE 0x1  // Reached as an instruction (else data)
+#define DISASM_WORD_LABEL 0x2 // Branch, CALL or vector target, return site
+
+// Recover blocks, edges, dominators and loops from an image loaded at 0
+// and entered at entry. image must outlive prog. False means the tables
+// could not be allocated.
+bool disasm_analyze(DisasmProgram *prog, const uint8_t *image, uint32_t size,
+                    uint16_t entry);
+void disasm_free(DisasmProgram *prog);
+
+// Assembler syntax for one instruction at address; branch and CALL targets
+// are written as labels of the form L1234
+void disasm_format(uint16_t raw, uint16_t address, char *out, size_t len);
+
+// IO register name, or NULL outside the known device registers
+const char *disasm_io_name(uint16_t address);
+
+// Output: a listing that reassembles to the same image, Graphviz DOT, JSON
+void disasm_print_listing(const DisasmProgram *prog, FILE *out);
+void disasm_print_dot(const DisasmProgram *prog, FILE *out);
+void disasm_print_json(const DisasmProgram *prog, FILE *out);
+
+#endif // DISASM_H
@@ -0,0 +1,39 @@
+#ifndef FUZZ_H
+#define FUZZ_H
+
+#include "cpu.h"
+#include "types.h"
+
+#define FUZZ_MAX_INPUT 1024         // Longest input generated
+#define FUZZ_MAX_CORPUS 4096        // Inputs kept in the queue
+#define FUZZ_MAX_CRASHES 256        // Distinct crashes and hangs saved
+#define FUZZ_DEFAULT_CYCLES 100000  // Runs longer than this are hangs
+#define FUZZ_DEFAULT_SECONDS 10
+
+// Fuzzing settings
+typedef struct {
+  const char *dir;     // Holds queue/ (seeds and new coverage) and crashes/
+  uint32_t jobs;       // Worker threads (0: one per online CPU)
+  uint32_t seconds;    // How long to fuzz
+  uint64_t max_cycles; // Hang threshold (0: FUZZ_DEFAULT_CYCLES)
+  bool memory_input;   // Write inputs to memory instead of the console
+  uint16_t input_addr; // Where memory inputs go; R0 holds the length
+} FuzzConfig;
+
+// Totals at the end of a campaign
+typedef struct {
+  uint64_t execs;   // Guest runs over all workers
+  double seconds;   // Wall-clock time spent
+  uint32_t corpus;  // Inputs in the queue
+  uint32_t edges;   // Coverage map entries ever hit
+  uint32_t crashes; // Distinct faults that stopped the guest
+  uint32_t hangs;   // Distinct runs cut off at the cycle limit
+} FuzzReport;
+
+// Fuzz the program loaded in prototype. Every run starts from a copy of it
+// and gets one input through the console (or in memory); inputs that reach
+// new branch edges join the corpus, and ones that fault or hang are saved.
+bool fuzz_run(const CPU *prototype, const FuzzConfig *config,
+              FuzzReport *report);
+
+#endif // FUZZ_H
@@ -0,0 +1,64 @@
+#ifndef HOST_H
+#define HOST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Error codes. Everything after CPU_ERR_PROGRAM_SIZE is a fault cause, the
+// value the guest reads from IO_FAULT_CAUSE.
+typedef enum {
+  CPU_OK = 0,
+  CPU_ERR_PROGRAM_SIZE,    // Image does not fit below the device window
+  CPU_ERR_MEMORY_BOUNDS,   // Word access past the end of memory
+  CPU_ERR_STACK_OVERFLOW,  // PUSH/CALL/trap entry below the stack limit
+  CPU_ERR_STACK_UNDERFLOW, // POP/RET/RETI above the stack top
+  CPU_ERR_DIVIDE_BY_ZERO,  // DIV/MOD by zero
+  CPU_ERR_UNKNOWN_OPCODE,  // Reserved instruction encoding
+  CPU_ERR_ATOMIC_ADDRESS,  // Misaligned or device atomic access
+  CPU_ERR_WFI_NO_SOURCE,   // WFI with nothing that could wake it
+  CPU_ERR_BANK_SELECT,     // Bank select past the end of extended memory
+
+  // Host-side failure, never a fault cause
+  CPU_ERR_HOST_IO = 0x100 // File could not be opened or mapped (see errno)
+} CpuError;
+
+// The last fault taken. pc is the faulting instruction, which has had no
+// effect on registers, flags, memory or SP.
+typedef struct {
+  CpuError cause;
+  uint16_t pc;
+  uint16_t address; // Data address, SP for stack faults, else 0
+} CpuFault;
+
+// Why cpu_run returned
+typedef enum {
+  CPU_STOP_HALT,  // HALT executed
+  CPU_STOP_FAULT, // Fault with no guest handler (or inside one); see fault
+  CPU_STOP_INPUT  // Console input needed; run again once there is some
+} CpuStop;
+
+// console_read results other than a byte
+#define CPU_CONSOLE_EOF (-1)   // Input has ended
+#define CPU_CONSOLE_EMPTY (-2) // Nothing buffered yet: the CPU stops
+
+typedef enum {
+  CPU_LOG_DEBUG, // Execution trace (cpu->debug)
+  CPU_LOG_ERROR  // Device errors and faults that stop the CPU
+} CpuLogLevel;
+
+// Services the embedding host provides to a CPU. Every callback is optional
+// and receives ctx; the core itself never touches stdio, the clock or the
+// file system. A missing console reads as end of input and drops output.
+// A host that never blocks returns CPU_CONSOLE_EMPTY (or a status of 0
+// when asked to wait) and gets CPU_STOP_INPUT back from cpu_run instead.
+typedef struct CpuHost {
+  void *ctx;
+  void (*console_write)(void *ctx, uint8_t ch);
+  int (*console_read)(void *ctx); // Byte, CPU_CONSOLE_EOF or _EMPTY
+  // CONSOLE_STATUS_* bits; with wait set, may block until one is set
+  uint16_t (*console_status)(void *ctx, bool wait);
+  uint64_t (*clock_ms)(void *ctx); // Wall clock for IO_TIMER_VAL
+  void (*log)(void *ctx, CpuLogLevel level, const char *message);
+} CpuHost;
+
+#endif // HOST_H
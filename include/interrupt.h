@@ -0,0 +1,14 @@
+#ifndef INTERRUPT_H
+#define INTERRUPT_H
+
+#include "cpu.h"
+#include "types.h"
+
+// Interrupt controller
+bool irq_active(const CPU *cpu);
+void irq_raise(CPU *cpu, uint16_t lines);
+void irq_tick(CPU *cpu);
+void irq_return(CPU *cpu);
+void irq_wait(CPU *cpu);
+
+#endif // INTERRUPT_H
@@ -0,0 +1,49 @@
+#ifndef IOLOG_H
+#define IOLOG_H
+
+#include "cpu.h"
+#include "types.h"
+#include <stdio.h>
+
+#define IOLOG_MAGIC "CPUIOLG1" // File header
+#define IOLOG_ERROR_LENGTH 160
+
+// Host inputs that make a run nondeterministic
+typedef enum {
+  IOLOG_REPEAT = 0,       // Previous record again; a repeat count follows
+  IOLOG_CONSOLE_READ = 1, // IO_CONSOLE_IN
+  IOLOG_CONSOLE_STATUS,   // IO_CONSOLE_STATUS, interrupt polling, WFI
+  IOLOG_CLOCK             // IO_TIMER_VAL
+} IoLogKind;
+
+// Records every input value a CPU takes from its host, keyed by cycle, or
+// replays a recording in place of the host. Records are a kind byte, then
+// the cycle delta and the (zigzag) value as LEB128 varints; runs of equal
+// records, such as a polling loop reading the clock, collapse into one
+// IOLOG_REPEAT. Output and log messages always pass through to the inner
+// host.
+typedef struct {
+  CpuHost host;                   // Install as cpu->host
+  const CpuHost *inner;           // Real host
+  CPU *cpu;                       // Cycle source; halted on divergence
+  FILE *file;                     // Log being written or read
+  bool replay;                    // false: record, true: replay
+  uint64_t last_cycle;            // Cycle of the previous record
+  IoLogKind run_kind;             // Previous record's kind,
+  uint64_t run_delta;             // cycle delta
+  uint64_t run_value;             // and zigzag value
+  uint64_t run_count;             // Repeats not yet written / replayed
+  uint64_t records;               // Records written or replayed
+  bool diverged;                  // Replay no longer matches the guest
+  char error[IOLOG_ERROR_LENGTH]; // Why it diverged
+} IoLog;
+
+// Open a log for recording or replay around inner, for one CPU
+bool iolog_open(IoLog *log, const char *path, bool replay, CPU *cpu,
+                const CpuHost *inner);
+
+// Finish the log. A replay must have consumed every record; returns false
+// if it did not or if the run diverged.
+bool iolog_close(IoLog *log);
+
+#endif // IOLOG_H
@@ -0,0 +1,29 @@
+#ifndef MEMMAP_H
+#define MEMMAP_H
+
+#include "cpu.h"
+#include "types.h"
+
+// Guest memory backed by a file instead of cpu->ram. A private mapping
+// loads a pre-initialised image copy-on-write: nothing is copied up front,
+// and guests mapping the same image share its page-cache pages until they
+// write. A shared mapping is persistent memory: guest stores reach the
+// file, and other processes can watch it while the guest runs.
+typedef struct {
+  uint8_t *base; // MEMORY_SIZE bytes of guest memory
+  bool shared;   // MAP_SHARED (persistent) rather than MAP_PRIVATE
+} MemMap;
+
+// Map a file as guest memory. A shared file is grown to MEMORY_SIZE; a
+// private image may be shorter (the rest reads as zero) but must fit below
+// IO_START. Returns CPU_OK, CPU_ERR_PROGRAM_SIZE for an image that does not
+// fit, or CPU_ERR_HOST_IO with errno set.
+CpuError memmap_open(MemMap *map, const char *path, bool shared);
+
+// Point a CPU at the mapping (the I/O window stays device-mapped)
+void memmap_attach(MemMap *map, CPU *cpu);
+
+// Flush a shared mapping to its file and unmap it
+void memmap_close(MemMap *map);
+
+#endif // MEMMAP_H
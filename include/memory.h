@@ -3,12 +3,71 @@
 
 #include "cpu.h"
 #include "types.h"
+#include <stdio.h>
+
+#define IO_TRACE_CAPACITY 4096
+
+// Guest byte at address, looked up through the page table (an lvalue)
+#define MEM_BYTE(cpu, address)                                                 \
+  ((cpu)->pages[(uint16_t)(address) >> MEM_PAGE_SHIFT]                         \
+               [(address) & MEM_PAGE_MASK])
+
+// Records MMIO read results on one CPU and replays them on another, so two
+// engines running the same guest see identical input and print only once
+typedef struct IOTrace {
+  bool replay;                          // false: record, true: replay
+  uint16_t values[IO_TRACE_CAPACITY];   // Values returned by MMIO reads
+  uint32_t count;                       // Values recorded
+  uint32_t next;                        // Next value to replay
+  bool underflow;                       // Replay ran past the recording
+} IOTrace;
 
 // Memory operations
 uint16_t mem_read_word(CPU *cpu, uint16_t address);
+uint16_t mem_fetch_word(CPU *cpu, uint16_t address);
 void mem_write_word(CPU *cpu, uint16_t address, uint16_t value);
 uint8_t mem_read_byte(CPU *cpu, uint16_t address);
 void mem_write_byte(CPU *cpu, uint16_t address, uint8_t value);
+bool mem_console_ready(CPU *cpu, bool wait);
+bool mem_atomic_word(CPU *cpu, Opcode op, uint16_t address, uint16_t expected,
+                     uint16_t operand, uint16_t *old);
 void mem_dump(CPU *cpu, uint16_t start, uint16_t end);
 
+// Dirty pages. Stores, atomics, DMA and bank switches mark the 256-byte
+// pages they change in cpu->dirty; anything else that changes guest memory
+// (program loads, mapped files, host writes) must call mem_mark_dirty.
+void mem_mark_dirty(CPU *cpu, uint16_t start, uint32_t len);
+
+// Bring image (MEMORY_SIZE bytes, equal to guest memory as of the previous
+// checkpoint, or zero for a freshly initialised CPU) up to date by copying
+// the dirty pages, and clear the dirty bits
+void mem_checkpoint(CPU *cpu, uint8_t *image);
+
+/*
+ * Memory diffs list the bytes of dirty pages that differ from a checkpoint
+ * image. Text output shows each changed 16-byte line before and after.
+ * Binary output is one record per diff, every field little-endian:
+ *   0  u32 magic       MEM_DIFF_MAGIC
+ *   4  u32 pages       Changed pages that follow
+ *   8  u64 cycles      cpu->cycle_count when the diff was taken
+ * then, per page, its u16 address and its MEM_DIRTY_SIZE bytes as they are
+ * now, so applying the records in order to the image rebuilds memory.
+ */
+#define MEM_DIFF_MAGIC 0x4649444Du // "MDIF"
+
+typedef enum { MEM_DIFF_TEXT, MEM_DIFF_BINARY } MemDiffFormat;
+
+// Write the changes since the checkpoint in image; returns changed pages
+uint32_t mem_diff(const CPU *cpu, const uint8_t *image, MemDiffFormat format,
+                  FILE *out);
+
+// Instruction word at address with no side effects (timing models, tools)
+uint16_t mem_peek_word(const CPU *cpu, uint16_t address);
+
+// Bank switching. Extended memory is count 4KB banks owned by the host (at
+// most MEM_MAX_BANKS); every page starts out on its own RAM. The page table
+// must be rebuilt whenever cpu->memory changes.
+void mem_attach_banks(CPU *cpu, uint8_t *banks, uint16_t count);
+void mem_map_pages(CPU *cpu);
+
 #endif // MEMORY_H
@@ -0,0 +1,30 @@
+#ifndef MULTICORE_H
+#define MULTICORE_H
+
+#include "cpu.h"
+#include "types.h"
+
+#define MC_MAX_CORES 8
+#define MC_DEFAULT_QUANTUM 64 // Instructions per core per round-robin turn
+
+// Several cores running one image against a single shared memory. Core 0
+// owns the RAM; the others point at it. Each core keeps its own registers,
+// stack slice, timer, DMA and interrupt state.
+typedef struct {
+  uint32_t count;           // Number of cores
+  CPU *cores;               // cores[id]
+  bool deterministic;       // Round-robin on one thread instead of a thread each
+  uint32_t quantum;         // Instructions per turn in deterministic mode
+} MultiCore;
+
+// Setup and teardown
+bool mc_init(MultiCore *mc, uint32_t count, const CPU *prototype);
+void mc_free(MultiCore *mc);
+
+// Run until every core halts
+bool mc_run(MultiCore *mc);
+
+// Instructions retired over all cores
+uint64_t mc_total_cycles(const MultiCore *mc);
+
+#endif // MULTICORE_H
@@ -0,0 +1,54 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "cpu.h"
+#include "predictor.h"
+#include "types.h"
+
+// Classic in-order IF/ID/EX/MEM/WB pipeline
+#define PIPELINE_DEPTH 5
+#define PIPELINE_BRANCH_PENALTY 2 // Branches resolve in EX: IF and ID flushed
+#define PIPELINE_FLAGS NUM_REGISTERS // Scoreboard slot for the status flags
+#define PIPELINE_TOP_PCS 10       // Instructions listed in the stall report
+
+// Why an instruction could not enter EX on the next cycle
+typedef enum {
+  STALL_DATA,     // Operand not yet written back (no forwarding path)
+  STALL_LOAD_USE, // Operand comes from a load still in MEM
+  STALL_CONTROL,  // Wrong-path fetches flushed after a control transfer
+  STALL_MEMORY,   // Cache misses (only with the cache simulator)
+  STALL_DEVICE,   // DMA transfers and WFI sleep
+  STALL_CAUSES
+} StallCause;
+
+// Timing model fed by cpu_step. It only observes execution; architectural
+// state and cycle_count are the same with or without it.
+typedef struct Pipeline {
+  bool forwarding;                     // EX/MEM and MEM/WB bypasses present
+  uint32_t branch_penalty;             // Bubbles per control transfer
+  uint64_t instructions;               // Instructions retired
+  uint64_t next_ex;                    // Earliest EX cycle for the next one
+  uint64_t last_ex;                    // EX cycle of the last instruction
+  uint64_t ready[NUM_REGISTERS + 1];   // First EX cycle that sees each value
+  bool from_load[NUM_REGISTERS + 1];   // Value produced in MEM
+  uint64_t stalls[STALL_CAUSES];       // Stall cycles per cause
+  uint32_t (*pc_stalls)[STALL_CAUSES]; // Stall cycles per instruction word
+} Pipeline;
+
+// Setup and teardown; false means the statistics could not be allocated
+bool pipeline_init(Pipeline *pl, bool forwarding);
+void pipeline_free(Pipeline *pl);
+
+// Account for one retired instruction. extra_cycles is time the functional
+// model charged beyond one cycle (DMA, WFI); memory_cycles is cache miss
+// latency for its fetch and data accesses; branch is the predictor's verdict
+// for conditional branches (BRANCH_NONE when no predictor is running).
+void pipeline_retire(Pipeline *pl, uint16_t pc, uint16_t raw,
+                     uint16_t next_pc, uint64_t extra_cycles,
+                     uint32_t memory_cycles, BranchOutcome branch);
+
+// Results
+uint64_t pipeline_cycles(const Pipeline *pl);
+void pipeline_report(const Pipeline *pl, const CPU *cpu);
+
+#endif // PIPELINE_H
@@ -0,0 +1,67 @@
+#ifndef PREDICTOR_H
+#define PREDICTOR_H
+
+#include "cpu.h"
+#include "types.h"
+
+#define PREDICTOR_TABLE_BITS 10  // 1024 two-bit counters (bimodal, gshare)
+#define PREDICTOR_HISTORY_BITS 8 // Global history length for gshare
+#define PREDICTOR_BTB_ENTRIES 16 // Direct-mapped branch target buffer
+#define PREDICTOR_TOP_PCS 10     // Branches listed in the report
+
+typedef enum {
+  PRED_NOT_TAKEN,    // Static: always fall through
+  PRED_BACKWARD,     // Static: backward taken, forward not taken
+  PRED_BIMODAL,      // Two-bit counter per branch address
+  PRED_GSHARE,       // Two-bit counters indexed by address XOR history
+  PRED_BTB,          // Target buffer with a two-bit counter per entry
+  PREDICTOR_COUNT
+} PredictorKind;
+
+// What the selected predictor's guess costs the pipeline
+typedef enum {
+  BRANCH_NONE,           // Not a conditional branch
+  BRANCH_CORRECT,        // Right path fetched without a bubble
+  BRANCH_CORRECT_DECODE, // Taken as predicted; target known only in ID
+  BRANCH_MISPREDICT      // Wrong path fetched until EX
+} BranchOutcome;
+
+typedef struct {
+  uint16_t pc;     // Branch address
+  uint16_t target; // Taken target
+  uint8_t counter; // Two-bit direction counter
+  bool valid;
+} BTBEntry;
+
+// Per-branch statistics
+typedef struct {
+  uint32_t executed;
+  uint32_t taken;
+  uint32_t correct[PREDICTOR_COUNT];
+} BranchStats;
+
+// Every predictor sees every BEQ/BNE/BLT; the selected one sets the cost
+typedef struct BranchStudy {
+  PredictorKind selected;
+  uint8_t bimodal[1 << PREDICTOR_TABLE_BITS];
+  uint8_t gshare[1 << PREDICTOR_TABLE_BITS];
+  uint16_t history;
+  BTBEntry btb[PREDICTOR_BTB_ENTRIES];
+  uint64_t branches;
+  uint64_t taken;
+  uint64_t correct[PREDICTOR_COUNT];
+  BranchStats *pc_stats; // [MEMORY_SIZE / 2]
+} BranchStudy;
+
+// Setup and teardown; false means the statistics could not be allocated
+bool predictor_init(BranchStudy *study, PredictorKind selected);
+void predictor_free(BranchStudy *study);
+bool predictor_parse(const char *name, PredictorKind *kind); // False: unknown
+
+// Predict and train on one retired instruction, given the flags it saw
+BranchOutcome predictor_observe(BranchStudy *study, uint16_t pc, uint16_t raw,
+                                uint8_t flags);
+
+void predictor_report(const BranchStudy *study, const CPU *cpu);
+
+#endif // PREDICTOR_H
@@ -0,0 +1,92 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "cpu.h"
+#include "types.h"
+
+#define SERVER_MAX_PROGRAMS 256         // Images kept loaded (then LRU)
+#define SERVER_MAX_INPUT 65536          // Console input bytes per request
+#define SERVER_MAX_OUTPUT 65536         // Console output kept per run
+#define SERVER_DEFAULT_CYCLES 10000000  // Runs stop here unless asked for more
+#define SERVER_DEFAULT_QUEUE 64         // Connections waiting for a worker
+#define SERVER_DEFAULT_IDLE 10          // Seconds a client may sit idle
+
+/*
+ * Wire protocol. Every field is little-endian. A connection carries any
+ * number of requests, each answered before the next is read.
+ *
+ * Request: 24-byte header, then image_len image bytes, then input_len
+ * bytes of console input.
+ *   0  u32 magic       SERVER_REQUEST_MAGIC
+ *   4  u8  kind        SERVER_LOAD or SERVER_RUN
+ *   5  u8[3]           zero
+ *   8  u32 program     Loaded program to run (ignored with an image)
+ *  12  u32 image_len   Image to load at 0 (and run, for SERVER_RUN)
+ *  16  u32 input_len
+ *  20  u32 max_cycles  0: SERVER_DEFAULT_CYCLES
+ *
+ * Response: 64-byte header, then output_len bytes of console output.
+ *   0  u32 magic       SERVER_RESPONSE_MAGIC
+ *   4  u8  status      ServerStatus
+ *   5  u8  stop        ServerStop
+ *   6  u8  truncated   Output past SERVER_MAX_OUTPUT was dropped
+ *   7  u8  flags
+ *   8  u32 program     Id to send instead of the image next time
+ *  12  u16 registers[8]
+ *  28  u16 pc, sp
+ *  32  u16 fault cause, fault pc, fault address
+ *  38  u16             zero
+ *  40  u64 cycles
+ *  48  u64 run_ns      Time spent executing the guest
+ *  56  u32 output_len
+ *  60  u32             zero
+ */
+#define SERVER_REQUEST_MAGIC 0x51554D45u  // "EMUQ"
+#define SERVER_RESPONSE_MAGIC 0x52554D45u // "EMUR"
+#define SERVER_REQUEST_SIZE 24
+#define SERVER_RESPONSE_SIZE 64
+
+typedef enum {
+  SERVER_LOAD = 1, // Load the image and return its id without running it
+  SERVER_RUN = 2   // Run a program (loading the image first if one is sent)
+} ServerKind;
+
+typedef enum {
+  SERVER_OK,
+  SERVER_ERR_REQUEST, // Bad magic, kind or length
+  SERVER_ERR_PROGRAM, // Unknown or unloaded program id, or none sent
+  SERVER_ERR_FULL     // Every loaded program is running
+} ServerStatus;
+
+typedef enum {
+  SERVER_STOP_HALT,  // HALT executed
+  SERVER_STOP_FAULT, // Unhandled fault; see the fault fields
+  SERVER_STOP_LIMIT  // max_cycles reached
+} ServerStop;
+
+// Server settings
+typedef struct {
+  const char *socket; // Unix socket path
+  uint32_t threads;   // Workers (0: one per online CPU)
+  uint32_t queue;     // Accepted connections waiting (0: default)
+  uint32_t idle;      // Seconds a connection may stall (0: default)
+} ServerConfig;
+
+// One-shot client settings
+typedef struct {
+  const char *socket;
+  const char *input;   // Console input file, or NULL for none
+  uint32_t max_cycles; // 0: the server's default
+  uint32_t repeat;     // Requests to send; later ones reuse the program id
+} ClientConfig;
+
+// Serve requests until SIGINT or SIGTERM. Each worker thread keeps a warm
+// CPU and restores it from a loaded program before each run. preload, if
+// not NULL, becomes program 0.
+bool server_run(const ServerConfig *config, const CPU *preload);
+
+// Send an image to a server, print the output, final registers and timing
+bool server_send(const ClientConfig *config, const uint8_t *image,
+                 uint32_t size);
+
+#endif // SERVER_H
@@ -0,0 +1,27 @@
+#ifndef STDIO_HOST_H
+#define STDIO_HOST_H
+
+#include "host.h"
+#include "types.h"
+#include <pthread.h>
+
+#define STDIO_INPUT_BUFFER 4096 // Console readahead per read() call
+
+// Host services backed by the process's stdio: console output to stdout,
+// console input read ahead from a file descriptor, debug traces to stdout
+// and errors to stderr with an "Error: " prefix. Cores cloned from one CPU
+// share the host, so the input buffer is locked.
+typedef struct {
+  CpuHost host;                      // Callbacks; ctx points at this struct
+  pthread_mutex_t lock;              // Input buffer, for threaded cores
+  int input_fd;                      // Console input: stdin, file or pipe
+  bool blocking;                     // Wait for input, or CPU_STOP_INPUT
+  bool eof;                          // input_fd has no more data
+  uint32_t head;                     // Next byte to hand out
+  uint32_t tail;                     // End of the buffered bytes
+  uint8_t input[STDIO_INPUT_BUFFER]; // Readahead buffer
+} StdioHost;
+
+void stdio_host_init(StdioHost *sh, int input_fd, bool blocking);
+
+#endif // STDIO_HOST_H
@@ -13,11 +13,68 @@
 #define STACK_START 0xF100
 #define STACK_END 0xFFFF
 
+// Paging: every 4KB page below the device window can be backed by a bank of
+// extended memory instead of its own slice of RAM
+#define MEM_PAGE_SHIFT 12
+#define MEM_PAGE_SIZE 0x1000
+#define MEM_PAGE_MASK (MEM_PAGE_SIZE - 1)
+#define MEM_PAGES (MEMORY_SIZE / MEM_PAGE_SIZE)
+#define MEM_BANKED_PAGES (IO_START / MEM_PAGE_SIZE) // Pages 0x0-0xE
+#define MEM_MAX_BANKS 4096                          // 16MB extended memory
+
+// Dirty tracking: every store marks its 256-byte page, so checkpoints,
+// memory diffs and resets only visit the pages a run wrote
+#define MEM_DIRTY_SHIFT 8
+#define MEM_DIRTY_SIZE 0x100
+#define MEM_DIRTY_PAGES (MEMORY_SIZE / MEM_DIRTY_SIZE)
+#define MEM_DIRTY_WORDS (MEM_DIRTY_PAGES / 64)
+
 // Memory-mapped I/O addresses
 #define IO_CONSOLE_OUT 0xF000
 #define IO_CONSOLE_IN 0xF001
 #define IO_TIMER_CTRL 0xF002
 #define IO_TIMER_VAL 0xF003
+#define IO_CONSOLE_STATUS 0xF004 // CONSOLE_STATUS_* bits (read-only)
+#define IO_DMA_SRC 0xF010  // Source address (fill mode: low byte is the value)
+#define IO_DMA_DST 0xF012  // Destination address
+#define IO_DMA_LEN 0xF014  // Transfer length in bytes
+#define IO_DMA_CTRL 0xF016 // Write a mode to start; read back the status
+#define IO_IRQ_ENABLE 0xF020   // Enabled interrupt lines
+#define IO_IRQ_PENDING 0xF022  // Read raised lines; write 1s to acknowledge
+#define IO_IRQ_VECTOR 0xF024   // Interrupt handler address
+#define IO_FAULT_VECTOR 0xF026 // Fault handler address (0: faults stop)
+#define IO_FAULT_CAUSE 0xF028  // Last fault's CpuError code (read-only)
+#define IO_FAULT_PC 0xF02A     // Last faulting instruction (read-only)
+#define IO_FAULT_ADDR 0xF02C   // Last fault's data address (read-only)
+#define IO_CORE_ID 0xF030      // This core's number (read-only)
+#define IO_CORE_COUNT 0xF032   // Number of cores (read-only)
+#define IO_BANK_SELECT 0xF040  // Bank behind each page (0: own RAM, n: n-1)
+#define IO_BANK_COUNT 0xF060   // Banks of extended memory (read-only)
+
+// Console status bits
+#define CONSOLE_STATUS_READY 0x1 // A byte can be read from IO_CONSOLE_IN
+#define CONSOLE_STATUS_EOF 0x2   // Input has ended (reads return 0xFFFF)
+
+// DMA modes and status
+#define DMA_MODE_COPY 0x1
+#define DMA_MODE_FILL 0x2
+#define DMA_STATUS_OK 0x0
+#define DMA_STATUS_ERROR 0x1
+
+// Default DMA cost: fixed setup plus one cycle per 16 bytes moved
+#define DMA_SETUP_CYCLES 4
+#define DMA_BYTES_PER_CYCLE 16
+
+// Interrupt lines
+#define IRQ_TIMER 0x1
+#define IRQ_CONSOLE 0x2
+
+// How often (in cycles) an enabled console interrupt checks for input
+#define IRQ_CONSOLE_POLL_CYCLES 1024
+
+// Edge coverage (fuzzing): 8-bit hit counters indexed by a hash of each
+// control transfer's source and target
+#define COVERAGE_MAP_SIZE 0x4000
 
 // Number of registers
 #define NUM_REGISTERS 8
@@ -27,6 +84,8 @@
 #define FLAG_NEGATIVE 0x02
 #define FLAG_CARRY 0x04
 #define FLAG_OVERFLOW 0x08
+#define FLAG_INTERRUPT 0x10 // Set while an interrupt handler runs
+#define FLAG_FAULT 0x20     // Set while the fault handler runs
 
 // Instruction opcodes
 typedef enum {
@@ -45,9 +104,72 @@ typedef enum {
   OP_BEQ = 0xC,
   OP_BNE = 0xD,
   OP_BLT = 0xE,
-  OP_HALT = 0xF
+  OP_HALT = 0xF,
+
+  // Extended opcodes, encoded under OP_NOP
+  OP_RETI = 0x10,
+  OP_WFI = 0x11,
+  OP_CALL = 0x12,
+  OP_RET = 0x13,
+  OP_PUSH = 0x14,
+  OP_POP = 0x15,
+
+  // Extended arithmetic, encoded as a function code under Format 1
+  OP_MUL = 0x20,
+  OP_MULH = 0x21,
+  OP_MULHU = 0x22,
+  OP_DIVU = 0x23,
+  OP_DIV = 0x24,
+  OP_MODU = 0x25,
+  OP_MOD = 0x26,
+  OP_SHL = 0x27,
+  OP_SHR = 0x28,
+  OP_SAR = 0x29,
+  OP_SHLI = 0x2A,
+  OP_SHRI = 0x2B,
+  OP_SARI = 0x2C,
+
+  // Atomic read-modify-write, function codes under XOR
+  OP_CAS = 0x30,
+  OP_FADD = 0x31,
+  OP_SWAP = 0x32,
+
+  OP_INVALID = 0xFF // Reserved encoding
 } Opcode;
 
+// Extended encodings under OP_NOP: 0000 0 xxx iiiiiiii (xxx = XOP_*)
+#define XOP_SHIFT 8
+#define XOP_MASK 0x7
+#define XOP_NOP 0x0
+#define XOP_RETI 0x1
+#define XOP_WFI 0x2
+#define XOP_RET 0x3
+#define XOP_PUSH 0x4 // Register in bits 2-0
+#define XOP_POP 0x5  // Register in bits 2-0
+
+// CALL: 0000 1 ooooooooooo (11-bit signed word offset from the next PC)
+#define XOP_CALL_BIT 0x0800
+
+// Function codes in bits 2-0 of Format 1 (0 = the base operation).
+// Under OR, Rd is shifted in place by the immediate in bits 6-3.
+#define FUNCT_MASK 0x7
+#define FUNCT_MUL 0x1   // ADD page
+#define FUNCT_MULH 0x2  // ADD page
+#define FUNCT_MULHU 0x3 // ADD page
+#define FUNCT_DIVU 0x1  // SUB page
+#define FUNCT_DIV 0x2   // SUB page
+#define FUNCT_MODU 0x3  // SUB page
+#define FUNCT_MOD 0x4   // SUB page
+#define FUNCT_SHL 0x1   // AND page
+#define FUNCT_SHR 0x2   // AND page
+#define FUNCT_SAR 0x3   // AND page
+#define FUNCT_SHLI 0x1  // OR page
+#define FUNCT_SHRI 0x2  // OR page
+#define FUNCT_SARI 0x3  // OR page
+#define FUNCT_CAS 0x1   // XOR page: CAS Rd, [Rs1], Rs2
+#define FUNCT_FADD 0x2  // XOR page: FADD Rd, [Rs1], Rs2
+#define FUNCT_SWAP 0x3  // XOR page: SWAP Rd, [Rs1], Rs2
+
 // Forward declaration
 typedef struct CPU CPU;
 
@@ -0,0 +1,33 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include "cpu.h"
+#include "types.h"
+
+#define VERIFY_DIFF_LENGTH 512
+#define VERIFY_MAX_BLOCK 1024 // Longest straight-line run between checks
+
+// Verification settings
+typedef struct {
+  uint32_t sample_rate; // Full comparison on 1 in N blocks (1 = every block)
+  uint64_t seed;        // Sampling seed (0 picks a fixed default)
+} VerifyConfig;
+
+// Outcome of a lockstep verification run
+typedef struct {
+  uint64_t blocks;                // Blocks executed by both engines
+  uint64_t full_checks;           // Blocks compared in full
+  bool diverged;                  // Engines disagreed
+  uint64_t cycle;                 // Cycle at the start of the failing block
+  uint16_t pc;                    // PC at the start of the failing block
+  char diff[VERIFY_DIFF_LENGTH];  // Differing state, one item per line
+} VerifyReport;
+
+// Run the batch engine against cu_execute, comparing at block boundaries.
+// cpu is the reference instance and holds its final state afterwards.
+bool verify_run(CPU *cpu, const VerifyConfig *config, VerifyReport *report);
+
+// Hash of the full memory image, extended memory and bank selects
+uint64_t verify_hash_memory(const CPU *cpu);
+
+#endif // VERIFY_H
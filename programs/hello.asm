@@ -1,46 +1,30 @@
 ; ============================================================================
-; SIMPLIFIED HELLO WORLD PROGRAM
+; HELLO WORLD PROGRAM
 ; ============================================================================
-; Stores the ASCII characters "HELLO" into memory.
+; Prints a NUL-terminated string, placed in the image with .string, to the
+; console output port.
 ;
 ; Registers:
-; R1 = Memory Pointer (starts at 0x0200)
-; R2 = Character value
+; R1 = String Pointer
+; R2 = Character
+; R3 = Byte Mask (0x00FF)
+; R4 = Console Output Address (0xF000)
 ; ============================================================================
 
-; Initialize Memory Pointer
-LOADI R1, #1        ; R1 = 1
-ADD R1, R1, R1      ; R1 = 2
-ADD R1, R1, R1      ; R1 = 4
-ADD R1, R1, R1      ; R1 = 8
-ADD R1, R1, R1      ; R1 = 16
-ADD R1, R1, R1      ; R1 = 32
-ADD R1, R1, R1      ; R1 = 64
-ADD R1, R1, R1      ; R1 = 128
-ADD R1, R1, R1      ; R1 = 256
-ADD R1, R1, R1      ; R1 = 512 (0x0200)
+LI R1, message
+LOADI R3, #255
+LI R4, #0xF000
 
-; Store 'H' (72)
-LOADI R2, #72
-STORE R2, [R1]
-ADDI R1, #2
+print:
+    LOAD R2, [R1]       ; Little-endian: the character is the low byte
+    AND R2, R2, R3
+    BEQ done            ; Stop at the terminating zero
+    STORE R2, [R4]
+    ADDI R1, #1
+    BRANCH print
 
-; Store 'E' (69)
-LOADI R2, #69
-STORE R2, [R1]
-ADDI R1, #2
+done:
+    HALT
 
-; Store 'L' (76)
-LOADI R2, #76
-STORE R2, [R1]
-ADDI R1, #2
-
-; Store 'L' (76)
-STORE R2, [R1]      ; 'L' is already in R2
-ADDI R1, #2
-
-; Store 'O' (79)
-LOADI R2, #79
-STORE R2, [R1]
-
-HALT
+message:
+    .string "Hello, World!\n"
@@ -18,22 +18,9 @@
 LOADI R1, #10       ; Counter = 10
 LOADI R2, #160      ; MemPtr = 160 (0x00A0)
 
-; Build Delay (1000)
-LOADI R5, #250
-ADD R5, R5, R5      ; 500
-ADD R5, R5, R5      ; 1000
-
-; Build Timer Address (0xF003)
-LOADI R6, #240      ; 0x00F0
-ADD R6, R6, R6      ; 0x01E0
-ADD R6, R6, R6      ; 0x03C0
-ADD R6, R6, R6      ; 0x0780
-ADD R6, R6, R6      ; 0x0F00
-ADD R6, R6, R6      ; 0x1E00
-ADD R6, R6, R6      ; 0x3C00
-ADD R6, R6, R6      ; 0x7800
-ADD R6, R6, R6      ; 0xF000
-ADDI R6, #3         ; 0xF003
+; Build Delay (1000) and Timer Address (0xF003)
+LI R5, #1000        ; LOADI #125, SHLI #3
+LI R6, #0xF003      ; LOADI, SHLI #7, ADDI
 
 loop:
     ; Store current counter
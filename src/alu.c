@@ -1,6 +1,41 @@
 #include "../include/alu.h"
 #include "../include/registers.h"
-#include <stdio.h>
+
+/**
+ * Set or clear a flag from a condition
+ */
+static void alu_flag(CPU *cpu, uint8_t flag, bool condition) {
+  if (condition) {
+    flags_set(cpu, flag);
+  } else {
+    flags_clear(cpu, flag);
+  }
+}
+
+/**
+ * Shift a value, reporting the last bit shifted out
+ */
+static uint16_t alu_shift(Opcode opcode, uint16_t value, uint8_t amount,
+                          bool *carry) {
+  *carry = false;
+  if (amount == 0) {
+    return value;
+  }
+
+  switch (opcode) {
+  case OP_SHL:
+  case OP_SHLI:
+    *carry = (value >> (16 - amount)) & 1;
+    return value << amount;
+  case OP_SHR:
+  case OP_SHRI:
+    *carry = (value >> (amount - 1)) & 1;
+    return value >> amount;
+  default: // OP_SAR, OP_SARI
+    *carry = (value >> (amount - 1)) & 1;
+    return (uint16_t)((int16_t)value >> amount);
+  }
+}
 
 /**
  * Execute ALU operation
@@ -85,6 +120,91 @@ bool alu_execute(CPU *cpu, Opcode opcode, uint8_t rd, uint8_t rs1, uint8_t rs2,
     reg_write(cpu, rd, imm9 & 0xFFFF);
     return true;
 
+  case OP_MUL:
+  case OP_MULH:
+  case OP_MULHU: {
+    // MUL Rd, Rs1, Rs2 (low word); MULH/MULHU give the signed/unsigned
+    // high word. C/O report whether the unsigned/signed product fits.
+    val1 = reg_read(cpu, rs1);
+    val2 = reg_read(cpu, rs2);
+    temp = (uint32_t)val1 * val2;
+    int32_t product = (int32_t)(int16_t)val1 * (int16_t)val2;
+    if (opcode == OP_MUL) {
+      result = temp & 0xFFFF;
+    } else if (opcode == OP_MULH) {
+      result = ((uint32_t)product >> 16) & 0xFFFF;
+    } else {
+      result = temp >> 16;
+    }
+    reg_write(cpu, rd, result);
+    flags_update(cpu, result);
+    alu_flag(cpu, FLAG_CARRY, temp > 0xFFFF);
+    alu_flag(cpu, FLAG_OVERFLOW, product < INT16_MIN || product > INT16_MAX);
+    return true;
+  }
+
+  case OP_DIVU:
+  case OP_DIV:
+  case OP_MODU:
+  case OP_MOD: {
+    // DIV Rd, Rs1, Rs2: quotient truncates toward zero, the remainder takes
+    // the sign of the dividend. -32768 / -1 sets O and yields -32768.
+    val1 = reg_read(cpu, rs1);
+    val2 = reg_read(cpu, rs2);
+    if (val2 == 0) {
+      cpu_fault(cpu, CPU_ERR_DIVIDE_BY_ZERO, 0);
+      return true;
+    }
+
+    int16_t dividend = (int16_t)val1;
+    int16_t divisor = (int16_t)val2;
+    bool overflow = dividend == INT16_MIN && divisor == -1;
+    switch (opcode) {
+    case OP_DIVU:
+      result = val1 / val2;
+      break;
+    case OP_MODU:
+      result = val1 % val2;
+      break;
+    case OP_DIV:
+      result = overflow ? val1 : (uint16_t)(dividend / divisor);
+      break;
+    default: // OP_MOD
+      result = overflow ? 0 : (uint16_t)(dividend % divisor);
+      break;
+    }
+    reg_write(cpu, rd, result);
+    flags_update(cpu, result);
+    flags_clear(cpu, FLAG_CARRY);
+    alu_flag(cpu, FLAG_OVERFLOW,
+             overflow && (opcode == OP_DIV || opcode == OP_MOD));
+    return true;
+  }
+
+  case OP_SHL:
+  case OP_SHR:
+  case OP_SAR:
+  case OP_SHLI:
+  case OP_SHRI:
+  case OP_SARI: {
+    // SHL Rd, Rs1, Rs2 shifts by Rs2 & 15; SHLI Rd, #n shifts Rd in place.
+    // C holds the last bit shifted out.
+    bool carry;
+    uint8_t amount;
+    if (opcode == OP_SHL || opcode == OP_SHR || opcode == OP_SAR) {
+      val1 = reg_read(cpu, rs1);
+      amount = reg_read(cpu, rs2) & 0xF;
+    } else {
+      val1 = reg_read(cpu, rd);
+      amount = ((uint16_t)imm9 >> 3) & 0xF;
+    }
+    result = alu_shift(opcode, val1, amount, &carry);
+    reg_write(cpu, rd, result);
+    flags_update(cpu, result);
+    alu_flag(cpu, FLAG_CARRY, carry);
+    return true;
+  }
+
   default:
     return false;
   }
@@ -0,0 +1,269 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../include/asmcache.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * ============================================================================
+ * ASSEMBLED IMAGE CACHE
+ * ============================================================================
+ * An entry is <key>.img: a 16-byte header (magic, ASM_VERSION, program
+ * size, zero), the image, then the source line of each word. The key is
+ * two independent 64-bit hashes of the options and the source text, so a
+ * stale or colliding entry is as unlikely as a 128-bit collision. Entries
+ * are never modified in place: a writer fills a private temporary file and
+ * rename()s it over the entry, and a reader that finds a short or foreign
+ * file treats it as a miss.
+ */
+
+#define ENTRY_MAGIC 0x494D5341u // "ASMI"
+#define ENTRY_HEADER 16
+
+typedef struct {
+  char name[ASM_CACHE_KEY_LENGTH + 8];
+  off_t size;
+  struct timespec mtime;
+} CacheEntry;
+
+/**
+ * Fold bytes into both key hashes (FNV-1a and a multiply-xorshift)
+ */
+static void cache_hash(uint64_t h[2], const uint8_t *data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    h[0] = (h[0] ^ data[i]) * 0x100000001B3ULL;
+    h[1] = (h[1] ^ data[i]) * 0x9E3779B97F4A7C15ULL;
+    h[1] ^= h[1] >> 29;
+  }
+}
+
+/**
+ * Key for a source file under as's options
+ */
+bool asm_cache_key(const Assembler *as, const char *source,
+                   char key[ASM_CACHE_KEY_LENGTH + 1]) {
+  FILE *file = fopen(source, "rb");
+  if (!file) {
+    return false;
+  }
+
+  uint64_t h[2] = {0xCBF29CE484222325ULL, 0x6A09E667F3BCC909ULL};
+  uint8_t options[4] = {ASM_VERSION & 0xFF, ASM_VERSION >> 8, as->optimize,
+                        as->li_cycles};
+  cache_hash(h, options, sizeof(options));
+
+  uint8_t buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), file)) > 0) {
+    cache_hash(h, buf, n);
+  }
+  bool ok = !ferror(file);
+  fclose(file);
+
+  snprintf(key, ASM_CACHE_KEY_LENGTH + 1, "%016llx%016llx",
+           (unsigned long long)h[0], (unsigned long long)h[1]);
+  return ok;
+}
+
+/**
+ * Path of a key's entry
+ */
+static void cache_path(const AsmCache *cache, const char *key, char *path,
+                       size_t len) {
+  snprintf(path, len, "%s/%s.img", cache->dir, key);
+}
+
+/**
+ * Read a whole entry file into buf; returns the length or -1
+ */
+static ssize_t cache_read(int fd, uint8_t *buf, size_t len) {
+  size_t total = 0;
+  while (total < len) {
+    ssize_t n = read(fd, buf + total, len - total);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      return -1;
+    }
+    if (n == 0) {
+      break;
+    }
+    total += (size_t)n;
+  }
+  return (ssize_t)total;
+}
+
+/**
+ * Load an entry, and mark it recently used
+ */
+bool asm_cache_load(const AsmCache *cache, const char *key, Assembler *as) {
+  char path[512];
+  cache_path(cache, key, path, sizeof(path));
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  // Largest possible entry, plus a byte to detect anything longer
+  static uint8_t buf[ENTRY_HEADER + MAX_PROGRAM_SIZE * 2 + 1];
+  ssize_t len = cache_read(fd, buf, sizeof(buf));
+  uint32_t size = len >= ENTRY_HEADER ? buf[8] | buf[9] << 8 : 0;
+  uint32_t words = (size + 1) / 2;
+  bool valid = len >= ENTRY_HEADER &&
+               (uint32_t)(buf[0] | buf[1] << 8 | buf[2] << 16 |
+                          (uint32_t)buf[3] << 24) == ENTRY_MAGIC &&
+               (buf[4] | buf[5] << 8) == ASM_VERSION &&
+               size <= MAX_PROGRAM_SIZE &&
+               (size_t)len == ENTRY_HEADER + size + 2 * words;
+  if (valid) {
+    futimens(fd, NULL);
+  }
+  close(fd);
+  if (!valid) {
+    return false;
+  }
+
+  memcpy(as->program, buf + ENTRY_HEADER, size);
+  as->program_size = (uint16_t)size;
+  const uint8_t *lines = buf + ENTRY_HEADER + size;
+  for (uint32_t w = 0; w < words; w++) {
+    as->word_lines[w] = lines[2 * w] | lines[2 * w + 1] << 8;
+  }
+  return true;
+}
+
+/**
+ * Oldest first
+ */
+static int cache_entry_compare(const void *a, const void *b) {
+  const struct timespec *x = &((const CacheEntry *)a)->mtime;
+  const struct timespec *y = &((const CacheEntry *)b)->mtime;
+  if (x->tv_sec != y->tv_sec) {
+    return x->tv_sec < y->tv_sec ? -1 : 1;
+  }
+  return (x->tv_nsec > y->tv_nsec) - (x->tv_nsec < y->tv_nsec);
+}
+
+/**
+ * Whether a directory entry is a cache entry: <32 hex digits>.img
+ */
+static bool cache_is_entry(const char *name) {
+  if (strlen(name) != ASM_CACHE_KEY_LENGTH + 4 ||
+      strcmp(name + ASM_CACHE_KEY_LENGTH, ".img") != 0) {
+    return false;
+  }
+  for (int i = 0; i < ASM_CACHE_KEY_LENGTH; i++) {
+    if (!strchr("0123456789abcdef", name[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Delete the least recently used entries until the directory fits in
+ * max_bytes. keep, the entry just written, is never deleted.
+ */
+static void cache_evict(const AsmCache *cache, const char *keep) {
+  DIR *dir = opendir(cache->dir);
+  if (!dir) {
+    return;
+  }
+
+  CacheEntry *entries = NULL;
+  size_t count = 0;
+  size_t capacity = 0;
+  uint64_t total = 0;
+  struct dirent *d;
+  char path[512];
+  while ((d = readdir(dir)) != NULL) {
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s", cache->dir, d->d_name);
+    if (!cache_is_entry(d->d_name) || stat(path, &st) != 0) {
+      continue;
+    }
+    if (count == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      CacheEntry *grown = realloc(entries, capacity * sizeof(CacheEntry));
+      if (!grown) {
+        break;
+      }
+      entries = grown;
+    }
+    memcpy(entries[count].name, d->d_name, ASM_CACHE_KEY_LENGTH + 5);
+    entries[count].size = st.st_size;
+    entries[count].mtime = st.st_mtim;
+    total += (uint64_t)st.st_size;
+    count++;
+  }
+  closedir(dir);
+
+  qsort(entries, count, sizeof(CacheEntry), cache_entry_compare);
+  for (size_t i = 0; i < count && total > cache->max_bytes; i++) {
+    if (strncmp(entries[i].name, keep, ASM_CACHE_KEY_LENGTH) == 0) {
+      continue;
+    }
+    // Another run may have removed or replaced it already
+    snprintf(path, sizeof(path), "%s/%s", cache->dir, entries[i].name);
+    if (unlink(path) == 0 || errno == ENOENT) {
+      total -= (uint64_t)entries[i].size;
+    }
+  }
+  free(entries);
+}
+
+/**
+ * Write an entry under a temporary name and rename it into place
+ */
+void asm_cache_store(const AsmCache *cache, const char *key,
+                     const Assembler *as) {
+  if (mkdir(cache->dir, 0755) != 0 && errno != EEXIST) {
+    fprintf(stderr, "Error: Cannot create cache directory %s\n", cache->dir);
+    return;
+  }
+
+  static uint8_t buf[ENTRY_HEADER + MAX_PROGRAM_SIZE * 2];
+  uint32_t size = as->program_size;
+  uint32_t words = (size + 1) / 2;
+  memset(buf, 0, ENTRY_HEADER);
+  for (int i = 0; i < 4; i++) {
+    buf[i] = (ENTRY_MAGIC >> (8 * i)) & 0xFF;
+  }
+  buf[4] = ASM_VERSION & 0xFF;
+  buf[5] = ASM_VERSION >> 8;
+  buf[8] = size & 0xFF;
+  buf[9] = size >> 8;
+  memcpy(buf + ENTRY_HEADER, as->program, size);
+  uint8_t *lines = buf + ENTRY_HEADER + size;
+  for (uint32_t w = 0; w < words; w++) {
+    lines[2 * w] = as->word_lines[w] & 0xFF;
+    lines[2 * w + 1] = as->word_lines[w] >> 8;
+  }
+  size_t len = ENTRY_HEADER + size + 2 * words;
+
+  char tmp[512];
+  char path[512];
+  snprintf(tmp, sizeof(tmp), "%s/.%s.%ld.tmp", cache->dir, key,
+           (long)getpid());
+  cache_path(cache, key, path, sizeof(path));
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "Error: Cannot write cache entry %s\n", tmp);
+    return;
+  }
+  bool ok = write(fd, buf, len) == (ssize_t)len;
+  ok = close(fd) == 0 && ok;
+  if (!ok || rename(tmp, path) != 0) {
+    fprintf(stderr, "Error: Cannot write cache entry %s\n", path);
+    unlink(tmp);
+    return;
+  }
+
+  cache_evict(cache, key);
+}
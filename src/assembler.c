@@ -1,6 +1,8 @@
 #include "../include/assembler.h"
 #include "../include/cpu.h"
+#include "../include/decoder.h"
 #include <ctype.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -45,23 +47,44 @@ int16_t asm_get_label_address(Assembler *as, const char *name) {
 }
 
 /**
- * Emit a 16-bit word to the program
+ * Emit a 16-bit word to the program at the current address
  */
 void asm_emit_word(Assembler *as, uint16_t word) {
-  if (as->program_size >= MAX_PROGRAM_SIZE - 1) {
+  if (as->current_address >= MAX_PROGRAM_SIZE - 1) {
     fprintf(stderr, "Error: Program too large\n");
     return;
   }
-  as->program[as->program_size++] = word & 0xFF;
-  as->program[as->program_size++] = (word >> 8) & 0xFF;
+  as->word_lines[as->current_address / 2] = as->line_number;
+  as->word_kinds[as->current_address / 2] = as->emit_kind;
+  as->program[as->current_address] = word & 0xFF;
+  as->program[as->current_address + 1] = (word >> 8) & 0xFF;
   as->current_address += 2;
+  if (as->current_address > as->program_size) {
+    as->program_size = as->current_address;
+  }
+}
+
+/**
+ * Emit one data byte at the current address
+ */
+void asm_emit_byte(Assembler *as, uint8_t byte) {
+  if (as->current_address >= MAX_PROGRAM_SIZE) {
+    fprintf(stderr, "Error: Program too large\n");
+    return;
+  }
+  as->word_lines[as->current_address / 2] = as->line_number;
+  as->word_kinds[as->current_address / 2] = WORD_DATA;
+  as->program[as->current_address++] = byte;
+  if (as->current_address > as->program_size) {
+    as->program_size = as->current_address;
+  }
 }
 
 /**
- * Parse register name (R0-R7)
+ * Parse register name (R0-R7); -1 if it is missing or invalid
  */
 int asm_parse_register(const char *str) {
-  if (str[0] == 'R' || str[0] == 'r') {
+  if (str && (str[0] == 'R' || str[0] == 'r')) {
     int reg = str[1] - '0';
     if (reg >= 0 && reg < NUM_REGISTERS) {
       return reg;
@@ -71,20 +94,36 @@ int asm_parse_register(const char *str) {
 }
 
 /**
- * Parse immediate value (decimal or hex)
+ * Parse immediate value (decimal or hex); false if it is missing
  */
-int16_t asm_parse_immediate(const char *str) {
+bool asm_parse_immediate(const char *str, int16_t *value) {
+  if (!str) {
+    return false;
+  }
+
   // Skip '#' if present
   if (str[0] == '#')
     str++;
+  if (str[0] == '\0') {
+    return false;
+  }
 
   // Parse hex (0x prefix)
   if (str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
-    return (int16_t)strtol(str, NULL, 16);
+    *value = (int16_t)strtol(str, NULL, 16);
+    return true;
   }
 
   // Parse decimal
-  return (int16_t)atoi(str);
+  *value = (int16_t)atoi(str);
+  return true;
+}
+
+/**
+ * Check whether an operand is a number rather than a label
+ */
+static bool asm_is_number(const char *str) {
+  return str[0] == '#' || str[0] == '-' || isdigit((unsigned char)str[0]);
 }
 
 /**
@@ -117,6 +156,452 @@ static void trim(char *str) {
   }
 }
 
+// Extended arithmetic: Format 1 base opcode plus function code
+typedef struct {
+  const char *name;
+  Opcode base;
+  uint8_t funct;
+  bool immediate; // Shift Rd in place by #imm instead of Rs1 by Rs2
+} FunctOp;
+
+static const FunctOp funct_ops[] = {
+    {"MUL", OP_ADD, FUNCT_MUL, false},    {"MULH", OP_ADD, FUNCT_MULH, false},
+    {"MULHU", OP_ADD, FUNCT_MULHU, false}, {"DIVU", OP_SUB, FUNCT_DIVU, false},
+    {"DIV", OP_SUB, FUNCT_DIV, false},    {"MODU", OP_SUB, FUNCT_MODU, false},
+    {"MOD", OP_SUB, FUNCT_MOD, false},    {"SHL", OP_AND, FUNCT_SHL, false},
+    {"SHR", OP_AND, FUNCT_SHR, false},    {"SAR", OP_AND, FUNCT_SAR, false},
+    {"SHLI", OP_OR, FUNCT_SHLI, true},    {"SHRI", OP_OR, FUNCT_SHRI, true},
+    {"SARI", OP_OR, FUNCT_SARI, true},
+};
+
+/**
+ * Look up an extended arithmetic mnemonic
+ */
+static const FunctOp *asm_find_funct(const char *name) {
+  for (size_t i = 0; i < sizeof(funct_ops) / sizeof(funct_ops[0]); i++) {
+    if (strcmp(funct_ops[i].name, name) == 0) {
+      return &funct_ops[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Resolve a label used as a target or value. Before the emit pass a forward
+ * reference is not known yet and the current address stands in for it.
+ */
+static bool asm_label_target(Assembler *as, const char *label,
+                             uint16_t *addr) {
+  int16_t found = label ? asm_get_label_address(as, label) : -1;
+  if (found >= 0) {
+    *addr = (uint16_t)found;
+    return true;
+  }
+  if (as->pass != ASM_PASS_EMIT) {
+    *addr = as->current_address;
+    return true;
+  }
+  fprintf(stderr, "Error: Undefined label '%s'\n", label ? label : "");
+  return false;
+}
+
+/**
+ * PC-relative offset of a branch target, which must be within 12 bits
+ */
+static bool asm_branch_offset(Assembler *as, const char *label,
+                              int16_t *offset) {
+  uint16_t addr;
+  if (!asm_label_target(as, label, &addr)) {
+    return false;
+  }
+  *offset = (int16_t)(addr - (as->current_address + 2));
+  if (as->pass == ASM_PASS_EMIT && (*offset < -2048 || *offset > 2047)) {
+    fprintf(stderr, "Error: Branch target '%s' out of range\n", label);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Record a site holding a label's address; fails when the table is full
+ */
+static bool asm_add_reloc(Assembler *as, RelocKind kind, uint8_t reg,
+                          const char *label) {
+  if (as->pass != ASM_PASS_EMIT) {
+    return true;
+  }
+  if (as->reloc_count >= MAX_RELOCS) {
+    fprintf(stderr, "Error: Too many label references (max %d)\n",
+            MAX_RELOCS);
+    return false;
+  }
+  Reloc *r = &as->relocs[as->reloc_count++];
+  r->address = as->current_address;
+  r->kind = kind;
+  r->reg = reg;
+  strncpy(r->label, label, MAX_LABEL_LENGTH - 1);
+  r->label[MAX_LABEL_LENGTH - 1] = '\0';
+  return true;
+}
+
+/*
+ * LI Rd, value: constant materialisation. Values that fit LOADI take one
+ * word; shifted or offset 9-bit values take two (LOADI+SHLI, LOADI+ADDI);
+ * anything else takes three (LOADI+SHLI #7+ADDI) or a LOAD from the literal
+ * pool at the start of the image (LOADI Rd, #slot; LOAD Rd, [Rd]). The pool
+ * is chosen when it is smaller (the value is used twice or more) or, with
+ * li_cycles, whenever it saves a cycle. A label value is not known until
+ * the last pass, so it always gets the pool or the three-word form.
+ */
+
+#define ASM_LOADI(rd, imm) ((OP_LOADI << 12) | ((rd) << 9) | ((imm) & 0x1FF))
+#define ASM_ADDI(rd, imm) ((OP_ADDI << 12) | ((rd) << 9) | ((imm) & 0x1FF))
+#define ASM_SHLI(rd, n) ((OP_OR << 12) | ((rd) << 9) | ((n) << 3) | FUNCT_SHLI)
+#define ASM_POOL_BASE 2 // Pool words follow the branch over them
+
+/**
+ * Three-word form that builds any 16-bit value
+ */
+static int asm_li_long(int rd, uint16_t value, uint16_t words[3]) {
+  int16_t high = (int16_t)value >> 7;
+  words[0] = ASM_LOADI(rd, high);
+  words[1] = ASM_SHLI(rd, 7);
+  words[2] = ASM_ADDI(rd, value & 0x7F);
+  return 3;
+}
+
+/**
+ * Shortest inline sequence for a value (1 to 3 words)
+ */
+static int asm_li_inline(int rd, uint16_t value, uint16_t words[3]) {
+  int16_t sv = (int16_t)value;
+  if (sv >= -256 && sv <= 255) {
+    words[0] = ASM_LOADI(rd, sv);
+    return 1;
+  }
+  for (int k = 1; k < 16; k++) {
+    int16_t s = sv >> k;
+    if (s >= -256 && s <= 255 && (uint16_t)((uint16_t)s << k) == value) {
+      words[0] = ASM_LOADI(rd, s);
+      words[1] = ASM_SHLI(rd, k);
+      return 2;
+    }
+  }
+  if (sv >= -512 && sv <= 510) {
+    int16_t a = sv > 0 ? 255 : -256;
+    words[0] = ASM_LOADI(rd, a);
+    words[1] = ASM_ADDI(rd, sv - a);
+    return 2;
+  }
+  return asm_li_long(rd, value, words);
+}
+
+/**
+ * Find the constant an LI operand refers to
+ */
+static Constant *asm_find_constant(Assembler *as, bool is_label,
+                                   const char *name, uint16_t value) {
+  for (int i = 0; i < as->constant_count; i++) {
+    Constant *c = &as->constants[i];
+    if (c->is_label == is_label &&
+        (is_label ? strcmp(c->name, name) == 0 : c->value == value)) {
+      return c;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Decide which constants go to the literal pool (after ASM_PASS_COUNT)
+ */
+static void asm_plan_pool(Assembler *as) {
+  uint16_t words[3];
+  as->pool_count = 0;
+  for (int i = 0; i < as->constant_count; i++) {
+    Constant *c = &as->constants[i];
+    bool long_form = c->is_label || asm_li_inline(0, c->value, words) == 3;
+    bool pooled = long_form && (as->li_cycles || c->uses >= 2);
+    c->slot = pooled && as->pool_count < MAX_POOL_ENTRIES ? as->pool_count++
+                                                          : -1;
+  }
+}
+
+/**
+ * Emit the branch over the literal pool and the pool itself
+ */
+static bool asm_emit_pool(Assembler *as) {
+  if (as->pool_count == 0) {
+    return true;
+  }
+  as->line_number = 0;
+  asm_emit_word(as, (OP_BRANCH << 12) | ((2 * as->pool_count) & 0xFFF));
+  as->emit_kind = WORD_DATA;
+  for (int i = 0; i < as->constant_count; i++) {
+    Constant *c = &as->constants[i];
+    if (c->slot >= 0) {
+      if (c->is_label && !asm_add_reloc(as, RELOC_WORD, 0, c->name)) {
+        return false;
+      }
+      asm_emit_word(as, c->value);
+    }
+  }
+  as->emit_kind = WORD_CODE;
+  return true;
+}
+
+/**
+ * Assemble LI Rd, operand
+ */
+static bool asm_load_immediate(Assembler *as, int rd, const char *operand) {
+  bool is_label = !asm_is_number(operand);
+  int16_t number = 0;
+  if (!is_label && !asm_parse_immediate(operand, &number)) {
+    fprintf(stderr, "Error: Invalid operands in LI\n");
+    return false;
+  }
+  uint16_t value = (uint16_t)number;
+  Constant *c = asm_find_constant(as, is_label, operand, value);
+
+  if (as->pass == ASM_PASS_COUNT) {
+    if (!c && as->constant_count < MAX_CONSTANTS) {
+      c = &as->constants[as->constant_count++];
+      strncpy(c->name, operand, MAX_LABEL_LENGTH - 1);
+      c->is_label = is_label;
+      c->value = value;
+    }
+    if (c) {
+      c->uses++;
+    }
+    return true;
+  }
+
+  uint16_t words[3];
+  int count;
+  if (c && c->slot >= 0) {
+    words[0] = ASM_LOADI(rd, ASM_POOL_BASE + 2 * c->slot);
+    words[1] = (OP_LOAD << 12) | (rd << 9) | (rd << 6);
+    count = 2;
+  } else if (is_label) {
+    if (!asm_label_target(as, operand, &value) ||
+        !asm_add_reloc(as, RELOC_LI, rd, operand)) {
+      return false;
+    }
+    count = asm_li_long(rd, value, words);
+  } else {
+    count = asm_li_inline(rd, value, words);
+  }
+
+  // Pool loads and label sequences must survive the optimizer intact
+  bool fixed = count == 2 && (words[1] >> 12) == OP_LOAD;
+  as->emit_kind = fixed || is_label ? WORD_FIXED : WORD_CODE;
+  for (int i = 0; i < count; i++) {
+    asm_emit_word(as, words[i]);
+  }
+  as->emit_kind = WORD_CODE;
+  return true;
+}
+
+/**
+ * Write every label address into the sites that refer to it
+ */
+void asm_apply_relocs(Assembler *as) {
+  for (int i = 0; i < as->reloc_count; i++) {
+    Reloc *r = &as->relocs[i];
+    uint16_t addr = (uint16_t)asm_get_label_address(as, r->label);
+    uint16_t words[3] = {addr, 0, 0};
+    int count = r->kind == RELOC_LI ? asm_li_long(r->reg, addr, words) : 1;
+    for (int w = 0; w < count; w++) {
+      uint16_t at = r->address + 2 * w;
+      as->program[at] = words[w] & 0xFF;
+      as->program[at + 1] = words[w] >> 8;
+    }
+  }
+}
+
+/**
+ * Find a character outside double-quoted strings
+ */
+static char *asm_find_unquoted(char *str, char ch) {
+  bool quoted = false;
+  for (char *p = str; *p; p++) {
+    if (quoted && *p == '\\' && p[1]) {
+      p++;
+    } else if (*p == '"') {
+      quoted = !quoted;
+    } else if (!quoted && *p == ch) {
+      return p;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Data and layout directives. Data words and bytes are marked WORD_DATA so
+ * the optimizer never treats them as instructions; .org and .align beyond
+ * word alignment pin addresses, which turns the optimizer off.
+ */
+
+/**
+ * .string "text": bytes with C escapes, then a terminating zero
+ */
+static bool asm_directive_string(Assembler *as, const char *args) {
+  const char *p = strchr(args, '"');
+  if (!p) {
+    fprintf(stderr, "Error: .string needs a quoted string\n");
+    return false;
+  }
+  for (p++; *p && *p != '"'; p++) {
+    char c = *p;
+    if (c == '\\') {
+      switch (*++p) {
+      case 'n':
+        c = '\n';
+        break;
+      case 't':
+        c = '\t';
+        break;
+      case 'r':
+        c = '\r';
+        break;
+      case '0':
+        c = '\0';
+        break;
+      case '\\':
+      case '"':
+        c = *p;
+        break;
+      default:
+        fprintf(stderr, "Error: Unknown escape '\\%c' in .string\n", *p);
+        return false;
+      }
+    }
+    asm_emit_byte(as, (uint8_t)c);
+  }
+  if (*p != '"') {
+    fprintf(stderr, "Error: Unterminated string\n");
+    return false;
+  }
+  asm_emit_byte(as, 0);
+  return true;
+}
+
+/**
+ * .word/.byte: comma-separated values; .word also takes label addresses
+ */
+static bool asm_directive_values(Assembler *as, char *args, bool words) {
+  if (words && (as->current_address & 1)) {
+    fprintf(stderr, "Error: .word at odd address 0x%04X\n",
+            as->current_address);
+    return false;
+  }
+  int count = 0;
+  for (char *value = strtok(args, " ,\t"); value;
+       value = strtok(NULL, " ,\t"), count++) {
+    if (!words) {
+      int16_t byte = 256;
+      if (!asm_is_number(value) || !asm_parse_immediate(value, &byte) ||
+          byte < -128 || byte > 255) {
+        fprintf(stderr, "Error: Invalid byte value '%s'\n", value);
+        return false;
+      }
+      asm_emit_byte(as, (uint8_t)byte);
+      continue;
+    }
+
+    uint16_t word;
+    int16_t number;
+    if (asm_is_number(value)) {
+      if (!asm_parse_immediate(value, &number)) {
+        fprintf(stderr, "Error: Invalid word value '%s'\n", value);
+        return false;
+      }
+      word = (uint16_t)number;
+    } else {
+      if (!asm_label_target(as, value, &word) ||
+          !asm_add_reloc(as, RELOC_WORD, 0, value)) {
+        return false;
+      }
+    }
+    as->emit_kind = WORD_DATA;
+    asm_emit_word(as, word);
+    as->emit_kind = WORD_CODE;
+  }
+  if (count == 0) {
+    fprintf(stderr, "Error: %s needs at least one value\n",
+            words ? ".word" : ".byte");
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Assemble a directive line (starting with '.')
+ */
+static bool asm_directive(Assembler *as, char *line) {
+  char *args = line;
+  while (*args && !isspace((unsigned char)*args)) {
+    args++;
+  }
+  if (*args) {
+    *args++ = '\0';
+  }
+  for (char *p = line; *p; p++) {
+    *p = tolower(*p);
+  }
+
+  if (strcmp(line, ".string") == 0) {
+    return asm_directive_string(as, args);
+  } else if (strcmp(line, ".word") == 0 || strcmp(line, ".byte") == 0) {
+    return asm_directive_values(as, args, line[1] == 'w');
+  }
+
+  char *operand = strtok(args, " ,\t");
+  char *fill_str = strtok(NULL, " ,\t");
+  int16_t number;
+  int16_t fill_value = 0;
+  if (!operand || !asm_is_number(operand) ||
+      !asm_parse_immediate(operand, &number) ||
+      (fill_str && !asm_parse_immediate(fill_str, &fill_value))) {
+    fprintf(stderr, "Error: %s needs a numeric operand\n", line);
+    return false;
+  }
+  uint16_t value = (uint16_t)number;
+  uint8_t fill = (uint8_t)fill_value;
+  uint32_t target;
+
+  if (strcmp(line, ".org") == 0) {
+    if (value < as->current_address) {
+      fprintf(stderr, "Error: .org 0x%04X is behind the current address 0x%04X\n",
+              value, as->current_address);
+      return false;
+    }
+    target = value;
+    as->fixed_layout = true;
+  } else if (strcmp(line, ".space") == 0) {
+    target = as->current_address + value;
+  } else if (strcmp(line, ".align") == 0) {
+    if (value == 0 || (value & (value - 1))) {
+      fprintf(stderr, "Error: .align %u is not a power of two\n", value);
+      return false;
+    }
+    target = (as->current_address + value - 1) & ~(uint32_t)(value - 1);
+    as->fixed_layout |= value > 2;
+  } else {
+    fprintf(stderr, "Error: Unknown directive '%s'\n", line);
+    return false;
+  }
+
+  if (target > MAX_PROGRAM_SIZE) {
+    fprintf(stderr, "Error: %s goes past the end of the program (0x%04X)\n",
+            line, MAX_PROGRAM_SIZE);
+    return false;
+  }
+  while (as->current_address < target) {
+    asm_emit_byte(as, fill);
+  }
+  return true;
+}
+
 /**
  * Assemble a single line of assembly code
  */
@@ -126,7 +611,7 @@ bool asm_assemble_line(Assembler *as, const char *line) {
   buffer[MAX_LINE_LENGTH - 1] = '\0';
 
   // Remove comments
-  char *comment = strchr(buffer, ';');
+  char *comment = asm_find_unquoted(buffer, ';');
   if (comment)
     *comment = '\0';
 
@@ -138,11 +623,20 @@ bool asm_assemble_line(Assembler *as, const char *line) {
   }
 
   // Check for label
-  char *colon = strchr(buffer, ':');
+  char *colon = asm_find_unquoted(buffer, ':');
   if (colon) {
     *colon = '\0';
     trim(buffer);
-    asm_add_label(as, buffer, as->current_address);
+    int16_t known = asm_get_label_address(as, buffer);
+    if (as->pass == ASM_PASS_SIZE && known >= 0) {
+      fprintf(stderr, "Error: Duplicate label '%s'\n", buffer);
+      return false;
+    } else if (as->pass != ASM_PASS_COUNT && known < 0) {
+      asm_add_label(as, buffer, as->current_address);
+    } else if (as->pass == ASM_PASS_EMIT && known != as->current_address) {
+      fprintf(stderr, "Error: Label '%s' moved between passes\n", buffer);
+      return false;
+    }
 
     // Process rest of line after label
     char *rest = colon + 1;
@@ -153,6 +647,10 @@ bool asm_assemble_line(Assembler *as, const char *line) {
     return true;
   }
 
+  if (buffer[0] == '.') {
+    return as->pass == ASM_PASS_COUNT || asm_directive(as, buffer);
+  }
+
   // Parse instruction
   char *token = strtok(buffer, " ,\t");
   if (!token)
@@ -162,6 +660,15 @@ bool asm_assemble_line(Assembler *as, const char *line) {
   for (char *p = token; *p; p++)
     *p = toupper(*p);
 
+  if (as->pass == ASM_PASS_COUNT && strcmp(token, "LI") != 0) {
+    return true;
+  }
+  if (as->current_address & 1) {
+    fprintf(stderr, "Error: Instruction at odd address 0x%04X (add .align 2)\n",
+            as->current_address);
+    return false;
+  }
+
   uint16_t instruction = 0;
 
   if (strcmp(token, "NOP") == 0) {
@@ -177,9 +684,9 @@ bool asm_assemble_line(Assembler *as, const char *line) {
     instruction = (OP_ADD << 12) | (rd << 9) | (rs1 << 6) | (rs2 << 3);
   } else if (strcmp(token, "ADDI") == 0) {
     int rd = asm_parse_register(strtok(NULL, " ,\t"));
-    int16_t imm = asm_parse_immediate(strtok(NULL, " ,\t"));
-    if (rd < 0) {
-      fprintf(stderr, "Error: Invalid register in ADDI\n");
+    int16_t imm;
+    if (rd < 0 || !asm_parse_immediate(strtok(NULL, " ,\t"), &imm)) {
+      fprintf(stderr, "Error: Invalid operands in ADDI\n");
       return false;
     }
     instruction = (OP_ADDI << 12) | (rd << 9) | (imm & 0x1FF);
@@ -194,9 +701,9 @@ bool asm_assemble_line(Assembler *as, const char *line) {
     instruction = (OP_SUB << 12) | (rd << 9) | (rs1 << 6) | (rs2 << 3);
   } else if (strcmp(token, "SUBI") == 0) {
     int rd = asm_parse_register(strtok(NULL, " ,\t"));
-    int16_t imm = asm_parse_immediate(strtok(NULL, " ,\t"));
-    if (rd < 0) {
-      fprintf(stderr, "Error: Invalid register in SUBI\n");
+    int16_t imm;
+    if (rd < 0 || !asm_parse_immediate(strtok(NULL, " ,\t"), &imm)) {
+      fprintf(stderr, "Error: Invalid operands in SUBI\n");
       return false;
     }
     instruction = (OP_SUBI << 12) | (rd << 9) | (imm & 0x1FF);
@@ -232,8 +739,9 @@ bool asm_assemble_line(Assembler *as, const char *line) {
     char *addr_str = strtok(NULL, " ,\t[]");
     int rs = asm_parse_register(addr_str);
     char *offset_str = strtok(NULL, " ,\t[]");
-    int8_t offset = offset_str ? asm_parse_immediate(offset_str) : 0;
-    if (rd < 0 || rs < 0) {
+    int16_t offset = 0;
+    if (rd < 0 || rs < 0 ||
+        (offset_str && !asm_parse_immediate(offset_str, &offset))) {
       fprintf(stderr, "Error: Invalid registers in LOAD\n");
       return false;
     }
@@ -243,58 +751,117 @@ bool asm_assemble_line(Assembler *as, const char *line) {
     char *addr_str = strtok(NULL, " ,\t[]");
     int rs = asm_parse_register(addr_str);
     char *offset_str = strtok(NULL, " ,\t[]");
-    int8_t offset = offset_str ? asm_parse_immediate(offset_str) : 0;
-    if (rd < 0 || rs < 0) {
+    int16_t offset = 0;
+    if (rd < 0 || rs < 0 ||
+        (offset_str && !asm_parse_immediate(offset_str, &offset))) {
       fprintf(stderr, "Error: Invalid registers in STORE\n");
       return false;
     }
     instruction = (OP_STORE << 12) | (rd << 9) | (rs << 6) | (offset & 0x3F);
   } else if (strcmp(token, "LOADI") == 0) {
     int rd = asm_parse_register(strtok(NULL, " ,\t"));
-    int16_t imm = asm_parse_immediate(strtok(NULL, " ,\t"));
-    if (rd < 0) {
-      fprintf(stderr, "Error: Invalid register in LOADI\n");
+    int16_t imm;
+    if (rd < 0 || !asm_parse_immediate(strtok(NULL, " ,\t"), &imm)) {
+      fprintf(stderr, "Error: Invalid operands in LOADI\n");
       return false;
     }
     instruction = (OP_LOADI << 12) | (rd << 9) | (imm & 0x1FF);
   } else if (strcmp(token, "BRANCH") == 0 || strcmp(token, "B") == 0) {
-    char *label = strtok(NULL, " ,\t");
-    int16_t addr = asm_get_label_address(as, label);
-    if (addr < 0) {
-      fprintf(stderr, "Error: Undefined label '%s'\n", label);
+    int16_t offset;
+    if (!asm_branch_offset(as, strtok(NULL, " ,\t"), &offset)) {
       return false;
     }
-    int16_t offset = addr - (as->current_address + 2);
     instruction = (OP_BRANCH << 12) | (offset & 0xFFF);
   } else if (strcmp(token, "BEQ") == 0) {
-    char *label = strtok(NULL, " ,\t");
-    int16_t addr = asm_get_label_address(as, label);
-    if (addr < 0) {
-      fprintf(stderr, "Error: Undefined label '%s'\n", label);
+    int16_t offset;
+    if (!asm_branch_offset(as, strtok(NULL, " ,\t"), &offset)) {
       return false;
     }
-    int16_t offset = addr - (as->current_address + 2);
     instruction = (OP_BEQ << 12) | (offset & 0xFFF);
   } else if (strcmp(token, "BNE") == 0) {
-    char *label = strtok(NULL, " ,\t");
-    int16_t addr = asm_get_label_address(as, label);
-    if (addr < 0) {
-      fprintf(stderr, "Error: Undefined label '%s'\n", label);
+    int16_t offset;
+    if (!asm_branch_offset(as, strtok(NULL, " ,\t"), &offset)) {
       return false;
     }
-    int16_t offset = addr - (as->current_address + 2);
     instruction = (OP_BNE << 12) | (offset & 0xFFF);
   } else if (strcmp(token, "BLT") == 0) {
-    char *label = strtok(NULL, " ,\t");
-    int16_t addr = asm_get_label_address(as, label);
-    if (addr < 0) {
-      fprintf(stderr, "Error: Undefined label '%s'\n", label);
+    int16_t offset;
+    if (!asm_branch_offset(as, strtok(NULL, " ,\t"), &offset)) {
       return false;
     }
-    int16_t offset = addr - (as->current_address + 2);
     instruction = (OP_BLT << 12) | (offset & 0xFFF);
   } else if (strcmp(token, "HALT") == 0) {
     instruction = OP_HALT << 12;
+  } else if (asm_find_funct(token)) {
+    const FunctOp *op = asm_find_funct(token);
+    int rd = asm_parse_register(strtok(NULL, " ,\t"));
+    if (op->immediate) {
+      int16_t amount = -1;
+      if (rd < 0 || !asm_parse_immediate(strtok(NULL, " ,\t"), &amount) ||
+          amount < 0 || amount > 15) {
+        fprintf(stderr, "Error: Invalid operands in %s\n", op->name);
+        return false;
+      }
+      instruction = (op->base << 12) | (rd << 9) | (amount << 3) | op->funct;
+    } else {
+      int rs1 = asm_parse_register(strtok(NULL, " ,\t"));
+      int rs2 = asm_parse_register(strtok(NULL, " ,\t"));
+      if (rd < 0 || rs1 < 0 || rs2 < 0) {
+        fprintf(stderr, "Error: Invalid registers in %s\n", op->name);
+        return false;
+      }
+      instruction =
+          (op->base << 12) | (rd << 9) | (rs1 << 6) | (rs2 << 3) | op->funct;
+    }
+  } else if (strcmp(token, "CAS") == 0 || strcmp(token, "FADD") == 0 ||
+             strcmp(token, "SWAP") == 0) {
+    // CAS Rd, [Rs1], Rs2
+    int rd = asm_parse_register(strtok(NULL, " ,\t"));
+    int rs1 = asm_parse_register(strtok(NULL, " ,\t[]"));
+    int rs2 = asm_parse_register(strtok(NULL, " ,\t[]"));
+    if (rd < 0 || rs1 < 0 || rs2 < 0) {
+      fprintf(stderr, "Error: Invalid registers in %s\n", token);
+      return false;
+    }
+    int funct = strcmp(token, "CAS") == 0    ? FUNCT_CAS
+                : strcmp(token, "FADD") == 0 ? FUNCT_FADD
+                                             : FUNCT_SWAP;
+    instruction = (OP_XOR << 12) | (rd << 9) | (rs1 << 6) | (rs2 << 3) | funct;
+  } else if (strcmp(token, "CALL") == 0) {
+    char *label = strtok(NULL, " ,\t");
+    uint16_t addr;
+    if (!asm_label_target(as, label, &addr)) {
+      return false;
+    }
+    int16_t offset = addr - (as->current_address + 2);
+    if (offset < -2048 || offset > 2046) {
+      fprintf(stderr, "Error: CALL target '%s' out of range\n", label);
+      return false;
+    }
+    instruction = (OP_NOP << 12) | XOP_CALL_BIT | ((offset >> 1) & 0x7FF);
+  } else if (strcmp(token, "RET") == 0) {
+    instruction = (OP_NOP << 12) | (XOP_RET << XOP_SHIFT);
+  } else if (strcmp(token, "PUSH") == 0 || strcmp(token, "POP") == 0) {
+    int reg = asm_parse_register(strtok(NULL, " ,\t"));
+    if (reg < 0) {
+      fprintf(stderr, "Error: Invalid register in %s\n", token);
+      return false;
+    }
+    int xop = strcmp(token, "PUSH") == 0 ? XOP_PUSH : XOP_POP;
+    instruction = (OP_NOP << 12) | (xop << XOP_SHIFT) | reg;
+  } else if (strcmp(token, "LI") == 0) {
+    // LI Rd, value|label (pseudo-instruction, 1-3 words)
+    int rd = asm_parse_register(strtok(NULL, " ,\t"));
+    char *operand = strtok(NULL, " ,\t");
+    if (rd < 0 || !operand) {
+      fprintf(stderr, "Error: Invalid operands in LI\n");
+      return false;
+    }
+    return asm_load_immediate(as, rd, operand);
+  } else if (strcmp(token, "RETI") == 0) {
+    instruction = (OP_NOP << 12) | (XOP_RETI << XOP_SHIFT);
+  } else if (strcmp(token, "WFI") == 0) {
+    instruction = (OP_NOP << 12) | (XOP_WFI << XOP_SHIFT);
   } else {
     fprintf(stderr, "Error: Unknown instruction '%s'\n", token);
     return false;
@@ -305,7 +872,8 @@ bool asm_assemble_line(Assembler *as, const char *line) {
 }
 
 /**
- * Assemble a file (two-pass assembler)
+ * Assemble a file. The first pass counts LI constants to plan the literal
+ * pool, the second lays out labels and the third generates code.
  */
 bool asm_assemble_file(Assembler *as, const char *filename) {
   FILE *file = fopen(filename, "r");
@@ -314,56 +882,40 @@ bool asm_assemble_file(Assembler *as, const char *filename) {
     return false;
   }
 
+  static const AsmPass passes[] = {ASM_PASS_COUNT, ASM_PASS_SIZE,
+                                   ASM_PASS_EMIT};
   char line[MAX_LINE_LENGTH];
 
-  // First pass: collect labels
-  while (fgets(line, sizeof(line), file)) {
-    char buffer[MAX_LINE_LENGTH];
-    strncpy(buffer, line, MAX_LINE_LENGTH - 1);
-
-    char *comment = strchr(buffer, ';');
-    if (comment)
-      *comment = '\0';
-
-    trim(buffer);
-
-    if (strlen(buffer) == 0)
-      continue;
-
-    char *colon = strchr(buffer, ':');
-    if (colon) {
-      *colon = '\0';
-      trim(buffer);
-      asm_add_label(as, buffer, as->current_address);
+  for (size_t p = 0; p < sizeof(passes) / sizeof(passes[0]); p++) {
+    as->pass = passes[p];
+    as->current_address = 0;
+    as->program_size = 0;
+    as->reloc_count = 0;
+    if (as->pass != ASM_PASS_COUNT && !asm_emit_pool(as)) {
+      fclose(file);
+      return false;
+    }
+    rewind(file);
 
-      char *rest = colon + 1;
-      trim(rest);
-      if (strlen(rest) > 0) {
-        as->current_address += 2;
+    int line_num = 0;
+    while (fgets(line, sizeof(line), file)) {
+      line_num++;
+      as->line_number = line_num;
+      if (!asm_assemble_line(as, line)) {
+        fprintf(stderr, "Error on line %d: %s\n", line_num, line);
+        fclose(file);
+        return false;
       }
-    } else {
-      as->current_address += 2;
     }
-  }
 
-  // Reset for second pass
-  as->current_address = 0;
-  as->program_size = 0;
-  rewind(file);
-
-  // Second pass: generate code
-  int line_num = 0;
-  while (fgets(line, sizeof(line), file)) {
-    line_num++;
-    if (!asm_assemble_line(as, line)) {
-      fprintf(stderr, "Error on line %d: %s\n", line_num, line);
-      fclose(file);
-      return false;
+    if (as->pass == ASM_PASS_COUNT) {
+      asm_plan_pool(as);
     }
   }
 
   fclose(file);
-  return true;
+  asm_apply_relocs(as);
+  return as->optimize ? asm_optimize(as) : true;
 }
 
 /**
@@ -380,3 +932,486 @@ bool asm_save_binary(Assembler *as, const char *filename) {
   fclose(file);
   return true;
 }
+
+/*
+ * ============================================================================
+ * PEEPHOLE OPTIMIZER
+ * ============================================================================
+ * Runs over the assembled words before they are saved or loaded. Each rule
+ * looks at an instruction and the next live one, which must not be a label
+ * target. Only BEQ/BNE/BLT read flags, and only Z and N, so the flags are
+ * dead after an instruction if something rewrites Z and N before the
+ * fall-through path reaches a conditional branch, call, return or HALT.
+ * PC-relative targets are kept as instruction indices and re-encoded once
+ * the deleted instructions are squeezed out. Code addresses must come from
+ * labels; a hard-coded address into the code is not relocated. Literal pool
+ * words and LI sequences are moved but never rewritten, and label addresses
+ * in them are patched again afterwards.
+ */
+
+#define OPT_MAX_HOPS 16 // Branch chains and value lookups followed at most
+
+typedef struct {
+  uint16_t word;
+  Instruction inst;
+  int target;    // Instruction index of a PC-relative target, else -1
+  int line;      // Source line
+  WordKind kind; // Only WORD_CODE is rewritten; WORD_DATA is not executed
+  bool labelled; // A label points here
+  bool deleted;
+} OptInsn;
+
+typedef struct {
+  Assembler *as;
+  OptInsn *insn;
+  int count;
+} OptProgram;
+
+/**
+ * Report one rewrite
+ */
+static void opt_note(OptProgram *p, int line, const char *format, ...) {
+  va_list args;
+  printf("Optimizer: line %d: ", line);
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+  printf("\n");
+  p->as->rewrites++;
+}
+
+/**
+ * Re-decode an instruction after its word changed
+ */
+static void opt_set_word(OptInsn *in, uint16_t word) {
+  in->word = word;
+  in->inst = decode_instruction(word);
+}
+
+/**
+ * Next live instruction after i (count if none)
+ */
+static int opt_next(const OptProgram *p, int i) {
+  do {
+    i++;
+  } while (i < p->count && p->insn[i].deleted);
+  return i;
+}
+
+/**
+ * First live instruction at or after i
+ */
+static int opt_resolve(const OptProgram *p, int i) {
+  while (i < p->count && p->insn[i].deleted) {
+    i++;
+  }
+  return i;
+}
+
+/**
+ * Delete an instruction; its labels move to the next live one
+ */
+static void opt_delete(OptProgram *p, int i) {
+  p->insn[i].deleted = true;
+  int next = opt_resolve(p, i);
+  if (p->insn[i].labelled && next < p->count) {
+    p->insn[next].labelled = true;
+  }
+}
+
+static bool opt_is_branch(Opcode op) {
+  return op == OP_BRANCH || op == OP_BEQ || op == OP_BNE || op == OP_BLT;
+}
+
+/**
+ * Instructions that set both Z and N from their result
+ */
+static bool opt_writes_flags(Opcode op) {
+  switch (op) {
+  case OP_ADD:
+  case OP_ADDI:
+  case OP_SUB:
+  case OP_SUBI:
+  case OP_AND:
+  case OP_OR:
+  case OP_XOR:
+  case OP_MUL:
+  case OP_MULH:
+  case OP_MULHU:
+  case OP_SHL:
+  case OP_SHR:
+  case OP_SAR:
+  case OP_SHLI:
+  case OP_SHRI:
+  case OP_SARI:
+    return true;
+  default:
+    return false;
+  }
+}
+
+/**
+ * Register an instruction writes, or -1
+ */
+static int opt_dest(const OptInsn *in) {
+  switch (in->inst.opcode) {
+  case OP_POP:
+    return in->word & 0x7;
+  case OP_STORE:
+  case OP_NOP:
+  case OP_HALT:
+  case OP_INVALID:
+  case OP_RETI:
+  case OP_WFI:
+  case OP_CALL:
+  case OP_RET:
+  case OP_PUSH:
+    return -1;
+  default:
+    return opt_is_branch(in->inst.opcode) ? -1 : in->inst.rd;
+  }
+}
+
+/**
+ * Check that nothing reads Z or N before they are rewritten
+ */
+static bool opt_flags_dead(const OptProgram *p, int i) {
+  int hops = 0;
+  int k = opt_next(p, i);
+  while (k < p->count) {
+    const OptInsn *in = &p->insn[k];
+    Opcode op = in->inst.opcode;
+    if (in->kind == WORD_DATA) {
+      return false;
+    }
+    if (opt_writes_flags(op)) {
+      return true;
+    }
+    if (op == OP_BRANCH && in->target >= 0 && ++hops <= OPT_MAX_HOPS) {
+      k = opt_resolve(p, in->target);
+      continue;
+    }
+    if (opt_is_branch(op) || op == OP_CALL || op == OP_RET ||
+        op == OP_RETI || op == OP_HALT || op == OP_INVALID) {
+      return false;
+    }
+    k = opt_next(p, k);
+  }
+  return false;
+}
+
+/**
+ * Work out a register's value on entry to instruction i from constant
+ * writes earlier in the same basic block
+ */
+static bool opt_known(const OptProgram *p, int i, int reg, uint16_t *value,
+                      int depth) {
+  if (depth > OPT_MAX_HOPS) {
+    return false;
+  }
+  for (int k = i; !p->insn[k].labelled;) {
+    do {
+      k--;
+    } while (k >= 0 && p->insn[k].deleted);
+    if (k < 0 || p->insn[k].inst.opcode == OP_CALL ||
+        p->insn[k].kind == WORD_DATA) {
+      return false;
+    }
+
+    const OptInsn *in = &p->insn[k];
+    const Instruction *inst = &in->inst;
+    if (opt_dest(in) != reg) {
+      continue;
+    }
+    if (in->kind != WORD_CODE) {
+      return false;
+    }
+
+    uint16_t a, b;
+    switch (inst->opcode) {
+    case OP_LOADI:
+      *value = (uint16_t)inst->imm9;
+      return true;
+    case OP_ADDI:
+    case OP_SUBI:
+      if (!opt_known(p, k, reg, &a, depth + 1)) {
+        return false;
+      }
+      *value = inst->opcode == OP_ADDI ? a + inst->imm9 : a - inst->imm9;
+      return true;
+    case OP_SHLI:
+    case OP_SHRI:
+      if (!opt_known(p, k, reg, &a, depth + 1)) {
+        return false;
+      }
+      b = ((uint16_t)inst->imm9 >> 3) & 0xF;
+      *value = inst->opcode == OP_SHLI ? (uint16_t)(a << b) : a >> b;
+      return true;
+    case OP_ADD:
+    case OP_SUB:
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+      if (!opt_known(p, k, inst->rs1, &a, depth + 1) ||
+          !opt_known(p, k, inst->rs2, &b, depth + 1)) {
+        return false;
+      }
+      *value = inst->opcode == OP_ADD   ? a + b
+               : inst->opcode == OP_SUB ? a - b
+               : inst->opcode == OP_AND ? a & b
+               : inst->opcode == OP_OR  ? a | b
+                                        : a ^ b;
+      return true;
+    default:
+      return false;
+    }
+  }
+  return false;
+}
+
+/**
+ * Encode ADDI or SUBI for a net adjustment, if it fits
+ */
+static bool opt_encode_adjust(int reg, int delta, uint16_t *word) {
+  if (delta >= -256 && delta <= 255) {
+    *word = (OP_ADDI << 12) | (reg << 9) | (delta & 0x1FF);
+    return true;
+  }
+  if (-delta >= -256 && -delta <= 255) {
+    *word = (OP_SUBI << 12) | (reg << 9) | (-delta & 0x1FF);
+    return true;
+  }
+  return false;
+}
+
+/**
+ * Try every rule on instruction i. Returns true if something changed.
+ */
+static bool opt_rules(OptProgram *p, int i) {
+  OptInsn *a = &p->insn[i];
+  int j = opt_next(p, i);
+  OptInsn *b = j < p->count ? &p->insn[j] : NULL;
+  const Instruction *x = &a->inst;
+  Opcode op = x->opcode;
+  if (a->kind != WORD_CODE) {
+    return false;
+  }
+
+  // Branch threading: a jump to a jump (or to the same condition) goes
+  // straight to the final target
+  if ((opt_is_branch(op) || op == OP_CALL) && a->target >= 0) {
+    int t = opt_resolve(p, a->target);
+    for (int hops = 0; t < p->count && hops < OPT_MAX_HOPS; hops++) {
+      const OptInsn *d = &p->insn[t];
+      bool same = d->inst.opcode == op && op != OP_CALL;
+      if ((d->inst.opcode != OP_BRANCH && !same) || d->target < 0 ||
+          d->kind != WORD_CODE) {
+        break;
+      }
+      int next = opt_resolve(p, d->target);
+      if (next == t) {
+        break;
+      }
+      t = next;
+    }
+    int distance = 2 * t - (2 * i + 2);
+    int limit = op == OP_CALL ? 2046 : 2047;
+    if (t != opt_resolve(p, a->target) && distance >= -2048 &&
+        distance <= limit) {
+      opt_note(p, a->line, "%s threaded through branch at line %d",
+               cpu_opcode_to_string(op), p->insn[opt_resolve(p, a->target)].line);
+      a->target = t;
+      return true;
+    }
+
+    // A branch to the next instruction does nothing
+    if (op != OP_CALL && t == j) {
+      opt_note(p, a->line, "%s to the next instruction removed",
+               cpu_opcode_to_string(op));
+      opt_delete(p, i);
+      return true;
+    }
+  }
+
+  if (!b || b->labelled || b->kind != WORD_CODE) {
+    return false;
+  }
+  const Instruction *y = &b->inst;
+
+  // LOADI Rx, #0; SUB Rx, Ra, Rx  ->  AND Rx, Ra, Ra (same Rx, Z and N)
+  if (op == OP_LOADI && x->imm9 == 0 && y->opcode == OP_SUB &&
+      y->rd == x->rd && y->rs2 == x->rd && y->rs1 != x->rd) {
+    opt_note(p, a->line, "LOADI R%d, #0 / SUB R%d, R%d, R%d -> AND R%d, R%d, R%d",
+             x->rd, y->rd, y->rs1, y->rs2, y->rd, y->rs1, y->rs1);
+    opt_set_word(b, (OP_AND << 12) | (y->rd << 9) | (y->rs1 << 6) |
+                        (y->rs1 << 3));
+    opt_delete(p, i);
+    return true;
+  }
+
+  // ADDI/SUBI Rx; ADDI/SUBI Rx  ->  one adjustment (same final flags)
+  if ((op == OP_ADDI || op == OP_SUBI) &&
+      (y->opcode == OP_ADDI || y->opcode == OP_SUBI) && y->rd == x->rd) {
+    int delta = (op == OP_ADDI ? x->imm9 : -x->imm9) +
+                (y->opcode == OP_ADDI ? y->imm9 : -y->imm9);
+    uint16_t word;
+    if (delta == 0 && opt_flags_dead(p, j)) {
+      opt_note(p, a->line, "adjustments of R%d cancel out, both removed", x->rd);
+      opt_delete(p, i);
+      opt_delete(p, j);
+      return true;
+    }
+    if (delta != 0 && opt_encode_adjust(x->rd, delta, &word)) {
+      opt_note(p, a->line, "adjustments of R%d merged into %s R%d, #%d", x->rd,
+               (word >> 12) == OP_ADDI ? "ADDI" : "SUBI", x->rd,
+               (word >> 12) == OP_ADDI ? delta : -delta);
+      opt_set_word(a, word);
+      opt_delete(p, j);
+      return true;
+    }
+  }
+
+  // LOADI Rx, #a; ADDI Rx, #b  ->  LOADI Rx, #(a + b) when flags are dead
+  if (op == OP_LOADI && (y->opcode == OP_ADDI || y->opcode == OP_SUBI) &&
+      y->rd == x->rd) {
+    int value = x->imm9 + (y->opcode == OP_ADDI ? y->imm9 : -y->imm9);
+    if (value >= -256 && value <= 255 && opt_flags_dead(p, j)) {
+      opt_note(p, a->line, "LOADI R%d folded with %s into LOADI R%d, #%d",
+               x->rd, cpu_opcode_to_string(y->opcode), x->rd, value);
+      opt_set_word(a, (OP_LOADI << 12) | (x->rd << 9) | (value & 0x1FF));
+      opt_delete(p, j);
+      return true;
+    }
+  }
+
+  // STORE Rs, [Ra, o]; LOAD Rd, [Ra, o]  ->  reuse Rs (RAM addresses only)
+  if (op == OP_STORE && y->opcode == OP_LOAD && y->rs1 == x->rs1 &&
+      y->offset6 == x->offset6) {
+    uint16_t base;
+    if (opt_known(p, i, x->rs1, &base, 0)) {
+      uint16_t addr = base + x->offset6;
+      bool ram = (addr < IO_START - 1 || addr > IO_END) && addr < 0xFFFF;
+      if (ram && y->rd == x->rd) {
+        opt_note(p, b->line, "reload of R%d from 0x%04X removed", y->rd, addr);
+        opt_delete(p, j);
+        return true;
+      }
+      if (ram && opt_flags_dead(p, j)) {
+        opt_note(p, b->line, "reload from 0x%04X -> OR R%d, R%d, R%d", addr,
+                 y->rd, x->rd, x->rd);
+        opt_set_word(b, (OP_OR << 12) | (y->rd << 9) | (x->rd << 6) |
+                            (x->rd << 3));
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+/**
+ * Run the peephole rules to a fixed point, then re-link the program
+ */
+bool asm_optimize(Assembler *as) {
+  if (as->fixed_layout) {
+    printf("Optimizer: skipped, .org or .align pins code addresses\n");
+    return true;
+  }
+
+  OptProgram p = {as, NULL, (as->program_size + 1) / 2};
+  p.insn = calloc(p.count + 1, sizeof(OptInsn));
+  int *address = calloc(p.count + 1, sizeof(int));
+  if (!p.insn || !address) {
+    free(p.insn);
+    free(address);
+    fprintf(stderr, "Error: Out of memory in optimizer\n");
+    return false;
+  }
+
+  for (int i = 0; i < p.count; i++) {
+    OptInsn *in = &p.insn[i];
+    opt_set_word(in, as->program[2 * i] | (as->program[2 * i + 1] << 8));
+    in->line = as->word_lines[i];
+    in->kind = as->word_kinds[i];
+    in->target = -1;
+
+    bool relative = in->kind != WORD_DATA &&
+                    (opt_is_branch(in->inst.opcode) ||
+                     in->inst.opcode == OP_CALL);
+    if (relative) {
+      int offset = in->inst.opcode == OP_CALL ? in->inst.call_offset
+                                              : in->inst.imm12;
+      int target = 2 * i + 2 + offset;
+      if (target < 0 || target > 2 * p.count || (target & 1)) {
+        printf("Optimizer: skipped, branch on line %d leaves the program\n",
+               in->line);
+        free(p.insn);
+        free(address);
+        return true;
+      }
+      in->target = target / 2;
+    }
+  }
+  for (int l = 0; l < as->label_count; l++) {
+    if (as->labels[l].address / 2 < p.count) {
+      p.insn[as->labels[l].address / 2].labelled = true;
+    }
+  }
+
+  int before = p.count;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = opt_resolve(&p, 0); i < p.count; i = opt_next(&p, i)) {
+      changed |= opt_rules(&p, i);
+    }
+  }
+
+  // New address of every old instruction slot (deleted ones map forward)
+  int size = 0;
+  for (int i = 0; i <= p.count; i++) {
+    address[i] = size;
+    if (i < p.count && !p.insn[i].deleted) {
+      size += 2;
+    }
+  }
+
+  int after = 0;
+  for (int i = 0; i < p.count; i++) {
+    OptInsn *in = &p.insn[i];
+    if (in->deleted) {
+      continue;
+    }
+    uint16_t word = in->word;
+    if (in->target >= 0) {
+      int offset = address[in->target] - (address[i] + 2);
+      word = in->inst.opcode == OP_CALL
+                 ? (word & 0xF800) | ((offset >> 1) & 0x7FF)
+                 : (word & 0xF000) | (offset & 0xFFF);
+    }
+    as->program[2 * after] = word & 0xFF;
+    as->program[2 * after + 1] = word >> 8;
+    as->word_lines[after] = in->line;
+    as->word_kinds[after] = in->kind;
+    after++;
+  }
+  // Data can leave labels and words on odd bytes; keep the byte in the slot
+  for (int l = 0; l < as->label_count; l++) {
+    uint16_t old = as->labels[l].address;
+    int slot = old / 2;
+    as->labels[l].address =
+        slot < p.count ? address[slot] + (old & 1) : address[p.count];
+  }
+  for (int r = 0; r < as->reloc_count; r++) {
+    uint16_t old = as->relocs[r].address;
+    as->relocs[r].address = address[old / 2] + (old & 1);
+  }
+  asm_apply_relocs(as);
+  as->program_size = size - (as->program_size & 1);
+  as->current_address = as->program_size;
+
+  printf("Optimizer: %d rewrites, %d -> %d instructions\n", as->rewrites,
+         before, after);
+  free(p.insn);
+  free(address);
+  return true;
+}
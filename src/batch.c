@@ -0,0 +1,480 @@
+#include "../include/batch.h"
+#include "../include/decoder.h"
+#include "../include/interrupt.h"
+#include "../include/memory.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/*
+ * ============================================================================
+ * VECTOR PRIMITIVES
+ * ============================================================================
+ * Every guest register is 16 bits wide, so one host vector holds the same
+ * register for 16 (AVX2) or 8 (SSE2) lanes. Masks use 0xFFFF for "lane
+ * selected" and 0x0000 otherwise. The scalar fallback treats a single
+ * uint16_t as a one-lane vector so the kernels below are written once.
+ */
+
+#if defined(__AVX2__)
+typedef __m256i vec_t;
+#define VEC_LANES 16
+#define vec_load(p) _mm256_load_si256((const __m256i *)(p))
+#define vec_store(p, v) _mm256_store_si256((__m256i *)(p), (v))
+#define vec_set1(x) _mm256_set1_epi16((short)(x))
+#define vec_add(a, b) _mm256_add_epi16((a), (b))
+#define vec_sub(a, b) _mm256_sub_epi16((a), (b))
+#define vec_and(a, b) _mm256_and_si256((a), (b))
+#define vec_or(a, b) _mm256_or_si256((a), (b))
+#define vec_xor(a, b) _mm256_xor_si256((a), (b))
+#define vec_andnot(a, b) _mm256_andnot_si256((a), (b)) // ~a & b
+#define vec_cmpeq(a, b) _mm256_cmpeq_epi16((a), (b))
+#define vec_adds(a, b) _mm256_adds_epu16((a), (b))
+#define vec_srli(a, n) _mm256_srli_epi16((a), (n))
+#elif defined(__SSE2__)
+typedef __m128i vec_t;
+#define VEC_LANES 8
+#define vec_load(p) _mm_load_si128((const __m128i *)(p))
+#define vec_store(p, v) _mm_store_si128((__m128i *)(p), (v))
+#define vec_set1(x) _mm_set1_epi16((short)(x))
+#define vec_add(a, b) _mm_add_epi16((a), (b))
+#define vec_sub(a, b) _mm_sub_epi16((a), (b))
+#define vec_and(a, b) _mm_and_si128((a), (b))
+#define vec_or(a, b) _mm_or_si128((a), (b))
+#define vec_xor(a, b) _mm_xor_si128((a), (b))
+#define vec_andnot(a, b) _mm_andnot_si128((a), (b)) // ~a & b
+#define vec_cmpeq(a, b) _mm_cmpeq_epi16((a), (b))
+#define vec_adds(a, b) _mm_adds_epu16((a), (b))
+#define vec_srli(a, n) _mm_srli_epi16((a), (n))
+#else
+typedef uint16_t vec_t;
+#define VEC_LANES 1
+#define vec_load(p) (*(p))
+#define vec_store(p, v) (*(p) = (v))
+#define vec_set1(x) ((uint16_t)(x))
+#define vec_add(a, b) ((uint16_t)((a) + (b)))
+#define vec_sub(a, b) ((uint16_t)((a) - (b)))
+#define vec_and(a, b) ((uint16_t)((a) & (b)))
+#define vec_or(a, b) ((uint16_t)((a) | (b)))
+#define vec_xor(a, b) ((uint16_t)((a) ^ (b)))
+#define vec_andnot(a, b) ((uint16_t)(~(a) & (b)))
+#define vec_cmpeq(a, b) ((uint16_t)((a) == (b) ? 0xFFFF : 0))
+#define vec_adds(a, b)                                                         \
+  ((uint16_t)((uint32_t)(a) + (b) > 0xFFFF ? 0xFFFF : (a) + (b)))
+#define vec_srli(a, n) ((uint16_t)((a) >> (n)))
+#endif
+
+// Select new where mask is set, old elsewhere
+#define vec_blend(mask, new, old)                                              \
+  vec_or(vec_and((mask), (new)), vec_andnot((mask), (old)))
+
+/*
+ * ============================================================================
+ * BATCH SETUP
+ * ============================================================================
+ */
+
+static uint16_t *batch_alloc_lanes(uint32_t stride) {
+  // stride is a multiple of 16, so the size is a multiple of the alignment
+  uint16_t *lanes = aligned_alloc(32, stride * sizeof(uint16_t));
+  if (lanes) {
+    memset(lanes, 0, stride * sizeof(uint16_t));
+  }
+  return lanes;
+}
+
+/**
+ * Create a batch of identical instances cloned from a prototype CPU
+ */
+bool batch_init(Batch *batch, uint32_t lanes, const CPU *prototype) {
+  memset(batch, 0, sizeof(Batch));
+  if (lanes == 0) {
+    fprintf(stderr, "Error: Batch needs at least one lane\n");
+    return false;
+  }
+
+  batch->lanes = lanes;
+  batch->stride = (lanes + BATCH_VECTOR_LANES - 1) & ~(BATCH_VECTOR_LANES - 1);
+
+  bool ok = true;
+  for (int r = 0; r < NUM_REGISTERS; r++) {
+    ok &= (batch->registers[r] = batch_alloc_lanes(batch->stride)) != NULL;
+  }
+  ok &= (batch->pc = batch_alloc_lanes(batch->stride)) != NULL;
+  ok &= (batch->flags = batch_alloc_lanes(batch->stride)) != NULL;
+  ok &= (batch->active = batch_alloc_lanes(batch->stride)) != NULL;
+  ok &= (batch->mask = batch_alloc_lanes(batch->stride)) != NULL;
+  ok &= (batch->devices = batch_alloc_lanes(batch->stride)) != NULL;
+  ok &= (batch->cycle_count = calloc(lanes, sizeof(uint64_t))) != NULL;
+  ok &= (batch->cpus = malloc((size_t)lanes * sizeof(CPU))) != NULL;
+  size_t bank_bytes = (size_t)prototype->bank_count * MEM_PAGE_SIZE;
+  if (bank_bytes) {
+    ok &= (batch->banks = malloc(lanes * bank_bytes)) != NULL;
+  }
+  if (!ok) {
+    fprintf(stderr, "Error: Out of memory for %u batch lanes\n", lanes);
+    batch_free(batch);
+    return false;
+  }
+
+  for (uint32_t i = 0; i < lanes; i++) {
+    cpu_clone(&batch->cpus[i], prototype);
+    // Lanes are independent machines, even when the prototype's memory is a
+    // shared or file-backed image or has extended memory
+    if (batch->cpus[i].memory != batch->cpus[i].ram) {
+      memcpy(batch->cpus[i].ram, prototype->memory, MEMORY_SIZE);
+      batch->cpus[i].memory = batch->cpus[i].ram;
+    }
+    if (bank_bytes) {
+      batch->cpus[i].banks = batch->banks + i * bank_bytes;
+      memcpy(batch->cpus[i].banks, prototype->banks, bank_bytes);
+    }
+    mem_map_pages(&batch->cpus[i]);
+    for (int r = 0; r < NUM_REGISTERS; r++) {
+      batch->registers[r][i] = prototype->registers[r];
+    }
+    batch->pc[i] = prototype->pc;
+    batch->flags[i] = prototype->flags;
+    batch->cycle_count[i] = prototype->cycle_count;
+    batch->active[i] = prototype->halted ? 0 : 0xFFFF;
+    batch->devices[i] = irq_active(prototype) ? 0xFFFF : 0;
+  }
+  batch->running = prototype->halted ? 0 : lanes;
+  return true;
+}
+
+/**
+ * Release batch storage
+ */
+void batch_free(Batch *batch) {
+  for (int r = 0; r < NUM_REGISTERS; r++) {
+    free(batch->registers[r]);
+  }
+  free(batch->pc);
+  free(batch->flags);
+  free(batch->active);
+  free(batch->mask);
+  free(batch->devices);
+  free(batch->cycle_count);
+  free(batch->cpus);
+  free(batch->banks);
+  memset(batch, 0, sizeof(Batch));
+}
+
+/**
+ * Set one lane's register (used to give each lane its own input)
+ */
+void batch_set_register(Batch *batch, uint32_t lane, uint8_t reg_index,
+                        uint16_t value) {
+  if (lane >= batch->lanes || reg_index >= NUM_REGISTERS) {
+    return;
+  }
+  batch->registers[reg_index][lane] = value;
+}
+
+/**
+ * Copy a lane's architectural state back into its CPU
+ */
+CPU *batch_lane_cpu(Batch *batch, uint32_t lane) {
+  CPU *cpu = &batch->cpus[lane];
+  for (int r = 0; r < NUM_REGISTERS; r++) {
+    cpu->registers[r] = batch->registers[r][lane];
+  }
+  cpu->pc = batch->pc[lane];
+  cpu->flags = batch->flags[lane] & 0xFF;
+  cpu->cycle_count = batch->cycle_count[lane];
+  cpu->halted = batch->active[lane] == 0;
+  return cpu;
+}
+
+/*
+ * ============================================================================
+ * LOCKSTEP KERNELS
+ * ============================================================================
+ */
+
+/**
+ * ADD/ADDI/SUB/SUBI/AND/OR/XOR on every selected lane
+ */
+static void batch_alu(Batch *batch, const Instruction *inst) {
+  // ADDI/SUBI use Rd as both source and destination
+  bool immediate = inst->opcode == OP_ADDI || inst->opcode == OP_SUBI;
+  const uint16_t *src1 =
+      batch->registers[immediate ? inst->rd : inst->rs1];
+  const uint16_t *src2 = batch->registers[inst->rs2];
+  uint16_t *dst = batch->registers[inst->rd];
+
+  const vec_t imm = vec_set1(inst->imm9);
+  const vec_t zero = vec_set1(0);
+  const vec_t zflag = vec_set1(FLAG_ZERO);
+  const vec_t nflag = vec_set1(FLAG_NEGATIVE);
+  const vec_t cflag = vec_set1(FLAG_CARRY);
+  // ADD also owns the carry flag; the others leave it alone
+  const vec_t written =
+      vec_set1(FLAG_ZERO | FLAG_NEGATIVE |
+               (inst->opcode == OP_ADD ? FLAG_CARRY : 0));
+
+  for (uint32_t i = 0; i < batch->stride; i += VEC_LANES) {
+    vec_t mask = vec_load(batch->mask + i);
+    vec_t a = vec_load(src1 + i);
+    vec_t carry = zero;
+    vec_t result;
+
+    switch (inst->opcode) {
+    case OP_ADD: {
+      vec_t b = vec_load(src2 + i);
+      result = vec_add(a, b);
+      // Saturating add differs from the wrapped sum exactly on carry-out
+      carry = vec_andnot(vec_cmpeq(vec_adds(a, b), result), cflag);
+      break;
+    }
+    case OP_ADDI:
+      result = vec_add(a, imm);
+      break;
+    case OP_SUB:
+      result = vec_sub(a, vec_load(src2 + i));
+      break;
+    case OP_SUBI:
+      result = vec_sub(a, imm);
+      break;
+    case OP_AND:
+      result = vec_and(a, vec_load(src2 + i));
+      break;
+    case OP_OR:
+      result = vec_or(a, vec_load(src2 + i));
+      break;
+    default: // OP_XOR
+      result = vec_xor(a, vec_load(src2 + i));
+      break;
+    }
+
+    vec_t flags = vec_load(batch->flags + i);
+    vec_t z = vec_and(vec_cmpeq(result, zero), zflag);
+    vec_t n = vec_and(vec_srli(result, 14), nflag);
+    vec_t updated = vec_or(vec_andnot(written, flags), vec_or(z, vec_or(n, carry)));
+
+    vec_store(dst + i, vec_blend(mask, result, vec_load(dst + i)));
+    vec_store(batch->flags + i, vec_blend(mask, updated, flags));
+  }
+}
+
+/**
+ * LOADI on every selected lane (flags unaffected)
+ */
+static void batch_loadi(Batch *batch, const Instruction *inst) {
+  uint16_t *dst = batch->registers[inst->rd];
+  const vec_t imm = vec_set1(inst->imm9);
+
+  for (uint32_t i = 0; i < batch->stride; i += VEC_LANES) {
+    vec_t mask = vec_load(batch->mask + i);
+    vec_store(dst + i, vec_blend(mask, imm, vec_load(dst + i)));
+  }
+}
+
+/**
+ * Advance PC past the current instruction, taking branches per lane
+ */
+static void batch_advance(Batch *batch, const Instruction *inst) {
+  const vec_t two = vec_set1(2);
+  const vec_t offset = vec_set1(inst->imm12);
+  const vec_t zflag = vec_set1(FLAG_ZERO);
+  const vec_t nflag = vec_set1(FLAG_NEGATIVE);
+
+  for (uint32_t i = 0; i < batch->stride; i += VEC_LANES) {
+    vec_t mask = vec_load(batch->mask + i);
+    vec_t flags = vec_load(batch->flags + i);
+    vec_t taken;
+
+    switch (inst->opcode) {
+    case OP_BRANCH:
+      taken = mask;
+      break;
+    case OP_BEQ:
+      taken = vec_and(mask, vec_cmpeq(vec_and(flags, zflag), zflag));
+      break;
+    case OP_BNE:
+      taken = vec_andnot(vec_cmpeq(vec_and(flags, zflag), zflag), mask);
+      break;
+    case OP_BLT:
+      taken = vec_and(mask, vec_cmpeq(vec_and(flags, nflag), nflag));
+      break;
+    default:
+      taken = vec_set1(0);
+      break;
+    }
+
+    vec_t pc = vec_load(batch->pc + i);
+    pc = vec_add(pc, vec_and(mask, two));
+    pc = vec_add(pc, vec_and(taken, offset));
+    vec_store(batch->pc + i, pc);
+  }
+}
+
+/**
+ * LOAD/STORE: a per-lane gather through the normal memory path. Device
+ * accesses can change timer, interrupt and cycle state, and out-of-bounds
+ * ones fault, so those lanes take a full scalar step.
+ */
+static void batch_step_lane(Batch *batch, uint32_t lane);
+
+static void batch_memory(Batch *batch, const Instruction *inst) {
+  const uint16_t *base = batch->registers[inst->rs1];
+  uint16_t *data = batch->registers[inst->rd];
+
+  for (uint32_t i = 0; i < batch->lanes; i++) {
+    if (!batch->mask[i]) {
+      continue;
+    }
+    uint16_t addr = base[i] + inst->offset6;
+    bool device = addr >= IO_START - 1 && addr <= IO_END;
+    if (device || addr >= MEMORY_SIZE - 1) {
+      batch->mask[i] = 0;
+      batch_step_lane(batch, i);
+    } else if (inst->opcode == OP_LOAD) {
+      data[i] = mem_read_word(&batch->cpus[i], addr);
+    } else {
+      mem_write_word(&batch->cpus[i], addr, data[i]);
+    }
+  }
+}
+
+/**
+ * Step a single lane through the scalar interpreter
+ */
+static void batch_step_lane(Batch *batch, uint32_t lane) {
+  CPU *cpu = batch_lane_cpu(batch, lane);
+  cpu_step(cpu);
+
+  for (int r = 0; r < NUM_REGISTERS; r++) {
+    batch->registers[r][lane] = cpu->registers[r];
+  }
+  batch->pc[lane] = cpu->pc;
+  batch->flags[lane] = cpu->flags;
+  batch->cycle_count[lane] = cpu->cycle_count;
+  batch->devices[lane] = irq_active(cpu) ? 0xFFFF : 0;
+  if (cpu->halted) {
+    batch->active[lane] = 0;
+    batch->running--;
+  }
+}
+
+/*
+ * ============================================================================
+ * SCHEDULER
+ * ============================================================================
+ */
+
+/**
+ * Issue one instruction to every lane waiting at the lowest PC.
+ * Returns false once all lanes have halted.
+ */
+bool batch_step(Batch *batch) {
+  if (batch->running == 0) {
+    return false;
+  }
+
+  // Lowest PC first: lanes that fell behind catch up and rejoin the group
+  uint32_t first = 0;
+  uint16_t leader = 0xFFFF;
+  bool found = false;
+  for (uint32_t i = 0; i < batch->lanes; i++) {
+    if (batch->active[i] && (!found || batch->pc[i] < leader)) {
+      leader = batch->pc[i];
+      first = i;
+      found = true;
+    }
+  }
+
+  batch->steps++;
+
+  // Fetches not wholly in RAM have side effects or fault; run them one lane
+  // at a time
+  if (leader >= IO_START - 1) {
+    batch_step_lane(batch, first);
+    batch->lane_instructions++;
+    return batch->running > 0;
+  }
+
+  uint16_t ir = mem_peek_word(&batch->cpus[first], leader);
+
+  // Select lanes at the leader PC that also hold the same instruction word
+  uint32_t selected = 0;
+  uint16_t devices = 0;
+  for (uint32_t i = 0; i < batch->lanes; i++) {
+    bool match = batch->active[i] && batch->pc[i] == leader &&
+                 mem_peek_word(&batch->cpus[i], leader) == ir;
+    batch->mask[i] = match ? 0xFFFF : 0;
+    devices |= batch->mask[i] & batch->devices[i];
+    selected += match;
+  }
+  batch->lane_instructions += selected;
+
+  // Lanes with a running timer or interrupts need the per-cycle device
+  // tick in cpu_step, so they leave the vector path
+  Instruction inst = decode_instruction(ir);
+  switch (devices ? OP_INVALID : inst.opcode) {
+  case OP_ADD:
+  case OP_ADDI:
+  case OP_SUB:
+  case OP_SUBI:
+  case OP_AND:
+  case OP_OR:
+  case OP_XOR:
+    batch_alu(batch, &inst);
+    break;
+
+  case OP_LOADI:
+    batch_loadi(batch, &inst);
+    break;
+
+  case OP_LOAD:
+  case OP_STORE:
+    batch_memory(batch, &inst);
+    break;
+
+  case OP_NOP:
+  case OP_BRANCH:
+  case OP_BEQ:
+  case OP_BNE:
+  case OP_BLT:
+    break;
+
+  case OP_HALT:
+    for (uint32_t i = 0; i < batch->lanes; i++) {
+      if (batch->mask[i]) {
+        batch->active[i] = 0;
+        batch->cpus[i].halted = true;
+      }
+    }
+    batch->running -= selected;
+    break;
+
+  default:
+    // No vector kernel: fall back to the reference interpreter per lane
+    for (uint32_t i = 0; i < batch->lanes; i++) {
+      if (batch->mask[i]) {
+        batch_step_lane(batch, i);
+      }
+    }
+    return batch->running > 0;
+  }
+
+  batch_advance(batch, &inst);
+  for (uint32_t i = 0; i < batch->lanes; i++) {
+    batch->cycle_count[i] += batch->mask[i] & 1;
+  }
+
+  return batch->running > 0;
+}
+
+/**
+ * Run every lane until it halts
+ */
+void batch_run(Batch *batch) {
+  while (batch_step(batch)) {
+  }
+}
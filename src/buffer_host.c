@@ -0,0 +1,80 @@
+#include "../include/buffer_host.h"
+#include <stddef.h>
+
+/*
+ * ============================================================================
+ * BUFFER HOST
+ * ============================================================================
+ * The CpuHost of the fuzzer and the server, whose guests read a request's
+ * bytes and must never wait on a terminal.
+ */
+
+/**
+ * Console output: kept up to output_size, the rest only noted
+ */
+static void buffer_console_write(void *ctx, uint8_t ch) {
+  BufferHost *bh = ctx;
+  if (bh->output_len < bh->output_size) {
+    bh->output[bh->output_len++] = ch;
+  } else {
+    bh->truncated = true;
+  }
+}
+
+/**
+ * Console read: the next input byte, then end of input
+ */
+static int buffer_console_read(void *ctx) {
+  BufferHost *bh = ctx;
+  return bh->input_pos < bh->input_len ? bh->input[bh->input_pos++]
+                                       : CPU_CONSOLE_EOF;
+}
+
+/**
+ * Console status: input is either waiting or over, so nothing ever blocks
+ */
+static uint16_t buffer_console_status(void *ctx, bool wait) {
+  (void)wait;
+  BufferHost *bh = ctx;
+  return bh->input_pos < bh->input_len ? CONSOLE_STATUS_READY
+                                       : CONSOLE_STATUS_EOF;
+}
+
+/**
+ * Set up a host with no input yet. Without an output buffer, console
+ * writes are left unconnected and cost nothing.
+ */
+void buffer_host_init(BufferHost *bh, uint8_t *output, uint32_t output_size) {
+  bh->host = (CpuHost){
+      .ctx = bh,
+      .console_write = output ? buffer_console_write : NULL,
+      .console_read = buffer_console_read,
+      .console_status = buffer_console_status,
+  };
+  bh->output = output;
+  bh->output_size = output ? output_size : 0;
+  buffer_host_reset(bh, NULL, 0);
+}
+
+/**
+ * Point the console at a new run's input and empty the output
+ */
+void buffer_host_reset(BufferHost *bh, const uint8_t *input,
+                       uint32_t input_len) {
+  bh->input = input;
+  bh->input_len = input_len;
+  bh->input_pos = 0;
+  bh->output_len = 0;
+  bh->truncated = false;
+}
+
+/**
+ * FNV-1a hash of a buffer
+ */
+uint64_t buffer_hash(const uint8_t *data, uint32_t len) {
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  for (uint32_t i = 0; i < len; i++) {
+    hash = (hash ^ data[i]) * 0x100000001B3ULL;
+  }
+  return hash;
+}
@@ -0,0 +1,365 @@
+#include "../include/cache.h"
+#include "../include/decoder.h"
+#include "../include/memory.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * ============================================================================
+ * CACHE SIMULATOR
+ * ============================================================================
+ * Tags only: data always lives in cpu->memory, the caches just decide how
+ * long each access would have taken. Write-back levels allocate on a write
+ * miss and write dirty victims to the next level; write-through levels send
+ * every write on and do not allocate. Writes that leave a level are assumed
+ * to drain through a write buffer and are not charged. DMA transfers bypass
+ * the caches.
+ */
+
+static const char *const cache_policy_names[] = {"LRU", "FIFO", "random"};
+
+/**
+ * Check for a nonzero power of two
+ */
+static bool cache_pow2(uint32_t value) {
+  return value != 0 && (value & (value - 1)) == 0;
+}
+
+/**
+ * Record why setup failed; always returns false
+ */
+static bool cache_fail(CacheHierarchy *h, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  vsnprintf(h->error, sizeof(h->error), format, args);
+  va_end(args);
+  return false;
+}
+
+/**
+ * Allocate the tag arrays and statistics for one level
+ */
+static bool cache_level_init(CacheHierarchy *h, Cache *c) {
+  const CacheConfig *cfg = &c->config;
+  if (!cache_pow2(cfg->size) || !cache_pow2(cfg->line_size) ||
+      cfg->line_size < 2 || cfg->ways == 0 ||
+      cfg->size % (cfg->ways * cfg->line_size) != 0) {
+    return cache_fail(h,
+                      "Invalid %s geometry (%u bytes, %u ways, %u-byte lines)",
+                      c->name, cfg->size, cfg->ways, cfg->line_size);
+  }
+
+  c->sets = cfg->size / (cfg->ways * cfg->line_size);
+  c->line_shift = 0;
+  while ((1u << c->line_shift) < cfg->line_size) {
+    c->line_shift++;
+  }
+
+  uint32_t lines = c->sets * cfg->ways;
+  c->tags = calloc(lines, sizeof(uint32_t));
+  c->valid = calloc(lines, 1);
+  c->dirty = calloc(lines, 1);
+  c->stamp = calloc(lines, sizeof(uint64_t));
+  c->pc_stats = calloc(MEMORY_SIZE / 2, sizeof(*c->pc_stats));
+  if (!c->tags || !c->valid || !c->dirty || !c->stamp || !c->pc_stats) {
+    return cache_fail(h, "Cannot allocate %s", c->name);
+  }
+  return true;
+}
+
+/**
+ * Parse "size/ways/line[/lru|fifo|random][/wb|wt][/latency]" or "off"
+ */
+static bool cache_parse_level(CacheHierarchy *h, Cache *c, const char *value) {
+  if (strcmp(value, "off") == 0) {
+    c->enabled = false;
+    return true;
+  }
+
+  char buffer[64];
+  strncpy(buffer, value, sizeof(buffer) - 1);
+  buffer[sizeof(buffer) - 1] = '\0';
+
+  uint32_t numbers[3] = {0, 0, 0};
+  int count = 0;
+  for (char *field = strtok(buffer, "/"); field; field = strtok(NULL, "/")) {
+    char *end;
+    unsigned long number = strtoul(field, &end, 0);
+    if (*end == '\0' && count < 3) {
+      numbers[count++] = (uint32_t)number;
+    } else if (*end == '\0') {
+      c->config.latency = (uint32_t)number;
+    } else if (strcmp(field, "lru") == 0) {
+      c->config.policy = CACHE_LRU;
+    } else if (strcmp(field, "fifo") == 0) {
+      c->config.policy = CACHE_FIFO;
+    } else if (strcmp(field, "random") == 0) {
+      c->config.policy = CACHE_RANDOM;
+    } else if (strcmp(field, "wb") == 0) {
+      c->config.write_back = true;
+    } else if (strcmp(field, "wt") == 0) {
+      c->config.write_back = false;
+    } else {
+      return cache_fail(h, "Unknown %s option '%s'", c->name, field);
+    }
+  }
+  if (count != 3) {
+    return cache_fail(h, "%s needs size/ways/line", c->name);
+  }
+
+  c->config.size = numbers[0];
+  c->config.ways = numbers[1];
+  c->config.line_size = numbers[2];
+  c->enabled = true;
+  return true;
+}
+
+/**
+ * Parse a hierarchy description into h (levels are not allocated yet)
+ */
+static bool cache_parse(CacheHierarchy *h, const char *spec) {
+  char buffer[256];
+  strncpy(buffer, spec, sizeof(buffer) - 1);
+  buffer[sizeof(buffer) - 1] = '\0';
+
+  // strtok is used again per level, so split the list by hand
+  char *item = buffer;
+  while (item && *item) {
+    char *comma = strchr(item, ',');
+    if (comma) {
+      *comma = '\0';
+    }
+    char *value = strchr(item, '=');
+    if (!value) {
+      return cache_fail(h, "Expected level=value in cache spec, got '%s'",
+                        item);
+    }
+    *value++ = '\0';
+
+    bool ok;
+    if (strcmp(item, "l1i") == 0) {
+      ok = cache_parse_level(h, &h->l1i, value);
+    } else if (strcmp(item, "l1d") == 0) {
+      ok = cache_parse_level(h, &h->l1d, value);
+    } else if (strcmp(item, "l2") == 0) {
+      ok = cache_parse_level(h, &h->l2, value);
+    } else if (strcmp(item, "mem") == 0) {
+      h->memory_latency = (uint32_t)strtoul(value, NULL, 0);
+      ok = true;
+    } else {
+      ok = cache_fail(h, "Unknown cache level '%s'", item);
+    }
+    if (!ok) {
+      return false;
+    }
+    item = comma ? comma + 1 : NULL;
+  }
+  return true;
+}
+
+/**
+ * Build the hierarchy from the defaults overridden by spec
+ */
+bool cache_init(CacheHierarchy *h, const char *spec) {
+  memset(h, 0, sizeof(CacheHierarchy));
+  CacheConfig l1 = {CACHE_DEFAULT_SIZE, CACHE_DEFAULT_WAYS, CACHE_DEFAULT_LINE,
+                    CACHE_LRU, true, 0};
+  h->l1i.config = l1;
+  h->l1i.name = "L1I";
+  h->l1i.enabled = true;
+  h->l1d.config = l1;
+  h->l1d.name = "L1D";
+  h->l1d.enabled = true;
+  h->l2.config = l1;
+  h->l2.config.size = CACHE_DEFAULT_SIZE * 8;
+  h->l2.config.ways = CACHE_DEFAULT_WAYS * 2;
+  h->l2.config.latency = CACHE_DEFAULT_L2_LATENCY;
+  h->l2.name = "L2";
+  h->memory_latency = CACHE_DEFAULT_MEM_LATENCY;
+  h->rng = 0x2545F491;
+
+  if (spec && !cache_parse(h, spec)) {
+    return false;
+  }
+
+  Cache *levels[] = {&h->l1i, &h->l1d, &h->l2};
+  for (int i = 0; i < 3; i++) {
+    if (levels[i]->enabled && !cache_level_init(h, levels[i])) {
+      cache_free(h);
+      return false;
+    }
+  }
+  Cache *l2 = h->l2.enabled ? &h->l2 : NULL;
+  h->l1i.next = l2;
+  h->l1d.next = l2;
+  return true;
+}
+
+/**
+ * Release every level
+ */
+void cache_free(CacheHierarchy *h) {
+  Cache *levels[] = {&h->l1i, &h->l1d, &h->l2};
+  for (int i = 0; i < 3; i++) {
+    free(levels[i]->tags);
+    free(levels[i]->valid);
+    free(levels[i]->dirty);
+    free(levels[i]->stamp);
+    free(levels[i]->pc_stats);
+    levels[i]->tags = NULL;
+    levels[i]->valid = levels[i]->dirty = NULL;
+    levels[i]->stamp = NULL;
+    levels[i]->pc_stats = NULL;
+  }
+}
+
+/**
+ * Look up one level, filling from the next on a miss.
+ * Returns the extra cycles the access cost.
+ */
+static uint32_t cache_lookup(CacheHierarchy *h, Cache *c, uint32_t address,
+                             bool write) {
+  if (!c) {
+    return write ? 0 : h->memory_latency;
+  }
+
+  uint32_t line = address >> c->line_shift;
+  uint32_t set = line % c->sets;
+  uint32_t tag = line / c->sets;
+  uint32_t ways = c->config.ways;
+  uint32_t base = set * ways;
+  uint32_t *stats = c->pc_stats[h->pc >> 1];
+
+  for (uint32_t w = 0; w < ways; w++) {
+    uint32_t i = base + w;
+    if (c->valid[i] && c->tags[i] == tag) {
+      c->hits++;
+      stats[0]++;
+      if (c->config.policy == CACHE_LRU) {
+        c->stamp[i] = ++h->clock;
+      }
+      if (write && c->config.write_back) {
+        c->dirty[i] = 1;
+      } else if (write) {
+        cache_lookup(h, c->next, address, true);
+      }
+      return c->config.latency;
+    }
+  }
+
+  c->misses++;
+  stats[1]++;
+  if (write && !c->config.write_back) {
+    cache_lookup(h, c->next, address, true); // No allocation
+    return 0;
+  }
+
+  // Victim: an invalid way if there is one, else by policy
+  uint32_t victim = base;
+  bool empty = false;
+  for (uint32_t w = 0; w < ways && !empty; w++) {
+    empty = !c->valid[base + w];
+    victim = base + w;
+  }
+  if (!empty && c->config.policy == CACHE_RANDOM) {
+    h->rng ^= h->rng << 13;
+    h->rng ^= h->rng >> 17;
+    h->rng ^= h->rng << 5;
+    victim = base + h->rng % ways;
+  } else if (!empty) {
+    // Oldest use (LRU) or oldest fill (FIFO)
+    victim = base;
+    for (uint32_t w = 1; w < ways; w++) {
+      if (c->stamp[base + w] < c->stamp[victim]) {
+        victim = base + w;
+      }
+    }
+  }
+
+  if (c->valid[victim] && c->dirty[victim]) {
+    c->writebacks++;
+    uint32_t old = (c->tags[victim] * c->sets + set) << c->line_shift;
+    cache_lookup(h, c->next, old, true);
+  }
+
+  uint32_t latency = c->config.latency + cache_lookup(h, c->next, address, false);
+  c->valid[victim] = 1;
+  c->dirty[victim] = write;
+  c->tags[victim] = tag;
+  c->stamp[victim] = ++h->clock;
+  return latency;
+}
+
+/**
+ * Simulate one word access issued by the current instruction
+ */
+void cache_access(CacheHierarchy *h, CacheAccess kind, uint16_t address) {
+  Cache *c = kind == CACHE_FETCH ? &h->l1i : &h->l1d;
+  if (!c->enabled) {
+    c = c->next;
+  }
+  uint32_t latency = cache_lookup(h, c, address, kind == CACHE_WRITE);
+  h->stall += latency;
+  h->stall_total += latency;
+}
+
+/**
+ * Hand accumulated miss cycles to the timing model
+ */
+uint32_t cache_take_stall(CacheHierarchy *h) {
+  uint32_t stall = h->stall;
+  h->stall = 0;
+  return stall;
+}
+
+/**
+ * Print one level's totals and its worst instructions
+ */
+static void cache_report_level(const Cache *c, const CPU *cpu) {
+  const CacheConfig *cfg = &c->config;
+  uint64_t accesses = c->hits + c->misses;
+  printf("%-3s %6uB %2u-way %3uB lines %-6s %s: %llu accesses, %llu misses "
+         "(%.2f%% miss), %llu writebacks\n",
+         c->name, cfg->size, cfg->ways, cfg->line_size,
+         cache_policy_names[cfg->policy],
+         cfg->write_back ? "write-back" : "write-through",
+         (unsigned long long)accesses, (unsigned long long)c->misses,
+         accesses ? 100.0 * c->misses / accesses : 0.0,
+         (unsigned long long)c->writebacks);
+
+  uint32_t top[CACHE_TOP_PCS];
+  uint64_t top_misses[CACHE_TOP_PCS];
+  int found = 0;
+  for (uint32_t i = 0; i < MEMORY_SIZE / 2; i++) {
+    uint32_t misses = c->pc_stats[i][1];
+    if (misses != 0) {
+      found = cpu_top_insert(top, top_misses, found, CACHE_TOP_PCS, i, misses);
+    }
+  }
+
+  for (int t = 0; t < found; t++) {
+    uint16_t pc = (uint16_t)(top[t] << 1);
+    uint16_t raw = mem_peek_word(cpu, pc);
+    const uint32_t *s = c->pc_stats[top[t]];
+    printf("    0x%04X  %-6s %8u hits %8u misses\n", pc,
+           cpu_opcode_to_string(decode_instruction(raw).opcode), s[0], s[1]);
+  }
+}
+
+/**
+ * Print hit/miss rates per level and per instruction
+ */
+void cache_report(const CacheHierarchy *h, const CPU *cpu) {
+  printf("\n=== Cache Simulation ===\n");
+  const Cache *levels[] = {&h->l1i, &h->l1d, &h->l2};
+  for (int i = 0; i < 3; i++) {
+    if (levels[i]->enabled) {
+      cache_report_level(levels[i], cpu);
+    }
+  }
+  printf("Miss cycles: %llu (L2 hit +%u, memory +%u)\n",
+         (unsigned long long)h->stall_total, h->l2.config.latency,
+         h->memory_latency);
+}
@@ -0,0 +1,2770 @@
+#include "../include/compiler.h"
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * ============================================================================
+ * C SUBSET COMPILER
+ * ============================================================================
+ * Translates a C subset (16-bit int and unsigned, pointers, arrays,
+ * functions, if/while/do/for, recursion) into assembly for this CPU. Each
+ * function is parsed into an AST, lowered to three-address code over
+ * virtual registers, given physical registers by linear scan and printed.
+ *
+ * Calling convention: R7 is the frame pointer of a data stack growing down
+ * from CC_STACK_TOP; the hardware stack only holds return addresses and
+ * saved registers. Argument i lives at [R7 + 2i] of the callee, locals and
+ * spill slots below R7. The caller stores the arguments past its own frame,
+ * moves R7 down onto them around the CALL and back afterwards. The result
+ * comes back in R0. R0-R4 are allocated and caller-saved (pushed around a
+ * call only while they hold a live value); R5 and R6 are scratch registers
+ * for spill code and address arithmetic.
+ */
+
+#define CC_MAX_IDENT 64
+#define CC_MAX_PARAMS 8
+#define CC_MAX_LOCALS 256
+#define CC_MAX_SCOPE 512
+#define CC_ALLOC_REGS 5 // R0-R4
+#define CC_SCRATCH_A 5
+#define CC_SCRATCH_B 6
+#define CC_FP 7
+#define CC_CALL_REACH 2046 // Bytes CALL can jump either way
+
+/* ============================================================================
+ * TOKENS AND TYPES
+ * ============================================================================
+ */
+
+typedef enum { TK_NUM, TK_IDENT, TK_PUNCT, TK_EOF } TokenKind;
+
+typedef struct {
+  TokenKind kind;
+  char text[CC_MAX_IDENT];
+  long value;
+  bool is_unsigned;
+  int line;
+} Token;
+
+typedef enum { TY_VOID, TY_INT, TY_UINT, TY_PTR, TY_ARRAY } TypeKind;
+
+typedef struct Type {
+  TypeKind kind;
+  struct Type *base; // Pointee or element type
+  int length;        // Array elements, -1 until an initialiser sizes it
+} Type;
+
+static Type ty_void = {TY_VOID, NULL, 0};
+static Type ty_int = {TY_INT, NULL, 0};
+static Type ty_uint = {TY_UINT, NULL, 0};
+
+typedef enum { SYM_GLOBAL, SYM_LOCAL, SYM_FUNC } SymbolKind;
+
+typedef struct Symbol {
+  char name[CC_MAX_IDENT];
+  SymbolKind kind;
+  Type *type;       // Variable type, or return type of a function
+  bool param;       // Local that is a parameter
+  int index;        // Parameter number
+  bool addressed;   // & was taken, so the variable lives in memory
+  int offset;       // Frame offset of a local in memory
+  int vreg;         // Virtual register of a local kept in a register
+  struct Node *init; // Global initialiser list
+  Type *params[CC_MAX_PARAMS];
+  int param_count;  // -1 for a prototype without a parameter list
+  bool defined;
+  int address;      // Upper bound on a function's code address
+} Symbol;
+
+typedef enum {
+  ND_NUM,
+  ND_VAR,
+  ND_CALL,
+  ND_NEG,
+  ND_BITNOT,
+  ND_NOT,
+  ND_ADDR,
+  ND_DEREF,
+  ND_CAST,
+  ND_BINARY,
+  ND_LOGAND,
+  ND_LOGOR,
+  ND_COND,
+  ND_ASSIGN,
+  ND_INCDEC,
+  ND_BLOCK,
+  ND_IF,
+  ND_WHILE,
+  ND_DO,
+  ND_FOR,
+  ND_RETURN,
+  ND_BREAK,
+  ND_CONTINUE,
+  ND_EXPR
+} NodeKind;
+
+typedef enum {
+  BIN_NONE = -1,
+  BIN_ADD,
+  BIN_SUB,
+  BIN_MUL,
+  BIN_DIV,
+  BIN_MOD,
+  BIN_AND,
+  BIN_OR,
+  BIN_XOR,
+  BIN_SHL,
+  BIN_SHR,
+  BIN_EQ,
+  BIN_NE,
+  BIN_LT,
+  BIN_LE,
+  BIN_GT,
+  BIN_GE
+} BinOp;
+
+typedef struct Node {
+  NodeKind kind;
+  BinOp op;          // ND_BINARY, compound ND_ASSIGN
+  Type *type;
+  bool is_unsigned;  // Unsigned division, right shift or comparison
+  bool post;         // Postfix ++/--
+  struct Node *lhs, *rhs;
+  struct Node *cond, *then, *els, *init, *inc;
+  struct Node *next; // Next statement, argument or initialiser
+  Symbol *sym;
+  long value;        // ND_NUM value, ND_INCDEC step
+  int line;
+} Node;
+
+typedef struct Function {
+  Symbol *sym;
+  Symbol **locals; // Parameters and locals, in declaration order
+  int local_count;
+  Node *body;
+  struct Function *next;
+} Function;
+
+// CALL reaches +-2KB; a call found to be possibly further away is emitted
+// as a far call instead (see emit_call_to)
+typedef struct {
+  Symbol *target;
+  int position; // Upper bound on the call's address
+  bool far;
+} CallSite;
+
+typedef struct {
+  const char *filename;
+  Token *tokens;
+  int token_count;
+  int pos;
+  bool error;
+
+  void **allocs; // Everything below is freed together at the end
+  int alloc_count;
+  int alloc_cap;
+
+  Symbol *scope[CC_MAX_SCOPE];
+  int scope_count;
+  int block_base; // First scope entry of the innermost block
+  Symbol *locals[CC_MAX_LOCALS];
+  int local_count;
+  Symbol *globals[CC_MAX_SCOPE];
+  int global_count;
+  Function *functions;
+  Function *last_function;
+  Type *return_type;
+
+  int label_count;
+  FILE *out;     // NULL while sizing the code
+  int code_size; // Upper bound on the bytes of code generated so far
+  CallSite *calls;
+  int call_count;
+  int call_cap;
+} Compiler;
+
+/**
+ * Report the first error; later ones are usually knock-on effects
+ */
+static void cc_error(Compiler *cc, int line, const char *format, ...) {
+  if (cc->error) {
+    return;
+  }
+  cc->error = true;
+  va_list args;
+  va_start(args, format);
+  fprintf(stderr, "Error: %s:%d: ", cc->filename, line);
+  vfprintf(stderr, format, args);
+  fprintf(stderr, "\n");
+  va_end(args);
+}
+
+/**
+ * Zeroed allocation owned by the compiler
+ */
+static void *cc_alloc(Compiler *cc, size_t size) {
+  if (cc->alloc_count == cc->alloc_cap) {
+    int cap = cc->alloc_cap ? 2 * cc->alloc_cap : 256;
+    void **allocs = realloc(cc->allocs, cap * sizeof(void *));
+    if (!allocs) {
+      fprintf(stderr, "Error: Out of memory in compiler\n");
+      exit(1);
+    }
+    cc->allocs = allocs;
+    cc->alloc_cap = cap;
+  }
+  void *p = calloc(1, size);
+  if (!p) {
+    fprintf(stderr, "Error: Out of memory in compiler\n");
+    exit(1);
+  }
+  cc->allocs[cc->alloc_count++] = p;
+  return p;
+}
+
+static Type *cc_pointer_to(Compiler *cc, Type *base) {
+  Type *t = cc_alloc(cc, sizeof(Type));
+  t->kind = TY_PTR;
+  t->base = base;
+  return t;
+}
+
+static Type *cc_array_of(Compiler *cc, Type *base, int length) {
+  Type *t = cc_alloc(cc, sizeof(Type));
+  t->kind = TY_ARRAY;
+  t->base = base;
+  t->length = length;
+  return t;
+}
+
+static int cc_size(const Type *t) {
+  switch (t->kind) {
+  case TY_VOID:
+    return 1;
+  case TY_ARRAY:
+    return t->length < 0 ? 0 : t->length * cc_size(t->base);
+  default:
+    return 2;
+  }
+}
+
+/* ============================================================================
+ * LEXER
+ * ============================================================================
+ * Preprocessor lines are skipped, so #include <stdio.h> is harmless.
+ */
+
+static const char *cc_puncts[] = {"<<=", ">>=", "==", "!=", "<=", ">=", "&&",
+                                  "||",  "++",  "--", "+=", "-=", "*=", "/=",
+                                  "%=",  "&=",  "|=", "^=", "<<", ">>", NULL};
+
+static Token *cc_new_token(Compiler *cc, TokenKind kind, int line) {
+  if (cc->token_count % 1024 == 0) {
+    Token *tokens =
+        realloc(cc->tokens, (cc->token_count + 1024) * sizeof(Token));
+    if (!tokens) {
+      fprintf(stderr, "Error: Out of memory in compiler\n");
+      exit(1);
+    }
+    cc->tokens = tokens;
+  }
+  Token *t = &cc->tokens[cc->token_count++];
+  memset(t, 0, sizeof(Token));
+  t->kind = kind;
+  t->line = line;
+  return t;
+}
+
+/**
+ * Character after a backslash in a character constant
+ */
+static int cc_escape(char c) {
+  switch (c) {
+  case 'n':
+    return '\n';
+  case 't':
+    return '\t';
+  case 'r':
+    return '\r';
+  case '0':
+    return 0;
+  default:
+    return c;
+  }
+}
+
+static bool cc_tokenize(Compiler *cc, const char *p) {
+  int line = 1;
+  bool line_start = true;
+
+  while (*p && !cc->error) {
+    if (*p == '\n') {
+      line++;
+      p++;
+      line_start = true;
+      continue;
+    }
+    if (isspace((unsigned char)*p)) {
+      p++;
+      continue;
+    }
+    if (line_start && *p == '#') {
+      while (*p && *p != '\n') {
+        p++;
+      }
+      continue;
+    }
+    line_start = false;
+
+    if (p[0] == '/' && p[1] == '/') {
+      while (*p && *p != '\n') {
+        p++;
+      }
+      continue;
+    }
+    if (p[0] == '/' && p[1] == '*') {
+      const char *end = strstr(p + 2, "*/");
+      if (!end) {
+        cc_error(cc, line, "unterminated comment");
+        break;
+      }
+      for (; p < end; p++) {
+        line += *p == '\n';
+      }
+      p += 2;
+      continue;
+    }
+
+    if (isdigit((unsigned char)*p)) {
+      char *end;
+      unsigned long value = strtoul(p, &end, 0);
+      Token *t = cc_new_token(cc, TK_NUM, line);
+      snprintf(t->text, CC_MAX_IDENT, "%.*s", (int)(end - p), p);
+      t->value = (long)value;
+      // No long: large decimal constants wrap to int, hex and octal ones
+      // are unsigned as in C
+      t->is_unsigned = value > 0x7FFF && p[0] == '0';
+      for (p = end; *p == 'u' || *p == 'U' || *p == 'l' || *p == 'L'; p++) {
+        t->is_unsigned |= *p == 'u' || *p == 'U';
+      }
+      if (value > 0xFFFF) {
+        cc_error(cc, line, "constant '%s' does not fit in 16 bits", t->text);
+      } else if (isalnum((unsigned char)*p)) {
+        cc_error(cc, line, "invalid number '%s%c'", t->text, *p);
+      }
+      continue;
+    }
+
+    if (*p == '\'') {
+      Token *t = cc_new_token(cc, TK_NUM, line);
+      t->value = p[1] == '\\' ? cc_escape(p[2]) : (unsigned char)p[1];
+      p += p[1] == '\\' ? 3 : 2;
+      if (*p != '\'') {
+        cc_error(cc, line, "invalid character constant");
+        break;
+      }
+      p++;
+      strcpy(t->text, "'c'");
+      continue;
+    }
+
+    if (isalpha((unsigned char)*p) || *p == '_') {
+      const char *start = p;
+      while (isalnum((unsigned char)*p) || *p == '_') {
+        p++;
+      }
+      if (p - start >= CC_MAX_IDENT - 1) { // Room for the '_' prefix
+        cc_error(cc, line, "identifier too long");
+        break;
+      }
+      Token *t = cc_new_token(cc, TK_IDENT, line);
+      memcpy(t->text, start, p - start);
+      continue;
+    }
+
+    int length = 0;
+    for (int i = 0; cc_puncts[i]; i++) {
+      if (strncmp(p, cc_puncts[i], strlen(cc_puncts[i])) == 0) {
+        length = strlen(cc_puncts[i]);
+        break;
+      }
+    }
+    if (!length && strchr("+-*/%&|^~!<>=(){}[];,?:", *p)) {
+      length = 1;
+    }
+    if (!length) {
+      cc_error(cc, line, "unexpected character '%c'", *p);
+      break;
+    }
+    Token *t = cc_new_token(cc, TK_PUNCT, line);
+    memcpy(t->text, p, length);
+    p += length;
+  }
+
+  Token *eof = cc_new_token(cc, TK_EOF, line);
+  strcpy(eof->text, "end of file");
+  return !cc->error;
+}
+
+/* ============================================================================
+ * PARSER
+ * ============================================================================
+ * Recursive descent straight into typed AST nodes. Array indexing becomes
+ * *(a + i), pointer arithmetic is scaled here and constant subexpressions
+ * are folded, so code generation only sees 16-bit word operations.
+ */
+
+static Token *cc_peek(Compiler *cc) { return &cc->tokens[cc->pos]; }
+
+static int cc_line(Compiler *cc) { return cc_peek(cc)->line; }
+
+static bool cc_is(Compiler *cc, const char *text) {
+  Token *t = cc_peek(cc);
+  return t->kind != TK_NUM && t->kind != TK_EOF && strcmp(t->text, text) == 0;
+}
+
+static bool cc_accept(Compiler *cc, const char *text) {
+  if (cc_is(cc, text)) {
+    cc->pos++;
+    return true;
+  }
+  return false;
+}
+
+static void cc_expect(Compiler *cc, const char *text) {
+  if (!cc_accept(cc, text)) {
+    cc_error(cc, cc_line(cc), "expected '%s' before '%s'", text,
+             cc_peek(cc)->text);
+  }
+}
+
+static const char *cc_identifier(Compiler *cc) {
+  Token *t = cc_peek(cc);
+  if (t->kind != TK_IDENT) {
+    cc_error(cc, t->line, "expected an identifier before '%s'", t->text);
+    return "?";
+  }
+  cc->pos++;
+  return t->text;
+}
+
+static bool cc_is_typename(Compiler *cc) {
+  return cc_is(cc, "int") || cc_is(cc, "unsigned") || cc_is(cc, "signed") ||
+         cc_is(cc, "void") || cc_is(cc, "const") || cc_is(cc, "volatile");
+}
+
+static bool cc_is_keyword(const char *text) {
+  static const char *keywords[] = {
+      "int",   "unsigned", "signed", "void",     "const",  "volatile",
+      "if",    "else",     "while",  "do",       "for",    "return",
+      "break", "continue", "sizeof", NULL};
+  for (int i = 0; keywords[i]; i++) {
+    if (strcmp(text, keywords[i]) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static Node *cc_node(Compiler *cc, NodeKind kind, int line) {
+  Node *n = cc_alloc(cc, sizeof(Node));
+  n->kind = kind;
+  n->op = BIN_NONE;
+  n->type = &ty_int;
+  n->line = line;
+  return n;
+}
+
+static Node *cc_num(Compiler *cc, long value, Type *type, int line) {
+  Node *n = cc_node(cc, ND_NUM, line);
+  n->value = value & 0xFFFF;
+  n->type = type;
+  return n;
+}
+
+/**
+ * Innermost local of that name, else the file-scope symbol
+ */
+static Symbol *cc_find(Compiler *cc, const char *name) {
+  for (int i = cc->scope_count - 1; i >= 0; i--) {
+    if (strcmp(cc->scope[i]->name, name) == 0) {
+      return cc->scope[i];
+    }
+  }
+  for (int i = 0; i < cc->global_count; i++) {
+    if (strcmp(cc->globals[i]->name, name) == 0) {
+      return cc->globals[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Declare a local in the current block, or a global or function
+ */
+static Symbol *cc_declare(Compiler *cc, const char *name, SymbolKind kind,
+                          Type *type, int line) {
+  bool local = kind == SYM_LOCAL;
+  Symbol **table = local ? cc->scope : cc->globals;
+  int first = local ? cc->block_base : 0;
+  int count = local ? cc->scope_count : cc->global_count;
+
+  for (int i = first; i < count && name[0]; i++) {
+    if (strcmp(table[i]->name, name) == 0) {
+      cc_error(cc, line, "'%s' redeclared", name);
+      return table[i];
+    }
+  }
+  if (count >= CC_MAX_SCOPE || (local && cc->local_count >= CC_MAX_LOCALS)) {
+    cc_error(cc, line, "too many declarations");
+    return cc_alloc(cc, sizeof(Symbol));
+  }
+
+  Symbol *sym = cc_alloc(cc, sizeof(Symbol));
+  snprintf(sym->name, CC_MAX_IDENT, "%s", name);
+  sym->kind = kind;
+  sym->type = type;
+  sym->vreg = -1;
+  if (local) {
+    cc->scope[cc->scope_count++] = sym;
+    cc->locals[cc->local_count++] = sym;
+  } else {
+    cc->globals[cc->global_count++] = sym;
+  }
+  return sym;
+}
+
+/**
+ * int, unsigned [int], signed [int], void; const/volatile are ignored
+ */
+static Type *cc_declspec(Compiler *cc) {
+  bool seen = false;
+  bool is_unsigned = false;
+  for (;;) {
+    if (cc_accept(cc, "const") || cc_accept(cc, "volatile")) {
+      continue;
+    } else if (cc_accept(cc, "unsigned")) {
+      is_unsigned = true;
+    } else if (cc_accept(cc, "signed") || cc_accept(cc, "int")) {
+      // Plain int
+    } else if (!seen && cc_accept(cc, "void")) {
+      return &ty_void;
+    } else {
+      break;
+    }
+    seen = true;
+  }
+  if (!seen) {
+    cc_error(cc, cc_line(cc), "expected a type before '%s' (only int, "
+             "unsigned and void are supported)", cc_peek(cc)->text);
+  }
+  return is_unsigned ? &ty_uint : &ty_int;
+}
+
+static Type *cc_pointers(Compiler *cc, Type *type) {
+  while (cc_accept(cc, "*")) {
+    type = cc_pointer_to(cc, type);
+    while (cc_accept(cc, "const") || cc_accept(cc, "volatile")) {
+    }
+  }
+  return type;
+}
+
+static Node *cc_expr(Compiler *cc);
+static Node *cc_assign(Compiler *cc);
+static Node *cc_conditional(Compiler *cc);
+static Node *cc_cast(Compiler *cc);
+
+/**
+ * Evaluate a constant expression
+ */
+static long cc_const_value(Compiler *cc, Node *n) {
+  if (n->kind != ND_NUM) {
+    cc_error(cc, n->line, "expression is not a constant");
+    return 0;
+  }
+  return n->value;
+}
+
+/**
+ * Array dimensions after a declarator name; only the first may be empty
+ */
+static Type *cc_array_suffix(Compiler *cc, Type *type) {
+  if (!cc_accept(cc, "[")) {
+    return type;
+  }
+  int length = -1;
+  if (!cc_is(cc, "]")) {
+    length = (int)cc_const_value(cc, cc_conditional(cc));
+    if (length <= 0) {
+      cc_error(cc, cc_line(cc), "array size must be positive");
+    }
+  }
+  cc_expect(cc, "]");
+  Type *element = cc_array_suffix(cc, type);
+  if (element->kind == TY_ARRAY && element->length < 0) {
+    cc_error(cc, cc_line(cc), "only the first array dimension may be empty");
+  }
+  return cc_array_of(cc, element, length);
+}
+
+/**
+ * Arrays used as values become a pointer to their first element
+ */
+static Node *cc_decay(Compiler *cc, Node *n) {
+  if (n->type->kind != TY_ARRAY) {
+    return n;
+  }
+  Node *addr = cc_node(cc, ND_ADDR, n->line);
+  addr->lhs = n;
+  addr->type = cc_pointer_to(cc, n->type->base);
+  return addr;
+}
+
+/**
+ * Fold an operation on two constants (16-bit wrap-around)
+ */
+static Node *cc_fold(Compiler *cc, Node *n) {
+  if (n->lhs->kind != ND_NUM || n->rhs->kind != ND_NUM) {
+    return n;
+  }
+  uint16_t a = (uint16_t)n->lhs->value;
+  uint16_t b = (uint16_t)n->rhs->value;
+  int16_t sa = (int16_t)a;
+  int16_t sb = (int16_t)b;
+  bool u = n->is_unsigned;
+  long r;
+  switch (n->op) {
+  case BIN_ADD:
+    r = a + b;
+    break;
+  case BIN_SUB:
+    r = a - b;
+    break;
+  case BIN_MUL:
+    r = (long)a * b;
+    break;
+  case BIN_DIV:
+  case BIN_MOD:
+    if (b == 0) {
+      return n;
+    }
+    if (n->op == BIN_DIV) {
+      r = u ? a / b : sa / sb;
+    } else {
+      r = u ? a % b : sa % sb;
+    }
+    break;
+  case BIN_AND:
+    r = a & b;
+    break;
+  case BIN_OR:
+    r = a | b;
+    break;
+  case BIN_XOR:
+    r = a ^ b;
+    break;
+  case BIN_SHL:
+    r = a << (b & 15);
+    break;
+  case BIN_SHR:
+    r = u ? a >> (b & 15) : sa >> (b & 15);
+    break;
+  case BIN_EQ:
+    r = a == b;
+    break;
+  case BIN_NE:
+    r = a != b;
+    break;
+  case BIN_LT:
+    r = u ? a < b : sa < sb;
+    break;
+  case BIN_LE:
+    r = u ? a <= b : sa <= sb;
+    break;
+  case BIN_GT:
+    r = u ? a > b : sa > sb;
+    break;
+  default:
+    r = u ? a >= b : sa >= sb;
+    break;
+  }
+  return cc_num(cc, r, n->type, n->line);
+}
+
+static Node *cc_binary(Compiler *cc, BinOp op, Node *lhs, Node *rhs,
+                       int line) {
+  lhs = cc_decay(cc, lhs);
+  rhs = cc_decay(cc, rhs);
+  if (lhs->type->kind == TY_VOID || rhs->type->kind == TY_VOID) {
+    cc_error(cc, line, "void value used in an expression");
+    return lhs;
+  }
+  bool lp = lhs->type->kind == TY_PTR;
+  bool rp = rhs->type->kind == TY_PTR;
+  bool compare = op >= BIN_EQ;
+
+  // Pointer arithmetic counts in elements
+  if (op == BIN_ADD && !lp && rp) {
+    Node *swap = lhs;
+    lhs = rhs;
+    rhs = swap;
+    lp = true;
+    rp = false;
+  }
+  if ((op == BIN_ADD || op == BIN_SUB) && lp && !rp) {
+    Node *scale = cc_num(cc, cc_size(lhs->type->base), &ty_int, line);
+    rhs = cc_binary(cc, BIN_MUL, rhs, scale, line);
+  } else if (op == BIN_SUB && lp && rp) {
+    Node *diff = cc_node(cc, ND_BINARY, line);
+    diff->op = BIN_SUB;
+    diff->lhs = lhs;
+    diff->rhs = rhs;
+    Node *size = cc_num(cc, cc_size(lhs->type->base), &ty_int, line);
+    return cc_binary(cc, BIN_DIV, diff, size, line);
+  } else if ((lp || rp) && !compare) {
+    cc_error(cc, line, "invalid operands to a pointer operation");
+    return lhs;
+  }
+
+  Node *n = cc_node(cc, ND_BINARY, line);
+  n->op = op;
+  n->lhs = lhs;
+  n->rhs = rhs;
+  if (op == BIN_SHL || op == BIN_SHR) {
+    n->is_unsigned = lhs->type->kind == TY_UINT;
+    n->type = lhs->type;
+  } else {
+    n->is_unsigned = lhs->type->kind != TY_INT || rhs->type->kind != TY_INT;
+    n->type = compare ? &ty_int
+              : lp    ? lhs->type
+              : n->is_unsigned ? &ty_uint
+                               : &ty_int;
+  }
+  return cc_fold(cc, n);
+}
+
+static bool cc_is_lvalue(const Node *n) {
+  return (n->kind == ND_VAR || n->kind == ND_DEREF) &&
+         n->type->kind != TY_ARRAY;
+}
+
+/**
+ * Function call; the callee must be declared first
+ */
+static Node *cc_call(Compiler *cc, const char *name, int line) {
+  Symbol *fn = cc_find(cc, name);
+  if (!fn || fn->kind != SYM_FUNC) {
+    cc_error(cc, line, "call to undeclared function '%s'", name);
+  }
+
+  Node *call = cc_node(cc, ND_CALL, line);
+  call->sym = fn;
+  call->type = fn ? fn->type : &ty_int;
+  Node head = {0};
+  Node *tail = &head;
+  int count = 0;
+  while (!cc_accept(cc, ")") && !cc->error) {
+    if (count > 0) {
+      cc_expect(cc, ",");
+    }
+    tail = tail->next = cc_decay(cc, cc_assign(cc));
+    if (tail->type->kind == TY_VOID) {
+      cc_error(cc, tail->line, "void value used as an argument");
+    }
+    count++;
+  }
+  call->lhs = head.next;
+  call->value = count;
+  if (count > CC_MAX_PARAMS) {
+    cc_error(cc, line, "too many arguments (at most %d)", CC_MAX_PARAMS);
+  } else if (fn && fn->param_count >= 0 && count != fn->param_count) {
+    cc_error(cc, line, "'%s' takes %d arguments, %d given", name,
+             fn->param_count, count);
+  }
+  return call;
+}
+
+static Node *cc_primary(Compiler *cc) {
+  Token *t = cc_peek(cc);
+  if (cc_accept(cc, "(")) {
+    Node *n = cc_expr(cc);
+    cc_expect(cc, ")");
+    return n;
+  }
+  if (t->kind == TK_NUM) {
+    cc->pos++;
+    return cc_num(cc, t->value, t->is_unsigned ? &ty_uint : &ty_int, t->line);
+  }
+  if (cc_accept(cc, "sizeof")) {
+    Type *type;
+    int start = cc->pos;
+    if (cc_accept(cc, "(") && cc_is_typename(cc)) {
+      type = cc_array_suffix(cc, cc_pointers(cc, cc_declspec(cc)));
+      cc_expect(cc, ")");
+    } else {
+      cc->pos = start;
+      type = cc_cast(cc)->type;
+    }
+    return cc_num(cc, cc_size(type), &ty_uint, t->line);
+  }
+  if (t->kind == TK_IDENT) {
+    cc->pos++;
+    if (cc_accept(cc, "(")) {
+      return cc_call(cc, t->text, t->line);
+    }
+    Symbol *sym = cc_find(cc, t->text);
+    if (!sym || sym->kind == SYM_FUNC) {
+      cc_error(cc, t->line, "'%s' is not a variable", t->text);
+      return cc_num(cc, 0, &ty_int, t->line);
+    }
+    Node *n = cc_node(cc, ND_VAR, t->line);
+    n->sym = sym;
+    n->type = sym->type;
+    return n;
+  }
+  cc_error(cc, t->line, "expected an expression before '%s'", t->text);
+  return cc_num(cc, 0, &ty_int, t->line);
+}
+
+static Node *cc_deref(Compiler *cc, Node *ptr, int line) {
+  ptr = cc_decay(cc, ptr);
+  if (ptr->type->kind != TY_PTR || ptr->type->base->kind == TY_VOID) {
+    cc_error(cc, line, "cannot dereference a non-pointer");
+    return ptr;
+  }
+  Node *n = cc_node(cc, ND_DEREF, line);
+  n->lhs = ptr;
+  n->type = ptr->type->base;
+  return n;
+}
+
+static Node *cc_incdec(Compiler *cc, Node *target, int delta, bool post,
+                       int line) {
+  if (!cc_is_lvalue(target)) {
+    cc_error(cc, line, "operand of ++/-- is not assignable");
+  }
+  Node *n = cc_node(cc, ND_INCDEC, line);
+  n->lhs = target;
+  n->type = target->type;
+  n->post = post;
+  n->value = target->type->kind == TY_PTR
+                 ? delta * cc_size(target->type->base)
+                 : delta;
+  return n;
+}
+
+static Node *cc_postfix(Compiler *cc) {
+  Node *n = cc_primary(cc);
+  for (;;) {
+    int line = cc_line(cc);
+    if (cc_accept(cc, "[")) {
+      Node *index = cc_expr(cc);
+      cc_expect(cc, "]");
+      n = cc_deref(cc, cc_binary(cc, BIN_ADD, n, index, line), line);
+    } else if (cc_accept(cc, "++")) {
+      n = cc_incdec(cc, n, 1, true, line);
+    } else if (cc_accept(cc, "--")) {
+      n = cc_incdec(cc, n, -1, true, line);
+    } else {
+      return n;
+    }
+  }
+}
+
+static Node *cc_unary(Compiler *cc) {
+  int line = cc_line(cc);
+  if (cc_accept(cc, "+")) {
+    return cc_cast(cc);
+  }
+  if (cc_accept(cc, "-")) {
+    Node *operand = cc_decay(cc, cc_cast(cc));
+    if (operand->kind == ND_NUM) {
+      return cc_num(cc, -operand->value, operand->type, line);
+    }
+    Node *n = cc_node(cc, ND_NEG, line);
+    n->lhs = operand;
+    n->type = operand->type;
+    return n;
+  }
+  if (cc_accept(cc, "~") || cc_accept(cc, "!")) {
+    bool logical = cc->tokens[cc->pos - 1].text[0] == '!';
+    Node *n = cc_node(cc, logical ? ND_NOT : ND_BITNOT, line);
+    n->lhs = cc_decay(cc, cc_cast(cc));
+    n->type = logical ? &ty_int : n->lhs->type;
+    if (n->lhs->kind == ND_NUM) {
+      long v = n->lhs->value;
+      return cc_num(cc, logical ? !v : ~v, n->type, line);
+    }
+    return n;
+  }
+  if (cc_accept(cc, "&")) {
+    Node *operand = cc_cast(cc);
+    if (operand->kind != ND_VAR && operand->kind != ND_DEREF) {
+      cc_error(cc, line, "cannot take the address of this expression");
+    }
+    if (operand->kind == ND_VAR) {
+      operand->sym->addressed = true;
+    }
+    Node *n = cc_node(cc, ND_ADDR, line);
+    n->lhs = operand;
+    n->type = cc_pointer_to(cc, operand->type);
+    return n;
+  }
+  if (cc_accept(cc, "*")) {
+    return cc_deref(cc, cc_cast(cc), line);
+  }
+  if (cc_accept(cc, "++")) {
+    return cc_incdec(cc, cc_unary(cc), 1, false, line);
+  }
+  if (cc_accept(cc, "--")) {
+    return cc_incdec(cc, cc_unary(cc), -1, false, line);
+  }
+  return cc_postfix(cc);
+}
+
+static Node *cc_cast(Compiler *cc) {
+  int line = cc_line(cc);
+  if (cc_accept(cc, "(")) {
+    if (cc_is_typename(cc)) {
+      Type *type = cc_pointers(cc, cc_declspec(cc));
+      cc_expect(cc, ")");
+      Node *operand = cc_decay(cc, cc_cast(cc));
+      if (operand->kind == ND_NUM && type->kind != TY_VOID) {
+        return cc_num(cc, operand->value, type, line);
+      }
+      Node *n = cc_node(cc, ND_CAST, line);
+      n->lhs = operand;
+      n->type = type;
+      return n;
+    }
+    cc->pos--;
+  }
+  return cc_unary(cc);
+}
+
+// Binary operators by precedence level, loosest first
+typedef struct {
+  const char *text;
+  BinOp op;
+} OpToken;
+
+static const OpToken cc_levels[][5] = {
+    {{"|", BIN_OR}},
+    {{"^", BIN_XOR}},
+    {{"&", BIN_AND}},
+    {{"==", BIN_EQ}, {"!=", BIN_NE}},
+    {{"<", BIN_LT}, {"<=", BIN_LE}, {">", BIN_GT}, {">=", BIN_GE}},
+    {{"<<", BIN_SHL}, {">>", BIN_SHR}},
+    {{"+", BIN_ADD}, {"-", BIN_SUB}},
+    {{"*", BIN_MUL}, {"/", BIN_DIV}, {"%", BIN_MOD}},
+};
+#define CC_LEVELS (int)(sizeof(cc_levels) / sizeof(cc_levels[0]))
+
+static Node *cc_binary_level(Compiler *cc, int level) {
+  if (level == CC_LEVELS) {
+    return cc_cast(cc);
+  }
+  Node *n = cc_binary_level(cc, level + 1);
+  for (;;) {
+    const OpToken *match = NULL;
+    for (int i = 0; i < 5 && cc_levels[level][i].text; i++) {
+      if (cc_is(cc, cc_levels[level][i].text)) {
+        match = &cc_levels[level][i];
+        break;
+      }
+    }
+    if (!match || cc->error) {
+      return n;
+    }
+    int line = cc_line(cc);
+    cc->pos++;
+    n = cc_binary(cc, match->op, n, cc_binary_level(cc, level + 1), line);
+  }
+}
+
+static Node *cc_logical(Compiler *cc, bool is_or) {
+  Node *n = is_or ? cc_logical(cc, false) : cc_binary_level(cc, 0);
+  while (cc_is(cc, is_or ? "||" : "&&") && !cc->error) {
+    Node *logic = cc_node(cc, is_or ? ND_LOGOR : ND_LOGAND, cc_line(cc));
+    cc->pos++;
+    logic->lhs = cc_decay(cc, n);
+    logic->rhs =
+        cc_decay(cc, is_or ? cc_logical(cc, false) : cc_binary_level(cc, 0));
+    n = logic;
+  }
+  return n;
+}
+
+static Node *cc_conditional(Compiler *cc) {
+  Node *cond = cc_logical(cc, true);
+  int line = cc_line(cc);
+  if (!cc_accept(cc, "?")) {
+    return cond;
+  }
+  Node *n = cc_node(cc, ND_COND, line);
+  n->cond = cc_decay(cc, cond);
+  n->then = cc_decay(cc, cc_expr(cc));
+  cc_expect(cc, ":");
+  n->els = cc_decay(cc, cc_conditional(cc));
+  n->type = n->then->type;
+  return n;
+}
+
+static const OpToken cc_assign_ops[] = {
+    {"=", BIN_NONE}, {"+=", BIN_ADD}, {"-=", BIN_SUB},  {"*=", BIN_MUL},
+    {"/=", BIN_DIV}, {"%=", BIN_MOD}, {"&=", BIN_AND},  {"|=", BIN_OR},
+    {"^=", BIN_XOR}, {"<<=", BIN_SHL}, {">>=", BIN_SHR}, {NULL, BIN_NONE}};
+
+static Node *cc_assign(Compiler *cc) {
+  Node *target = cc_conditional(cc);
+  for (int i = 0; cc_assign_ops[i].text; i++) {
+    if (!cc_is(cc, cc_assign_ops[i].text)) {
+      continue;
+    }
+    int line = cc_line(cc);
+    cc->pos++;
+    if (!cc_is_lvalue(target)) {
+      cc_error(cc, line, "left side of assignment is not assignable");
+    }
+    Node *n = cc_node(cc, ND_ASSIGN, line);
+    n->op = cc_assign_ops[i].op;
+    n->lhs = target;
+    n->rhs = cc_decay(cc, cc_assign(cc));
+    n->type = target->type;
+    if (n->rhs->type->kind == TY_VOID) {
+      cc_error(cc, line, "void value used in an expression");
+    }
+    if (n->op != BIN_NONE) {
+      // Type the compound operation as target op value would be
+      Node *as_binary = cc_binary(cc, n->op, target, n->rhs, line);
+      if (as_binary->kind == ND_BINARY) {
+        n->rhs = as_binary->rhs;
+        n->is_unsigned = as_binary->is_unsigned;
+      }
+    }
+    return n;
+  }
+  return target;
+}
+
+static Node *cc_expr(Compiler *cc) { return cc_assign(cc); }
+
+static Node *cc_statement(Compiler *cc);
+
+/**
+ * Local declaration; initialisers become assignment statements
+ */
+static Node *cc_local_declaration(Compiler *cc) {
+  Type *base = cc_declspec(cc);
+  Node head = {0};
+  Node *tail = &head;
+
+  do {
+    int line = cc_line(cc);
+    Type *type = cc_pointers(cc, base);
+    const char *name = cc_identifier(cc);
+    type = cc_array_suffix(cc, type);
+    if (type->kind == TY_VOID) {
+      cc_error(cc, line, "variable '%s' declared void", name);
+    }
+    Symbol *sym = cc_declare(cc, name, SYM_LOCAL, type, line);
+    if (!cc_accept(cc, "=")) {
+      if (type->kind == TY_ARRAY && type->length < 0) {
+        cc_error(cc, line, "array '%s' needs a size", name);
+      }
+      continue;
+    }
+
+    if (type->kind != TY_ARRAY) {
+      Node *var = cc_node(cc, ND_VAR, line);
+      var->sym = sym;
+      var->type = type;
+      Node *assign = cc_node(cc, ND_ASSIGN, line);
+      assign->lhs = var;
+      assign->rhs = cc_decay(cc, cc_assign(cc));
+      assign->type = type;
+      tail = tail->next = cc_node(cc, ND_EXPR, line);
+      tail->lhs = assign;
+      continue;
+    }
+
+    // Array initialiser: one assignment per element, the rest zeroed
+    if (type->base->kind == TY_ARRAY) {
+      cc_error(cc, line, "initialisers for nested arrays are not supported");
+    }
+    cc_expect(cc, "{");
+    Node values = {0};
+    Node *last = &values;
+    int count = 0;
+    while (!cc_accept(cc, "}") && !cc->error) {
+      if (count > 0) {
+        cc_expect(cc, ",");
+        if (cc_accept(cc, "}")) {
+          break;
+        }
+      }
+      last = last->next = cc_decay(cc, cc_assign(cc));
+      count++;
+    }
+    if (type->length < 0) {
+      type->length = count;
+    } else if (count > type->length) {
+      cc_error(cc, line, "too many initialisers for '%s'", name);
+    }
+    Node *value = values.next;
+    for (int i = 0; i < type->length; i++) {
+      Node *var = cc_node(cc, ND_VAR, line);
+      var->sym = sym;
+      var->type = type;
+      Node *index = cc_num(cc, i, &ty_int, line);
+      Node *assign = cc_node(cc, ND_ASSIGN, line);
+      Node *element = cc_binary(cc, BIN_ADD, var, index, line);
+      assign->lhs = cc_deref(cc, element, line);
+      assign->rhs = value ? value : cc_num(cc, 0, &ty_int, line);
+      assign->type = type->base;
+      value = value ? value->next : NULL;
+      tail = tail->next = cc_node(cc, ND_EXPR, line);
+      tail->lhs = assign;
+    }
+  } while (cc_accept(cc, ",") && !cc->error);
+  cc_expect(cc, ";");
+
+  Node *block = cc_node(cc, ND_BLOCK, cc_line(cc));
+  block->then = head.next;
+  return block;
+}
+
+static Node *cc_compound(Compiler *cc) {
+  Node *block = cc_node(cc, ND_BLOCK, cc_line(cc));
+  int saved_base = cc->block_base;
+  int saved_count = cc->scope_count;
+  cc->block_base = cc->scope_count;
+
+  Node head = {0};
+  Node *tail = &head;
+  while (!cc_accept(cc, "}") && !cc->error) {
+    if (cc_peek(cc)->kind == TK_EOF) {
+      cc_error(cc, cc_line(cc), "expected '}' at end of file");
+      break;
+    }
+    Token *t = cc_peek(cc);
+    if (t->kind == TK_IDENT && t[1].kind == TK_IDENT &&
+        !cc_is_keyword(t->text)) {
+      cc_error(cc, t->line, "unknown type name '%s'", t->text);
+      break;
+    }
+    tail = tail->next =
+        cc_is_typename(cc) ? cc_local_declaration(cc) : cc_statement(cc);
+  }
+  block->then = head.next;
+
+  cc->block_base = saved_base;
+  cc->scope_count = saved_count;
+  return block;
+}
+
+static Node *cc_condition(Compiler *cc) {
+  cc_expect(cc, "(");
+  Node *cond = cc_decay(cc, cc_expr(cc));
+  cc_expect(cc, ")");
+  if (cond->type->kind == TY_VOID) {
+    cc_error(cc, cond->line, "void value used as a condition");
+  }
+  return cond;
+}
+
+static Node *cc_statement(Compiler *cc) {
+  int line = cc_line(cc);
+  Node *n;
+
+  if (cc_accept(cc, "{")) {
+    return cc_compound(cc);
+  }
+  if (cc_accept(cc, ";")) {
+    return cc_node(cc, ND_BLOCK, line);
+  }
+  if (cc_accept(cc, "if")) {
+    n = cc_node(cc, ND_IF, line);
+    n->cond = cc_condition(cc);
+    n->then = cc_statement(cc);
+    if (cc_accept(cc, "else")) {
+      n->els = cc_statement(cc);
+    }
+    return n;
+  }
+  if (cc_accept(cc, "while")) {
+    n = cc_node(cc, ND_WHILE, line);
+    n->cond = cc_condition(cc);
+    n->then = cc_statement(cc);
+    return n;
+  }
+  if (cc_accept(cc, "do")) {
+    n = cc_node(cc, ND_DO, line);
+    n->then = cc_statement(cc);
+    cc_expect(cc, "while");
+    n->cond = cc_condition(cc);
+    cc_expect(cc, ";");
+    return n;
+  }
+  if (cc_accept(cc, "for")) {
+    // The loop variable of for (int i = ...) is scoped to the loop
+    int saved_base = cc->block_base;
+    int saved_count = cc->scope_count;
+    cc->block_base = cc->scope_count;
+
+    n = cc_node(cc, ND_FOR, line);
+    cc_expect(cc, "(");
+    if (cc_is_typename(cc)) {
+      n->init = cc_local_declaration(cc);
+    } else {
+      if (!cc_is(cc, ";")) {
+        n->init = cc_node(cc, ND_EXPR, line);
+        n->init->lhs = cc_expr(cc);
+      }
+      cc_expect(cc, ";");
+    }
+    if (!cc_is(cc, ";")) {
+      n->cond = cc_decay(cc, cc_expr(cc));
+    }
+    cc_expect(cc, ";");
+    if (!cc_is(cc, ")")) {
+      n->inc = cc_expr(cc);
+    }
+    cc_expect(cc, ")");
+    n->then = cc_statement(cc);
+
+    cc->block_base = saved_base;
+    cc->scope_count = saved_count;
+    return n;
+  }
+  if (cc_accept(cc, "return")) {
+    n = cc_node(cc, ND_RETURN, line);
+    if (!cc_is(cc, ";")) {
+      n->lhs = cc_decay(cc, cc_expr(cc));
+    }
+    if (n->lhs && n->lhs->type->kind == TY_VOID) {
+      cc_error(cc, line, "void value returned");
+    } else if (n->lhs && cc->return_type->kind == TY_VOID) {
+      cc_error(cc, line, "void function returns a value");
+    } else if (!n->lhs && cc->return_type->kind != TY_VOID) {
+      cc_error(cc, line, "return without a value");
+    }
+    cc_expect(cc, ";");
+    return n;
+  }
+  if (cc_accept(cc, "break") || cc_accept(cc, "continue")) {
+    bool is_break = cc->tokens[cc->pos - 1].text[0] == 'b';
+    n = cc_node(cc, is_break ? ND_BREAK : ND_CONTINUE, line);
+    cc_expect(cc, ";");
+    return n;
+  }
+
+  n = cc_node(cc, ND_EXPR, line);
+  n->lhs = cc_expr(cc);
+  cc_expect(cc, ";");
+  return n;
+}
+
+/**
+ * Parameter list after "(": names are optional in prototypes
+ */
+static void cc_parameters(Compiler *cc, Symbol *params[], Type *types[],
+                          int *count) {
+  *count = 0;
+  if (cc_accept(cc, ")")) {
+    *count = -1;
+    return;
+  }
+  if (cc_is(cc, "void") && cc->tokens[cc->pos + 1].text[0] == ')') {
+    cc->pos += 2;
+    return;
+  }
+  do {
+    int line = cc_line(cc);
+    Type *type = cc_pointers(cc, cc_declspec(cc));
+    const char *name = NULL;
+    if (cc_peek(cc)->kind == TK_IDENT) {
+      name = cc_identifier(cc);
+    }
+    type = cc_array_suffix(cc, type);
+    if (type->kind == TY_ARRAY) {
+      type = cc_pointer_to(cc, type->base);
+    }
+    if (type->kind == TY_VOID) {
+      cc_error(cc, line, "parameter declared void");
+    }
+    if (*count >= CC_MAX_PARAMS) {
+      cc_error(cc, line, "too many parameters (at most %d)", CC_MAX_PARAMS);
+      return;
+    }
+    types[*count] = type;
+    params[*count] = cc_declare(cc, name ? name : "", SYM_LOCAL, type, line);
+    params[*count]->param = true;
+    params[*count]->index = *count;
+    if (!name) {
+      params[*count]->name[0] = '\0';
+    }
+    (*count)++;
+  } while (cc_accept(cc, ",") && !cc->error);
+  cc_expect(cc, ")");
+}
+
+/**
+ * Function prototype or definition after its name
+ */
+static void cc_function(Compiler *cc, Type *return_type, const char *name,
+                        int line) {
+  Symbol *params[CC_MAX_PARAMS];
+  Type *types[CC_MAX_PARAMS];
+  int count;
+
+  // Parameters form the outermost block of the body
+  cc->local_count = 0;
+  cc->scope_count = 0;
+  cc->block_base = 0;
+  cc_parameters(cc, params, types, &count);
+
+  Symbol *fn = cc_find(cc, name);
+  if (fn && fn->kind != SYM_FUNC) {
+    cc_error(cc, line, "'%s' redeclared as a function", name);
+    return;
+  }
+  if (!fn) {
+    fn = cc_declare(cc, name, SYM_FUNC, return_type, line);
+    fn->param_count = count;
+    memcpy(fn->params, types, sizeof(types[0]) * (count > 0 ? count : 0));
+  } else if (fn->param_count < 0) {
+    fn->param_count = count;
+  } else if (count >= 0 && count != fn->param_count) {
+    cc_error(cc, line, "conflicting declarations of '%s'", name);
+  }
+
+  if (!cc_accept(cc, "{")) {
+    cc_expect(cc, ";");
+    cc->scope_count = 0;
+    return;
+  }
+  if (fn->defined) {
+    cc_error(cc, line, "function '%s' redefined", name);
+  }
+  fn->defined = true;
+  if (fn->param_count < 0) {
+    fn->param_count = 0;
+  }
+
+  cc->return_type = return_type;
+  Node *body = cc_compound(cc);
+  cc->scope_count = 0;
+
+  Function *f = cc_alloc(cc, sizeof(Function));
+  f->sym = fn;
+  f->body = body;
+  f->local_count = cc->local_count;
+  f->locals = cc_alloc(cc, sizeof(Symbol *) * (cc->local_count + 1));
+  memcpy(f->locals, cc->locals, sizeof(Symbol *) * cc->local_count);
+  if (cc->last_function) {
+    cc->last_function->next = f;
+  } else {
+    cc->functions = f;
+  }
+  cc->last_function = f;
+}
+
+/**
+ * Global variable initialiser: a constant, or a list for an array
+ */
+static void cc_global_initialiser(Compiler *cc, Symbol *sym, int line) {
+  Node head = {0};
+  Node *tail = &head;
+  int count = 0;
+
+  if (sym->type->kind != TY_ARRAY) {
+    head.next = cc_conditional(cc);
+    cc_const_value(cc, head.next);
+  } else {
+    if (sym->type->base->kind == TY_ARRAY) {
+      cc_error(cc, line, "initialisers for nested arrays are not supported");
+    }
+    cc_expect(cc, "{");
+    while (!cc_accept(cc, "}") && !cc->error) {
+      if (count > 0) {
+        cc_expect(cc, ",");
+        if (cc_accept(cc, "}")) {
+          break;
+        }
+      }
+      tail = tail->next = cc_conditional(cc);
+      cc_const_value(cc, tail);
+      count++;
+    }
+    if (sym->type->length < 0) {
+      sym->type->length = count;
+    } else if (count > sym->type->length) {
+      cc_error(cc, line, "too many initialisers for '%s'", sym->name);
+    }
+  }
+  sym->init = head.next;
+}
+
+static void cc_toplevel(Compiler *cc) {
+  Type *base = cc_declspec(cc);
+  bool first = true;
+  do {
+    int line = cc_line(cc);
+    Type *type = cc_pointers(cc, base);
+    const char *name = cc_identifier(cc);
+    if (cc_accept(cc, "(")) {
+      if (!first) {
+        cc_error(cc, line, "function declared in a variable list");
+      }
+      cc_function(cc, type, name, line);
+      return;
+    }
+    first = false;
+
+    type = cc_array_suffix(cc, type);
+    if (type->kind == TY_VOID) {
+      cc_error(cc, line, "variable '%s' declared void", name);
+    }
+    Symbol *sym = cc_declare(cc, name, SYM_GLOBAL, type, line);
+    if (cc_accept(cc, "=")) {
+      cc_global_initialiser(cc, sym, line);
+    } else if (type->kind == TY_ARRAY && type->length < 0) {
+      cc_error(cc, line, "array '%s' needs a size", name);
+    }
+  } while (cc_accept(cc, ",") && !cc->error);
+  cc_expect(cc, ";");
+}
+
+/* ============================================================================
+ * INTERMEDIATE CODE
+ * ============================================================================
+ * Three-address code over virtual registers. Register variables own a
+ * virtual register for the whole function; every other value gets a fresh
+ * one, written once.
+ */
+
+typedef enum {
+  IR_LI,      // dst = imm
+  IR_LA,      // dst = address of global name
+  IR_FRAME,   // dst = R7 + imm
+  IR_MOV,     // dst = a
+  IR_BIN,     // dst = a <name> b
+  IR_ADDI,    // dst = a + imm
+  IR_SHI,     // dst = a shifted by imm (name is SHLI, SHRI or SARI)
+  IR_LOAD,    // dst = [a + imm]
+  IR_STORE,   // [b + imm] = a
+  IR_LOADF,   // dst = [R7 + imm]
+  IR_STOREF,  // [R7 + imm] = a
+  IR_LABEL,   // imm is the label number
+  IR_JMP,     // goto imm
+  IR_BZ,      // if a == 0 goto imm
+  IR_BNZ,     // if a != 0 goto imm
+  IR_BNEG,    // if a < 0 goto imm
+  IR_BNONNEG, // if a >= 0 goto imm
+  IR_BEQ,     // if a == b goto label
+  IR_BNE,     // if a != b goto label
+  IR_ARG,     // argument imm of count = a
+  IR_CALL,    // dst = name(count arguments)
+  IR_RET      // return a (-1 for none)
+} IrOp;
+
+typedef struct {
+  IrOp op;
+  int dst, a, b;
+  long imm;
+  int label;        // IR_BEQ, IR_BNE
+  int count;        // IR_ARG, IR_CALL
+  const char *name; // IR_BIN or IR_SHI mnemonic, IR_LA global
+  Symbol *target;   // IR_CALL function
+} Ir;
+
+typedef struct {
+  int start, end; // First and last instruction using the register
+  int reg;        // Physical register, -1 when spilled
+  int slot;       // Frame offset of the spill slot
+  bool named;     // Register variable, live across loop back edges
+  bool prefer_r0; // Call result or return value
+  bool param;     // Parameter: spills back to its argument slot
+  int home;       // Frame offset of that slot
+} Interval;
+
+typedef struct {
+  int start, end;
+} LoopRange;
+
+typedef enum { LOC_REG, LOC_FRAME, LOC_PTR } LocKind;
+
+// Where an lvalue lives
+typedef struct {
+  LocKind kind;
+  int vreg;   // LOC_REG: the variable, LOC_PTR: the base address
+  int offset; // Byte offset from R7 or from the base address
+} Loc;
+
+typedef struct {
+  Compiler *cc;
+  Function *fn;
+  Ir *code;
+  int count;
+  int cap;
+  int vregs;
+  int first_temp; // Virtual registers below this belong to variables
+  Interval *intervals;
+  LoopRange *loops;
+  int loop_count;
+  int loop_cap;
+  int break_label;
+  int continue_label;
+  int frame;      // Bytes of locals and spill slots below R7
+  int spills;
+  int flags_vreg; // Virtual register the Z/N flags currently describe
+} Gen;
+
+static int ir_new_vreg(Gen *g) { return g->vregs++; }
+
+static int ir_new_label(Gen *g) { return g->cc->label_count++; }
+
+static Ir *ir_emit(Gen *g, IrOp op, int dst, int a, int b, long imm) {
+  if (g->count == g->cap) {
+    g->cap = g->cap ? 2 * g->cap : 256;
+    Ir *code = realloc(g->code, g->cap * sizeof(Ir));
+    if (!code) {
+      fprintf(stderr, "Error: Out of memory in compiler\n");
+      exit(1);
+    }
+    g->code = code;
+  }
+  Ir *ir = &g->code[g->count++];
+  memset(ir, 0, sizeof(Ir));
+  ir->op = op;
+  ir->dst = dst;
+  ir->a = a;
+  ir->b = b;
+  ir->imm = imm;
+  return ir;
+}
+
+static int ir_value(Gen *g, IrOp op, int a, int b, long imm) {
+  int dst = ir_new_vreg(g);
+  ir_emit(g, op, dst, a, b, imm);
+  return dst;
+}
+
+static void ir_label(Gen *g, int label) {
+  ir_emit(g, IR_LABEL, -1, -1, -1, label);
+}
+
+static void ir_branch(Gen *g, IrOp op, int a, int label) {
+  ir_emit(g, op, -1, a, -1, label);
+}
+
+static int ir_li(Gen *g, long value) {
+  return ir_value(g, IR_LI, -1, -1, (int16_t)value);
+}
+
+static int ir_bin(Gen *g, const char *mnemonic, int a, int b) {
+  int dst = ir_value(g, IR_BIN, a, b, 0);
+  g->code[g->count - 1].name = mnemonic;
+  return dst;
+}
+
+static int ir_shift(Gen *g, const char *mnemonic, int a, int amount) {
+  int dst = ir_value(g, IR_SHI, a, -1, amount);
+  g->code[g->count - 1].name = mnemonic;
+  return dst;
+}
+
+/**
+ * a + constant, as ADDI when the constant fits its 9-bit immediate
+ */
+static int ir_add_const(Gen *g, int a, int value) {
+  value = (int16_t)value;
+  if (value == 0) {
+    return a;
+  }
+  if (value >= -256 && value <= 255) {
+    return ir_value(g, IR_ADDI, a, -1, value);
+  }
+  return ir_bin(g, "ADD", a, ir_li(g, value));
+}
+
+static bool ir_power_of_two(long value, int *shift) {
+  for (int i = 0; i < 16; i++) {
+    if (value == (1L << i)) {
+      *shift = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+/* ============================================================================
+ * EXPRESSIONS
+ * ============================================================================
+ */
+
+static int gen_expr(Gen *g, Node *n);
+static void gen_branch(Gen *g, Node *n, int label, bool jump_if);
+
+static bool gen_in_memory(const Symbol *sym) {
+  return sym->kind == SYM_GLOBAL || sym->addressed ||
+         sym->type->kind == TY_ARRAY;
+}
+
+static bool gen_is_const(const Node *n, long value) {
+  return n->kind == ND_NUM && (int16_t)n->value == value;
+}
+
+/**
+ * Location of the object a pointer expression points at; constant offsets
+ * are folded into the location instead of being added at run time
+ */
+static Loc gen_pointee(Gen *g, Node *ptr) {
+  if (ptr->kind == ND_BINARY && (ptr->op == BIN_ADD || ptr->op == BIN_SUB) &&
+      ptr->rhs->kind == ND_NUM && ptr->lhs->type->kind == TY_PTR) {
+    int delta = (int16_t)ptr->rhs->value;
+    Loc loc = gen_pointee(g, ptr->lhs);
+    loc.offset += ptr->op == BIN_ADD ? delta : -delta;
+    return loc;
+  }
+  if (ptr->kind == ND_ADDR && ptr->lhs->kind == ND_VAR &&
+      ptr->lhs->sym->kind == SYM_LOCAL) {
+    return (Loc){LOC_FRAME, -1, ptr->lhs->sym->offset};
+  }
+  if (ptr->kind == ND_ADDR && ptr->lhs->kind == ND_DEREF) {
+    return gen_pointee(g, ptr->lhs->lhs);
+  }
+  return (Loc){LOC_PTR, gen_expr(g, ptr), 0};
+}
+
+/**
+ * Location of an lvalue, with pointer offsets in LOAD/STORE range
+ */
+static Loc gen_lvalue(Gen *g, Node *n) {
+  Loc loc;
+  if (n->kind == ND_VAR && !gen_in_memory(n->sym)) {
+    loc = (Loc){LOC_REG, n->sym->vreg, 0};
+  } else if (n->kind == ND_VAR && n->sym->kind == SYM_LOCAL) {
+    loc = (Loc){LOC_FRAME, -1, n->sym->offset};
+  } else if (n->kind == ND_VAR) {
+    int addr = ir_value(g, IR_LA, -1, -1, 0);
+    g->code[g->count - 1].name = n->sym->name;
+    loc = (Loc){LOC_PTR, addr, 0};
+  } else {
+    loc = gen_pointee(g, n->lhs);
+  }
+
+  loc.offset = (int16_t)loc.offset;
+  if (loc.kind == LOC_PTR && (loc.offset < -32 || loc.offset > 31)) {
+    loc.vreg = ir_add_const(g, loc.vreg, loc.offset);
+    loc.offset = 0;
+  }
+  return loc;
+}
+
+static int gen_load(Gen *g, Loc loc) {
+  switch (loc.kind) {
+  case LOC_REG:
+    return loc.vreg;
+  case LOC_FRAME:
+    return ir_value(g, IR_LOADF, -1, -1, loc.offset);
+  default:
+    return ir_value(g, IR_LOAD, loc.vreg, -1, loc.offset);
+  }
+}
+
+/**
+ * Store a value; a register variable takes over the instruction that just
+ * computed a fresh temporary instead of copying it
+ */
+static void gen_store(Gen *g, Loc loc, int value) {
+  switch (loc.kind) {
+  case LOC_REG: {
+    Ir *last = g->count ? &g->code[g->count - 1] : NULL;
+    if (last && last->dst == value && value >= g->first_temp &&
+        last->op != IR_CALL) {
+      last->dst = loc.vreg;
+    } else if (value != loc.vreg) {
+      ir_emit(g, IR_MOV, loc.vreg, value, -1, 0);
+    }
+    break;
+  }
+  case LOC_FRAME:
+    ir_emit(g, IR_STOREF, -1, value, -1, loc.offset);
+    break;
+  default:
+    ir_emit(g, IR_STORE, -1, value, loc.vreg, loc.offset);
+    break;
+  }
+}
+
+static int gen_address(Gen *g, Node *n) {
+  Loc loc = gen_lvalue(g, n);
+  if (loc.kind == LOC_FRAME) {
+    return ir_value(g, IR_FRAME, -1, -1, loc.offset);
+  }
+  return ir_add_const(g, loc.vreg, loc.offset);
+}
+
+/**
+ * Value whose sign bit is set exactly when a < b: the sign of a - b,
+ * corrected for signed overflow or turned into the unsigned borrow
+ */
+static int gen_less(Gen *g, int a, int b, bool is_unsigned) {
+  int diff = ir_bin(g, "SUB", a, b);
+  int differ = ir_bin(g, "XOR", a, b);
+  int fix = ir_bin(g, "XOR", diff, is_unsigned ? b : a);
+  fix = ir_bin(g, "AND", fix, differ);
+  return ir_bin(g, "XOR", diff, fix);
+}
+
+/**
+ * Value whose sign bit is the outcome of an ordering comparison, or its
+ * inverse when *negated is set on return
+ */
+static int gen_compare(Gen *g, Node *n, bool *negated) {
+  BinOp op = n->op;
+  Node *lhs = n->lhs;
+  Node *rhs = n->rhs;
+  if (lhs->kind == ND_NUM && rhs->kind != ND_NUM) {
+    // Constant on the right: c < x is x > c and so on
+    static const BinOp mirror[] = {BIN_GT, BIN_GE, BIN_LT, BIN_LE};
+    op = mirror[op - BIN_LT];
+    lhs = n->rhs;
+    rhs = n->lhs;
+  }
+
+  // Signed x < k is the sign of x | (x - k) for k >= 0 and of x & (x - k)
+  // for k < 0: the subtraction cannot overflow where the other operand does
+  // not already decide. x <= k is x < k + 1, x > k and x >= k the negations.
+  if (!n->is_unsigned && rhs->kind == ND_NUM) {
+    int k = (int16_t)rhs->value;
+    bool plus_one = op == BIN_LE || op == BIN_GT;
+    if (!plus_one || k < 32767) {
+      k += plus_one;
+      *negated = op == BIN_GT || op == BIN_GE;
+      int x = gen_expr(g, lhs);
+      return k == 0 ? x : ir_bin(g, k > 0 ? "OR" : "AND", x,
+                                 ir_add_const(g, x, -k));
+    }
+  }
+
+  // a > b is b < a, a >= b is !(a < b), a <= b is !(b < a)
+  bool swap = op == BIN_GT || op == BIN_LE;
+  *negated = op == BIN_GE || op == BIN_LE;
+  int a = gen_expr(g, swap ? rhs : lhs);
+  return gen_less(g, a, gen_expr(g, swap ? lhs : rhs), n->is_unsigned);
+}
+
+/**
+ * 0 or 1 from a condition, through the branch code
+ */
+static int gen_truth(Gen *g, Node *n) {
+  int dst = ir_new_vreg(g);
+  int end = ir_new_label(g);
+  ir_emit(g, IR_LI, dst, -1, -1, 1);
+  gen_branch(g, n, end, true);
+  ir_emit(g, IR_LI, dst, -1, -1, 0);
+  ir_label(g, end);
+  return dst;
+}
+
+static int gen_arith(Gen *g, BinOp op, bool is_unsigned, int a, Node *rhs) {
+  static const char *mnemonics[] = {"ADD", "SUB", "MUL", "DIV", "MOD",
+                                    "AND", "OR",  "XOR", "SHL", "SHR"};
+  int shift;
+
+  if (rhs->kind == ND_NUM) {
+    long c = rhs->value;
+    if (op == BIN_ADD || op == BIN_SUB) {
+      return ir_add_const(g, a, op == BIN_ADD ? c : -c);
+    }
+    if (op == BIN_MUL && ir_power_of_two(c, &shift)) {
+      return shift ? ir_shift(g, "SHLI", a, shift) : a;
+    }
+    if (op == BIN_DIV && is_unsigned && ir_power_of_two(c, &shift)) {
+      return shift ? ir_shift(g, "SHRI", a, shift) : a;
+    }
+    if (op == BIN_MOD && is_unsigned && ir_power_of_two(c, &shift)) {
+      return ir_bin(g, "AND", a, ir_li(g, c - 1));
+    }
+    if (op == BIN_SHL || op == BIN_SHR) {
+      const char *mnemonic = op == BIN_SHL ? "SHLI"
+                             : is_unsigned ? "SHRI"
+                                           : "SARI";
+      return (c & 15) ? ir_shift(g, mnemonic, a, c & 15) : a;
+    }
+  }
+  int b = gen_expr(g, rhs);
+  const char *mnemonic = mnemonics[op];
+  if (op == BIN_DIV && is_unsigned) {
+    mnemonic = "DIVU";
+  } else if (op == BIN_MOD && is_unsigned) {
+    mnemonic = "MODU";
+  } else if (op == BIN_SHR && !is_unsigned) {
+    mnemonic = "SAR";
+  }
+  return ir_bin(g, mnemonic, a, b);
+}
+
+static int gen_binary(Gen *g, Node *n) {
+  BinOp op = n->op;
+  if (op == BIN_EQ || op == BIN_NE) {
+    return gen_truth(g, n);
+  }
+  if (op >= BIN_LT) {
+    bool negated;
+    int bit = ir_shift(g, "SHRI", gen_compare(g, n, &negated), 15);
+    return negated ? ir_bin(g, "XOR", bit, ir_li(g, 1)) : bit;
+  }
+
+  Node *lhs = n->lhs;
+  Node *rhs = n->rhs;
+  bool commutative = op == BIN_ADD || op == BIN_MUL || op == BIN_AND ||
+                     op == BIN_OR || op == BIN_XOR;
+  if (commutative && lhs->kind == ND_NUM) {
+    Node *swap = lhs;
+    lhs = rhs;
+    rhs = swap;
+  }
+  return gen_arith(g, op, n->is_unsigned, gen_expr(g, lhs), rhs);
+}
+
+static int gen_call(Gen *g, Node *n) {
+  if (n->sym && !n->sym->defined) {
+    cc_error(g->cc, n->line, "function '%s' is never defined", n->sym->name);
+  }
+
+  // Evaluate every argument before storing any: a nested call would reuse
+  // the argument area
+  int args[CC_MAX_PARAMS];
+  int count = 0;
+  for (Node *arg = n->lhs; arg && count < CC_MAX_PARAMS; arg = arg->next) {
+    args[count++] = gen_expr(g, arg);
+  }
+  for (int i = 0; i < count; i++) {
+    Ir *ir = ir_emit(g, IR_ARG, -1, args[i], -1, i);
+    ir->count = count;
+  }
+
+  int dst = ir_new_vreg(g);
+  Ir *call = ir_emit(g, IR_CALL, dst, -1, -1, 0);
+  call->target = n->sym;
+  call->count = count;
+  return n->type->kind == TY_VOID ? -1 : dst;
+}
+
+/**
+ * Compound assignment and ++/--: the location is computed once
+ */
+static int gen_update(Gen *g, Node *n) {
+  Loc loc = gen_lvalue(g, n->lhs);
+  int old = gen_load(g, loc);
+  int result;
+
+  if (n->kind == ND_INCDEC) {
+    if (n->post && loc.kind == LOC_REG) {
+      old = ir_value(g, IR_MOV, old, -1, 0);
+    }
+    result = ir_add_const(g, old, n->value);
+  } else {
+    result = gen_arith(g, n->op, n->is_unsigned, old, n->rhs);
+  }
+
+  if (loc.kind == LOC_REG && result != loc.vreg) {
+    gen_store(g, loc, result);
+    result = loc.vreg;
+  } else if (loc.kind != LOC_REG) {
+    gen_store(g, loc, result);
+  }
+  return n->kind == ND_INCDEC && n->post ? old : result;
+}
+
+static int gen_expr(Gen *g, Node *n) {
+  switch (n->kind) {
+  case ND_NUM:
+    return ir_li(g, n->value);
+  case ND_VAR:
+  case ND_DEREF:
+    return gen_load(g, gen_lvalue(g, n));
+  case ND_CALL:
+    return gen_call(g, n);
+  case ND_NEG:
+    return ir_bin(g, "SUB", ir_li(g, 0), gen_expr(g, n->lhs));
+  case ND_BITNOT: {
+    int a = gen_expr(g, n->lhs);
+    return ir_bin(g, "XOR", a, ir_li(g, -1));
+  }
+  case ND_ADDR:
+    return gen_address(g, n->lhs);
+  case ND_CAST: {
+    int value = gen_expr(g, n->lhs);
+    return n->type->kind == TY_VOID ? -1 : value;
+  }
+  case ND_BINARY:
+    return gen_binary(g, n);
+  case ND_NOT:
+  case ND_LOGAND:
+  case ND_LOGOR:
+    return gen_truth(g, n);
+  case ND_COND: {
+    int dst = ir_new_vreg(g);
+    int other = ir_new_label(g);
+    int end = ir_new_label(g);
+    gen_branch(g, n->cond, other, false);
+    int value = gen_expr(g, n->then);
+    if (value >= 0) {
+      ir_emit(g, IR_MOV, dst, value, -1, 0);
+    }
+    ir_branch(g, IR_JMP, -1, end);
+    ir_label(g, other);
+    value = gen_expr(g, n->els);
+    if (value >= 0) {
+      ir_emit(g, IR_MOV, dst, value, -1, 0);
+    }
+    ir_label(g, end);
+    return n->type->kind == TY_VOID ? -1 : dst;
+  }
+  case ND_ASSIGN: {
+    if (n->op != BIN_NONE) {
+      return gen_update(g, n);
+    }
+    Loc loc = gen_lvalue(g, n->lhs);
+    int value = gen_expr(g, n->rhs);
+    gen_store(g, loc, value);
+    return loc.kind == LOC_REG ? loc.vreg : value;
+  }
+  case ND_INCDEC:
+    return gen_update(g, n);
+  default:
+    cc_error(g->cc, n->line, "statement used as an expression");
+    return ir_li(g, 0);
+  }
+}
+
+/**
+ * Jump to label when the truth of n equals jump_if, else fall through
+ */
+static void gen_branch(Gen *g, Node *n, int label, bool jump_if) {
+  switch (n->kind) {
+  case ND_NUM:
+    if ((n->value != 0) == jump_if) {
+      ir_branch(g, IR_JMP, -1, label);
+    }
+    return;
+  case ND_NOT:
+    gen_branch(g, n->lhs, label, !jump_if);
+    return;
+  case ND_LOGAND:
+  case ND_LOGOR: {
+    // Short circuit: a && b jumps when true only if both are, a || b falls
+    // through when false only if both are
+    bool is_and = n->kind == ND_LOGAND;
+    if (jump_if == is_and) {
+      int skip = ir_new_label(g);
+      gen_branch(g, n->lhs, skip, !is_and);
+      gen_branch(g, n->rhs, label, jump_if);
+      ir_label(g, skip);
+    } else {
+      gen_branch(g, n->lhs, label, jump_if);
+      gen_branch(g, n->rhs, label, jump_if);
+    }
+    return;
+  }
+  case ND_BINARY:
+    break;
+  default: {
+    int value = gen_expr(g, n);
+    ir_branch(g, jump_if ? IR_BNZ : IR_BZ, value, label);
+    return;
+  }
+  }
+
+  BinOp op = n->op;
+  if (op == BIN_EQ || op == BIN_NE) {
+    bool on_equal = (op == BIN_EQ) == jump_if;
+    int a = gen_expr(g, n->lhs);
+    if (gen_is_const(n->rhs, 0)) {
+      ir_branch(g, on_equal ? IR_BZ : IR_BNZ, a, label);
+    } else {
+      Ir *ir = ir_emit(g, on_equal ? IR_BEQ : IR_BNE, -1, a,
+                       gen_expr(g, n->rhs), 0);
+      ir->label = label;
+    }
+    return;
+  }
+  if (op < BIN_LT) {
+    int value = gen_expr(g, n);
+    ir_branch(g, jump_if ? IR_BNZ : IR_BZ, value, label);
+    return;
+  }
+
+  bool negated;
+  int sign = gen_compare(g, n, &negated);
+  ir_branch(g, jump_if != negated ? IR_BNEG : IR_BNONNEG, sign, label);
+}
+
+/* ============================================================================
+ * STATEMENTS
+ * ============================================================================
+ */
+
+static void gen_statement(Gen *g, Node *n);
+
+static void gen_loop_body(Gen *g, Node *body, int break_label,
+                          int continue_label) {
+  int saved_break = g->break_label;
+  int saved_continue = g->continue_label;
+  g->break_label = break_label;
+  g->continue_label = continue_label;
+  gen_statement(g, body);
+  g->break_label = saved_break;
+  g->continue_label = saved_continue;
+}
+
+/**
+ * Remember a loop's extent for the liveness of register variables
+ */
+static void gen_record_loop(Gen *g, int start) {
+  if (g->loop_count == g->loop_cap) {
+    g->loop_cap = g->loop_cap ? 2 * g->loop_cap : 16;
+    LoopRange *loops = realloc(g->loops, g->loop_cap * sizeof(LoopRange));
+    if (!loops) {
+      fprintf(stderr, "Error: Out of memory in compiler\n");
+      exit(1);
+    }
+    g->loops = loops;
+  }
+  g->loops[g->loop_count++] = (LoopRange){start, g->count - 1};
+}
+
+static void gen_statement(Gen *g, Node *n) {
+  switch (n->kind) {
+  case ND_BLOCK:
+    for (Node *s = n->then; s && !g->cc->error; s = s->next) {
+      gen_statement(g, s);
+    }
+    return;
+
+  case ND_EXPR:
+    if (n->lhs->kind == ND_INCDEC) {
+      n->lhs->post = false; // Value unused
+    }
+    gen_expr(g, n->lhs);
+    return;
+
+  case ND_IF: {
+    int other = ir_new_label(g);
+    gen_branch(g, n->cond, other, false);
+    gen_statement(g, n->then);
+    if (n->els) {
+      int end = ir_new_label(g);
+      ir_branch(g, IR_JMP, -1, end);
+      ir_label(g, other);
+      gen_statement(g, n->els);
+      ir_label(g, end);
+    } else {
+      ir_label(g, other);
+    }
+    return;
+  }
+
+  case ND_WHILE:
+  case ND_FOR:
+  case ND_DO: {
+    // Test at the bottom: one branch per iteration
+    int body = ir_new_label(g);
+    int next = ir_new_label(g);
+    int test = ir_new_label(g);
+    int end = ir_new_label(g);
+    if (n->init) {
+      gen_statement(g, n->init);
+    }
+    if (n->kind != ND_DO) {
+      ir_branch(g, IR_JMP, -1, test);
+    }
+    int start = g->count;
+    ir_label(g, body);
+    gen_loop_body(g, n->then, end, next);
+    ir_label(g, next);
+    if (n->inc) {
+      if (n->inc->kind == ND_INCDEC) {
+        n->inc->post = false;
+      }
+      gen_expr(g, n->inc);
+    }
+    ir_label(g, test);
+    if (n->cond) {
+      gen_branch(g, n->cond, body, true);
+    } else {
+      ir_branch(g, IR_JMP, -1, body);
+    }
+    gen_record_loop(g, start);
+    ir_label(g, end);
+    return;
+  }
+
+  case ND_RETURN:
+    ir_emit(g, IR_RET, -1, n->lhs ? gen_expr(g, n->lhs) : -1, -1, 0);
+    return;
+
+  case ND_BREAK:
+  case ND_CONTINUE: {
+    int label = n->kind == ND_BREAK ? g->break_label : g->continue_label;
+    if (label < 0) {
+      cc_error(g->cc, n->line, "%s outside a loop",
+               n->kind == ND_BREAK ? "break" : "continue");
+      return;
+    }
+    ir_branch(g, IR_JMP, -1, label);
+    return;
+  }
+
+  default:
+    gen_expr(g, n);
+    return;
+  }
+}
+
+/* ============================================================================
+ * REGISTER ALLOCATION
+ * ============================================================================
+ * Linear scan over live intervals. Intervals are first and last use in
+ * instruction order, which is exact for temporaries; register variables
+ * are additionally stretched over every loop they appear in, because they
+ * stay live around the back edge.
+ */
+
+static void ra_touch(Gen *g, int vreg, int pos) {
+  if (vreg < 0) {
+    return;
+  }
+  Interval *iv = &g->intervals[vreg];
+  if (iv->start < 0) {
+    iv->start = pos;
+  }
+  iv->end = pos;
+}
+
+static void ra_build_intervals(Gen *g) {
+  for (int v = 0; v < g->vregs; v++) {
+    g->intervals[v] = (Interval){-1, -1, -1, 0, v < g->first_temp, false,
+                                 false, 0};
+  }
+  for (int pos = 0; pos < g->count; pos++) {
+    Ir *ir = &g->code[pos];
+    ra_touch(g, ir->a, pos);
+    ra_touch(g, ir->b, pos);
+    ra_touch(g, ir->dst, pos);
+    if (ir->op == IR_LOADF && ir->dst < g->first_temp) {
+      g->intervals[ir->dst].param = true;
+      g->intervals[ir->dst].home = ir->imm;
+    }
+    if (ir->op == IR_CALL && ir->dst >= 0) {
+      g->intervals[ir->dst].prefer_r0 = true;
+    } else if (ir->op == IR_RET && ir->a >= 0) {
+      g->intervals[ir->a].prefer_r0 = true;
+    }
+  }
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int v = 0; v < g->first_temp; v++) {
+      Interval *iv = &g->intervals[v];
+      for (int l = 0; l < g->loop_count && iv->start >= 0; l++) {
+        LoopRange *loop = &g->loops[l];
+        if (iv->start > loop->end || iv->end < loop->start) {
+          continue;
+        }
+        if (iv->start > loop->start) {
+          iv->start = loop->start;
+          changed = true;
+        }
+        if (iv->end < loop->end) {
+          iv->end = loop->end;
+          changed = true;
+        }
+      }
+    }
+  }
+}
+
+static void ra_spill(Gen *g, Interval *iv) {
+  iv->reg = -1;
+  if (iv->param) {
+    iv->slot = iv->home;
+    return;
+  }
+  g->frame += 2;
+  g->spills++;
+  iv->slot = -g->frame;
+}
+
+static void ra_allocate(Gen *g) {
+  int *order = malloc((g->vregs + 1) * sizeof(int));
+  int count = 0;
+  for (int v = 0; v < g->vregs; v++) {
+    if (g->intervals[v].start >= 0) {
+      order[count++] = v;
+    }
+  }
+  // Insertion sort by start; virtual registers are mostly created in order
+  for (int i = 1; i < count; i++) {
+    int v = order[i];
+    int j = i - 1;
+    while (j >= 0 && g->intervals[order[j]].start > g->intervals[v].start) {
+      order[j + 1] = order[j];
+      j--;
+    }
+    order[j + 1] = v;
+  }
+
+  int active[CC_ALLOC_REGS]; // Virtual register holding each physical one
+  for (int r = 0; r < CC_ALLOC_REGS; r++) {
+    active[r] = -1;
+  }
+
+  for (int i = 0; i < count; i++) {
+    Interval *iv = &g->intervals[order[i]];
+    // A register whose value dies here can be written by this instruction
+    int free_reg = -1;
+    for (int r = 0; r < CC_ALLOC_REGS; r++) {
+      if (active[r] >= 0 && g->intervals[active[r]].end <= iv->start) {
+        active[r] = -1;
+      }
+      if (active[r] < 0 && (free_reg < 0 || (iv->prefer_r0 && r == 0))) {
+        free_reg = r;
+      }
+    }
+    if (free_reg >= 0) {
+      iv->reg = free_reg;
+      active[free_reg] = order[i];
+      continue;
+    }
+
+    // Spill whichever interval reaches furthest
+    int victim = 0;
+    for (int r = 1; r < CC_ALLOC_REGS; r++) {
+      if (g->intervals[active[r]].end > g->intervals[active[victim]].end) {
+        victim = r;
+      }
+    }
+    Interval *other = &g->intervals[active[victim]];
+    if (other->end > iv->end) {
+      iv->reg = victim;
+      ra_spill(g, other);
+      active[victim] = order[i];
+    } else {
+      ra_spill(g, iv);
+    }
+  }
+  free(order);
+}
+
+/* ============================================================================
+ * EMISSION
+ * ============================================================================
+ * Spilled operands are reloaded into R5 (first source) and R6 (second
+ * source); a spilled result is computed in R6 and stored with R5 as the
+ * address scratch.
+ */
+
+static void emit(Gen *g, const char *format, ...) {
+  // LI expands to at most three words, everything else is one
+  g->cc->code_size += strncmp(format, "LI ", 3) == 0 ? 6 : 2;
+  if (!g->cc->out) {
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  fprintf(g->cc->out, "  ");
+  vfprintf(g->cc->out, format, args);
+  fprintf(g->cc->out, "\n");
+  va_end(args);
+}
+
+static void emit_label(Gen *g, int label) {
+  if (g->cc->out) {
+    fprintf(g->cc->out, ".L%d:\n", label);
+  }
+  g->flags_vreg = -1;
+}
+
+/**
+ * CALL, or when the target may be out of its reach, push the return
+ * address and the target and let RET jump there
+ */
+static void emit_call_to(Gen *g, Symbol *target) {
+  Compiler *cc = g->cc;
+  if (cc->call_count == cc->call_cap) {
+    int cap = cc->call_cap ? 2 * cc->call_cap : 64;
+    CallSite *calls = realloc(cc->calls, cap * sizeof(CallSite));
+    if (!calls) {
+      fprintf(stderr, "Error: Out of memory in compiler\n");
+      exit(1);
+    }
+    memset(calls + cc->call_cap, 0, (cap - cc->call_cap) * sizeof(CallSite));
+    cc->calls = calls;
+    cc->call_cap = cap;
+  }
+  CallSite *site = &cc->calls[cc->call_count++];
+  site->target = target;
+  site->position = cc->code_size;
+
+  if (!site->far) {
+    emit(g, "CALL _%s", target->name);
+    return;
+  }
+  int back = ir_new_label(g);
+  emit(g, "LI R%d, .L%d", CC_SCRATCH_B, back);
+  emit(g, "PUSH R%d", CC_SCRATCH_B);
+  emit(g, "LI R%d, _%s", CC_SCRATCH_B, target->name);
+  emit(g, "PUSH R%d", CC_SCRATCH_B);
+  emit(g, "RET");
+  emit_label(g, back);
+}
+
+/**
+ * LOAD or STORE reg at R7 + offset, via scratch when out of offset range
+ */
+static void emit_frame(Gen *g, const char *op, int reg, int offset,
+                       int scratch) {
+  if (offset >= -32 && offset <= 31) {
+    emit(g, "%s R%d, [R%d, %d]", op, reg, CC_FP, offset);
+    return;
+  }
+  emit(g, "LI R%d, #%d", scratch, offset);
+  emit(g, "ADD R%d, R%d, R%d", scratch, scratch, CC_FP);
+  emit(g, "%s R%d, [R%d]", op, reg, scratch);
+  g->flags_vreg = -1;
+}
+
+static void emit_move(Gen *g, int dst, int src) {
+  if (dst != src) {
+    emit(g, "OR R%d, R%d, R%d", dst, src, src);
+  }
+}
+
+/**
+ * Add a constant to R7 (moving the frame around a call)
+ */
+static void emit_adjust_fp(Gen *g, int amount) {
+  if (amount == 0) {
+    return;
+  }
+  if (amount >= -256 && amount <= 255) {
+    emit(g, "ADDI R%d, #%d", CC_FP, amount);
+  } else {
+    emit(g, "LI R%d, #%d", CC_SCRATCH_B, amount);
+    emit(g, "ADD R%d, R%d, R%d", CC_FP, CC_FP, CC_SCRATCH_B);
+  }
+}
+
+static int emit_src(Gen *g, int vreg, int scratch) {
+  Interval *iv = &g->intervals[vreg];
+  if (iv->reg >= 0) {
+    return iv->reg;
+  }
+  emit_frame(g, "LOAD", scratch, iv->slot, scratch);
+  return scratch;
+}
+
+static int emit_dst(Gen *g, int vreg) {
+  int reg = g->intervals[vreg].reg;
+  return reg >= 0 ? reg : CC_SCRATCH_B;
+}
+
+/**
+ * Write back a spilled result; sets_flags says the instruction that
+ * produced it left Z/N describing it
+ */
+static void emit_result(Gen *g, int vreg, bool sets_flags) {
+  g->flags_vreg = sets_flags ? vreg : -1;
+  Interval *iv = &g->intervals[vreg];
+  if (iv->reg < 0) {
+    emit_frame(g, "STORE", CC_SCRATCH_B, iv->slot, CC_SCRATCH_A);
+  }
+}
+
+/**
+ * Set Z/N from a value unless they already describe it
+ */
+static int emit_test(Gen *g, int vreg) {
+  int reg = emit_src(g, vreg, CC_SCRATCH_A);
+  if (g->flags_vreg != vreg) {
+    emit(g, "OR R%d, R%d, R%d", reg, reg, reg);
+    g->flags_vreg = vreg;
+  }
+  return reg;
+}
+
+static void emit_call(Gen *g, Ir *ir, int pos) {
+  // Save the allocated registers whose values outlive the call
+  int saved[CC_ALLOC_REGS];
+  int saved_count = 0;
+  for (int r = 0; r < CC_ALLOC_REGS; r++) {
+    for (int v = 0; v < g->vregs; v++) {
+      Interval *iv = &g->intervals[v];
+      if (iv->reg == r && iv->start < pos && iv->end > pos) {
+        saved[saved_count++] = r;
+        break;
+      }
+    }
+  }
+  for (int i = 0; i < saved_count; i++) {
+    emit(g, "PUSH R%d", saved[i]);
+  }
+
+  int adjust = g->frame + 2 * ir->count;
+  emit_adjust_fp(g, -adjust);
+  emit_call_to(g, ir->target);
+  emit_adjust_fp(g, adjust);
+  g->flags_vreg = -1;
+
+  if (ir->dst >= 0) {
+    emit_move(g, emit_dst(g, ir->dst), 0);
+    emit_result(g, ir->dst, false);
+  }
+  for (int i = saved_count - 1; i >= 0; i--) {
+    emit(g, "POP R%d", saved[i]);
+  }
+}
+
+static void emit_instruction(Gen *g, Ir *ir, int pos) {
+  int ra, rb, rd;
+  switch (ir->op) {
+  case IR_LI:
+    rd = emit_dst(g, ir->dst);
+    emit(g, "LI R%d, #%ld", rd, ir->imm);
+    emit_result(g, ir->dst, false);
+    break;
+  case IR_LA:
+    rd = emit_dst(g, ir->dst);
+    emit(g, "LI R%d, _%s", rd, ir->name);
+    emit_result(g, ir->dst, false);
+    break;
+  case IR_FRAME:
+    rd = emit_dst(g, ir->dst);
+    if (ir->imm >= -256 && ir->imm <= 255) {
+      emit_move(g, rd, CC_FP);
+      emit(g, "ADDI R%d, #%ld", rd, ir->imm);
+    } else {
+      emit(g, "LI R%d, #%ld", rd, ir->imm);
+      emit(g, "ADD R%d, R%d, R%d", rd, rd, CC_FP);
+    }
+    emit_result(g, ir->dst, false);
+    break;
+  case IR_MOV:
+    ra = emit_src(g, ir->a, CC_SCRATCH_A);
+    rd = emit_dst(g, ir->dst);
+    if (ra != rd) {
+      emit_move(g, rd, ra);
+      emit_result(g, ir->dst, true);
+    } else {
+      emit_result(g, ir->dst, g->flags_vreg == ir->a);
+    }
+    break;
+  case IR_BIN:
+    ra = emit_src(g, ir->a, CC_SCRATCH_A);
+    rb = emit_src(g, ir->b, CC_SCRATCH_B);
+    rd = emit_dst(g, ir->dst);
+    emit(g, "%s R%d, R%d, R%d", ir->name, rd, ra, rb);
+    emit_result(g, ir->dst, true);
+    break;
+  case IR_ADDI:
+  case IR_SHI:
+    ra = emit_src(g, ir->a, CC_SCRATCH_A);
+    rd = emit_dst(g, ir->dst);
+    emit_move(g, rd, ra);
+    emit(g, "%s R%d, #%ld", ir->op == IR_ADDI ? "ADDI" : ir->name, rd,
+         ir->imm);
+    emit_result(g, ir->dst, true);
+    break;
+  case IR_LOAD:
+    ra = emit_src(g, ir->a, CC_SCRATCH_A);
+    rd = emit_dst(g, ir->dst);
+    emit(g, "LOAD R%d, [R%d, %ld]", rd, ra, ir->imm);
+    emit_result(g, ir->dst, false);
+    break;
+  case IR_STORE:
+    ra = emit_src(g, ir->a, CC_SCRATCH_A);
+    rb = emit_src(g, ir->b, CC_SCRATCH_B);
+    emit(g, "STORE R%d, [R%d, %ld]", ra, rb, ir->imm);
+    break;
+  case IR_LOADF: {
+    Interval *iv = &g->intervals[ir->dst];
+    if (iv->reg < 0 && iv->slot == ir->imm) {
+      break; // Spilled parameter already in its slot
+    }
+    rd = emit_dst(g, ir->dst);
+    emit_frame(g, "LOAD", rd, ir->imm, CC_SCRATCH_B);
+    emit_result(g, ir->dst, false);
+    break;
+  }
+  case IR_STOREF:
+    ra = emit_src(g, ir->a, CC_SCRATCH_A);
+    emit_frame(g, "STORE", ra, ir->imm, CC_SCRATCH_B);
+    break;
+  case IR_ARG:
+    ra = emit_src(g, ir->a, CC_SCRATCH_A);
+    emit_frame(g, "STORE", ra, -(g->frame + 2 * ir->count) + 2 * ir->imm,
+               CC_SCRATCH_B);
+    break;
+  case IR_LABEL:
+    emit_label(g, ir->imm);
+    break;
+  case IR_JMP:
+    emit(g, "B .L%ld", ir->imm);
+    break;
+  case IR_BZ:
+  case IR_BNZ:
+    emit_test(g, ir->a);
+    emit(g, "%s .L%ld", ir->op == IR_BZ ? "BEQ" : "BNE", ir->imm);
+    break;
+  case IR_BNEG:
+    emit_test(g, ir->a);
+    emit(g, "BLT .L%ld", ir->imm);
+    break;
+  case IR_BNONNEG: {
+    // No branch-if-not-negative: hop over an unconditional branch
+    int skip = ir_new_label(g);
+    emit_test(g, ir->a);
+    emit(g, "BLT .L%d", skip);
+    emit(g, "B .L%ld", ir->imm);
+    emit_label(g, skip);
+    break;
+  }
+  case IR_BEQ:
+  case IR_BNE:
+    ra = emit_src(g, ir->a, CC_SCRATCH_A);
+    rb = emit_src(g, ir->b, CC_SCRATCH_B);
+    emit(g, "SUB R%d, R%d, R%d", CC_SCRATCH_B, ra, rb);
+    emit(g, "%s .L%d", ir->op == IR_BEQ ? "BEQ" : "BNE", ir->label);
+    g->flags_vreg = -1;
+    break;
+  case IR_CALL:
+    emit_call(g, ir, pos);
+    break;
+  case IR_RET:
+    if (ir->a >= 0) {
+      emit_move(g, 0, emit_src(g, ir->a, CC_SCRATCH_A));
+    }
+    emit(g, "RET");
+    break;
+  }
+}
+
+/**
+ * Lower, allocate and print one function
+ */
+static void gen_function(Compiler *cc, Function *fn) {
+  Gen g = {0};
+  g.cc = cc;
+  g.fn = fn;
+  g.break_label = -1;
+  g.continue_label = -1;
+  g.flags_vreg = -1;
+
+  // Register variables first, then memory homes for the rest
+  for (int i = 0; i < fn->local_count; i++) {
+    Symbol *sym = fn->locals[i];
+    if (!gen_in_memory(sym)) {
+      sym->vreg = ir_new_vreg(&g);
+    } else if (sym->param) {
+      sym->offset = 2 * sym->index;
+    } else {
+      g.frame += (cc_size(sym->type) + 1) & ~1;
+      sym->offset = -g.frame;
+    }
+  }
+  g.first_temp = g.vregs;
+  int locals_size = g.frame;
+
+  for (int i = 0; i < fn->local_count; i++) {
+    Symbol *sym = fn->locals[i];
+    if (sym->param && sym->vreg >= 0) {
+      ir_emit(&g, IR_LOADF, sym->vreg, -1, -1, 2 * sym->index);
+    }
+  }
+  gen_statement(&g, fn->body);
+  if (g.count == 0 || g.code[g.count - 1].op != IR_RET) {
+    // Falling off the end; main returns 0 like a hosted C program
+    bool is_main = strcmp(fn->sym->name, "main") == 0;
+    ir_emit(&g, IR_RET, -1, is_main ? ir_li(&g, 0) : -1, -1, 0);
+  }
+
+  if (!cc->error) {
+    g.intervals = malloc((g.vregs + 1) * sizeof(Interval));
+    ra_build_intervals(&g);
+    ra_allocate(&g);
+
+    if (cc->out) {
+      fprintf(cc->out, "\n; %s: %d bytes of locals, %d spill slot%s\n",
+              fn->sym->name, locals_size, g.spills, g.spills == 1 ? "" : "s");
+      fprintf(cc->out, "_%s:\n", fn->sym->name);
+    }
+    fn->sym->address = cc->code_size;
+    for (int pos = 0; pos < g.count; pos++) {
+      emit_instruction(&g, &g.code[pos], pos);
+    }
+  }
+
+  free(g.intervals);
+  free(g.code);
+  free(g.loops);
+}
+
+static void gen_globals(Compiler *cc) {
+  for (int i = 0; i < cc->global_count; i++) {
+    Symbol *sym = cc->globals[i];
+    if (sym->kind != SYM_GLOBAL) {
+      continue;
+    }
+    int size = cc_size(sym->type);
+    fprintf(cc->out, "_%s:\n", sym->name);
+    if (sym->init) {
+      fprintf(cc->out, "  .word ");
+      for (Node *value = sym->init; value; value = value->next) {
+        fprintf(cc->out, "%s%ld", value == sym->init ? "" : ", ",
+                value->value & 0xFFFF);
+        size -= 2;
+      }
+      fprintf(cc->out, "\n");
+    }
+    if (size > 0) {
+      fprintf(cc->out, "  .space %d\n", size);
+    }
+  }
+}
+
+/* ============================================================================
+ * DRIVER
+ * ============================================================================
+ */
+
+/**
+ * Startup code, every function and the globals
+ */
+static void cc_generate(Compiler *cc, Symbol *main_fn) {
+  cc->label_count = 0;
+  cc->code_size = 0;
+  cc->call_count = 0;
+
+  // Startup: set up the data stack, run main, halt with its result in R0
+  Gen startup = {0};
+  startup.cc = cc;
+  emit(&startup, "LI R%d, #0x%04X", CC_FP, CC_STACK_TOP);
+  emit_call_to(&startup, main_fn);
+  emit(&startup, "HALT");
+
+  for (Function *fn = cc->functions; fn && !cc->error; fn = fn->next) {
+    gen_function(cc, fn);
+  }
+  if (cc->out && !cc->error) {
+    fprintf(cc->out, "\n");
+    gen_globals(cc);
+  }
+}
+
+/**
+ * Mark the calls whose target may be out of CALL's reach
+ */
+static bool cc_mark_far_calls(Compiler *cc) {
+  bool changed = false;
+  for (int i = 0; i < cc->call_count; i++) {
+    CallSite *site = &cc->calls[i];
+    int distance = site->target->address - (site->position + 2);
+    if (!site->far && (distance < -CC_CALL_REACH || distance > CC_CALL_REACH)) {
+      site->far = true;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+static char *cc_read_file(const char *filename) {
+  FILE *file = fopen(filename, "rb");
+  if (!file) {
+    fprintf(stderr, "Error: Cannot open source file '%s'\n", filename);
+    return NULL;
+  }
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  char *source = malloc(size + 1);
+  if (source && fread(source, 1, size, file) != (size_t)size) {
+    free(source);
+    source = NULL;
+  }
+  fclose(file);
+  if (!source) {
+    fprintf(stderr, "Error: Cannot read source file '%s'\n", filename);
+    return NULL;
+  }
+  source[size] = '\0';
+  return source;
+}
+
+bool cc_compile_file(const char *source, const char *output) {
+  char *text = cc_read_file(source);
+  if (!text) {
+    return false;
+  }
+
+  Compiler *cc = calloc(1, sizeof(Compiler));
+  if (!cc) {
+    free(text);
+    fprintf(stderr, "Error: Out of memory in compiler\n");
+    return false;
+  }
+  cc->filename = source;
+
+  if (cc_tokenize(cc, text)) {
+    while (cc_peek(cc)->kind != TK_EOF && !cc->error) {
+      cc_toplevel(cc);
+    }
+  }
+  Symbol *main_fn = cc->error ? NULL : cc_find(cc, "main");
+  if (!cc->error && (!main_fn || main_fn->kind != SYM_FUNC ||
+                     !main_fn->defined)) {
+    cc_error(cc, cc_line(cc), "no definition of main");
+  }
+
+  if (!cc->error) {
+    // Size the code with every call near, then make far the calls that
+    // might not reach; that only lengthens the code, so repeat until stable
+    do {
+      cc_generate(cc, main_fn);
+    } while (!cc->error && cc_mark_far_calls(cc));
+  }
+  if (!cc->error) {
+    cc->out = fopen(output, "w");
+    if (!cc->out) {
+      fprintf(stderr, "Error: Cannot create output file '%s'\n", output);
+      cc->error = true;
+    }
+  }
+  if (cc->out) {
+    fprintf(cc->out, "; Compiled from %s\n", source);
+    cc_generate(cc, main_fn);
+    fclose(cc->out);
+  }
+
+  bool ok = !cc->error;
+  for (int i = 0; i < cc->alloc_count; i++) {
+    free(cc->allocs[i]);
+  }
+  free(cc->allocs);
+  free(cc->tokens);
+  free(cc->calls);
+  free(cc);
+  free(text);
+  return ok;
+}
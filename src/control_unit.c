@@ -1,9 +1,22 @@
 #include "../include/control_unit.h"
 #include "../include/alu.h"
 #include "../include/decoder.h"
+#include "../include/interrupt.h"
 #include "../include/memory.h"
 #include "../include/registers.h"
-#include <stdio.h>
+
+/**
+ * Count a control transfer from the executing instruction (at pc - 2) to
+ * target in the coverage map. Not-taken branches count as an edge to the
+ * next instruction.
+ */
+static void cu_edge(CPU *cpu, uint16_t target) {
+  if (cpu->coverage) {
+    uint16_t from = cpu->pc - 2;
+    uint32_t index = (from >> 1) * 0x9E37u ^ (target >> 1);
+    cpu->coverage[index & (COVERAGE_MAP_SIZE - 1)]++;
+  }
+}
 
 /**
  * Execute a single instruction
@@ -13,15 +26,17 @@ void cu_execute(CPU *cpu, uint16_t raw_instruction) {
   Instruction inst = decode_instruction(raw_instruction);
 
   if (cpu->debug) {
-    printf("  COMPUTE: Opcode=%s Rd=R%d Rs1=R%d Rs2=R%d Imm9=%d Imm12=%d\n",
-           cpu_opcode_to_string(inst.opcode), inst.rd, inst.rs1, inst.rs2,
-           inst.imm9, inst.imm12);
+    cpu_log(cpu, CPU_LOG_DEBUG,
+            "  COMPUTE: Opcode=%s Rd=R%d Rs1=R%d Rs2=R%d Imm9=%d Imm12=%d",
+            cpu_opcode_to_string(inst.opcode), inst.rd, inst.rs1, inst.rs2,
+            inst.imm9, inst.imm12);
   }
 
   // Try ALU first
   if (alu_execute(cpu, inst.opcode, inst.rd, inst.rs1, inst.rs2, inst.imm9)) {
     if (cpu->debug) {
-      printf("  STORE: R%d = 0x%04X\n", inst.rd, reg_read(cpu, inst.rd));
+      cpu_log(cpu, CPU_LOG_DEBUG, "  STORE: R%d = 0x%04X", inst.rd,
+              reg_read(cpu, inst.rd));
     }
     return;
   }
@@ -38,9 +53,12 @@ void cu_execute(CPU *cpu, uint16_t raw_instruction) {
     // LOAD Rd, [Rs + offset]
     addr = reg_read(cpu, inst.rs1) + inst.offset6;
     result = mem_read_word(cpu, addr);
+    if (cpu->aborted) {
+      break;
+    }
     reg_write(cpu, inst.rd, result);
     if (cpu->debug)
-      printf("  STORE: R%d = 0x%04X\n", inst.rd, result);
+      cpu_log(cpu, CPU_LOG_DEBUG, "  STORE: R%d = 0x%04X", inst.rd, result);
     break;
 
   case OP_STORE:
@@ -48,46 +66,122 @@ void cu_execute(CPU *cpu, uint16_t raw_instruction) {
     addr = reg_read(cpu, inst.rs1) + inst.offset6;
     mem_write_word(cpu, addr, reg_read(cpu, inst.rd));
     if (cpu->debug)
-      printf("  STORE: Mem[0x%04X] = 0x%04X\n", addr, reg_read(cpu, inst.rd));
+      cpu_log(cpu, CPU_LOG_DEBUG, "  STORE: Mem[0x%04X] = 0x%04X", addr,
+              reg_read(cpu, inst.rd));
+    break;
+
+  case OP_CAS:
+  case OP_FADD:
+  case OP_SWAP:
+    // CAS Rd, [Rs1], Rs2: if Mem == Rd then Mem = Rs2 (Z set on success)
+    // FADD Rd, [Rs1], Rs2: Mem += Rs2; SWAP Rd, [Rs1], Rs2: Mem = Rs2
+    // All three return the old memory word in Rd
+    addr = reg_read(cpu, inst.rs1);
+    if (!mem_atomic_word(cpu, inst.opcode, addr, reg_read(cpu, inst.rd),
+                         reg_read(cpu, inst.rs2), &result)) {
+      break;
+    }
+    if (inst.opcode == OP_CAS) {
+      if (result == reg_read(cpu, inst.rd)) {
+        flags_set(cpu, FLAG_ZERO);
+      } else {
+        flags_clear(cpu, FLAG_ZERO);
+      }
+    }
+    reg_write(cpu, inst.rd, result);
+    if (cpu->debug)
+      cpu_log(cpu, CPU_LOG_DEBUG, "  STORE: R%d = 0x%04X (atomic Mem[0x%04X])",
+              inst.rd, result, addr);
     break;
 
   case OP_BRANCH:
     // BRANCH offset
+    cu_edge(cpu, cpu->pc + inst.imm12);
     cpu->pc += inst.imm12;
     return; // Don't increment PC
 
   case OP_BEQ:
     // Branch if equal (zero flag set)
     if (flags_get(cpu, FLAG_ZERO)) {
+      cu_edge(cpu, cpu->pc + inst.imm12);
       cpu->pc += inst.imm12;
       return; // Don't increment PC
     }
+    cu_edge(cpu, cpu->pc);
     break;
 
   case OP_BNE:
     // Branch if not equal (zero flag clear)
     if (!flags_get(cpu, FLAG_ZERO)) {
+      cu_edge(cpu, cpu->pc + inst.imm12);
       cpu->pc += inst.imm12;
       return; // Don't increment PC
     }
+    cu_edge(cpu, cpu->pc);
     break;
 
   case OP_BLT:
     // Branch if less than (negative flag set)
     if (flags_get(cpu, FLAG_NEGATIVE)) {
+      cu_edge(cpu, cpu->pc + inst.imm12);
       cpu->pc += inst.imm12;
       return; // Don't increment PC
     }
+    cu_edge(cpu, cpu->pc);
     break;
 
   case OP_HALT:
     cpu->halted = true;
     break;
 
+  case OP_RETI:
+    // Restore FLAGS and PC saved on interrupt entry
+    irq_return(cpu);
+    return;
+
+  case OP_WFI:
+    // Sleep until an enabled interrupt line is raised
+    irq_wait(cpu);
+    break;
+
+  case OP_CALL:
+    // CALL offset: push return address, jump PC-relative
+    cpu_push(cpu, cpu->pc);
+    if (cpu->debug)
+      cpu_log(cpu, CPU_LOG_DEBUG,
+              "  STORE: Mem[0x%04X] = 0x%04X (return address)", cpu->sp,
+              cpu->pc);
+    cu_edge(cpu, cpu->pc + inst.call_offset);
+    cpu->pc += inst.call_offset;
+    return; // Don't increment PC
+
+  case OP_RET:
+    result = cpu_pop(cpu);
+    cu_edge(cpu, result);
+    cpu->pc = result;
+    return; // Don't increment PC
+
+  case OP_PUSH:
+    // PUSH Rn (register in the low bits)
+    cpu_push(cpu, reg_read(cpu, raw_instruction & 0x7));
+    if (cpu->debug)
+      cpu_log(cpu, CPU_LOG_DEBUG, "  STORE: Mem[0x%04X] = 0x%04X", cpu->sp,
+              reg_read(cpu, raw_instruction & 0x7));
+    break;
+
+  case OP_POP:
+    result = cpu_pop(cpu);
+    if (cpu->aborted) {
+      break;
+    }
+    reg_write(cpu, raw_instruction & 0x7, result);
+    if (cpu->debug)
+      cpu_log(cpu, CPU_LOG_DEBUG, "  STORE: R%d = 0x%04X",
+              raw_instruction & 0x7, result);
+    break;
+
   default:
-    fprintf(stderr, "Error: Unknown opcode 0x%X at PC=0x%04X\n", inst.opcode,
-            cpu->pc);
-    cpu->halted = true;
+    cpu_fault(cpu, CPU_ERR_UNKNOWN_OPCODE, 0);
     break;
   }
 }
@@ -1,7 +1,13 @@
 #include "../include/cpu.h"
+#include "../include/cache.h"
 #include "../include/control_unit.h"
+#include "../include/interrupt.h"
 #include "../include/memory.h"
+#include "../include/pipeline.h"
+#include "../include/predictor.h"
 #include "../include/registers.h"
+#include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -17,11 +23,18 @@
  */
 void cpu_init(CPU *cpu) {
   memset(cpu, 0, sizeof(CPU));
+  cpu->memory = cpu->ram;
+  mem_map_pages(cpu);
   cpu->sp = STACK_END; // Stack grows downward
+  cpu->stack_limit = STACK_START;
+  cpu->stack_top = STACK_END;
+  cpu->core_count = 1;
   cpu->halted = false;
   cpu->cycle_count = 0;
   cpu->timer = 0;
   cpu->timer_enabled = false;
+  cpu->dma_setup_cycles = DMA_SETUP_CYCLES;
+  cpu->dma_bytes_per_cycle = DMA_BYTES_PER_CYCLE;
   cpu->debug = false;
 }
 
@@ -30,17 +43,218 @@ void cpu_init(CPU *cpu) {
  */
 void cpu_reset(CPU *cpu) { cpu_init(cpu); }
 
+/**
+ * Copy a CPU. A private memory image is copied along with it; shared memory
+ * and extended memory banks stay shared. Timing, cache, predictor and
+ * coverage models belong to the original only.
+ */
+void cpu_clone(CPU *dst, const CPU *src) {
+  memcpy(dst, src, sizeof(CPU));
+  if (src->memory == src->ram) {
+    dst->memory = dst->ram;
+    mem_map_pages(dst);
+  }
+  dst->pipeline = NULL;
+  dst->cache = NULL;
+  dst->predictor = NULL;
+  dst->coverage = NULL;
+}
+
+/**
+ * Return a CPU to a copy of src. dst must be a cpu_clone of src (or already
+ * restored from it) that has only run since, so its memory differs from
+ * src's at most in its dirty pages: those are copied back instead of the
+ * whole 64KB, and the bits are cleared. Everything else is as for cpu_clone.
+ */
+void cpu_restore(CPU *dst, const CPU *src) {
+  uint64_t dirty[MEM_DIRTY_WORDS];
+  memcpy(dirty, dst->dirty, sizeof(dirty));
+
+  // ram is the last member, so this is everything else
+  memcpy(dst, src, offsetof(CPU, ram));
+  if (src->memory == src->ram) {
+    dst->memory = dst->ram;
+    mem_map_pages(dst);
+    for (uint32_t page = 0; page < MEM_DIRTY_PAGES; page++) {
+      if ((dirty[page / 64] >> (page % 64)) & 1) {
+        size_t at = (size_t)page << MEM_DIRTY_SHIFT;
+        memcpy(dst->ram + at, src->ram + at, MEM_DIRTY_SIZE);
+      }
+    }
+  }
+  memset(dst->dirty, 0, sizeof(dst->dirty));
+  dst->pipeline = NULL;
+  dst->cache = NULL;
+  dst->predictor = NULL;
+  dst->coverage = NULL;
+}
+
 /**
  * Load program into memory
  */
-void cpu_load_program(CPU *cpu, const uint8_t *program, uint16_t size,
-                      uint16_t start_addr) {
+CpuError cpu_load_program(CPU *cpu, const uint8_t *program, uint16_t size,
+                          uint16_t start_addr) {
   if (start_addr + size > RAM_END) {
-    fprintf(stderr, "Error: Program too large or invalid start address\n");
-    return;
+    return CPU_ERR_PROGRAM_SIZE;
   }
   memcpy(&cpu->memory[start_addr], program, size);
+  mem_mark_dirty(cpu, start_addr, size);
   cpu->pc = start_addr;
+  return CPU_OK;
+}
+
+/**
+ * Describe an error code
+ */
+const char *cpu_error_string(CpuError error) {
+  switch (error) {
+  case CPU_OK:
+    return "No error";
+  case CPU_ERR_PROGRAM_SIZE:
+    return "Program too large or invalid start address";
+  case CPU_ERR_MEMORY_BOUNDS:
+    return "Memory access out of bounds";
+  case CPU_ERR_STACK_OVERFLOW:
+    return "Stack overflow";
+  case CPU_ERR_STACK_UNDERFLOW:
+    return "Stack underflow";
+  case CPU_ERR_DIVIDE_BY_ZERO:
+    return "Divide by zero";
+  case CPU_ERR_UNKNOWN_OPCODE:
+    return "Unknown opcode";
+  case CPU_ERR_ATOMIC_ADDRESS:
+    return "Invalid atomic access";
+  case CPU_ERR_WFI_NO_SOURCE:
+    return "WFI with no interrupt source";
+  case CPU_ERR_BANK_SELECT:
+    return "Bank select out of range";
+  case CPU_ERR_HOST_IO:
+    return "Host I/O error";
+  default:
+    return "Unknown error";
+  }
+}
+
+/**
+ * Insert id into a list of the n highest scores, highest first; an equal
+ * score keeps the earlier id ahead. Returns the new length.
+ */
+int cpu_top_insert(uint32_t *top, uint64_t *scores, int found, int n,
+                   uint32_t id, uint64_t score) {
+  int pos = found < n ? found++ : n;
+  while (pos > 0 && scores[pos - 1] < score) {
+    if (pos < n) {
+      top[pos] = top[pos - 1];
+      scores[pos] = scores[pos - 1];
+    }
+    pos--;
+  }
+  if (pos < n) {
+    top[pos] = id;
+    scores[pos] = score;
+  }
+  return found;
+}
+
+/**
+ * Format a message for the host's log sink. Nothing is formatted when the
+ * host has no sink, so debug tracing costs only the cpu->debug test.
+ */
+static void cpu_vlog(const CPU *cpu, CpuLogLevel level, const char *format,
+                     va_list args) {
+  if (!cpu->host || !cpu->host->log) {
+    return;
+  }
+  char message[256];
+  vsnprintf(message, sizeof(message), format, args);
+  cpu->host->log(cpu->host->ctx, level, message);
+}
+
+/**
+ * Send a message to the host's log sink
+ */
+void cpu_log(const CPU *cpu, CpuLogLevel level, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  cpu_vlog(cpu, level, format, args);
+  va_end(args);
+}
+
+/*
+ * ============================================================================
+ * FAULTS
+ * ============================================================================
+ * A fault is raised with cpu_fault while an instruction executes and taken
+ * by cpu_step when it returns. The instruction is rolled back (PC, SP and
+ * flags restored; memory and register writes never happen), then the CPU
+ * either enters the handler at fault_vector like an interrupt, with PC and
+ * FLAGS pushed, or stops with CPU_STOP_FAULT. RETI from the handler retries
+ * the faulting instruction unless the handler advanced the saved PC.
+ */
+
+/**
+ * Raise a fault from the executing instruction
+ */
+void cpu_fault(CPU *cpu, CpuError cause, uint16_t address) {
+  cpu->fault.cause = cause;
+  cpu->fault.address = address;
+  cpu->aborted = true;
+}
+
+/**
+ * Abandon the executing instruction until console input arrives
+ */
+void cpu_wait_input(CPU *cpu) {
+  cpu->aborted = true;
+  cpu->input_wait = true;
+}
+
+/**
+ * Report a fault that stopped the CPU
+ */
+static void cpu_log_fault(const CPU *cpu) {
+  const CpuFault *f = &cpu->fault;
+  const char *what = cpu_error_string(f->cause);
+  switch (f->cause) {
+  case CPU_ERR_MEMORY_BOUNDS:
+  case CPU_ERR_ATOMIC_ADDRESS:
+    cpu_log(cpu, CPU_LOG_ERROR, "%s at PC=0x%04X (address 0x%04X)", what,
+            f->pc, f->address);
+    break;
+  case CPU_ERR_STACK_OVERFLOW:
+  case CPU_ERR_STACK_UNDERFLOW:
+    cpu_log(cpu, CPU_LOG_ERROR, "%s at PC=0x%04X (SP=0x%04X)", what, f->pc,
+            f->address);
+    break;
+  default:
+    cpu_log(cpu, CPU_LOG_ERROR, "%s at PC=0x%04X", what, f->pc);
+    break;
+  }
+}
+
+/**
+ * Take the pending fault at pc, given the SP and flags it started with
+ */
+static void cpu_trap(CPU *cpu, uint16_t pc, uint16_t sp, uint8_t flags) {
+  cpu->aborted = false;
+  cpu->fault.pc = pc;
+  cpu->pc = pc;
+  cpu->sp = sp;
+  cpu->flags = flags;
+
+  // A fault inside the handler, or with no room for its frame, is fatal
+  if (cpu->fault_vector != 0 && !(flags & FLAG_FAULT) &&
+      cpu->sp >= cpu->stack_limit + 4) {
+    cpu_push(cpu, pc);
+    cpu_push(cpu, flags);
+    cpu->flags |= FLAG_FAULT | FLAG_INTERRUPT;
+    cpu->pc = cpu->fault_vector;
+    return;
+  }
+
+  cpu_log_fault(cpu);
+  cpu->stop = CPU_STOP_FAULT;
+  cpu->halted = true;
 }
 
 /**
@@ -80,11 +294,68 @@ const char *cpu_opcode_to_string(Opcode op) {
     return "BLT";
   case OP_HALT:
     return "HALT";
+  case OP_RETI:
+    return "RETI";
+  case OP_WFI:
+    return "WFI";
+  case OP_CALL:
+    return "CALL";
+  case OP_RET:
+    return "RET";
+  case OP_PUSH:
+    return "PUSH";
+  case OP_POP:
+    return "POP";
+  case OP_MUL:
+    return "MUL";
+  case OP_MULH:
+    return "MULH";
+  case OP_MULHU:
+    return "MULHU";
+  case OP_DIVU:
+    return "DIVU";
+  case OP_DIV:
+    return "DIV";
+  case OP_MODU:
+    return "MODU";
+  case OP_MOD:
+    return "MOD";
+  case OP_SHL:
+    return "SHL";
+  case OP_SHR:
+    return "SHR";
+  case OP_SAR:
+    return "SAR";
+  case OP_SHLI:
+    return "SHLI";
+  case OP_SHRI:
+    return "SHRI";
+  case OP_SARI:
+    return "SARI";
+  case OP_CAS:
+    return "CAS";
+  case OP_FADD:
+    return "FADD";
+  case OP_SWAP:
+    return "SWAP";
   default:
     return "UNKNOWN";
   }
 }
 
+/**
+ * Hand a finished step to the timing model, if there is one. cycles is the
+ * cycle count the step started from.
+ */
+static void cpu_retire(CPU *cpu, uint16_t pc, uint64_t cycles,
+                       BranchOutcome branch) {
+  if (cpu->pipeline) {
+    uint32_t memory = cpu->cache ? cache_take_stall(cpu->cache) : 0;
+    pipeline_retire(cpu->pipeline, pc, cpu->ir, cpu->pc,
+                    cpu->cycle_count - cycles - 1, memory, branch);
+  }
+}
+
 /**
  * Execute one instruction cycle (Fetch-Decode-Execute)
  */
@@ -93,27 +364,99 @@ void cpu_step(CPU *cpu) {
     return;
   }
 
+  uint16_t pc = cpu->pc;
+  uint16_t sp = cpu->sp;
+  uint8_t flags = cpu->flags;
+  uint64_t cycles = cpu->cycle_count;
+  cpu->input_wait = false;
+
   // FETCH
-  cpu->ir = mem_read_word(cpu, cpu->pc);
+  if (cpu->cache) {
+    cpu->cache->pc = pc;
+  }
+  cpu->ir = mem_fetch_word(cpu, cpu->pc);
   if (cpu->debug) {
-    printf("FETCH: PC=0x%04X IR=0x%04X\n", cpu->pc, cpu->ir);
+    cpu_log(cpu, CPU_LOG_DEBUG, "FETCH: PC=0x%04X IR=0x%04X", cpu->pc,
+            cpu->ir);
   }
   cpu->pc += 2; // Move to next instruction
 
   // DECODE & EXECUTE (delegated to Control Unit)
-  cu_execute(cpu, cpu->ir);
+  if (!cpu->aborted) {
+    cu_execute(cpu, cpu->ir);
+  }
+  if (cpu->input_wait) {
+    // Not started: no cycle is charged and the step is repeated later
+    cpu->aborted = false;
+    cpu->pc = pc;
+    cpu->sp = sp;
+    cpu->flags = flags;
+    return;
+  }
+  if (cpu->aborted) {
+    // The faulting instruction still took its slot, and fault entry (or
+    // the stop) flushes the pipeline like a mispredicted branch
+    cpu_trap(cpu, pc, sp, flags);
+    cpu->cycle_count++;
+    cpu_retire(cpu, pc, cycles, BRANCH_MISPREDICT);
+    return;
+  }
+  // Branches leave the flags alone, so these are the ones they tested
+  BranchOutcome branch =
+      cpu->predictor
+          ? predictor_observe(cpu->predictor, pc, cpu->ir, cpu->flags)
+          : BRANCH_NONE;
 
   // Update cycle counter
   cpu->cycle_count++;
+
+  // Timer and interrupt delivery between instructions
+  if (irq_active(cpu)) {
+    irq_tick(cpu);
+    if (cpu->aborted) {
+      cpu_trap(cpu, cpu->pc, cpu->sp, cpu->flags); // Interrupt entry
+    }
+  }
+
+  cpu_retire(cpu, pc, cycles, branch);
+}
+
+/**
+ * Push a word onto the stack
+ */
+void cpu_push(CPU *cpu, uint16_t value) {
+  if (cpu->sp < cpu->stack_limit + 2) {
+    cpu_fault(cpu, CPU_ERR_STACK_OVERFLOW, cpu->sp);
+    return;
+  }
+  cpu->sp -= 2;
+  mem_write_word(cpu, cpu->sp, value);
+}
+
+/**
+ * Pop a word from the stack
+ */
+uint16_t cpu_pop(CPU *cpu) {
+  if (cpu->sp < cpu->stack_limit || (uint32_t)cpu->sp + 2 > cpu->stack_top) {
+    cpu_fault(cpu, CPU_ERR_STACK_UNDERFLOW, cpu->sp);
+    return 0;
+  }
+  uint16_t value = mem_read_word(cpu, cpu->sp);
+  cpu->sp += 2;
+  return value;
 }
 
 /**
- * Run CPU until halted
+ * Run CPU until it halts or needs console input the host does not have yet
  */
-void cpu_run(CPU *cpu) {
+CpuStop cpu_run(CPU *cpu) {
   while (!cpu->halted) {
     cpu_step(cpu);
+    if (cpu->input_wait) {
+      return CPU_STOP_INPUT;
+    }
   }
+  return cpu->stop;
 }
 
 /**
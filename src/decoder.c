@@ -1,5 +1,103 @@
 #include "../include/decoder.h"
 
+/**
+ * Decode the extended page under OP_NOP
+ */
+static Opcode decode_extended(uint16_t raw) {
+  if (raw & XOP_CALL_BIT) {
+    return OP_CALL;
+  }
+
+  switch ((raw >> XOP_SHIFT) & XOP_MASK) {
+  case XOP_NOP:
+    return OP_NOP;
+  case XOP_RETI:
+    return OP_RETI;
+  case XOP_WFI:
+    return OP_WFI;
+  case XOP_RET:
+    return OP_RET;
+  case XOP_PUSH:
+    return OP_PUSH;
+  case XOP_POP:
+    return OP_POP;
+  default:
+    return OP_INVALID;
+  }
+}
+
+/**
+ * Decode the function code of a Format 1 instruction
+ */
+static Opcode decode_funct(Opcode base, uint16_t raw) {
+  uint8_t funct = raw & FUNCT_MASK;
+  if (funct == 0) {
+    return base;
+  }
+
+  switch (base) {
+  case OP_ADD:
+    switch (funct) {
+    case FUNCT_MUL:
+      return OP_MUL;
+    case FUNCT_MULH:
+      return OP_MULH;
+    case FUNCT_MULHU:
+      return OP_MULHU;
+    }
+    break;
+  case OP_SUB:
+    switch (funct) {
+    case FUNCT_DIVU:
+      return OP_DIVU;
+    case FUNCT_DIV:
+      return OP_DIV;
+    case FUNCT_MODU:
+      return OP_MODU;
+    case FUNCT_MOD:
+      return OP_MOD;
+    }
+    break;
+  case OP_AND:
+    switch (funct) {
+    case FUNCT_SHL:
+      return OP_SHL;
+    case FUNCT_SHR:
+      return OP_SHR;
+    case FUNCT_SAR:
+      return OP_SAR;
+    }
+    break;
+  case OP_OR:
+    // Shift amount is 4 bits; bits 8-7 must be clear
+    if (raw & 0x0180) {
+      break;
+    }
+    switch (funct) {
+    case FUNCT_SHLI:
+      return OP_SHLI;
+    case FUNCT_SHRI:
+      return OP_SHRI;
+    case FUNCT_SARI:
+      return OP_SARI;
+    }
+    break;
+  case OP_XOR:
+    switch (funct) {
+    case FUNCT_CAS:
+      return OP_CAS;
+    case FUNCT_FADD:
+      return OP_FADD;
+    case FUNCT_SWAP:
+      return OP_SWAP;
+    }
+    break;
+  default:
+    break;
+  }
+  return OP_INVALID;
+}
+
 /**
  * Decode a raw 16-bit instruction
  */
@@ -7,6 +105,13 @@ Instruction decode_instruction(uint16_t raw) {
   Instruction inst;
 
   inst.opcode = (raw >> 12) & 0xF;
+  if (inst.opcode == OP_NOP) {
+    inst.opcode = decode_extended(raw);
+  } else if (inst.opcode == OP_ADD || inst.opcode == OP_SUB ||
+             inst.opcode == OP_AND || inst.opcode == OP_OR ||
+             inst.opcode == OP_XOR) {
+    inst.opcode = decode_funct(inst.opcode, raw);
+  }
   inst.rd = (raw >> 9) & 0x7;
   inst.rs1 = (raw >> 6) & 0x7;
   inst.rs2 = (raw >> 3) & 0x7;
@@ -23,6 +128,13 @@ Instruction decode_instruction(uint16_t raw) {
     inst.imm12 |= 0xF000;
   }
 
+  // Sign extend 11-bit CALL word offset and scale to bytes
+  inst.call_offset = (raw & 0x7FF);
+  if (inst.call_offset & 0x400) {
+    inst.call_offset |= 0xF800;
+  }
+  inst.call_offset *= 2;
+
   // Sign extend 6-bit offset
   inst.offset6 = (raw & 0x3F);
   if (inst.offset6 & 0x20) {
@@ -0,0 +1,1110 @@
+#include "../include/disasm.h"
+#include "../include/cpu.h"
+#include "../include/decoder.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * ============================================================================
+ * DISASSEMBLER
+ * ============================================================================
+ * Code is found by recursive descent from the entry point, so data placed
+ * between routines (the LI literal pool, strings, tables) is never decoded.
+ * CALL targets start functions of their own. Handlers installed by storing
+ * a constant to IO_IRQ_VECTOR or IO_FAULT_VECTOR are found by the constant
+ * propagation that also resolves MMIO addresses, and the analysis is run
+ * again with them as extra roots. Jumps through registers do not exist in
+ * this ISA, so every edge is known statically apart from RET and RETI.
+ */
+
+#define WORD_ROOT 0x4 // word_kind bit: function entry or handler
+
+typedef enum {
+  FLOW_NEXT,   // Falls through to the next word
+  FLOW_BRANCH, // Conditional: target or next
+  FLOW_JUMP,   // Target only
+  FLOW_CALL,   // Target, then the next word on return
+  FLOW_STOP    // RET, RETI, HALT or an invalid encoding
+} Flow;
+
+// Register values known on entry to a block
+typedef struct {
+  uint16_t value[8];
+  uint8_t known; // Bit per register
+  bool reached;
+} RegState;
+
+// Edges without CALLs, in both directions, as compressed adjacency lists.
+// Node block_count is a virtual root whose successors are the roots.
+typedef struct {
+  uint32_t *succ_start;
+  uint32_t *succ;
+  uint32_t *pred_start;
+  uint32_t *pred;
+  uint32_t *rpo;     // Nodes in reverse postorder, virtual root first
+  uint32_t *rpo_num; // Position of each node in rpo
+  uint32_t *idom;
+} Graph;
+
+static const struct {
+  uint16_t address;
+  uint16_t span;
+  const char *name;
+} io_names[] = {
+    {IO_CONSOLE_OUT, 1, "CONSOLE_OUT"},
+    {IO_CONSOLE_IN, 1, "CONSOLE_IN"},
+    {IO_TIMER_CTRL, 1, "TIMER_CTRL"},
+    {IO_TIMER_VAL, 1, "TIMER_VAL"},
+    {IO_CONSOLE_STATUS, 1, "CONSOLE_STATUS"},
+    {IO_DMA_SRC, 2, "DMA_SRC"},
+    {IO_DMA_DST, 2, "DMA_DST"},
+    {IO_DMA_LEN, 2, "DMA_LEN"},
+    {IO_DMA_CTRL, 2, "DMA_CTRL"},
+    {IO_IRQ_ENABLE, 2, "IRQ_ENABLE"},
+    {IO_IRQ_PENDING, 2, "IRQ_PENDING"},
+    {IO_IRQ_VECTOR, 2, "IRQ_VECTOR"},
+    {IO_FAULT_VECTOR, 2, "FAULT_VECTOR"},
+    {IO_FAULT_CAUSE, 2, "FAULT_CAUSE"},
+    {IO_FAULT_PC, 2, "FAULT_PC"},
+    {IO_FAULT_ADDR, 2, "FAULT_ADDR"},
+    {IO_CORE_ID, 2, "CORE_ID"},
+    {IO_CORE_COUNT, 2, "CORE_COUNT"},
+    {IO_BANK_SELECT, 2 * MEM_BANKED_PAGES, "BANK_SELECT"},
+    {IO_BANK_COUNT, 2, "BANK_COUNT"},
+};
+
+static const char *const edge_names[] = {"fall", "taken", "jump", "call"};
+
+/*
+ * ============================================================================
+ * DECODING
+ * ============================================================================
+ */
+
+/**
+ * IO register name, or NULL outside the known device registers
+ */
+const char *disasm_io_name(uint16_t address) {
+  for (size_t i = 0; i < sizeof(io_names) / sizeof(io_names[0]); i++) {
+    if (address >= io_names[i].address &&
+        address < io_names[i].address + io_names[i].span) {
+      return io_names[i].name;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * How control leaves an instruction
+ */
+static Flow disasm_flow(Opcode op) {
+  switch (op) {
+  case OP_BEQ:
+  case OP_BNE:
+  case OP_BLT:
+    return FLOW_BRANCH;
+  case OP_BRANCH:
+    return FLOW_JUMP;
+  case OP_CALL:
+    return FLOW_CALL;
+  case OP_RET:
+  case OP_RETI:
+  case OP_HALT:
+  case OP_INVALID:
+    return FLOW_STOP;
+  default:
+    return FLOW_NEXT;
+  }
+}
+
+/**
+ * Destination of a branch or CALL at address
+ */
+static uint16_t disasm_target(const Instruction *inst, uint16_t address) {
+  int16_t offset = inst->opcode == OP_CALL ? inst->call_offset : inst->imm12;
+  return (uint16_t)(address + 2 + offset);
+}
+
+/**
+ * Whether an instruction's bits are exactly what the assembler emits for
+ * it. Bits the CPU ignores (HALT's low 12, RET's low 8, ...) only survive
+ * a listing written as .word.
+ */
+static bool disasm_canonical(const Instruction *inst, uint16_t raw) {
+  switch (inst->opcode) {
+  case OP_NOP:
+  case OP_HALT:
+    return (raw & 0x0FFF) == 0;
+  case OP_RETI:
+  case OP_WFI:
+  case OP_RET:
+    return (raw & 0x00FF) == 0;
+  case OP_PUSH:
+  case OP_POP:
+    return (raw & 0x00F8) == 0;
+  case OP_INVALID:
+    return false;
+  default:
+    return true;
+  }
+}
+
+/**
+ * Assembler syntax for one instruction at address
+ */
+void disasm_format(uint16_t raw, uint16_t address, char *out, size_t len) {
+  Instruction inst = decode_instruction(raw);
+  const char *name = cpu_opcode_to_string(inst.opcode);
+
+  if (!disasm_canonical(&inst, raw)) {
+    snprintf(out, len, ".word 0x%04X", raw);
+    return;
+  }
+
+  switch (inst.opcode) {
+  case OP_ADDI:
+  case OP_SUBI:
+  case OP_LOADI:
+    snprintf(out, len, "%s R%d, #%d", name, inst.rd, inst.imm9);
+    break;
+  case OP_LOAD:
+  case OP_STORE:
+    if (inst.offset6 == 0) {
+      snprintf(out, len, "%s R%d, [R%d]", name, inst.rd, inst.rs1);
+    } else {
+      snprintf(out, len, "%s R%d, [R%d, %d]", name, inst.rd, inst.rs1,
+               inst.offset6);
+    }
+    break;
+  case OP_BRANCH:
+  case OP_BEQ:
+  case OP_BNE:
+  case OP_BLT:
+  case OP_CALL:
+    snprintf(out, len, "%s L%04X", name, disasm_target(&inst, address));
+    break;
+  case OP_PUSH:
+  case OP_POP:
+    snprintf(out, len, "%s R%d", name, raw & 0x7);
+    break;
+  case OP_SHLI:
+  case OP_SHRI:
+  case OP_SARI:
+    snprintf(out, len, "%s R%d, #%d", name, inst.rd, (raw >> 3) & 0xF);
+    break;
+  case OP_CAS:
+  case OP_FADD:
+  case OP_SWAP:
+    snprintf(out, len, "%s R%d, [R%d], R%d", name, inst.rd, inst.rs1,
+             inst.rs2);
+    break;
+  case OP_NOP:
+  case OP_HALT:
+  case OP_RET:
+  case OP_RETI:
+  case OP_WFI:
+    snprintf(out, len, "%s", name);
+    break;
+  default: // Three-register ALU operations
+    snprintf(out, len, "%s R%d, R%d, R%d", name, inst.rd, inst.rs1, inst.rs2);
+    break;
+  }
+}
+
+/*
+ * ============================================================================
+ * BLOCK DISCOVERY
+ * ============================================================================
+ */
+
+/**
+ * Whether a whole word at address lies inside the image
+ */
+static bool disasm_in_image(const DisasmProgram *prog, uint32_t address) {
+  return !(address & 1) && address + 1 < prog->size;
+}
+
+/**
+ * Little-endian word of the image
+ */
+static uint16_t disasm_word(const DisasmProgram *prog, uint32_t address) {
+  return prog->image[address] | (prog->image[address + 1] << 8);
+}
+
+/**
+ * Whether a branch at address has a target the listing can name
+ */
+static bool disasm_target_known(const DisasmProgram *prog, uint16_t raw,
+                                uint16_t address) {
+  Instruction inst = decode_instruction(raw);
+  uint16_t target = disasm_target(&inst, address);
+  return disasm_in_image(prog, target) &&
+         (prog->word_kind[target / 2] & DISASM_WORD_LABEL);
+}
+
+/**
+ * Mark every word reachable from a root as code, and branch targets and
+ * return sites as labels
+ */
+static bool disasm_discover(DisasmProgram *prog) {
+  uint32_t words = prog->size / 2;
+  uint32_t *stack = malloc((3 * words + 1) * sizeof(uint32_t));
+  if (!stack) {
+    return false;
+  }
+
+  uint32_t top = 0;
+  for (uint32_t w = 0; w < words; w++) {
+    prog->word_kind[w] &= ~DISASM_WORD_CODE;
+    if (prog->word_kind[w] & WORD_ROOT) {
+      stack[top++] = w * 2;
+    }
+  }
+
+  while (top > 0) {
+    uint32_t address = stack[--top];
+    while (disasm_in_image(prog, address) &&
+           !(prog->word_kind[address / 2] & DISASM_WORD_CODE)) {
+      prog->word_kind[address / 2] |= DISASM_WORD_CODE;
+      Instruction inst = decode_instruction(disasm_word(prog, address));
+      Flow flow = disasm_flow(inst.opcode);
+
+      if (flow == FLOW_BRANCH || flow == FLOW_JUMP || flow == FLOW_CALL) {
+        uint16_t target = disasm_target(&inst, address);
+        if (disasm_in_image(prog, target)) {
+          prog->word_kind[target / 2] |=
+              DISASM_WORD_LABEL | (flow == FLOW_CALL ? WORD_ROOT : 0);
+          stack[top++] = target;
+        }
+      }
+      if (flow == FLOW_BRANCH || flow == FLOW_CALL) {
+        if (disasm_in_image(prog, address + 2)) {
+          prog->word_kind[address / 2 + 1] |= DISASM_WORD_LABEL;
+          stack[top++] = address + 2;
+        }
+      }
+      if (flow != FLOW_NEXT) {
+        break;
+      }
+      address += 2;
+    }
+  }
+
+  free(stack);
+  return true;
+}
+
+/**
+ * Add an edge to the block starting at address, if it is code
+ */
+static void disasm_add_edge(DisasmProgram *prog, DisasmBlock *block,
+                            uint32_t address, DisasmEdgeKind kind) {
+  if (disasm_in_image(prog, address) &&
+      (prog->word_kind[address / 2] & DISASM_WORD_CODE)) {
+    block->succ[block->succ_count].block = prog->block_of[address / 2];
+    block->succ[block->succ_count].kind = kind;
+    block->succ_count++;
+  }
+}
+
+/**
+ * Split the code into blocks at labels and after control transfers, then
+ * link them
+ */
+static void disasm_build_blocks(DisasmProgram *prog) {
+  uint32_t words = prog->size / 2;
+  bool open = false;
+
+  prog->block_count = 0;
+  for (uint32_t w = 0; w < words; w++) {
+    uint8_t kind = prog->word_kind[w];
+    prog->block_of[w] = DISASM_NONE;
+    if (!(kind & DISASM_WORD_CODE)) {
+      open = false;
+      continue;
+    }
+    if (!open || (kind & (DISASM_WORD_LABEL | WORD_ROOT))) {
+      DisasmBlock *block = &prog->blocks[prog->block_count++];
+      memset(block, 0, sizeof(DisasmBlock));
+      block->start = w * 2;
+      block->root = kind & WORD_ROOT;
+      block->idom = DISASM_NONE;
+      block->loop = DISASM_NONE;
+      open = true;
+    }
+    DisasmBlock *block = &prog->blocks[prog->block_count - 1];
+    block->end = w * 2 + 2;
+    block->insns++;
+    prog->block_of[w] = prog->block_count - 1;
+
+    Opcode op = decode_instruction(disasm_word(prog, w * 2)).opcode;
+    open = disasm_flow(op) == FLOW_NEXT;
+  }
+
+  for (uint32_t b = 0; b < prog->block_count; b++) {
+    DisasmBlock *block = &prog->blocks[b];
+    uint16_t last = block->end - 2;
+    Instruction inst = decode_instruction(disasm_word(prog, last));
+    uint16_t target = disasm_target(&inst, last);
+
+    switch (disasm_flow(inst.opcode)) {
+    case FLOW_NEXT:
+      disasm_add_edge(prog, block, block->end, DISASM_EDGE_FALL);
+      break;
+    case FLOW_BRANCH:
+      disasm_add_edge(prog, block, target, DISASM_EDGE_TAKEN);
+      disasm_add_edge(prog, block, block->end, DISASM_EDGE_FALL);
+      break;
+    case FLOW_JUMP:
+      disasm_add_edge(prog, block, target, DISASM_EDGE_JUMP);
+      break;
+    case FLOW_CALL:
+      disasm_add_edge(prog, block, target, DISASM_EDGE_CALL);
+      disasm_add_edge(prog, block, block->end, DISASM_EDGE_FALL);
+      break;
+    case FLOW_STOP:
+      break;
+    }
+  }
+}
+
+/*
+ * ============================================================================
+ * DOMINATORS AND LOOPS
+ * ============================================================================
+ * Dominators use the iterative algorithm of Cooper, Harvey and Kennedy over
+ * intraprocedural edges. A virtual root joins the roots, so a block inside
+ * a function is dominated by the function's entry, and the return site of
+ * a CALL by the block that made it.
+ */
+
+/**
+ * Build adjacency lists without CALL edges and number nodes in reverse
+ * postorder
+ */
+static bool graph_init(Graph *g, const DisasmProgram *prog) {
+  uint32_t n = prog->block_count;
+  memset(g, 0, sizeof(Graph));
+  g->succ_start = calloc(n + 2, sizeof(uint32_t));
+  g->succ = malloc((2 * n + n + 1) * sizeof(uint32_t));
+  g->pred_start = calloc(n + 2, sizeof(uint32_t));
+  g->pred = malloc((2 * n + n + 1) * sizeof(uint32_t));
+  g->rpo = malloc((n + 1) * sizeof(uint32_t));
+  g->rpo_num = malloc((n + 1) * sizeof(uint32_t));
+  g->idom = malloc((n + 1) * sizeof(uint32_t));
+  uint32_t *stack = malloc((n + 1) * sizeof(uint32_t));
+  uint32_t *next = calloc(n + 1, sizeof(uint32_t));
+  if (!g->succ_start || !g->succ || !g->pred_start || !g->pred || !g->rpo ||
+      !g->rpo_num || !g->idom || !stack || !next) {
+    free(stack);
+    free(next);
+    return false;
+  }
+
+  // Count, then fill, both directions
+  for (uint32_t b = 0; b <= n; b++) {
+    if (b == n) {
+      for (uint32_t r = 0; r < n; r++) {
+        if (prog->blocks[r].root) {
+          g->succ_start[n + 1]++;
+          g->pred_start[r + 1]++;
+        }
+      }
+      continue;
+    }
+    for (uint32_t i = 0; i < prog->blocks[b].succ_count; i++) {
+      const DisasmEdge *e = &prog->blocks[b].succ[i];
+      if (e->kind != DISASM_EDGE_CALL) {
+        g->succ_start[b + 1]++;
+        g->pred_start[e->block + 1]++;
+      }
+    }
+  }
+  for (uint32_t b = 0; b <= n; b++) {
+    g->succ_start[b + 1] += g->succ_start[b];
+    g->pred_start[b + 1] += g->pred_start[b];
+  }
+  uint32_t *pred_fill = next; // Reused below as the DFS cursor
+  for (uint32_t b = 0; b <= n; b++) {
+    uint32_t fill = g->succ_start[b];
+    for (uint32_t i = 0; b < n && i < prog->blocks[b].succ_count; i++) {
+      const DisasmEdge *e = &prog->blocks[b].succ[i];
+      if (e->kind != DISASM_EDGE_CALL) {
+        g->succ[fill++] = e->block;
+        g->pred[g->pred_start[e->block] + pred_fill[e->block]++] = b;
+      }
+    }
+    for (uint32_t r = 0; b == n && r < n; r++) {
+      if (prog->blocks[r].root) {
+        g->succ[fill++] = r;
+        g->pred[g->pred_start[r] + pred_fill[r]++] = n;
+      }
+    }
+  }
+
+  // Iterative depth-first search for the postorder
+  memset(next, 0, (n + 1) * sizeof(uint32_t));
+  for (uint32_t b = 0; b <= n; b++) {
+    g->rpo_num[b] = DISASM_NONE;
+  }
+  uint32_t top = 0;
+  uint32_t post = n + 1;
+  stack[top++] = n;
+  g->rpo_num[n] = 0;
+  while (top > 0) {
+    uint32_t node = stack[top - 1];
+    if (g->succ_start[node] + next[node] < g->succ_start[node + 1]) {
+      uint32_t child = g->succ[g->succ_start[node] + next[node]++];
+      if (g->rpo_num[child] == DISASM_NONE) {
+        g->rpo_num[child] = 0;
+        stack[top++] = child;
+      }
+    } else {
+      g->rpo[--post] = node;
+      top--;
+    }
+  }
+  for (uint32_t i = 0; i <= n; i++) {
+    g->rpo_num[g->rpo[i]] = i;
+  }
+
+  free(stack);
+  free(next);
+  return true;
+}
+
+/**
+ * Release the adjacency lists
+ */
+static void graph_free(Graph *g) {
+  free(g->succ_start);
+  free(g->succ);
+  free(g->pred_start);
+  free(g->pred);
+  free(g->rpo);
+  free(g->rpo_num);
+  free(g->idom);
+}
+
+/**
+ * Nearest common dominator of two processed nodes
+ */
+static uint32_t graph_intersect(const Graph *g, uint32_t a, uint32_t b) {
+  while (a != b) {
+    while (g->rpo_num[a] > g->rpo_num[b]) {
+      a = g->idom[a];
+    }
+    while (g->rpo_num[b] > g->rpo_num[a]) {
+      b = g->idom[b];
+    }
+  }
+  return a;
+}
+
+/**
+ * Compute immediate dominators until they stop changing
+ */
+static void graph_dominators(Graph *g, uint32_t n) {
+  for (uint32_t b = 0; b <= n; b++) {
+    g->idom[b] = DISASM_NONE;
+  }
+  g->idom[n] = n;
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (uint32_t i = 1; i <= n; i++) {
+      uint32_t b = g->rpo[i];
+      uint32_t idom = DISASM_NONE;
+      for (uint32_t p = g->pred_start[b]; p < g->pred_start[b + 1]; p++) {
+        uint32_t pred = g->pred[p];
+        if (g->idom[pred] == DISASM_NONE) {
+          continue;
+        }
+        idom = idom == DISASM_NONE ? pred : graph_intersect(g, pred, idom);
+      }
+      if (g->idom[b] != idom) {
+        g->idom[b] = idom;
+        changed = true;
+      }
+    }
+  }
+}
+
+/**
+ * Whether block a dominates block b
+ */
+static bool graph_dominates(const Graph *g, uint32_t a, uint32_t b,
+                            uint32_t n) {
+  while (b != a && b != n) {
+    b = g->idom[b];
+  }
+  return b == a;
+}
+
+/**
+ * Find natural loops. Headers are visited in reverse postorder, so a loop
+ * is recorded after every loop that contains it and each block ends up
+ * pointing at its innermost loop.
+ */
+static bool disasm_find_loops(DisasmProgram *prog, const Graph *g) {
+  uint32_t n = prog->block_count;
+  uint32_t *work = malloc((n + 1) * sizeof(uint32_t));
+  uint32_t *mark = malloc((n + 1) * sizeof(uint32_t));
+  prog->loops = malloc((n + 1) * sizeof(DisasmLoop));
+  if (!work || !mark || !prog->loops) {
+    free(work);
+    free(mark);
+    return false;
+  }
+  for (uint32_t b = 0; b < n; b++) {
+    mark[b] = DISASM_NONE;
+  }
+
+  prog->loop_count = 0;
+  for (uint32_t i = 1; i <= n; i++) {
+    uint32_t header = g->rpo[i];
+    uint32_t top = 0;
+    uint32_t latches = 0;
+    for (uint32_t p = g->pred_start[header]; p < g->pred_start[header + 1];
+         p++) {
+      uint32_t pred = g->pred[p];
+      if (pred != n && graph_dominates(g, header, pred, n)) {
+        latches++;
+        work[top++] = pred;
+      }
+    }
+    if (latches == 0) {
+      continue;
+    }
+
+    uint32_t index = prog->loop_count++;
+    DisasmLoop *loop = &prog->loops[index];
+    memset(loop, 0, sizeof(DisasmLoop));
+    loop->header = header;
+    loop->latches = latches;
+    loop->parent = prog->blocks[header].loop;
+    loop->depth =
+        loop->parent == DISASM_NONE ? 1 : prog->loops[loop->parent].depth + 1;
+
+    // Walk back from the latches; the header stops the walk
+    mark[header] = index;
+    for (uint32_t t = 0; t < top; t++) {
+      mark[work[t]] = index;
+    }
+    for (uint32_t t = 0; t < top; t++) {
+      uint32_t b = work[t];
+      if (b == header) {
+        continue;
+      }
+      for (uint32_t p = g->pred_start[b]; p < g->pred_start[b + 1]; p++) {
+        uint32_t pred = g->pred[p];
+        if (pred != n && mark[pred] != index) {
+          mark[pred] = index;
+          work[top++] = pred;
+        }
+      }
+    }
+
+    for (uint32_t b = 0; b < n; b++) {
+      if (mark[b] == index) {
+        prog->blocks[b].loop = index;
+        prog->blocks[b].loop_depth = loop->depth;
+        loop->blocks++;
+        loop->insns += prog->blocks[b].insns;
+      }
+    }
+  }
+
+  free(work);
+  free(mark);
+  return true;
+}
+
+/*
+ * ============================================================================
+ * CONSTANT PROPAGATION
+ * ============================================================================
+ * Register values are tracked through LOADI, the immediate forms, simple
+ * ALU operations and LI literal-pool loads (LOAD Rd, [Rd] from data in the
+ * image), which covers every way the assembler builds an address. A value
+ * is known on entry to a block only if every predecessor agrees on it.
+ * Registers are zero at the entry point; other roots and return sites start
+ * with nothing known.
+ */
+
+/**
+ * Apply one instruction to the tracked registers. When recording, note
+ * device accesses and any handler vectors installed.
+ */
+static bool disasm_step(DisasmProgram *prog, RegState *s, uint16_t address,
+                        bool record) {
+  uint16_t raw = disasm_word(prog, address);
+  Instruction inst = decode_instruction(raw);
+  uint8_t rd_bit = 1u << inst.rd;
+  bool known1 = s->known & (1u << inst.rs1);
+  bool known2 = s->known & (1u << inst.rs2);
+  uint16_t a = s->value[inst.rs1];
+  uint16_t b = s->value[inst.rs2];
+  uint16_t result = 0;
+  bool known = false;
+
+  switch (inst.opcode) {
+  case OP_LOADI:
+    result = (uint16_t)inst.imm9;
+    known = true;
+    break;
+  case OP_ADDI:
+  case OP_SUBI:
+    result = inst.opcode == OP_ADDI ? s->value[inst.rd] + inst.imm9
+                                    : s->value[inst.rd] - inst.imm9;
+    known = s->known & rd_bit;
+    break;
+  case OP_SHLI:
+  case OP_SHRI:
+  case OP_SARI: {
+    uint16_t value = s->value[inst.rd];
+    uint8_t amount = (raw >> 3) & 0xF;
+    result = inst.opcode == OP_SHLI   ? (uint16_t)(value << amount)
+             : inst.opcode == OP_SHRI ? (uint16_t)(value >> amount)
+                                      : (uint16_t)((int16_t)value >> amount);
+    known = s->known & rd_bit;
+    break;
+  }
+  case OP_ADD:
+  case OP_SUB:
+  case OP_AND:
+  case OP_OR:
+  case OP_XOR:
+  case OP_MUL:
+    result = inst.opcode == OP_ADD   ? a + b
+             : inst.opcode == OP_SUB ? a - b
+             : inst.opcode == OP_AND ? a & b
+             : inst.opcode == OP_OR  ? a | b
+             : inst.opcode == OP_XOR ? a ^ b
+                                     : (uint16_t)(a * b);
+    known = known1 && known2;
+    break;
+  case OP_LOAD:
+  case OP_STORE: {
+    uint16_t target = a + inst.offset6;
+    if (known1 && target >= IO_START && target <= IO_END && record) {
+      DisasmAccess *access = &prog->accesses[prog->access_count++];
+      access->pc = address;
+      access->address = target;
+      access->write = inst.opcode == OP_STORE;
+    }
+    if (inst.opcode == OP_STORE) {
+      uint16_t vector = s->value[inst.rd];
+      bool install = known1 && (s->known & rd_bit) &&
+                     (target == IO_IRQ_VECTOR || target == IO_FAULT_VECTOR);
+      if (record && install && disasm_in_image(prog, vector) &&
+          !(prog->word_kind[vector / 2] & WORD_ROOT)) {
+        prog->word_kind[vector / 2] |= WORD_ROOT | DISASM_WORD_LABEL;
+        return true;
+      }
+      return false;
+    }
+    if (known1 && inst.rs1 == inst.rd && inst.offset6 == 0 &&
+        disasm_in_image(prog, target) &&
+        !(prog->word_kind[target / 2] & DISASM_WORD_CODE)) {
+      result = disasm_word(prog, target);
+      known = true;
+    }
+    break;
+  }
+  case OP_POP:
+    s->known &= ~(1u << (raw & 0x7));
+    return false;
+  case OP_MULH:
+  case OP_MULHU:
+  case OP_DIVU:
+  case OP_DIV:
+  case OP_MODU:
+  case OP_MOD:
+  case OP_SHL:
+  case OP_SHR:
+  case OP_SAR:
+  case OP_CAS:
+  case OP_FADD:
+  case OP_SWAP:
+    break;
+  default: // Nothing written to a register
+    return false;
+  }
+
+  s->value[inst.rd] = result;
+  s->known = known ? s->known | rd_bit : s->known & ~rd_bit;
+  return false;
+}
+
+/**
+ * Merge a predecessor's exit state into a block's entry state
+ */
+static bool disasm_meet(RegState *in, const RegState *out) {
+  if (!in->reached) {
+    *in = *out;
+    in->reached = true;
+    return true;
+  }
+  uint8_t known = in->known & out->known;
+  for (int r = 0; r < 8; r++) {
+    if (in->value[r] != out->value[r]) {
+      known &= ~(1u << r);
+    }
+  }
+  if (known == in->known) {
+    return false;
+  }
+  in->known = known;
+  return true;
+}
+
+/**
+ * Propagate register values to a fixed point, then record each block's
+ * device accesses. Returns 1 if a new handler vector turned up, 0 if not,
+ * -1 if memory ran out.
+ */
+static int disasm_propagate(DisasmProgram *prog, const Graph *g) {
+  uint32_t n = prog->block_count;
+  RegState *in = calloc(n + 1, sizeof(RegState));
+  prog->accesses = malloc((prog->size / 2 + 1) * sizeof(DisasmAccess));
+  if (!in || !prog->accesses) {
+    free(in);
+    return -1;
+  }
+  for (uint32_t b = 0; b < n; b++) {
+    in[b].reached = prog->blocks[b].root;
+    if (prog->blocks[b].start == prog->entry) {
+      in[b].known = 0xFF;
+    }
+  }
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (uint32_t i = 1; i <= n; i++) {
+      uint32_t b = g->rpo[i];
+      const DisasmBlock *block = &prog->blocks[b];
+      if (!in[b].reached) {
+        continue;
+      }
+      RegState out = in[b];
+      for (uint16_t pc = block->start; pc < block->end; pc += 2) {
+        disasm_step(prog, &out, pc, false);
+      }
+      bool call = false;
+      for (uint32_t s = 0; s < block->succ_count; s++) {
+        call |= block->succ[s].kind == DISASM_EDGE_CALL;
+      }
+      if (call) {
+        out.known = 0; // The callee may change any register
+      }
+      for (uint32_t s = 0; s < block->succ_count; s++) {
+        const DisasmEdge *e = &block->succ[s];
+        if (e->kind != DISASM_EDGE_CALL && !prog->blocks[e->block].root) {
+          changed |= disasm_meet(&in[e->block], &out);
+        }
+      }
+    }
+  }
+
+  int found = 0;
+  prog->access_count = 0;
+  for (uint32_t b = 0; b < n; b++) {
+    DisasmBlock *block = &prog->blocks[b];
+    RegState s = in[b];
+    block->access_first = prog->access_count;
+    for (uint16_t pc = block->start; pc < block->end; pc += 2) {
+      if (disasm_step(prog, &s, pc, true)) {
+        found = 1;
+      }
+    }
+    block->access_count = prog->access_count - block->access_first;
+  }
+
+  free(in);
+  return found;
+}
+
+/*
+ * ============================================================================
+ * ANALYSIS
+ * ============================================================================
+ */
+
+/**
+ * Release the per-pass results so the analysis can run again
+ */
+static void disasm_reset(DisasmProgram *prog) {
+  free(prog->loops);
+  free(prog->accesses);
+  prog->loops = NULL;
+  prog->accesses = NULL;
+  prog->loop_count = 0;
+  prog->access_count = 0;
+}
+
+/**
+ * Recover blocks, edges, dominators and loops from an image loaded at 0
+ */
+bool disasm_analyze(DisasmProgram *prog, const uint8_t *image, uint32_t size,
+                    uint16_t entry) {
+  memset(prog, 0, sizeof(DisasmProgram));
+  prog->image = image;
+  prog->size = size;
+  prog->entry = entry;
+
+  uint32_t words = size / 2;
+  prog->word_kind = calloc(words + 1, 1);
+  prog->block_of = malloc((words + 1) * sizeof(uint32_t));
+  prog->blocks = malloc((words + 1) * sizeof(DisasmBlock));
+  if (!prog->word_kind || !prog->block_of || !prog->blocks) {
+    disasm_free(prog);
+    return false;
+  }
+  if (disasm_in_image(prog, entry)) {
+    prog->word_kind[entry / 2] |= WORD_ROOT | DISASM_WORD_LABEL;
+  }
+
+  // Each new handler vector is another root, so go round until none appear
+  int found = 1;
+  while (found == 1) {
+    Graph g;
+    disasm_reset(prog);
+    if (!disasm_discover(prog)) {
+      found = -1;
+      break;
+    }
+    disasm_build_blocks(prog);
+    if (!graph_init(&g, prog)) {
+      graph_free(&g);
+      found = -1;
+      break;
+    }
+    graph_dominators(&g, prog->block_count);
+    for (uint32_t b = 0; b < prog->block_count; b++) {
+      uint32_t idom = g.idom[b];
+      prog->blocks[b].idom = idom == prog->block_count ? DISASM_NONE : idom;
+    }
+    found = disasm_find_loops(prog, &g) ? disasm_propagate(prog, &g) : -1;
+    graph_free(&g);
+  }
+
+  if (found < 0) {
+    disasm_free(prog);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Release an analysis
+ */
+void disasm_free(DisasmProgram *prog) {
+  disasm_reset(prog);
+  free(prog->word_kind);
+  free(prog->block_of);
+  free(prog->blocks);
+  prog->word_kind = NULL;
+  prog->block_of = NULL;
+  prog->blocks = NULL;
+  prog->block_count = 0;
+}
+
+/*
+ * ============================================================================
+ * OUTPUT
+ * ============================================================================
+ */
+
+/**
+ * Text of the instruction at address, falling back to .word when a branch
+ * target has no label the listing defines
+ */
+static void disasm_text(const DisasmProgram *prog, uint16_t address,
+                        char *out, size_t len) {
+  uint16_t raw = disasm_word(prog, address);
+  Flow flow = disasm_flow(decode_instruction(raw).opcode);
+  if ((flow == FLOW_BRANCH || flow == FLOW_JUMP || flow == FLOW_CALL) &&
+      !disasm_target_known(prog, raw, address)) {
+    snprintf(out, len, ".word 0x%04X", raw);
+    return;
+  }
+  disasm_format(raw, address, out, len);
+}
+
+/**
+ * Comment line describing a block
+ */
+static void disasm_block_comment(const DisasmProgram *prog, uint32_t b,
+                                 FILE *out) {
+  const DisasmBlock *block = &prog->blocks[b];
+  fprintf(out, "; block %u: %u instruction%s", b, block->insns,
+          block->insns == 1 ? "" : "s");
+  if (block->root) {
+    fprintf(out, ", root");
+  }
+  if (block->loop != DISASM_NONE) {
+    const DisasmLoop *loop = &prog->loops[block->loop];
+    if (loop->header == b) {
+      fprintf(out, ", loop header (%u blocks, %u instructions)", loop->blocks,
+              loop->insns);
+    }
+    fprintf(out, ", depth %u", block->loop_depth);
+  }
+  fprintf(out, "\n");
+  for (uint32_t i = 0; i < block->access_count; i++) {
+    const DisasmAccess *a = &prog->accesses[block->access_first + i];
+    const char *name = disasm_io_name(a->address);
+    fprintf(out, ";   0x%04X %s %s (0x%04X)\n", a->pc,
+            a->write ? "writes" : "reads", name ? name : "IO", a->address);
+  }
+}
+
+/**
+ * Listing that reassembles to the same image
+ */
+void disasm_print_listing(const DisasmProgram *prog, FILE *out) {
+  uint32_t words = prog->size / 2;
+  char text[48];
+
+  fprintf(out, "; %u bytes, %u blocks, %u loops, %u MMIO accesses\n",
+          prog->size, prog->block_count, prog->loop_count,
+          prog->access_count);
+  for (uint32_t w = 0; w < words; w++) {
+    uint16_t address = w * 2;
+    uint8_t kind = prog->word_kind[w];
+    bool code = kind & DISASM_WORD_CODE;
+    uint32_t b = prog->block_of[w];
+
+    if (code && prog->blocks[b].start == address) {
+      fprintf(out, "\n");
+      disasm_block_comment(prog, b, out);
+    }
+    if (kind & DISASM_WORD_LABEL) {
+      fprintf(out, "L%04X:\n", address);
+    }
+    if (code) {
+      disasm_text(prog, address, text, sizeof(text));
+    } else {
+      snprintf(text, sizeof(text), ".word 0x%04X", disasm_word(prog, address));
+    }
+    fprintf(out, "    %-24s ; %04X: %04X\n", text, address,
+            disasm_word(prog, address));
+  }
+  if (prog->size & 1) {
+    fprintf(out, "    .byte 0x%02X\n", prog->image[prog->size - 1]);
+  }
+}
+
+/**
+ * Graphviz graph with one node per block
+ */
+void disasm_print_dot(const DisasmProgram *prog, FILE *out) {
+  char text[48];
+
+  fprintf(out, "digraph cfg {\n");
+  fprintf(out, "  node [shape=box, fontname=\"monospace\"];\n");
+  for (uint32_t b = 0; b < prog->block_count; b++) {
+    const DisasmBlock *block = &prog->blocks[b];
+    bool header = block->loop != DISASM_NONE &&
+                  prog->loops[block->loop].header == b;
+    fprintf(out, "  b%u [label=\"L%04X (%u)\\l", b, block->start,
+            block->insns);
+    for (uint16_t pc = block->start; pc < block->end; pc += 2) {
+      disasm_format(disasm_word(prog, pc), pc, text, sizeof(text));
+      fprintf(out, "%04X  %s\\l", pc, text);
+    }
+    for (uint32_t i = 0; i < block->access_count; i++) {
+      const DisasmAccess *a = &prog->accesses[block->access_first + i];
+      const char *name = disasm_io_name(a->address);
+      fprintf(out, "%s %s\\l", a->write ? "out" : "in", name ? name : "IO");
+    }
+    fprintf(out, "\"%s%s];\n", block->root ? ", peripheries=2" : "",
+            header ? ", style=bold" : "");
+  }
+  for (uint32_t b = 0; b < prog->block_count; b++) {
+    const DisasmBlock *block = &prog->blocks[b];
+    for (uint32_t i = 0; i < block->succ_count; i++) {
+      const DisasmEdge *e = &block->succ[i];
+      fprintf(out, "  b%u -> b%u [label=\"%s\"%s];\n", b, e->block,
+              edge_names[e->kind],
+              e->kind == DISASM_EDGE_CALL ? ", style=dashed" : "");
+    }
+  }
+  fprintf(out, "}\n");
+}
+
+/**
+ * Print a JSON index or null
+ */
+static void disasm_json_index(uint32_t index, FILE *out) {
+  if (index == DISASM_NONE) {
+    fprintf(out, "null");
+  } else {
+    fprintf(out, "%u", index);
+  }
+}
+
+/**
+ * Blocks, edges, dominators, loops and MMIO accesses as JSON
+ */
+void disasm_print_json(const DisasmProgram *prog, FILE *out) {
+  char text[48];
+
+  fprintf(out, "{\n  \"size\": %u,\n  \"blocks\": [", prog->size);
+  for (uint32_t b = 0; b < prog->block_count; b++) {
+    const DisasmBlock *block = &prog->blocks[b];
+    fprintf(out, "%s\n    {\"id\": %u, \"start\": %u, \"end\": %u, ",
+            b ? "," : "", b, block->start, block->end);
+    fprintf(out, "\"insns\": %u, \"root\": %s, \"idom\": ", block->insns,
+            block->root ? "true" : "false");
+    disasm_json_index(block->idom, out);
+    fprintf(out, ", \"loop\": ");
+    disasm_json_index(block->loop, out);
+    fprintf(out, ", \"loop_depth\": %u,\n     \"succs\": [", block->loop_depth);
+    for (uint32_t i = 0; i < block->succ_count; i++) {
+      fprintf(out, "%s{\"block\": %u, \"kind\": \"%s\"}", i ? ", " : "",
+              block->succ[i].block, edge_names[block->succ[i].kind]);
+    }
+    fprintf(out, "],\n     \"mmio\": [");
+    for (uint32_t i = 0; i < block->access_count; i++) {
+      const DisasmAccess *a = &prog->accesses[block->access_first + i];
+      const char *name = disasm_io_name(a->address);
+      fprintf(out, "%s{\"pc\": %u, \"address\": %u, \"name\": \"%s\", ",
+              i ? ", " : "", a->pc, a->address, name ? name : "IO");
+      fprintf(out, "\"access\": \"%s\"}", a->write ? "write" : "read");
+    }
+    fprintf(out, "],\n     \"code\": [");
+    for (uint16_t pc = block->start; pc < block->end; pc += 2) {
+      disasm_format(disasm_word(prog, pc), pc, text, sizeof(text));
+      fprintf(out, "%s\"%s\"", pc > block->start ? ", " : "", text);
+    }
+    fprintf(out, "]}");
+  }
+
+  fprintf(out, "\n  ],\n  \"loops\": [");
+  for (uint32_t l = 0; l < prog->loop_count; l++) {
+    const DisasmLoop *loop = &prog->loops[l];
+    fprintf(out, "%s\n    {\"id\": %u, \"header\": %u, \"parent\": ",
+            l ? "," : "", l, loop->header);
+    disasm_json_index(loop->parent, out);
+    fprintf(out, ", \"depth\": %u, \"latches\": %u, \"insns\": %u, ",
+            loop->depth, loop->latches, loop->insns);
+    fprintf(out, "\"blocks\": [");
+    bool first = true;
+    for (uint32_t b = 0; b < prog->block_count; b++) {
+      uint32_t inner = prog->blocks[b].loop;
+      while (inner != DISASM_NONE && inner != l) {
+        inner = prog->loops[inner].parent;
+      }
+      if (inner == l) {
+        fprintf(out, "%s%u", first ? "" : ", ", b);
+        first = false;
+      }
+    }
+    fprintf(out, "]}");
+  }
+  fprintf(out, "\n  ]\n}\n");
+}
@@ -0,0 +1,556 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../include/fuzz.h"
+#include "../include/buffer_host.h"
+#include "../include/memory.h"
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * ============================================================================
+ * IN-PROCESS FUZZER
+ * ============================================================================
+ * Each worker thread owns a CPU and restores it from a prepared image before
+ * every run, so an execution costs copying back the pages the last run
+ * wrote plus the guest's own instructions. Coverage is edge hit counts from
+ * cu_execute, bucketed into eight classes; an input is kept when it sets a
+ * bucket bit no earlier input set. The corpus only grows: an entry is
+ * complete before the release store that publishes the new count, so
+ * workers read entries without locking.
+ */
+
+typedef struct {
+  uint8_t *data;
+  uint16_t len;
+} FuzzInput;
+
+typedef enum { FUZZ_OK, FUZZ_CRASH, FUZZ_HANG } FuzzOutcome;
+
+// State shared by every worker
+typedef struct {
+  const FuzzConfig *config;
+  uint64_t max_cycles;
+  uint16_t max_len;
+  uint8_t virgin[COVERAGE_MAP_SIZE];     // Bucket bits seen so far
+  FuzzInput corpus[FUZZ_MAX_CORPUS];
+  uint32_t corpus_count;                 // Published entries
+  uint32_t crash_keys[FUZZ_MAX_CRASHES]; // Kind, cause and PC of each saved
+  uint32_t crash_count;
+  uint32_t crashes;
+  uint32_t hangs;
+  bool stop;
+  pthread_mutex_t lock; // Corpus appends, the crash set and file writes
+} Fuzzer;
+
+// One worker thread and its private machine
+typedef struct {
+  Fuzzer *fz;
+  pthread_t thread;
+  uint64_t rng;
+  uint64_t execs;
+  CPU base; // Prepared image every run starts from
+  CPU cpu;  // The run in progress
+  BufferHost host; // Console input of the current run
+  uint8_t trace[COVERAGE_MAP_SIZE];
+  uint8_t buf[FUZZ_MAX_INPUT];
+} FuzzWorker;
+
+/*
+ * ============================================================================
+ * GUEST SIDE
+ * ============================================================================
+ */
+
+/**
+ * Prepare a worker's private copy of the program. Output, the clock and
+ * log messages are left unconnected, so runs are silent and repeatable.
+ */
+static void fuzz_worker_init(FuzzWorker *w, Fuzzer *fz, const CPU *prototype,
+                             uint32_t id) {
+  w->fz = fz;
+  w->rng = ((uint64_t)time(NULL) << 16 ^ (id + 1) * 0x9E3779B97F4A7C15ULL) | 1;
+  buffer_host_init(&w->host, NULL, 0);
+
+  cpu_clone(&w->base, prototype);
+  if (w->base.memory != w->base.ram) {
+    memcpy(w->base.ram, prototype->memory, MEMORY_SIZE);
+    w->base.memory = w->base.ram;
+  }
+  w->base.host = &w->host.host;
+  w->base.io_trace = NULL;
+  w->base.debug = false;
+  cpu_clone(&w->cpu, &w->base);
+}
+
+/**
+ * Run one input from the prepared image
+ */
+static FuzzOutcome fuzz_exec(FuzzWorker *w, const uint8_t *data,
+                             uint16_t len) {
+  const FuzzConfig *config = w->fz->config;
+  CPU *cpu = &w->cpu;
+  cpu_restore(cpu, &w->base);
+  memset(w->trace, 0, sizeof(w->trace));
+  cpu->coverage = w->trace;
+
+  if (config->memory_input) {
+    if (len > 0) {
+      memcpy(&cpu->ram[config->input_addr], data, len);
+      mem_mark_dirty(cpu, config->input_addr, len);
+    }
+    cpu->registers[0] = len;
+    buffer_host_reset(&w->host, NULL, 0);
+  } else {
+    buffer_host_reset(&w->host, data, len);
+  }
+
+  uint64_t limit = cpu->cycle_count + w->fz->max_cycles;
+  while (!cpu->halted && cpu->cycle_count < limit) {
+    cpu_step(cpu);
+  }
+  __atomic_store_n(&w->execs, w->execs + 1, __ATOMIC_RELAXED);
+
+  if (!cpu->halted) {
+    return FUZZ_HANG;
+  }
+  return cpu->stop == CPU_STOP_FAULT ? FUZZ_CRASH : FUZZ_OK;
+}
+
+/*
+ * ============================================================================
+ * COVERAGE AND CORPUS
+ * ============================================================================
+ */
+
+/**
+ * Hit-count class of an edge: 1, 2, 3, 4-7, 8-15, 16-31, 32-127, 128+
+ */
+static uint8_t fuzz_bucket(uint8_t hits) {
+  if (hits <= 2) {
+    return hits;
+  }
+  if (hits == 3) {
+    return 4;
+  }
+  if (hits < 8) {
+    return 8;
+  }
+  if (hits < 16) {
+    return 16;
+  }
+  if (hits < 32) {
+    return 32;
+  }
+  return hits < 128 ? 64 : 128;
+}
+
+/**
+ * Merge the last run's trace into the shared map. Returns true if it set a
+ * bucket bit for the first time.
+ */
+static bool fuzz_new_coverage(FuzzWorker *w) {
+  uint8_t *virgin = w->fz->virgin;
+  bool found = false;
+  for (uint32_t i = 0; i < COVERAGE_MAP_SIZE; i += 8) {
+    uint64_t chunk;
+    memcpy(&chunk, &w->trace[i], sizeof(chunk));
+    if (chunk == 0) {
+      continue;
+    }
+    for (uint32_t j = i; j < i + 8; j++) {
+      uint8_t bits = w->trace[j] ? fuzz_bucket(w->trace[j]) : 0;
+      if (bits & ~__atomic_load_n(&virgin[j], __ATOMIC_RELAXED)) {
+        uint8_t old = __atomic_fetch_or(&virgin[j], bits, __ATOMIC_RELAXED);
+        found |= (bits & ~old) != 0;
+      }
+    }
+  }
+  return found;
+}
+
+/**
+ * Coverage map entries hit by any run so far
+ */
+static uint32_t fuzz_edges(Fuzzer *fz) {
+  uint32_t edges = 0;
+  for (uint32_t i = 0; i < COVERAGE_MAP_SIZE; i++) {
+    edges += __atomic_load_n(&fz->virgin[i], __ATOMIC_RELAXED) != 0;
+  }
+  return edges;
+}
+
+/**
+ * Write an input to dir/sub/name-hash. Called with the lock held.
+ */
+static void fuzz_save(Fuzzer *fz, const char *sub, const char *name,
+                      const uint8_t *data, uint16_t len) {
+  char path[512];
+  snprintf(path, sizeof(path), "%s/%s/%s-%016llx", fz->config->dir, sub, name,
+           (unsigned long long)buffer_hash(data, len));
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    fprintf(stderr, "Error: Cannot write %s\n", path);
+    return;
+  }
+  if (len > 0) {
+    fwrite(data, 1, len, file);
+  }
+  fclose(file);
+}
+
+/**
+ * Add an input to the corpus, and to the queue directory unless it came
+ * from there
+ */
+static void fuzz_add(Fuzzer *fz, const uint8_t *data, uint16_t len,
+                     bool save) {
+  pthread_mutex_lock(&fz->lock);
+  uint32_t count = fz->corpus_count;
+  uint8_t *copy = count < FUZZ_MAX_CORPUS ? malloc(len ? len : 1) : NULL;
+  if (copy) {
+    if (len > 0) {
+      memcpy(copy, data, len);
+    }
+    fz->corpus[count].data = copy;
+    fz->corpus[count].len = len;
+    __atomic_store_n(&fz->corpus_count, count + 1, __ATOMIC_RELEASE);
+    if (save) {
+      char name[32];
+      snprintf(name, sizeof(name), "id-%06u", count);
+      fuzz_save(fz, "queue", name, data, len);
+    }
+  }
+  pthread_mutex_unlock(&fz->lock);
+}
+
+/**
+ * Save a crashing or hanging input, once per kind, cause and PC
+ */
+static void fuzz_crash(FuzzWorker *w, FuzzOutcome outcome, const uint8_t *data,
+                       uint16_t len) {
+  Fuzzer *fz = w->fz;
+  const CPU *cpu = &w->cpu;
+  uint16_t pc = outcome == FUZZ_HANG ? cpu->pc : cpu->fault.pc;
+  uint32_t cause = outcome == FUZZ_HANG ? 0xFF : (uint32_t)cpu->fault.cause;
+  uint32_t key = cause << 16 | pc;
+
+  pthread_mutex_lock(&fz->lock);
+  bool seen = false;
+  for (uint32_t i = 0; i < fz->crash_count && !seen; i++) {
+    seen = fz->crash_keys[i] == key;
+  }
+  if (!seen && fz->crash_count < FUZZ_MAX_CRASHES) {
+    fz->crash_keys[fz->crash_count++] = key;
+    char name[48];
+    if (outcome == FUZZ_HANG) {
+      snprintf(name, sizeof(name), "hang-pc%04X", pc);
+      __atomic_fetch_add(&fz->hangs, 1, __ATOMIC_RELAXED);
+    } else {
+      snprintf(name, sizeof(name), "fault%u-pc%04X", cause, pc);
+      __atomic_fetch_add(&fz->crashes, 1, __ATOMIC_RELAXED);
+    }
+    fuzz_save(fz, "crashes", name, data, len);
+  }
+  pthread_mutex_unlock(&fz->lock);
+}
+
+/**
+ * Keep an input that found new edges, or record it if it failed
+ */
+static void fuzz_triage(FuzzWorker *w, FuzzOutcome outcome,
+                        const uint8_t *data, uint16_t len) {
+  if (outcome != FUZZ_OK) {
+    fuzz_crash(w, outcome, data, len);
+  }
+  if (fuzz_new_coverage(w) && outcome == FUZZ_OK) {
+    fuzz_add(w->fz, data, len, true);
+  }
+}
+
+/*
+ * ============================================================================
+ * MUTATION
+ * ============================================================================
+ */
+
+/**
+ * xorshift64* step
+ */
+static uint64_t fuzz_rand(FuzzWorker *w) {
+  w->rng ^= w->rng >> 12;
+  w->rng ^= w->rng << 25;
+  w->rng ^= w->rng >> 27;
+  return w->rng * 0x2545F4914F6CDD1DULL;
+}
+
+/**
+ * Apply a stack of random edits to w->buf. Returns the new length.
+ */
+static uint16_t fuzz_mutate(FuzzWorker *w, uint16_t len) {
+  static const uint8_t interesting[] = {0,   1,   0x7F, 0x80, 0xFF, '\n',
+                                        ' ', '-', '0',  '9',  'A',  'z'};
+  Fuzzer *fz = w->fz;
+  uint8_t *buf = w->buf;
+  uint32_t rounds = 1 + fuzz_rand(w) % 8;
+
+  for (uint32_t r = 0; r < rounds; r++) {
+    uint32_t pos = len ? fuzz_rand(w) % len : 0;
+    switch (fuzz_rand(w) % (len ? 8 : 1)) {
+    case 0: // Insert a byte
+      if (len < fz->max_len) {
+        memmove(&buf[pos + 1], &buf[pos], len - pos);
+        buf[pos] = fuzz_rand(w) & 1
+                       ? interesting[fuzz_rand(w) % sizeof(interesting)]
+                       : (uint8_t)fuzz_rand(w);
+        len++;
+      }
+      break;
+    case 1: // Flip a bit
+      buf[pos] ^= 1 << (fuzz_rand(w) % 8);
+      break;
+    case 2: // Random byte
+      buf[pos] = (uint8_t)fuzz_rand(w);
+      break;
+    case 3: // Interesting byte
+      buf[pos] = interesting[fuzz_rand(w) % sizeof(interesting)];
+      break;
+    case 4: // Small add or subtract
+      buf[pos] += (uint8_t)(fuzz_rand(w) % 35) - 17;
+      break;
+    case 5: // Delete a run of bytes
+    {
+      uint32_t n = 1 + fuzz_rand(w) % (len - pos);
+      memmove(&buf[pos], &buf[pos + n], len - pos - n);
+      len -= n;
+      break;
+    }
+    case 6: // Duplicate a run of bytes in place
+    {
+      uint32_t n = 1 + fuzz_rand(w) % (len - pos);
+      if (len + n <= fz->max_len) {
+        memmove(&buf[pos + n], &buf[pos], len - pos);
+        len += n;
+      }
+      break;
+    }
+    case 7: // Splice in the tail of another corpus entry
+    {
+      uint32_t count = __atomic_load_n(&fz->corpus_count, __ATOMIC_ACQUIRE);
+      const FuzzInput *other = &fz->corpus[fuzz_rand(w) % count];
+      uint32_t from = other->len ? fuzz_rand(w) % other->len : 0;
+      uint32_t n = other->len - from;
+      if (pos + n > fz->max_len) {
+        n = fz->max_len - pos;
+      }
+      memcpy(&buf[pos], &other->data[from], n);
+      len = pos + n;
+      break;
+    }
+    }
+  }
+  return len;
+}
+
+/**
+ * Worker thread: mutate a random corpus entry, run it, keep what is new
+ */
+static void *fuzz_thread(void *arg) {
+  FuzzWorker *w = arg;
+  Fuzzer *fz = w->fz;
+  while (!__atomic_load_n(&fz->stop, __ATOMIC_RELAXED)) {
+    uint32_t count = __atomic_load_n(&fz->corpus_count, __ATOMIC_ACQUIRE);
+    const FuzzInput *parent = &fz->corpus[fuzz_rand(w) % count];
+    memcpy(w->buf, parent->data, parent->len);
+    uint16_t len = fuzz_mutate(w, parent->len);
+    fuzz_triage(w, fuzz_exec(w, w->buf, len), w->buf, len);
+  }
+  return NULL;
+}
+
+/*
+ * ============================================================================
+ * CAMPAIGN
+ * ============================================================================
+ */
+
+/**
+ * Create a directory unless it already exists
+ */
+static bool fuzz_mkdir(const char *dir, const char *sub) {
+  char path[512];
+  snprintf(path, sizeof(path), "%s%s%s", dir, sub ? "/" : "", sub ? sub : "");
+  if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+    fprintf(stderr, "Error: Cannot create directory %s\n", path);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Run every file in dir/queue as a seed. Returns the number loaded.
+ */
+static uint32_t fuzz_load_seeds(Fuzzer *fz, FuzzWorker *w) {
+  char path[512];
+  snprintf(path, sizeof(path), "%s/queue", fz->config->dir);
+  DIR *dir = opendir(path);
+  if (!dir) {
+    return 0;
+  }
+
+  uint32_t loaded = 0;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    snprintf(path, sizeof(path), "%s/queue/%s", fz->config->dir,
+             entry->d_name);
+    struct stat st;
+    FILE *file = NULL;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode) ||
+        !(file = fopen(path, "rb"))) {
+      continue;
+    }
+    uint16_t len = (uint16_t)fread(w->buf, 1, fz->max_len, file);
+    fclose(file);
+
+    FuzzOutcome outcome = fuzz_exec(w, w->buf, len);
+    fuzz_new_coverage(w);
+    if (outcome != FUZZ_OK) {
+      fuzz_crash(w, outcome, w->buf, len);
+    }
+    fuzz_add(fz, w->buf, len, false);
+    loaded++;
+  }
+  closedir(dir);
+  return loaded;
+}
+
+/**
+ * Seconds on the monotonic clock
+ */
+static double fuzz_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Sum of runs over all workers
+ */
+static uint64_t fuzz_execs(FuzzWorker *workers, uint32_t jobs) {
+  uint64_t execs = 0;
+  for (uint32_t i = 0; i < jobs; i++) {
+    execs += __atomic_load_n(&workers[i].execs, __ATOMIC_RELAXED);
+  }
+  return execs;
+}
+
+/**
+ * Fuzz for config->seconds on config->jobs threads, printing progress once
+ * a second
+ */
+bool fuzz_run(const CPU *prototype, const FuzzConfig *config,
+              FuzzReport *report) {
+  memset(report, 0, sizeof(FuzzReport));
+  if (prototype->bank_count) {
+    fprintf(stderr, "Error: Fuzzing does not support extended memory\n");
+    return false;
+  }
+  if (config->memory_input && config->input_addr >= IO_START) {
+    fprintf(stderr, "Error: Fuzz input address must be below 0x%04X\n",
+            IO_START);
+    return false;
+  }
+  if (!fuzz_mkdir(config->dir, NULL) || !fuzz_mkdir(config->dir, "queue") ||
+      !fuzz_mkdir(config->dir, "crashes")) {
+    return false;
+  }
+
+  uint32_t jobs = config->jobs;
+  if (jobs == 0) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    jobs = online > 0 ? (uint32_t)online : 1;
+  }
+
+  Fuzzer *fz = calloc(1, sizeof(Fuzzer));
+  FuzzWorker *workers = calloc(jobs, sizeof(FuzzWorker));
+  if (!fz || !workers) {
+    fprintf(stderr, "Error: Out of memory for %u fuzzing workers\n", jobs);
+    free(fz);
+    free(workers);
+    return false;
+  }
+  fz->config = config;
+  fz->max_cycles = config->max_cycles ? config->max_cycles
+                                      : FUZZ_DEFAULT_CYCLES;
+  fz->max_len = FUZZ_MAX_INPUT;
+  if (config->memory_input && IO_START - config->input_addr < fz->max_len) {
+    fz->max_len = IO_START - config->input_addr;
+  }
+  pthread_mutex_init(&fz->lock, NULL);
+  for (uint32_t i = 0; i < jobs; i++) {
+    fuzz_worker_init(&workers[i], fz, prototype, i);
+  }
+
+  // Seeds, or a single empty input, give the workers something to mutate
+  uint32_t seeds = fuzz_load_seeds(fz, &workers[0]);
+  if (seeds == 0) {
+    fuzz_triage(&workers[0], fuzz_exec(&workers[0], NULL, 0), NULL, 0);
+    if (fz->corpus_count == 0) {
+      fuzz_add(fz, NULL, 0, false);
+    }
+  }
+  printf("%u seed inputs, %u jobs, %s input\n", seeds, jobs,
+         config->memory_input ? "memory" : "console");
+
+  double start = fuzz_now();
+  uint32_t started = 0;
+  for (; started < jobs; started++) {
+    if (pthread_create(&workers[started].thread, NULL, fuzz_thread,
+                       &workers[started]) != 0) {
+      fprintf(stderr, "Error: Cannot start fuzzing thread %u\n", started);
+      break;
+    }
+  }
+
+  uint64_t last_execs = 0;
+  for (uint32_t second = 1; started > 0 && second <= config->seconds;
+       second++) {
+    struct timespec tick = {1, 0};
+    nanosleep(&tick, NULL);
+    uint64_t execs = fuzz_execs(workers, jobs);
+    printf("[%4us] %llu execs (%llu/s), corpus %u, edges %u, crashes %u, "
+           "hangs %u\n",
+           second, (unsigned long long)execs,
+           (unsigned long long)(execs - last_execs),
+           __atomic_load_n(&fz->corpus_count, __ATOMIC_ACQUIRE), fuzz_edges(fz),
+           __atomic_load_n(&fz->crashes, __ATOMIC_RELAXED),
+           __atomic_load_n(&fz->hangs, __ATOMIC_RELAXED));
+    fflush(stdout);
+    last_execs = execs;
+  }
+
+  __atomic_store_n(&fz->stop, true, __ATOMIC_RELAXED);
+  for (uint32_t i = 0; i < started; i++) {
+    pthread_join(workers[i].thread, NULL);
+  }
+
+  report->execs = fuzz_execs(workers, jobs);
+  report->seconds = fuzz_now() - start;
+  report->corpus = fz->corpus_count;
+  report->edges = fuzz_edges(fz);
+  report->crashes = fz->crashes;
+  report->hangs = fz->hangs;
+
+  for (uint32_t i = 0; i < fz->corpus_count; i++) {
+    free(fz->corpus[i].data);
+  }
+  pthread_mutex_destroy(&fz->lock);
+  free(workers);
+  free(fz);
+  return started == jobs;
+}
@@ -0,0 +1,106 @@
+#include "../include/interrupt.h"
+#include "../include/memory.h"
+
+/*
+ * ============================================================================
+ * INTERRUPT CONTROLLER
+ * ============================================================================
+ * Lines are latched in irq_pending until the guest acknowledges them and
+ * are delivered when they are also set in irq_enable and FLAG_INTERRUPT is
+ * clear. Entry pushes PC then FLAGS at SP and jumps to irq_vector; RETI
+ * pops both back, which also clears FLAG_INTERRUPT again.
+ */
+
+/**
+ * Check whether the timer or any interrupt line needs per-cycle service
+ */
+bool irq_active(const CPU *cpu) {
+  return cpu->timer_enabled || cpu->irq_enable != 0;
+}
+
+/**
+ * Latch interrupt lines as pending
+ */
+void irq_raise(CPU *cpu, uint16_t lines) { cpu->irq_pending |= lines; }
+
+/**
+ * Enter the interrupt handler if an enabled line is pending
+ */
+static void irq_dispatch(CPU *cpu) {
+  if (!(cpu->irq_pending & cpu->irq_enable) || (cpu->flags & FLAG_INTERRUPT)) {
+    return;
+  }
+
+  if (cpu->debug) {
+    cpu_log(cpu, CPU_LOG_DEBUG,
+            "  IRQ: lines=0x%04X vector=0x%04X return=0x%04X",
+            cpu->irq_pending & cpu->irq_enable, cpu->irq_vector, cpu->pc);
+  }
+  uint16_t sp = cpu->sp;
+  cpu_push(cpu, cpu->pc);
+  cpu_push(cpu, cpu->flags);
+  if (cpu->aborted) {
+    cpu->sp = sp; // No room for the frame: cpu_step takes the fault
+    return;
+  }
+  cpu->flags |= FLAG_INTERRUPT;
+  cpu->pc = cpu->irq_vector;
+}
+
+/**
+ * Advance devices by one cycle and take any pending interrupt
+ */
+void irq_tick(CPU *cpu) {
+  // Timer counts down while enabled and restarts from the last value written
+  if (cpu->timer_enabled && cpu->timer != 0 && --cpu->timer == 0) {
+    irq_raise(cpu, IRQ_TIMER);
+    cpu->timer = cpu->timer_reload;
+  }
+
+  if ((cpu->irq_enable & IRQ_CONSOLE) && !(cpu->irq_pending & IRQ_CONSOLE) &&
+      cpu->cycle_count % IRQ_CONSOLE_POLL_CYCLES == 0 &&
+      mem_console_ready(cpu, false)) {
+    irq_raise(cpu, IRQ_CONSOLE);
+  }
+
+  irq_dispatch(cpu);
+}
+
+/**
+ * Return from interrupt (RETI)
+ */
+void irq_return(CPU *cpu) {
+  cpu->flags = cpu_pop(cpu) & 0xFF;
+  cpu->pc = cpu_pop(cpu);
+}
+
+/**
+ * Wait for interrupt (WFI). The timer is fast-forwarded to its next expiry;
+ * console input blocks the host thread until data arrives, or stops the CPU
+ * with CPU_STOP_INPUT if the host does not block.
+ */
+void irq_wait(CPU *cpu) {
+  while (!(cpu->irq_pending & cpu->irq_enable)) {
+    bool timer = (cpu->irq_enable & IRQ_TIMER) && cpu->timer_enabled &&
+                 cpu->timer != 0;
+    bool console = (cpu->irq_enable & IRQ_CONSOLE) != 0;
+
+    if (!timer && !console) {
+      cpu_fault(cpu, CPU_ERR_WFI_NO_SOURCE, 0);
+      return;
+    }
+
+    if (console && mem_console_ready(cpu, !timer)) {
+      irq_raise(cpu, IRQ_CONSOLE);
+    } else if (timer) {
+      // Skip the idle cycles; the tick after this instruction fires it
+      cpu->cycle_count += cpu->timer - 1;
+      cpu->timer = 1;
+      return;
+    } else {
+      // The host would not block: hand the wait back to it
+      cpu_wait_input(cpu);
+      return;
+    }
+  }
+}
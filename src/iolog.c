@@ -0,0 +1,285 @@
+#include "../include/iolog.h"
+#include <string.h>
+
+/*
+ * ============================================================================
+ * I/O RECORD/REPLAY
+ * ============================================================================
+ * Console input, console status and the wall clock are the only inputs a
+ * guest receives that are not fixed by its image. Recording them with the
+ * cycle they were read at makes any run reproducible: replay answers the
+ * same questions with the same values without touching stdin or the clock,
+ * and a guest that asks for a different input, or at a different cycle, has
+ * diverged from the recording.
+ */
+
+static const char *iolog_kind_names[] = {"a repeat", "console input",
+                                         "console status", "the clock"};
+
+/**
+ * Append an unsigned LEB128 varint
+ */
+static void iolog_put_varint(FILE *file, uint64_t value) {
+  while (value >= 0x80) {
+    fputc((int)(value & 0x7F) | 0x80, file);
+    value >>= 7;
+  }
+  fputc((int)value, file);
+}
+
+/**
+ * Read an unsigned LEB128 varint
+ */
+static bool iolog_get_varint(FILE *file, uint64_t *value) {
+  *value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    int byte = fgetc(file);
+    if (byte == EOF) {
+      return false;
+    }
+    *value |= (uint64_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Write out a pending run of repeated records
+ */
+static void iolog_flush_run(IoLog *log) {
+  if (log->run_count > 0) {
+    fputc(IOLOG_REPEAT, log->file);
+    iolog_put_varint(log->file, log->run_count);
+    log->run_count = 0;
+  }
+}
+
+/**
+ * Append a record, folding it into the current run if it repeats the last
+ */
+static void iolog_write(IoLog *log, IoLogKind kind, uint64_t delta,
+                        uint64_t value) {
+  if (log->records > 0 && kind == log->run_kind && delta == log->run_delta &&
+      value == log->run_value) {
+    log->run_count++;
+    return;
+  }
+  iolog_flush_run(log);
+  fputc(kind, log->file);
+  iolog_put_varint(log->file, delta);
+  iolog_put_varint(log->file, value);
+  log->run_kind = kind;
+  log->run_delta = delta;
+  log->run_value = value;
+}
+
+/**
+ * Read the next record, expanding runs. Returns a message on failure.
+ */
+static const char *iolog_read(IoLog *log) {
+  if (log->run_count > 0) {
+    log->run_count--;
+    return NULL;
+  }
+
+  int tag = fgetc(log->file);
+  if (tag == EOF) {
+    return "no more records";
+  }
+  if (tag == IOLOG_REPEAT) {
+    if (log->records == 0 || !iolog_get_varint(log->file, &log->run_count) ||
+        log->run_count == 0) {
+      return "a corrupt record";
+    }
+    log->run_count--;
+    return NULL;
+  }
+  if (tag > IOLOG_CLOCK || !iolog_get_varint(log->file, &log->run_delta) ||
+      !iolog_get_varint(log->file, &log->run_value)) {
+    return "a corrupt record";
+  }
+  log->run_kind = tag;
+  return NULL;
+}
+
+/**
+ * Stop the guest where replay stopped matching it
+ */
+static void iolog_diverge(IoLog *log, IoLogKind kind, const char *expected) {
+  if (!log->diverged) {
+    snprintf(log->error, sizeof(log->error),
+             "guest read %s at cycle %llu, log has %s",
+             iolog_kind_names[kind], (unsigned long long)log->cpu->cycle_count,
+             expected);
+    log->diverged = true;
+  }
+  log->cpu->halted = true;
+}
+
+/**
+ * Record one input value, or return the recorded one in its place
+ */
+static int64_t iolog_value(IoLog *log, IoLogKind kind, int64_t value) {
+  uint64_t cycle = log->cpu->cycle_count;
+
+  if (!log->replay) {
+    uint64_t zigzag = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+    iolog_write(log, kind, cycle - log->last_cycle, zigzag);
+    log->last_cycle = cycle;
+    log->records++;
+    return value;
+  }
+
+  if (log->diverged) {
+    return value;
+  }
+  const char *error = iolog_read(log);
+  if (error) {
+    iolog_diverge(log, kind, error);
+    return value;
+  }
+  if (log->run_kind != kind || log->last_cycle + log->run_delta != cycle) {
+    char expected[64];
+    snprintf(expected, sizeof(expected), "%s at cycle %llu",
+             iolog_kind_names[log->run_kind],
+             (unsigned long long)(log->last_cycle + log->run_delta));
+    iolog_diverge(log, kind, expected);
+    return value;
+  }
+
+  log->last_cycle = cycle;
+  log->records++;
+  return (int64_t)(log->run_value >> 1) ^ -(int64_t)(log->run_value & 1);
+}
+
+/*
+ * ============================================================================
+ * HOST CALLBACKS
+ * ============================================================================
+ * On replay the inner host's inputs are never called; the values below are
+ * only the fallbacks returned once the guest has diverged.
+ */
+
+/**
+ * Pass console output through
+ */
+static void iolog_console_write(void *ctx, uint8_t ch) {
+  const CpuHost *inner = ((IoLog *)ctx)->inner;
+  if (inner->console_write) {
+    inner->console_write(inner->ctx, ch);
+  }
+}
+
+/**
+ * Console input byte
+ */
+static int iolog_console_read(void *ctx) {
+  IoLog *log = ctx;
+  const CpuHost *inner = log->inner;
+  int value = CPU_CONSOLE_EOF;
+  if (!log->replay && inner->console_read) {
+    value = inner->console_read(inner->ctx);
+  }
+  return (int)iolog_value(log, IOLOG_CONSOLE_READ, value);
+}
+
+/**
+ * Console status bits
+ */
+static uint16_t iolog_console_status(void *ctx, bool wait) {
+  IoLog *log = ctx;
+  const CpuHost *inner = log->inner;
+  uint16_t value = CONSOLE_STATUS_EOF;
+  if (!log->replay && inner->console_status) {
+    value = inner->console_status(inner->ctx, wait);
+  }
+  return (uint16_t)iolog_value(log, IOLOG_CONSOLE_STATUS, value);
+}
+
+/**
+ * Wall clock
+ */
+static uint64_t iolog_clock_ms(void *ctx) {
+  IoLog *log = ctx;
+  const CpuHost *inner = log->inner;
+  uint64_t value = 0;
+  if (!log->replay && inner->clock_ms) {
+    value = inner->clock_ms(inner->ctx);
+  }
+  return (uint64_t)iolog_value(log, IOLOG_CLOCK, (int64_t)value);
+}
+
+/**
+ * Pass log messages through
+ */
+static void iolog_log(void *ctx, CpuLogLevel level, const char *message) {
+  const CpuHost *inner = ((IoLog *)ctx)->inner;
+  if (inner->log) {
+    inner->log(inner->ctx, level, message);
+  }
+}
+
+/*
+ * ============================================================================
+ * SETUP
+ * ============================================================================
+ */
+
+/**
+ * Open a log for recording or replay
+ */
+bool iolog_open(IoLog *log, const char *path, bool replay, CPU *cpu,
+                const CpuHost *inner) {
+  memset(log, 0, sizeof(*log));
+  log->file = fopen(path, replay ? "rb" : "wb");
+  if (!log->file) {
+    fprintf(stderr, "Error: Cannot open I/O log %s\n", path);
+    return false;
+  }
+
+  char magic[sizeof(IOLOG_MAGIC) - 1];
+  if (!replay) {
+    fwrite(IOLOG_MAGIC, 1, sizeof(magic), log->file);
+  } else if (fread(magic, 1, sizeof(magic), log->file) != sizeof(magic) ||
+             memcmp(magic, IOLOG_MAGIC, sizeof(magic)) != 0) {
+    fprintf(stderr, "Error: %s is not an I/O log\n", path);
+    fclose(log->file);
+    return false;
+  }
+
+  log->host = (CpuHost){
+      .ctx = log,
+      .console_write = iolog_console_write,
+      .console_read = iolog_console_read,
+      .console_status = iolog_console_status,
+      .clock_ms = iolog_clock_ms,
+      .log = iolog_log,
+  };
+  log->inner = inner;
+  log->cpu = cpu;
+  log->replay = replay;
+  return true;
+}
+
+/**
+ * Finish the log, checking that a replay used all of it
+ */
+bool iolog_close(IoLog *log) {
+  bool ok = !log->diverged;
+  if (!log->replay) {
+    iolog_flush_run(log);
+  } else if (ok && (log->run_count > 0 || fgetc(log->file) != EOF)) {
+    snprintf(log->error, sizeof(log->error),
+             "guest halted at cycle %llu with records left in the log",
+             (unsigned long long)log->cpu->cycle_count);
+    log->diverged = true;
+    ok = false;
+  }
+  if (fclose(log->file) != 0) {
+    snprintf(log->error, sizeof(log->error), "cannot write the I/O log");
+    ok = false;
+  }
+  return ok;
+}
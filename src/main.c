@@ -1,17 +1,208 @@
+#include "../include/asmcache.h"
 #include "../include/assembler.h"
+#include "../include/batch.h"
+#include "../include/cache.h"
+#include "../include/compiler.h"
 #include "../include/cpu.h"
+#include "../include/decoder.h"
+#include "../include/disasm.h"
+#include "../include/fuzz.h"
+#include "../include/iolog.h"
+#include "../include/memmap.h"
+#include "../include/memory.h"
+#include "../include/multicore.h"
+#include "../include/pipeline.h"
+#include "../include/predictor.h"
+#include "../include/server.h"
+#include "../include/stdio_host.h"
+#include "../include/verify.h"
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+/**
+ * Assemble a source file, or take it from the cache, and save the binary
+ * next to it
+ */
+static bool assemble_program(Assembler *assembler, const char *input_file,
+                             bool optimize, bool li_cycles,
+                             const AsmCache *cache) {
+  asm_init(assembler);
+  assembler->optimize = optimize;
+  assembler->li_cycles = li_cycles;
+
+  printf("Assembling %s...\n", input_file);
+
+  char key[ASM_CACHE_KEY_LENGTH + 1];
+  bool keyed = cache->dir && asm_cache_key(assembler, input_file, key);
+  if (keyed && asm_cache_load(cache, key, assembler)) {
+    printf("Assembly cached! Program size: %d bytes\n",
+           assembler->program_size);
+  } else {
+    // Assemble the file
+    if (!asm_assemble_file(assembler, input_file)) {
+      fprintf(stderr, "Assembly failed\n");
+      return false;
+    }
+
+    printf("Assembly successful! Program size: %d bytes\n",
+           assembler->program_size);
+    if (keyed) {
+      asm_cache_store(cache, key, assembler);
+    }
+  }
+
+  // Save binary file
+  char output_file[256];
+  strncpy(output_file, input_file, sizeof(output_file) - 5);
+  output_file[sizeof(output_file) - 5] = '\0';
+  char *dot = strrchr(output_file, '.');
+  if (dot)
+    *dot = '\0';
+  strcat(output_file, ".bin");
+
+  if (asm_save_binary(assembler, output_file)) {
+    printf("Binary saved to %s\n", output_file);
+  }
+  return true;
+}
+
+/**
+ * Print a program's listing, or write its control-flow graph to cfg_file
+ * as DOT or JSON (chosen by the file's extension)
+ */
+static bool disassemble(const uint8_t *program, uint32_t size,
+                        const char *cfg_file) {
+  const char *ext = cfg_file ? strrchr(cfg_file, '.') : NULL;
+  bool json = ext && strcmp(ext, ".json") == 0;
+  if (cfg_file && !json && !(ext && strcmp(ext, ".dot") == 0)) {
+    fprintf(stderr, "Error: --cfg needs a .dot or .json file\n");
+    return false;
+  }
+
+  DisasmProgram prog;
+  if (!disasm_analyze(&prog, program, size, 0x0000)) {
+    fprintf(stderr, "Error: Cannot allocate disassembler tables\n");
+    return false;
+  }
+
+  if (!cfg_file) {
+    printf("\n");
+    disasm_print_listing(&prog, stdout);
+  } else {
+    FILE *out = fopen(cfg_file, "w");
+    if (!out) {
+      fprintf(stderr, "Error: Cannot create file '%s'\n", cfg_file);
+      disasm_free(&prog);
+      return false;
+    }
+    if (json) {
+      disasm_print_json(&prog, out);
+    } else {
+      disasm_print_dot(&prog, out);
+    }
+    fclose(out);
+    printf("Control-flow graph written to %s (%u blocks, %u loops)\n",
+           cfg_file, prog.block_count, prog.loop_count);
+  }
+  disasm_free(&prog);
+  return true;
+}
+
+/**
+ * Read a binary image for the disassembler
+ */
+static uint8_t *read_image(const char *path, uint32_t *size) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    fprintf(stderr, "Error: Cannot open file '%s'\n", path);
+    return NULL;
+  }
+  uint8_t *image = malloc(IO_START);
+  if (image) {
+    *size = (uint32_t)fread(image, 1, IO_START, file);
+  }
+  fclose(file);
+  return image;
+}
+
+/**
+ * Write the memory changed since the last checkpoint, then checkpoint
+ */
+static void write_memdiff(CPU *cpu, uint8_t *base, MemDiffFormat format,
+                          FILE *out) {
+  mem_diff(cpu, base, format, out);
+  mem_checkpoint(cpu, base);
+}
+
+/**
+ * Print why cpu stopped if an unhandled fault stopped it; true if one did
+ */
+static bool report_fault(const char *who, const CPU *cpu) {
+  if (!cpu->halted || cpu->stop != CPU_STOP_FAULT) {
+    return false;
+  }
+  printf("%s stopped by a fault: %s at PC=0x%04X (address 0x%04X)\n", who,
+         cpu_error_string(cpu->fault.cause), cpu->fault.pc,
+         cpu->fault.address);
+  return true;
+}
 
 void print_usage(const char *program_name) {
-  printf("Usage: %s [options] <file.asm>\n", program_name);
+  printf("Usage: %s [options] <file.asm | file.c | file.bin>\n", program_name);
   printf("Options:\n");
   printf("  -a, --assemble     Assemble only (create .bin file)\n");
   printf("  -r, --run          Assemble and run\n");
   printf("  -d, --debug        Run with debug output\n");
   printf("  -s, --step         Run in step mode\n");
   printf("  -m, --memdump      Dump memory after execution\n");
+  printf("  --memdiff <file>   Write the memory the run changed (- for stdout;\n");
+  printf("                     .bin for binary records)\n");
+  printf("  --memdiff-step <n> Also write a diff every n cycles, each against\n");
+  printf("                     the one before\n");
+  printf("  -b, --batch <n>    Run n instances in lockstep (SIMD engine)\n");
+  printf("  --verify <n>       Check the batch engine against the reference\n");
+  printf("                     interpreter on 1 in n blocks (1 = every block)\n");
+  printf("  -c, --cores <n>    Run n cores sharing one memory\n");
+  printf("  --deterministic    Interleave cores on one thread (reproducible)\n");
+  printf("  -p, --pipeline     Report 5-stage pipeline timing (CPI, stalls)\n");
+  printf("  --no-forwarding    Pipeline model without bypass paths\n");
+  printf("  --cache            Simulate split L1 caches (1KB, 2-way, 16B)\n");
+  printf("  --cache-config <s> Cache levels, e.g. l1d=2048/4/16/fifo/wt,\n");
+  printf("                     l2=8192/8/32/lru/wb/8,mem=40 (implies --cache)\n");
+  printf("  --predictor <p>    Compare branch predictors; p (nt, btfn, bimodal,\n");
+  printf("                     gshare, btb) sets the pipeline's branch cost\n");
+  printf("  -O, --optimize     Run the peephole optimizer on the program\n");
+  printf("  --li-cycles        Expand LI for speed (literal pool) over size\n");
+  printf("  --asm-cache <dir>  Reuse images assembled from identical sources\n");
+  printf("  --asm-cache-mb <n> Evict least recently used images past n MB\n");
+  printf("                     (default 64)\n");
+  printf("  --console <file>   Read console input from a file or pipe\n");
+  printf("  --record <log>     Record console input and clock reads to a log\n");
+  printf("  --replay <log>     Replay a recorded log instead of real input\n");
+  printf("  --map <file>       Back memory with a file that persists across runs\n");
+  printf("  --banks <n>        Add n 4KB banks of extended memory (up to 4096)\n");
+  printf("  --fuzz <dir>       Fuzz the program's input; corpus and crashes in dir\n");
+  printf("  --fuzz-jobs <n>    Fuzzing threads (default: one per host CPU)\n");
+  printf("  --fuzz-time <s>    Seconds to fuzz for (default 10)\n");
+  printf("  --fuzz-input <a>   Put inputs in memory at a (length in R0), not\n");
+  printf("                     on the console\n");
+  printf("  --fuzz-cycles <n>  Runs longer than n cycles are hangs (default\n");
+  printf("                     100000)\n");
+  printf("  --disasm           List the program with its blocks, loops and MMIO\n");
+  printf("  --cfg <file>       Write the control-flow graph as .dot or .json\n");
+  printf("  --serve <socket>   Serve run requests on a Unix socket (the input\n");
+  printf("                     file, if any, is preloaded as program 0)\n");
+  printf("  --serve-jobs <n>   Worker threads (default: one per host CPU)\n");
+  printf("  --serve-queue <n>  Connections queued before accepting stops\n");
+  printf("  --serve-idle <s>   Disconnect clients idle for s seconds (default\n");
+  printf("                     10)\n");
+  printf("  --send <socket>    Run the program on a server; --console gives input\n");
+  printf("  --send-cycles <n>  Cycle limit for --send (default 10000000)\n");
+  printf("  --send-repeat <n>  Send n requests and report the mean round trip\n");
   printf("  -h, --help         Show this help message\n");
 }
 
@@ -26,7 +217,32 @@ int main(int argc, char *argv[]) {
   bool debug_mode = false;
   bool step_mode = false;
   bool memdump = false;
+  uint32_t batch_lanes = 0;
+  uint32_t verify_rate = 0;
+  uint32_t core_count = 0;
+  bool deterministic = false;
+  bool pipeline_mode = false;
+  bool forwarding = true;
+  bool cache_mode = false;
+  const char *cache_spec = NULL;
+  bool predictor_mode = false;
+  bool optimize = false;
+  bool li_cycles = false;
+  AsmCache asm_cache = {.max_bytes = (uint64_t)ASM_CACHE_DEFAULT_MB << 20};
+  PredictorKind predictor_kind = PRED_NOT_TAKEN;
   char *input_file = NULL;
+  const char *console_file = NULL;
+  const char *iolog_file = NULL;
+  const char *memdiff_file = NULL;
+  uint64_t memdiff_step = 0;
+  bool replay = false;
+  const char *map_file = NULL;
+  uint32_t bank_count = 0;
+  FuzzConfig fuzz = {.seconds = FUZZ_DEFAULT_SECONDS};
+  bool disasm_mode = false;
+  const char *cfg_file = NULL;
+  ServerConfig server = {0};
+  ClientConfig client = {0};
 
   // Parse command line arguments
   for (int i = 1; i < argc; i++) {
@@ -42,6 +258,97 @@ int main(int argc, char *argv[]) {
     } else if (strcmp(argv[i], "-m") == 0 ||
                strcmp(argv[i], "--memdump") == 0) {
       memdump = true;
+    } else if ((strcmp(argv[i], "-b") == 0 ||
+                strcmp(argv[i], "--batch") == 0) &&
+               i + 1 < argc) {
+      batch_lanes = (uint32_t)strtoul(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--verify") == 0 && i + 1 < argc) {
+      verify_rate = (uint32_t)strtoul(argv[++i], NULL, 0);
+      if (verify_rate == 0) {
+        verify_rate = 1;
+      }
+    } else if ((strcmp(argv[i], "-c") == 0 ||
+                strcmp(argv[i], "--cores") == 0) &&
+               i + 1 < argc) {
+      core_count = (uint32_t)strtoul(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--deterministic") == 0) {
+      deterministic = true;
+    } else if (strcmp(argv[i], "-p") == 0 ||
+               strcmp(argv[i], "--pipeline") == 0) {
+      pipeline_mode = true;
+    } else if (strcmp(argv[i], "--no-forwarding") == 0) {
+      pipeline_mode = true;
+      forwarding = false;
+    } else if (strcmp(argv[i], "--cache") == 0) {
+      cache_mode = true;
+    } else if (strcmp(argv[i], "--cache-config") == 0 && i + 1 < argc) {
+      cache_mode = true;
+      cache_spec = argv[++i];
+    } else if (strcmp(argv[i], "--predictor") == 0 && i + 1 < argc) {
+      if (!predictor_parse(argv[++i], &predictor_kind)) {
+        fprintf(stderr, "Error: Unknown predictor '%s' (nt, btfn, bimodal, "
+                        "gshare, btb)\n", argv[i]);
+        return 1;
+      }
+      predictor_mode = true;
+    } else if (strcmp(argv[i], "-O") == 0 ||
+               strcmp(argv[i], "--optimize") == 0) {
+      optimize = true;
+    } else if (strcmp(argv[i], "--li-cycles") == 0) {
+      li_cycles = true;
+    } else if (strcmp(argv[i], "--asm-cache") == 0 && i + 1 < argc) {
+      asm_cache.dir = argv[++i];
+    } else if (strcmp(argv[i], "--asm-cache-mb") == 0 && i + 1 < argc) {
+      asm_cache.max_bytes = strtoull(argv[++i], NULL, 0) << 20;
+    } else if (strcmp(argv[i], "--memdiff") == 0 && i + 1 < argc) {
+      memdiff_file = argv[++i];
+    } else if (strcmp(argv[i], "--memdiff-step") == 0 && i + 1 < argc) {
+      memdiff_step = strtoull(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--console") == 0 && i + 1 < argc) {
+      console_file = argv[++i];
+    } else if ((strcmp(argv[i], "--record") == 0 ||
+                strcmp(argv[i], "--replay") == 0) &&
+               i + 1 < argc) {
+      replay = strcmp(argv[i], "--replay") == 0;
+      iolog_file = argv[++i];
+    } else if (strcmp(argv[i], "--map") == 0 && i + 1 < argc) {
+      map_file = argv[++i];
+    } else if (strcmp(argv[i], "--banks") == 0 && i + 1 < argc) {
+      bank_count = (uint32_t)strtoul(argv[++i], NULL, 0);
+      if (bank_count == 0 || bank_count > MEM_MAX_BANKS) {
+        fprintf(stderr, "Error: --banks must be 1 to %d\n", MEM_MAX_BANKS);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--fuzz") == 0 && i + 1 < argc) {
+      fuzz.dir = argv[++i];
+    } else if (strcmp(argv[i], "--fuzz-jobs") == 0 && i + 1 < argc) {
+      fuzz.jobs = (uint32_t)strtoul(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--fuzz-time") == 0 && i + 1 < argc) {
+      fuzz.seconds = (uint32_t)strtoul(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--fuzz-input") == 0 && i + 1 < argc) {
+      fuzz.memory_input = true;
+      fuzz.input_addr = (uint16_t)strtoul(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--fuzz-cycles") == 0 && i + 1 < argc) {
+      fuzz.max_cycles = strtoull(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--disasm") == 0) {
+      disasm_mode = true;
+    } else if (strcmp(argv[i], "--cfg") == 0 && i + 1 < argc) {
+      disasm_mode = true;
+      cfg_file = argv[++i];
+    } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+      server.socket = argv[++i];
+    } else if (strcmp(argv[i], "--serve-jobs") == 0 && i + 1 < argc) {
+      server.threads = (uint32_t)strtoul(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--serve-queue") == 0 && i + 1 < argc) {
+      server.queue = (uint32_t)strtoul(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--serve-idle") == 0 && i + 1 < argc) {
+      server.idle = (uint32_t)strtoul(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--send") == 0 && i + 1 < argc) {
+      client.socket = argv[++i];
+    } else if (strcmp(argv[i], "--send-cycles") == 0 && i + 1 < argc) {
+      client.max_cycles = (uint32_t)strtoul(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--send-repeat") == 0 && i + 1 < argc) {
+      client.repeat = (uint32_t)strtoul(argv[++i], NULL, 0);
     } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
       print_usage(argv[0]);
       return 0;
@@ -50,50 +357,310 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  if (iolog_file && (batch_lanes || verify_rate || core_count)) {
+    fprintf(stderr, "Error: --record/--replay need a single CPU\n");
+    return 1;
+  }
+  if (memdiff_file && (batch_lanes || verify_rate || core_count || fuzz.dir ||
+                       server.socket)) {
+    fprintf(stderr, "Error: --memdiff needs a single CPU\n");
+    return 1;
+  }
+  if (fuzz.dir && (batch_lanes || verify_rate || core_count || iolog_file)) {
+    fprintf(stderr, "Error: --fuzz cannot be combined with -b, -c, --verify "
+                    "or --record/--replay\n");
+    return 1;
+  }
+
+  if (server.socket && (batch_lanes || verify_rate || core_count ||
+                        iolog_file || fuzz.dir || bank_count || map_file)) {
+    fprintf(stderr, "Error: --serve cannot be combined with -b, -c, --verify, "
+                    "--record/--replay, --fuzz, --banks or --map\n");
+    return 1;
+  }
+  if (server.socket && !input_file) {
+    return server_run(&server, NULL) ? 0 : 1;
+  }
+
   if (!input_file) {
     fprintf(stderr, "Error: No input file specified\n");
     print_usage(argv[0]);
     return 1;
   }
 
-  // Initialize assembler
-  Assembler assembler;
-  asm_init(&assembler);
-
-  printf("Assembling %s...\n", input_file);
+  // C sources are compiled to an assembly file next to them first
+  char asm_file[256];
+  const char *ext = strrchr(input_file, '.');
+  if (ext && strcmp(ext, ".c") == 0) {
+    snprintf(asm_file, sizeof(asm_file), "%.*s.s", (int)(ext - input_file),
+             input_file);
+    printf("Compiling %s...\n", input_file);
+    if (!cc_compile_file(input_file, asm_file)) {
+      fprintf(stderr, "Compilation failed\n");
+      return 1;
+    }
+    printf("Assembly written to %s\n", asm_file);
+    input_file = asm_file;
+  }
 
-  // Assemble the file
-  if (!asm_assemble_file(&assembler, input_file)) {
-    fprintf(stderr, "Assembly failed\n");
+  // A binary image is mapped copy-on-write as it stands; anything else is
+  // assembled and copied in
+  bool image = ext && (strcmp(ext, ".bin") == 0 || strcmp(ext, ".img") == 0);
+  if (image && map_file) {
+    fprintf(stderr, "Error: --map cannot be used with a binary image\n");
     return 1;
   }
 
-  printf("Assembly successful! Program size: %d bytes\n",
-         assembler.program_size);
-
-  // Save binary file
-  char output_file[256];
-  strncpy(output_file, input_file, sizeof(output_file) - 5);
-  char *dot = strrchr(output_file, '.');
-  if (dot)
-    *dot = '\0';
-  strcat(output_file, ".bin");
+  Assembler assembler;
+  if (!image) {
+    if (!assemble_program(&assembler, input_file, optimize, li_cycles,
+                          &asm_cache)) {
+      return 1;
+    }
+    if (assemble_only) {
+      return 0;
+    }
+  }
 
-  if (asm_save_binary(&assembler, output_file)) {
-    printf("Binary saved to %s\n", output_file);
+  // Disassembly and server requests work on the image alone
+  if (disasm_mode || client.socket) {
+    uint32_t size = 0;
+    uint8_t *loaded = image ? read_image(input_file, &size) : NULL;
+    if (image && !loaded) {
+      return 1;
+    }
+    const uint8_t *program = image ? loaded : assembler.program;
+    if (!image) {
+      size = assembler.program_size;
+    }
+    client.input = console_file;
+    bool ok = disasm_mode ? disassemble(program, size, cfg_file)
+                          : server_send(&client, program, size);
+    free(loaded);
+    return ok ? 0 : 1;
   }
 
-  if (assemble_only) {
-    return 0;
+  // Console input comes from stdin unless redirected to a file
+  int console_fd = STDIN_FILENO;
+  if (console_file && (console_fd = open(console_file, O_RDONLY)) < 0) {
+    fprintf(stderr, "Error: Cannot open console input %s\n", console_file);
+    return 1;
   }
+  StdioHost host;
+  stdio_host_init(&host, console_fd, true);
 
   // Initialize CPU
   CPU cpu;
   cpu_init(&cpu);
+  cpu.host = &host.host;
   cpu.debug = debug_mode;
 
-  // Load program
-  cpu_load_program(&cpu, assembler.program, assembler.program_size, 0x0000);
+  MemMap map;
+  if (image || map_file) {
+    const char *path = image ? input_file : map_file;
+    CpuError error = memmap_open(&map, path, !image);
+    if (error != CPU_OK) {
+      fprintf(stderr, "Error: Cannot map %s: %s\n", path,
+              error == CPU_ERR_HOST_IO ? strerror(errno)
+                                       : cpu_error_string(error));
+      return 1;
+    }
+    memmap_attach(&map, &cpu);
+    printf("Memory mapped from %s (%s)\n", path, image ? "private" : "shared");
+  }
+
+  // Extended memory lives as long as the process
+  if (bank_count > 0) {
+    uint8_t *banks = calloc(bank_count, MEM_PAGE_SIZE);
+    if (!banks) {
+      fprintf(stderr, "Error: Out of memory for %u banks\n", bank_count);
+      return 1;
+    }
+    mem_attach_banks(&cpu, banks, (uint16_t)bank_count);
+  }
+
+  IoLog iolog;
+  if (iolog_file) {
+    if (!iolog_open(&iolog, iolog_file, replay, &cpu, &host.host)) {
+      return 1;
+    }
+    cpu.host = &iolog.host;
+  }
+
+  // Load program; a mapped image already holds it and starts at 0
+  CpuError error =
+      image ? CPU_OK
+            : cpu_load_program(&cpu, assembler.program, assembler.program_size,
+                               0x0000);
+  if (error != CPU_OK) {
+    fprintf(stderr, "Error: %s\n", cpu_error_string(error));
+    return 1;
+  }
+
+  if (server.socket) {
+    return server_run(&server, &cpu) ? 0 : 1;
+  }
+
+  if (fuzz.dir) {
+    FuzzReport report;
+
+    printf("\nFuzzing for %us (corpus in %s)...\n", fuzz.seconds, fuzz.dir);
+    printf("==================\n\n");
+    if (!fuzz_run(&cpu, &fuzz, &report)) {
+      return 1;
+    }
+
+    printf("\n==================\n");
+    printf("Executions: %llu in %.1fs (%.0f/s)\n",
+           (unsigned long long)report.execs, report.seconds,
+           report.seconds > 0 ? report.execs / report.seconds : 0.0);
+    printf("Corpus: %u inputs covering %u edges\n", report.corpus,
+           report.edges);
+    printf("Crashes: %u, hangs: %u (saved in %s/crashes)\n", report.crashes,
+           report.hangs, fuzz.dir);
+    return report.crashes || report.hangs ? 2 : 0;
+  }
+
+  if (verify_rate > 0) {
+    VerifyConfig config = {.sample_rate = verify_rate, .seed = 0};
+    VerifyReport report;
+
+    printf("\nVerifying batch engine (1 in %u blocks)...\n", verify_rate);
+    printf("==================\n\n");
+    if (!verify_run(&cpu, &config, &report)) {
+      return 1;
+    }
+
+    printf("\n\n==================\n");
+    printf("Blocks: %llu (%llu compared in full)\n",
+           (unsigned long long)report.blocks,
+           (unsigned long long)report.full_checks);
+    if (report.diverged) {
+      printf("DIVERGENCE in block at PC=0x%04X, cycle %llu:\n%s", report.pc,
+             (unsigned long long)report.cycle, report.diff);
+      return 2;
+    }
+    printf("Engines agree after %llu cycles\n",
+           (unsigned long long)cpu.cycle_count);
+    bool faulted = report_fault("Program", &cpu);
+    cpu_dump_registers(&cpu);
+    return faulted ? 1 : 0;
+  }
+
+  if (batch_lanes > 0) {
+    Batch batch;
+    if (!batch_init(&batch, batch_lanes, &cpu)) {
+      return 1;
+    }
+
+    printf("\nRunning %u instances in lockstep...\n", batch_lanes);
+    printf("==================\n\n");
+    batch_run(&batch);
+
+    printf("\n\n==================\n");
+    printf("Batch halted after %llu lockstep steps\n",
+           (unsigned long long)batch.steps);
+    printf("Lane instructions: %llu (%.2f lanes per step)\n",
+           (unsigned long long)batch.lane_instructions,
+           batch.steps ? (double)batch.lane_instructions / batch.steps : 0.0);
+    bool faulted = false;
+    for (uint32_t lane = 0; lane < batch.lanes; lane++) {
+      char who[24];
+      snprintf(who, sizeof(who), "Lane %u", lane);
+      faulted |= report_fault(who, batch_lane_cpu(&batch, lane));
+    }
+
+    // Lane 0 stands in for the rest; all lanes ran the same image
+    cpu_dump_registers(batch_lane_cpu(&batch, 0));
+    if (memdump || debug_mode) {
+      printf("\n=== Data Memory Dump (lane 0) ===\n");
+      cpu_dump_memory(&batch.cpus[0], 0x0080, 0x0220);
+    }
+    batch_free(&batch);
+    return faulted ? 1 : 0;
+  }
+
+  if (core_count > 0) {
+    MultiCore mc;
+    if (!mc_init(&mc, core_count, &cpu)) {
+      return 1;
+    }
+    mc.deterministic = deterministic;
+
+    printf("\nRunning %u cores (%s)...\n", core_count,
+           deterministic ? "deterministic" : "threaded");
+    printf("==================\n\n");
+    bool ok = mc_run(&mc);
+
+    printf("\n\n==================\n");
+    printf("All cores halted after %llu instructions\n",
+           (unsigned long long)mc_total_cycles(&mc));
+    bool faulted = false;
+    for (uint32_t id = 0; id < mc.count; id++) {
+      printf("\n=== Core %u (%llu cycles) ===\n", id,
+             (unsigned long long)mc.cores[id].cycle_count);
+      char who[24];
+      snprintf(who, sizeof(who), "Core %u", id);
+      faulted |= report_fault(who, &mc.cores[id]);
+      cpu_dump_registers(&mc.cores[id]);
+    }
+    if (memdump || debug_mode) {
+      printf("\n=== Data Memory Dump (shared) ===\n");
+      cpu_dump_memory(&mc.cores[0], 0x0080, 0x0220);
+    }
+    mc_free(&mc);
+    return ok && !faulted ? 0 : 1;
+  }
+
+  Pipeline pipeline;
+  if (pipeline_mode) {
+    if (!pipeline_init(&pipeline, forwarding)) {
+      fprintf(stderr, "Error: Cannot allocate pipeline statistics\n");
+      return 1;
+    }
+    cpu.pipeline = &pipeline;
+  }
+
+  CacheHierarchy cache;
+  if (cache_mode) {
+    if (!cache_init(&cache, cache_spec)) {
+      fprintf(stderr, "Error: %s\n", cache.error);
+      return 1;
+    }
+    cpu.cache = &cache;
+  }
+
+  BranchStudy study;
+  if (predictor_mode) {
+    if (!predictor_init(&study, predictor_kind)) {
+      fprintf(stderr, "Error: Cannot allocate branch statistics\n");
+      return 1;
+    }
+    cpu.predictor = &study;
+  }
+
+  // Diffs start from memory as loaded; with --memdiff-step each one then
+  // starts where the previous one left off
+  FILE *memdiff = NULL;
+  uint8_t *memdiff_base = NULL;
+  MemDiffFormat memdiff_format = MEM_DIFF_TEXT;
+  uint64_t memdiff_next = memdiff_step;
+  if (memdiff_file) {
+    const char *dext = strrchr(memdiff_file, '.');
+    if (dext && strcmp(dext, ".bin") == 0) {
+      memdiff_format = MEM_DIFF_BINARY;
+    }
+    memdiff = strcmp(memdiff_file, "-") == 0
+                  ? stdout
+                  : fopen(memdiff_file,
+                          memdiff_format == MEM_DIFF_BINARY ? "wb" : "w");
+    memdiff_base = calloc(1, MEMORY_SIZE);
+    if (!memdiff || !memdiff_base) {
+      fprintf(stderr, "Error: Cannot write memory diff to %s\n", memdiff_file);
+      return 1;
+    }
+    mem_checkpoint(&cpu, memdiff_base);
+  }
 
   printf("\nRunning program...\n");
   printf("==================\n\n");
@@ -109,10 +676,14 @@ int main(int argc, char *argv[]) {
       cpu_step(&cpu);
 
       if (debug_mode) {
-        uint8_t opcode = (cpu.ir >> 12) & 0xF;
+        Opcode opcode = decode_instruction(cpu.ir).opcode;
         printf("Executed: %s (0x%04X)\n", cpu_opcode_to_string(opcode), cpu.ir);
         cpu_dump_registers(&cpu);
       }
+      if (memdiff_step && cpu.cycle_count >= memdiff_next) {
+        write_memdiff(&cpu, memdiff_base, memdiff_format, memdiff);
+        memdiff_next = cpu.cycle_count + memdiff_step;
+      }
 
       printf("\nPress Enter to continue (or 'q' to quit): ");
       if (fgets(input, sizeof(input), stdin) && input[0] == 'q') {
@@ -129,23 +700,60 @@ int main(int argc, char *argv[]) {
       cpu_step(&cpu);
 
       if (debug_mode) {
-        uint8_t opcode = (cpu.ir >> 12) & 0xF;
+        Opcode opcode = decode_instruction(cpu.ir).opcode;
         printf("Executed: %s (0x%04X)\n", cpu_opcode_to_string(opcode), cpu.ir);
       }
+      if (memdiff_step && cpu.cycle_count >= memdiff_next) {
+        write_memdiff(&cpu, memdiff_base, memdiff_format, memdiff);
+        memdiff_next = cpu.cycle_count + memdiff_step;
+      }
     }
   }
 
   printf("\n\n==================\n");
   printf("Program halted after %llu cycles\n", cpu.cycle_count);
+  bool faulted = report_fault("Program", &cpu);
+  if (iolog_file) {
+    bool ok = iolog_close(&iolog);
+    printf("I/O log: %llu records %s\n", (unsigned long long)iolog.records,
+           replay ? "replayed" : "recorded");
+    if (!ok) {
+      fprintf(stderr, "Error: I/O log %s: %s\n", iolog_file, iolog.error);
+      return 2;
+    }
+  }
 
   // Dump final state
   cpu_dump_registers(&cpu);
 
+  if (pipeline_mode) {
+    pipeline_report(&pipeline, &cpu);
+    pipeline_free(&pipeline);
+  }
+  if (cache_mode) {
+    cache_report(&cache, &cpu);
+    cache_free(&cache);
+  }
+  if (predictor_mode) {
+    predictor_report(&study, &cpu);
+    predictor_free(&study);
+  }
+
   if (memdump || debug_mode) {
     printf("\n=== Data Memory Dump ===\n");
     // Fibonacci (0x0080), Timer (0x0100), Hello (0x0200)
     cpu_dump_memory(&cpu, 0x0080, 0x0220);
   }
+  if (memdiff) {
+    write_memdiff(&cpu, memdiff_base, memdiff_format, memdiff);
+    if (memdiff != stdout) {
+      fclose(memdiff);
+    }
+    free(memdiff_base);
+  }
+  if (image || map_file) {
+    memmap_close(&map);
+  }
 
-  return 0;
+  return faulted ? 1 : 0;
 }
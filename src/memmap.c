@@ -0,0 +1,98 @@
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS
+#include "../include/memmap.h"
+#include "../include/memory.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * ============================================================================
+ * FILE-BACKED MEMORY
+ * ============================================================================
+ * The CPU only sees memory through cpu->memory, so a mapping simply takes
+ * the place of cpu->ram. Device accesses are decoded by address before
+ * memory is touched and never write through to the mapping.
+ */
+
+/**
+ * Map a private, copy-on-write image. The anonymous reservation supplies
+ * zero pages past the end of a short file instead of SIGBUS.
+ */
+static uint8_t *memmap_private(int fd, off_t size) {
+  uint8_t *base = mmap(NULL, MEMORY_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED || size == 0) {
+    return base;
+  }
+
+  if (mmap(base, (size_t)size, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+    int saved = errno;
+    munmap(base, MEMORY_SIZE);
+    errno = saved;
+    return MAP_FAILED;
+  }
+  return base;
+}
+
+/**
+ * Map a file as guest memory
+ */
+CpuError memmap_open(MemMap *map, const char *path, bool shared) {
+  map->base = NULL;
+  map->shared = shared;
+
+  int fd = open(path, shared ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+  if (fd < 0) {
+    return CPU_ERR_HOST_IO;
+  }
+  struct stat st;
+  uint8_t *base;
+  CpuError error = CPU_OK;
+  if (fstat(fd, &st) != 0) {
+    base = MAP_FAILED;
+  } else if (!shared && st.st_size > IO_START) {
+    base = MAP_FAILED;
+    error = CPU_ERR_PROGRAM_SIZE;
+  } else if (!shared) {
+    base = memmap_private(fd, st.st_size);
+  } else if (st.st_size < MEMORY_SIZE && ftruncate(fd, MEMORY_SIZE) != 0) {
+    base = MAP_FAILED;
+  } else {
+    base = mmap(NULL, MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  int saved = errno;
+  close(fd); // The mapping keeps the file open
+  errno = saved;
+
+  if (base == MAP_FAILED) {
+    return error != CPU_OK ? error : CPU_ERR_HOST_IO;
+  }
+  map->base = base;
+  return CPU_OK;
+}
+
+/**
+ * Use the mapping as a CPU's memory
+ */
+void memmap_attach(MemMap *map, CPU *cpu) {
+  cpu->memory = map->base;
+  mem_map_pages(cpu);
+  mem_mark_dirty(cpu, 0, MEMORY_SIZE);
+}
+
+/**
+ * Flush and unmap
+ */
+void memmap_close(MemMap *map) {
+  if (!map->base) {
+    return;
+  }
+  if (map->shared) {
+    msync(map->base, MEMORY_SIZE, MS_SYNC);
+  }
+  munmap(map->base, MEMORY_SIZE);
+  map->base = NULL;
+}
@@ -1,80 +1,630 @@
 #include "../include/memory.h"
+#include "../include/cache.h"
 #include <stdio.h>
-#include <sys/time.h>
+#include <string.h>
+
+// Guest accesses. With --cores, other threads touch the same bytes at the
+// same time, so every guest load and store is a relaxed atomic; these
+// compile to the same plain moves, but concurrent accesses are no longer
+// data races. Words stay two byte accesses and may tear, as documented.
+#define MEM_LOAD(cpu, address)                                                 \
+  __atomic_load_n(&MEM_BYTE(cpu, address), __ATOMIC_RELAXED)
+#define MEM_STORE(cpu, address, value)                                         \
+  __atomic_store_n(&MEM_BYTE(cpu, address), (uint8_t)(value),                  \
+                   __ATOMIC_RELAXED)
+
+/*
+ * ============================================================================
+ * PAGE TABLE
+ * ============================================================================
+ * Every guest access goes through cpu->pages, so remapping a page to another
+ * bank is a single pointer update and never copies memory. The top page
+ * holds the device window and the stack and is never banked.
+ */
 
 /**
- * Read 16-bit word from memory (little-endian)
+ * Host memory behind a page: its bank, or its own slice of memory
  */
-uint16_t mem_read_word(CPU *cpu, uint16_t address) {
-  if (address >= MEMORY_SIZE - 1) {
-    fprintf(stderr, "Error: Memory read out of bounds at 0x%04X\n", address);
-    return 0;
+static uint8_t *mem_page_base(const CPU *cpu, int page, uint16_t bank) {
+  return bank ? cpu->banks + (size_t)(bank - 1) * MEM_PAGE_SIZE
+              : cpu->memory + page * MEM_PAGE_SIZE;
+}
+
+/**
+ * Rebuild the page table from the bank selects
+ */
+void mem_map_pages(CPU *cpu) {
+  for (int page = 0; page < MEM_PAGES; page++) {
+    cpu->pages[page] = mem_page_base(cpu, page, cpu->bank_select[page]);
   }
+}
 
-  // Handle memory-mapped I/O
-  if (address >= IO_START && address <= IO_END) {
-    switch (address) {
-    case IO_CONSOLE_IN:
-      return getchar();
-    case IO_TIMER_VAL: {
-      struct timeval tv;
-      gettimeofday(&tv, NULL);
-      uint64_t ms = (tv.tv_sec * 1000) + (tv.tv_usec / 1000);
-      return (uint16_t)(ms & 0xFFFF);
-    }
-    default:
+/**
+ * Give a CPU extended memory, with every page back on its own RAM
+ */
+void mem_attach_banks(CPU *cpu, uint8_t *banks, uint16_t count) {
+  for (int page = 0; page < MEM_PAGES; page++) {
+    if (cpu->bank_select[page]) {
+      mem_mark_dirty(cpu, page * MEM_PAGE_SIZE, MEM_PAGE_SIZE);
+    }
+  }
+  cpu->banks = banks;
+  cpu->bank_count = banks ? count : 0;
+  memset(cpu->bank_select, 0, sizeof(cpu->bank_select));
+  mem_map_pages(cpu);
+}
+
+/**
+ * Check for one of the IO_BANK_SELECT words
+ */
+static bool mem_bank_register(uint16_t address) {
+  return address >= IO_BANK_SELECT &&
+         address < IO_BANK_SELECT + 2 * MEM_BANKED_PAGES && !(address & 1);
+}
+
+/**
+ * Map a bank at a page. A bank past the end of extended memory faults and
+ * leaves the page table alone.
+ */
+static void mem_select_bank(CPU *cpu, uint16_t address, uint16_t bank) {
+  if (bank > cpu->bank_count) {
+    cpu_fault(cpu, CPU_ERR_BANK_SELECT, address);
+    return;
+  }
+  int page = (address - IO_BANK_SELECT) / 2;
+  if (cpu->bank_select[page] != bank) {
+    // Every byte of the page may read differently now
+    mem_mark_dirty(cpu, page * MEM_PAGE_SIZE, MEM_PAGE_SIZE);
+  }
+  cpu->bank_select[page] = bank;
+  cpu->pages[page] = mem_page_base(cpu, page, bank);
+}
+
+/*
+ * ============================================================================
+ * DIRTY PAGES
+ * ============================================================================
+ * One bit per 256-byte page of the guest's view of memory, set on every
+ * store. A checkpoint copies just the marked pages into an image and clears
+ * the bits, so the bits always say which pages may differ from the last
+ * checkpoint. A bank switch marks the whole 4KB page, since the view changed
+ * even though nothing was written.
+ */
+
+// Mark the page holding an address (the store fast path)
+#define MEM_SET_DIRTY(cpu, address)                                            \
+  ((cpu)->dirty[(uint16_t)(address) >> 14] |=                                  \
+   1ULL << (((uint16_t)(address) >> MEM_DIRTY_SHIFT) & 63))
+
+/**
+ * Check a page's dirty bit
+ */
+static bool mem_page_dirty(const CPU *cpu, uint32_t page) {
+  return (cpu->dirty[page / 64] >> (page % 64)) & 1;
+}
+
+/**
+ * Mark every page overlapping [start, start + len)
+ */
+void mem_mark_dirty(CPU *cpu, uint16_t start, uint32_t len) {
+  if (len == 0) {
+    return;
+  }
+  uint32_t last = (uint32_t)start + len - 1;
+  if (last >= MEMORY_SIZE) {
+    last = MEMORY_SIZE - 1;
+  }
+  for (uint32_t page = start >> MEM_DIRTY_SHIFT;
+       page <= last >> MEM_DIRTY_SHIFT; page++) {
+    cpu->dirty[page / 64] |= 1ULL << (page % 64);
+  }
+}
+
+/**
+ * Copy the dirty pages into a checkpoint image and clear their bits
+ */
+void mem_checkpoint(CPU *cpu, uint8_t *image) {
+  for (uint32_t page = 0; page < MEM_DIRTY_PAGES; page++) {
+    if (mem_page_dirty(cpu, page)) {
+      uint16_t address = page << MEM_DIRTY_SHIFT;
+      memcpy(image + address, &MEM_BYTE(cpu, address), MEM_DIRTY_SIZE);
+    }
+  }
+  memset(cpu->dirty, 0, sizeof(cpu->dirty));
+}
+
+/**
+ * Store a little-endian value of n bytes
+ */
+static void mem_put(FILE *out, uint64_t value, int n) {
+  for (int i = 0; i < n; i++) {
+    fputc((value >> (8 * i)) & 0xFF, out);
+  }
+}
+
+/**
+ * Print one 16-byte line of a page before or after
+ */
+static void mem_diff_line(FILE *out, uint16_t address, char sign,
+                          const uint8_t *bytes) {
+  fprintf(out, "0x%04X %c", address, sign);
+  for (int i = 0; i < 16; i++) {
+    fprintf(out, " %02X", bytes[i]);
+  }
+  fputc('\n', out);
+}
+
+/**
+ * Write the dirty pages that no longer match a checkpoint image
+ */
+uint32_t mem_diff(const CPU *cpu, const uint8_t *image, MemDiffFormat format,
+                  FILE *out) {
+  // Pages can be written back to what they held, so compare before listing
+  uint16_t changed[MEM_DIRTY_PAGES];
+  uint32_t count = 0;
+  uint32_t dirty = 0;
+  for (uint32_t page = 0; page < MEM_DIRTY_PAGES; page++) {
+    uint16_t address = page << MEM_DIRTY_SHIFT;
+    if (mem_page_dirty(cpu, page)) {
+      dirty++;
+      if (memcmp(image + address, &MEM_BYTE(cpu, address), MEM_DIRTY_SIZE)) {
+        changed[count++] = address;
+      }
+    }
+  }
+
+  if (format == MEM_DIFF_BINARY) {
+    mem_put(out, MEM_DIFF_MAGIC, 4);
+    mem_put(out, count, 4);
+    mem_put(out, cpu->cycle_count, 8);
+    for (uint32_t i = 0; i < count; i++) {
+      mem_put(out, changed[i], 2);
+      fwrite(&MEM_BYTE(cpu, changed[i]), 1, MEM_DIRTY_SIZE, out);
+    }
+    return count;
+  }
+
+  fprintf(out,
+          "\n=== Memory Diff (cycle %llu: %u of %u dirty pages changed) ===\n",
+          (unsigned long long)cpu->cycle_count, count, dirty);
+  for (uint32_t i = 0; i < count; i++) {
+    for (uint16_t line = 0; line < MEM_DIRTY_SIZE; line += 16) {
+      uint16_t address = changed[i] + line;
+      const uint8_t *now = &MEM_BYTE(cpu, address);
+      if (memcmp(image + address, now, 16) != 0) {
+        mem_diff_line(out, address, '-', image + address);
+        mem_diff_line(out, address, '+', now);
+      }
+    }
+  }
+  return count;
+}
+
+/**
+ * Instruction word at an address, without devices, faults or cache traffic
+ */
+uint16_t mem_peek_word(const CPU *cpu, uint16_t address) {
+  return MEM_LOAD(cpu, address) | (MEM_LOAD(cpu, address + 1) << 8);
+}
+
+/*
+ * ============================================================================
+ * DEVICES
+ * ============================================================================
+ */
+
+/**
+ * Read a memory-mapped device register
+ */
+static uint16_t mem_read_io(CPU *cpu, uint16_t address) {
+  const CpuHost *host = cpu->host;
+  switch (address) {
+  case IO_CONSOLE_IN: {
+    if (!host || !host->console_read) {
+      return 0xFFFF; // No console: end of input
+    }
+    int ch = host->console_read(host->ctx);
+    if (ch == CPU_CONSOLE_EMPTY) {
+      cpu_wait_input(cpu);
       return 0;
     }
+    return (uint16_t)ch;
+  }
+  case IO_CONSOLE_STATUS:
+    if (!host || !host->console_status) {
+      return CONSOLE_STATUS_EOF;
+    }
+    return host->console_status(host->ctx, false);
+  case IO_TIMER_VAL:
+    if (!host || !host->clock_ms) {
+      return 0;
+    }
+    return (uint16_t)(host->clock_ms(host->ctx) & 0xFFFF);
+  case IO_DMA_SRC:
+    return cpu->dma_src;
+  case IO_DMA_DST:
+    return cpu->dma_dst;
+  case IO_DMA_LEN:
+    return cpu->dma_len;
+  case IO_DMA_CTRL:
+    return cpu->dma_status;
+  case IO_IRQ_ENABLE:
+    return cpu->irq_enable;
+  case IO_IRQ_PENDING:
+    return cpu->irq_pending;
+  case IO_IRQ_VECTOR:
+    return cpu->irq_vector;
+  case IO_FAULT_VECTOR:
+    return cpu->fault_vector;
+  case IO_FAULT_CAUSE:
+    return cpu->fault.cause;
+  case IO_FAULT_PC:
+    return cpu->fault.pc;
+  case IO_FAULT_ADDR:
+    return cpu->fault.address;
+  case IO_CORE_ID:
+    return cpu->core_id;
+  case IO_CORE_COUNT:
+    return cpu->core_count;
+  case IO_BANK_COUNT:
+    return cpu->bank_count;
+  default:
+    if (mem_bank_register(address)) {
+      return cpu->bank_select[(address - IO_BANK_SELECT) / 2];
+    }
+    return 0;
   }
+}
 
-  return (cpu->memory[address + 1] << 8) | cpu->memory[address];
+/**
+ * Check that [start, start + len) is plain memory: inside the address
+ * space and clear of the device window
+ */
+static bool mem_range_valid(uint16_t start, uint16_t len) {
+  uint32_t end = (uint32_t)start + len - 1;
+  return end < MEMORY_SIZE && (end < IO_START || start > IO_END);
 }
 
 /**
- * Write 16-bit word to memory (little-endian)
+ * Bytes from a and b (both counting up) to the nearer page end, at most len
  */
-void mem_write_word(CPU *cpu, uint16_t address, uint16_t value) {
-  if (address >= MEMORY_SIZE - 1) {
-    fprintf(stderr, "Error: Memory write out of bounds at 0x%04X\n", address);
+static uint16_t mem_chunk(uint16_t len, uint16_t a, uint16_t b) {
+  uint16_t n = MEM_PAGE_SIZE - (a & MEM_PAGE_MASK);
+  uint16_t m = MEM_PAGE_SIZE - (b & MEM_PAGE_MASK);
+  n = m < n ? m : n;
+  return len < n ? len : n;
+}
+
+/**
+ * memmove within one page-contiguous piece. Memory shared with cores on
+ * other threads is copied a relaxed atomic byte at a time instead.
+ */
+static void mem_move(const CPU *cpu, uint8_t *dst, const uint8_t *src,
+                     uint16_t n) {
+  if (cpu->core_count <= 1) {
+    memmove(dst, src, n);
+  } else if (dst <= src) {
+    for (uint16_t i = 0; i < n; i++) {
+      __atomic_store_n(&dst[i], __atomic_load_n(&src[i], __ATOMIC_RELAXED),
+                       __ATOMIC_RELAXED);
+    }
+  } else {
+    for (uint16_t i = n; i > 0; i--) {
+      __atomic_store_n(&dst[i - 1],
+                       __atomic_load_n(&src[i - 1], __ATOMIC_RELAXED),
+                       __ATOMIC_RELAXED);
+    }
+  }
+}
+
+/**
+ * memset within one page-contiguous piece, atomically as for mem_move
+ */
+static void mem_fill(const CPU *cpu, uint8_t *dst, uint8_t value,
+                     uint16_t n) {
+  if (cpu->core_count <= 1) {
+    memset(dst, value, n);
+    return;
+  }
+  for (uint16_t i = 0; i < n; i++) {
+    __atomic_store_n(&dst[i], value, __ATOMIC_RELAXED);
+  }
+}
+
+/**
+ * memmove between guest ranges one page-contiguous piece at a time. Pieces
+ * are taken from the end when the destination is above the source, so an
+ * overlapping copy within the same memory is still exact.
+ */
+static void mem_dma_copy(CPU *cpu, uint16_t dst, uint16_t src, uint16_t len) {
+  if (dst <= src) {
+    while (len > 0) {
+      uint16_t n = mem_chunk(len, dst, src);
+      mem_move(cpu, &MEM_BYTE(cpu, dst), &MEM_BYTE(cpu, src), n);
+      dst += n;
+      src += n;
+      len -= n;
+    }
+    return;
+  }
+
+  while (len > 0) {
+    // Bytes back to the start of the pages holding the last ones
+    uint16_t d = ((dst + len - 1) & MEM_PAGE_MASK) + 1;
+    uint16_t s = ((src + len - 1) & MEM_PAGE_MASK) + 1;
+    uint16_t n = d < s ? d : s;
+    n = len < n ? len : n;
+    len -= n;
+    mem_move(cpu, &MEM_BYTE(cpu, dst + len), &MEM_BYTE(cpu, src + len), n);
+  }
+}
+
+/**
+ * Run the DMA transfer selected by a write to IO_DMA_CTRL
+ */
+static void mem_dma_start(CPU *cpu, uint16_t mode) {
+  uint16_t len = cpu->dma_len;
+  cpu->dma_status = DMA_STATUS_OK;
+  if (len == 0) {
+    return;
+  }
+
+  if (!mem_range_valid(cpu->dma_dst, len) ||
+      (mode == DMA_MODE_COPY && !mem_range_valid(cpu->dma_src, len))) {
+    cpu_log(cpu, CPU_LOG_ERROR,
+            "DMA range out of bounds (src=0x%04X dst=0x%04X len=%u)",
+            cpu->dma_src, cpu->dma_dst, len);
+    cpu->dma_status = DMA_STATUS_ERROR;
+    return;
+  }
+
+  switch (mode) {
+  case DMA_MODE_COPY:
+    mem_mark_dirty(cpu, cpu->dma_dst, len);
+    mem_dma_copy(cpu, cpu->dma_dst, cpu->dma_src, len);
+    break;
+  case DMA_MODE_FILL:
+    mem_mark_dirty(cpu, cpu->dma_dst, len);
+    for (uint16_t addr = cpu->dma_dst, left = len; left > 0;) {
+      uint16_t n = mem_chunk(left, addr, addr);
+      mem_fill(cpu, &MEM_BYTE(cpu, addr), cpu->dma_src & 0xFF, n);
+      addr += n;
+      left -= n;
+    }
+    break;
+  default:
+    cpu_log(cpu, CPU_LOG_ERROR, "Unknown DMA mode 0x%X", mode);
+    cpu->dma_status = DMA_STATUS_ERROR;
     return;
   }
 
+  uint16_t rate = cpu->dma_bytes_per_cycle ? cpu->dma_bytes_per_cycle : 1;
+  cpu->cycle_count += cpu->dma_setup_cycles + (len + rate - 1) / rate;
+}
+
+/**
+ * Word read at or above the last RAM byte: MMIO, the stack region, or one
+ * of the out-of-bounds words at 0xEFFF and 0xFFFF, whose high byte lies in
+ * the device window or past the end of memory
+ */
+static uint16_t mem_read_high(CPU *cpu, uint16_t address) {
+  if (address == IO_START - 1 || address >= MEMORY_SIZE - 1) {
+    cpu_fault(cpu, CPU_ERR_MEMORY_BOUNDS, address);
+    return 0;
+  }
+
   // Handle memory-mapped I/O
-  if (address >= IO_START && address <= IO_END) {
-    switch (address) {
-    case IO_CONSOLE_OUT:
-      if (cpu->debug) {
-        printf("\n\n>>> OUTPUT: %c <<<\n\n", value & 0xFF);
-      } else {
-        putchar(value & 0xFF);
+  if (address <= IO_END) {
+    IOTrace *trace = cpu->io_trace;
+    if (trace && trace->replay) {
+      if (trace->next >= trace->count) {
+        trace->underflow = true;
+        return 0;
       }
-      fflush(stdout);
-      return;
-    case IO_TIMER_CTRL:
-      cpu->timer_enabled = (value != 0);
+      return trace->values[trace->next++];
+    }
+
+    uint16_t value = mem_read_io(cpu, address);
+    if (trace && !cpu->input_wait && trace->count < IO_TRACE_CAPACITY) {
+      trace->values[trace->count++] = value;
+    }
+    return value;
+  }
+
+  if (cpu->cache) {
+    cache_access(cpu->cache, CACHE_READ, address);
+  }
+  return (MEM_LOAD(cpu, address + 1) << 8) | MEM_LOAD(cpu, address);
+}
+
+/**
+ * Read 16-bit word from memory (little-endian). Every word wholly below the
+ * device window is plain RAM, so one compare covers devices and bounds
+ * faults.
+ */
+uint16_t mem_read_word(CPU *cpu, uint16_t address) {
+  if (address >= IO_START - 1) {
+    return mem_read_high(cpu, address);
+  }
+  if (cpu->cache) {
+    cache_access(cpu->cache, CACHE_READ, address);
+  }
+  return (MEM_LOAD(cpu, address + 1) << 8) | MEM_LOAD(cpu, address);
+}
+
+/**
+ * Fetch an instruction word. Same as mem_read_word, but seen by the
+ * instruction cache rather than the data cache.
+ */
+uint16_t mem_fetch_word(CPU *cpu, uint16_t address) {
+  if (address >= IO_START - 1) {
+    return mem_read_high(cpu, address);
+  }
+  if (cpu->cache) {
+    cache_access(cpu->cache, CACHE_FETCH, address);
+  }
+  return (MEM_LOAD(cpu, address + 1) << 8) | MEM_LOAD(cpu, address);
+}
+
+/**
+ * Write a device register. Stores to addresses in the window with no
+ * register behind them are dropped, just as they read back as zero.
+ */
+static void mem_write_io(CPU *cpu, uint16_t address, uint16_t value) {
+  switch (address) {
+  case IO_CONSOLE_OUT:
+    if (cpu->io_trace && cpu->io_trace->replay) {
+      return; // Already printed by the recording engine
+    }
+    if (cpu->debug) {
+      cpu_log(cpu, CPU_LOG_DEBUG, "\n\n>>> OUTPUT: %c <<<\n", value & 0xFF);
+    } else if (cpu->host && cpu->host->console_write) {
+      cpu->host->console_write(cpu->host->ctx, value & 0xFF);
+    }
+    return;
+  case IO_TIMER_CTRL:
+    cpu->timer_enabled = (value != 0);
+    return;
+  case IO_TIMER_VAL:
+    cpu->timer = value;
+    cpu->timer_reload = value;
+    return;
+  case IO_IRQ_ENABLE:
+    cpu->irq_enable = value;
+    return;
+  case IO_IRQ_PENDING:
+    cpu->irq_pending &= ~value;
+    return;
+  case IO_IRQ_VECTOR:
+    cpu->irq_vector = value;
+    return;
+  case IO_FAULT_VECTOR:
+    cpu->fault_vector = value;
+    return;
+  case IO_DMA_SRC:
+    cpu->dma_src = value;
+    return;
+  case IO_DMA_DST:
+    cpu->dma_dst = value;
+    return;
+  case IO_DMA_LEN:
+    cpu->dma_len = value;
+    return;
+  case IO_DMA_CTRL:
+    mem_dma_start(cpu, value);
+    return;
+  default:
+    if (mem_bank_register(address)) {
+      mem_select_bank(cpu, address, value);
+    }
+    return;
+  }
+}
+
+/**
+ * Write 16-bit word to memory (little-endian). As for reads, one compare
+ * separates plain RAM from devices and bounds faults.
+ */
+void mem_write_word(CPU *cpu, uint16_t address, uint16_t value) {
+  if (address >= IO_START - 1) {
+    // A word at 0xEFFF would put its high byte in the device window
+    if (address == IO_START - 1 || address >= MEMORY_SIZE - 1) {
+      cpu_fault(cpu, CPU_ERR_MEMORY_BOUNDS, address);
       return;
-    case IO_TIMER_VAL:
-      cpu->timer = value;
+    }
+    // The I/O window is device-mapped: stores there never reach RAM, which
+    // may be a file shared with other processes
+    if (address <= IO_END) {
+      mem_write_io(cpu, address, value);
       return;
     }
   }
 
-  cpu->memory[address] = value & 0xFF;
-  cpu->memory[address + 1] = (value >> 8) & 0xFF;
+  if (cpu->cache) {
+    cache_access(cpu->cache, CACHE_WRITE, address);
+  }
+
+  MEM_STORE(cpu, address, value & 0xFF);
+  MEM_STORE(cpu, address + 1, (value >> 8) & 0xFF);
+  MEM_SET_DIRTY(cpu, address);
+  if ((address & (MEM_DIRTY_SIZE - 1)) == MEM_DIRTY_SIZE - 1) {
+    MEM_SET_DIRTY(cpu, address + 1);
+  }
+}
+
+/**
+ * Atomic read-modify-write of an aligned RAM word, sequentially consistent
+ * with respect to every other core's atomics. The old value is returned in
+ * *old. Misaligned and device addresses are rejected.
+ */
+bool mem_atomic_word(CPU *cpu, Opcode op, uint16_t address, uint16_t expected,
+                     uint16_t operand, uint16_t *old) {
+  if ((address & 1) || (address >= IO_START && address <= IO_END)) {
+    cpu_fault(cpu, CPU_ERR_ATOMIC_ADDRESS, address);
+    return false;
+  }
+
+  if (cpu->cache) {
+    cache_access(cpu->cache, CACHE_WRITE, address);
+  }
+
+  MEM_SET_DIRTY(cpu, address);
+
+  // Guest words are little-endian, as are the supported hosts
+  uint16_t *word = (uint16_t *)&MEM_BYTE(cpu, address);
+  switch (op) {
+  case OP_CAS:
+    *old = expected;
+    __atomic_compare_exchange_n(word, old, operand, false, __ATOMIC_SEQ_CST,
+                                __ATOMIC_SEQ_CST);
+    return true;
+  case OP_FADD:
+    *old = __atomic_fetch_add(word, operand, __ATOMIC_SEQ_CST);
+    return true;
+  case OP_SWAP:
+    *old = __atomic_exchange_n(word, operand, __ATOMIC_SEQ_CST);
+    return true;
+  default:
+    return false;
+  }
+}
+
+/**
+ * Report whether console input is waiting or has ended. With wait set, the
+ * host may block until it is. Without a console, input is always at its end.
+ */
+bool mem_console_ready(CPU *cpu, bool wait) {
+  IOTrace *trace = cpu->io_trace;
+  if (trace && trace->replay) {
+    if (trace->next >= trace->count) {
+      trace->underflow = true;
+      return false;
+    }
+    return trace->values[trace->next++] != 0;
+  }
+
+  const CpuHost *host = cpu->host;
+  bool ready = !host || !host->console_status ||
+               host->console_status(host->ctx, wait) != 0;
+  if (trace && trace->count < IO_TRACE_CAPACITY) {
+    trace->values[trace->count++] = ready;
+  }
+  return ready;
 }
 
 /**
  * Read byte from memory
  */
 uint8_t mem_read_byte(CPU *cpu, uint16_t address) {
-  return cpu->memory[address];
+  return MEM_LOAD(cpu, address);
 }
 
 /**
  * Write byte to memory
  */
 void mem_write_byte(CPU *cpu, uint16_t address, uint8_t value) {
-  cpu->memory[address] = value;
+  MEM_STORE(cpu, address, value);
+  MEM_SET_DIRTY(cpu, address);
 }
 
 /**
@@ -86,7 +636,7 @@ void mem_dump(CPU *cpu, uint16_t start, uint16_t end) {
     // Check if line is all zeros
     bool all_zeros = true;
     for (int i = 0; i < 16 && (addr + i) <= end; i++) {
-      if (cpu->memory[addr + i] != 0) {
+      if (MEM_BYTE(cpu, addr + i) != 0) {
         all_zeros = false;
         break;
       }
@@ -97,7 +647,7 @@ void mem_dump(CPU *cpu, uint16_t start, uint16_t end) {
 
     printf("0x%04X: ", addr);
     for (int i = 0; i < 16 && (addr + i) <= end; i++) {
-      printf("%02X ", cpu->memory[addr + i]);
+      printf("%02X ", MEM_BYTE(cpu, addr + i));
     }
     printf("\n");
   }
@@ -0,0 +1,126 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../include/multicore.h"
+#include "../include/memory.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * ============================================================================
+ * MULTI-CORE
+ * ============================================================================
+ * All cores execute the same image from 0x0000 and tell themselves apart by
+ * reading IO_CORE_ID. The stack region is split into one equal slice per
+ * core, so PUSH/CALL on one core cannot silently run into another's frames.
+ * Plain loads and stores go straight to the shared array; only CAS, FADD and
+ * SWAP are ordered between cores.
+ */
+
+/**
+ * Initialize count cores from a loaded prototype
+ */
+bool mc_init(MultiCore *mc, uint32_t count, const CPU *prototype) {
+  if (count == 0 || count > MC_MAX_CORES) {
+    fprintf(stderr, "Error: Core count must be between 1 and %d\n",
+            MC_MAX_CORES);
+    return false;
+  }
+
+  mc->cores = malloc(count * sizeof(CPU));
+  if (!mc->cores) {
+    fprintf(stderr, "Error: Cannot allocate %u cores\n", count);
+    return false;
+  }
+  mc->count = count;
+  mc->deterministic = false;
+  mc->quantum = MC_DEFAULT_QUANTUM;
+
+  // Even-sized slices, carved downwards from the top of the stack region
+  uint16_t slice = ((STACK_END + 1 - STACK_START) / count) & ~1u;
+  for (uint32_t id = 0; id < count; id++) {
+    CPU *core = &mc->cores[id];
+    cpu_clone(core, prototype);
+    if (id > 0) {
+      core->memory = mc->cores[0].memory;
+      mem_map_pages(core);
+    }
+    core->core_id = id;
+    core->core_count = count;
+    core->stack_top = STACK_END - id * slice;
+    core->stack_limit = core->stack_top - slice + 1;
+    core->sp = core->stack_top;
+  }
+  return true;
+}
+
+/**
+ * Free the core array
+ */
+void mc_free(MultiCore *mc) {
+  free(mc->cores);
+  mc->cores = NULL;
+  mc->count = 0;
+}
+
+/**
+ * Thread body: one host thread per guest core
+ */
+static void *mc_thread(void *arg) {
+  cpu_run((CPU *)arg);
+  return NULL;
+}
+
+/**
+ * Interleave the cores on the calling thread, quantum instructions at a
+ * time, so that runs are reproducible
+ */
+static void mc_run_deterministic(MultiCore *mc) {
+  uint32_t quantum = mc->quantum ? mc->quantum : 1;
+  bool running = true;
+  while (running) {
+    running = false;
+    for (uint32_t id = 0; id < mc->count; id++) {
+      CPU *core = &mc->cores[id];
+      for (uint32_t i = 0; i < quantum && !core->halted; i++) {
+        cpu_step(core);
+      }
+      running |= !core->halted;
+    }
+  }
+}
+
+/**
+ * Run all cores to completion. Returns false if threads could not be
+ * started; cores already started are still joined.
+ */
+bool mc_run(MultiCore *mc) {
+  if (mc->deterministic || mc->count == 1) {
+    mc_run_deterministic(mc);
+    return true;
+  }
+
+  pthread_t threads[MC_MAX_CORES];
+  uint32_t started = 0;
+  for (; started < mc->count; started++) {
+    if (pthread_create(&threads[started], NULL, mc_thread,
+                       &mc->cores[started]) != 0) {
+      fprintf(stderr, "Error: Cannot start thread for core %u\n", started);
+      break;
+    }
+  }
+  for (uint32_t id = 0; id < started; id++) {
+    pthread_join(threads[id], NULL);
+  }
+  return started == mc->count;
+}
+
+/**
+ * Sum of instructions retired by every core
+ */
+uint64_t mc_total_cycles(const MultiCore *mc) {
+  uint64_t total = 0;
+  for (uint32_t id = 0; id < mc->count; id++) {
+    total += mc->cores[id].cycle_count;
+  }
+  return total;
+}
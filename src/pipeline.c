@@ -0,0 +1,258 @@
+#include "../include/pipeline.h"
+#include "../include/decoder.h"
+#include "../include/memory.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * ============================================================================
+ * PIPELINE TIMING MODEL
+ * ============================================================================
+ * A scoreboard over the register file and flags records, for every value,
+ * the first cycle an instruction in EX could consume it. Each retired
+ * instruction enters EX at the later of the cycle after its predecessor and
+ * the readiness of its operands; the difference is charged as a stall.
+ * Control transfers resolve in EX, so a taken branch, jump, call, return
+ * or interrupt entry flushes the two younger instructions behind it.
+ * With a branch predictor, conditional branches cost nothing when predicted
+ * right (one bubble if the target is only known in ID). Cache misses freeze
+ * the whole pipeline for their latency.
+ */
+
+#define SLOT(r) (1u << (r))
+
+// Scoreboard slots an instruction reads and writes
+typedef struct {
+  uint16_t reads;
+  uint16_t writes;
+  bool memory_result; // Written values come out of MEM, not EX
+} Operands;
+
+/**
+ * Work out which registers and flags an instruction depends on
+ */
+static Operands pipeline_operands(uint16_t raw) {
+  Instruction inst = decode_instruction(raw);
+  Operands ops = {0, 0, false};
+
+  switch (inst.opcode) {
+  case OP_ADD:
+  case OP_SUB:
+  case OP_AND:
+  case OP_OR:
+  case OP_XOR:
+  case OP_MUL:
+  case OP_MULH:
+  case OP_MULHU:
+  case OP_DIVU:
+  case OP_DIV:
+  case OP_MODU:
+  case OP_MOD:
+  case OP_SHL:
+  case OP_SHR:
+  case OP_SAR:
+    ops.reads = SLOT(inst.rs1) | SLOT(inst.rs2);
+    ops.writes = SLOT(inst.rd) | SLOT(PIPELINE_FLAGS);
+    break;
+  case OP_ADDI:
+  case OP_SUBI:
+  case OP_SHLI:
+  case OP_SHRI:
+  case OP_SARI:
+    ops.reads = SLOT(inst.rd);
+    ops.writes = SLOT(inst.rd) | SLOT(PIPELINE_FLAGS);
+    break;
+  case OP_LOADI:
+    ops.writes = SLOT(inst.rd);
+    break;
+  case OP_LOAD:
+    ops.reads = SLOT(inst.rs1);
+    ops.writes = SLOT(inst.rd);
+    ops.memory_result = true;
+    break;
+  case OP_STORE:
+    ops.reads = SLOT(inst.rs1) | SLOT(inst.rd);
+    break;
+  case OP_CAS:
+  case OP_FADD:
+  case OP_SWAP:
+    ops.reads = SLOT(inst.rd) | SLOT(inst.rs1) | SLOT(inst.rs2);
+    ops.writes = SLOT(inst.rd);
+    if (inst.opcode == OP_CAS) {
+      ops.writes |= SLOT(PIPELINE_FLAGS);
+    }
+    ops.memory_result = true;
+    break;
+  case OP_BEQ:
+  case OP_BNE:
+  case OP_BLT:
+    ops.reads = SLOT(PIPELINE_FLAGS);
+    break;
+  case OP_PUSH:
+    ops.reads = SLOT(raw & 0x7);
+    break;
+  case OP_POP:
+    ops.writes = SLOT(raw & 0x7);
+    ops.memory_result = true;
+    break;
+  case OP_RETI:
+    ops.writes = SLOT(PIPELINE_FLAGS);
+    ops.memory_result = true;
+    break;
+  default:
+    break;
+  }
+  return ops;
+}
+
+/**
+ * Initialize an empty pipeline
+ */
+bool pipeline_init(Pipeline *pl, bool forwarding) {
+  memset(pl, 0, sizeof(Pipeline));
+  pl->pc_stalls = calloc(MEMORY_SIZE / 2, sizeof(*pl->pc_stalls));
+  if (!pl->pc_stalls) {
+    return false;
+  }
+  pl->forwarding = forwarding;
+  pl->branch_penalty = PIPELINE_BRANCH_PENALTY;
+  pl->next_ex = 2; // The first instruction spends cycles 0-1 in IF and ID
+  return true;
+}
+
+/**
+ * Free the per-PC statistics
+ */
+void pipeline_free(Pipeline *pl) {
+  free(pl->pc_stalls);
+  pl->pc_stalls = NULL;
+}
+
+/**
+ * Charge stall cycles to a cause and to the instruction that suffered them
+ */
+static void pipeline_charge(Pipeline *pl, uint16_t pc, StallCause cause,
+                            uint64_t cycles) {
+  pl->stalls[cause] += cycles;
+  pl->pc_stalls[pc >> 1][cause] += (uint32_t)cycles;
+}
+
+/**
+ * Account for one retired instruction
+ */
+void pipeline_retire(Pipeline *pl, uint16_t pc, uint16_t raw,
+                     uint16_t next_pc, uint64_t extra_cycles,
+                     uint32_t memory_cycles, BranchOutcome branch) {
+  Operands ops = pipeline_operands(raw);
+
+  // Wait in ID until every operand can be read or forwarded
+  uint64_t ex = pl->next_ex;
+  StallCause cause = STALL_DATA;
+  for (int slot = 0; slot <= PIPELINE_FLAGS; slot++) {
+    if ((ops.reads & SLOT(slot)) && pl->ready[slot] > ex) {
+      ex = pl->ready[slot];
+      cause = pl->from_load[slot] ? STALL_LOAD_USE : STALL_DATA;
+    }
+  }
+  if (ex > pl->next_ex) {
+    pipeline_charge(pl, pc, cause, ex - pl->next_ex);
+  }
+
+  // With bypasses an EX result is usable next cycle and a MEM result one
+  // later; without them consumers read the register file after WB
+  uint64_t latency = !pl->forwarding ? 3 : ops.memory_result ? 2 : 1;
+  for (int slot = 0; slot <= PIPELINE_FLAGS; slot++) {
+    if (ops.writes & SLOT(slot)) {
+      pl->ready[slot] = ex + latency;
+      pl->from_load[slot] = pl->forwarding && ops.memory_result;
+    }
+  }
+
+  pl->instructions++;
+  pl->last_ex = ex;
+  pl->next_ex = ex + 1;
+
+  // Without a predictor every control transfer is a not-taken miss
+  uint32_t bubbles = 0;
+  switch (branch) {
+  case BRANCH_NONE:
+    bubbles = next_pc != (uint16_t)(pc + 2) ? pl->branch_penalty : 0;
+    break;
+  case BRANCH_CORRECT:
+    break;
+  case BRANCH_CORRECT_DECODE:
+    bubbles = 1;
+    break;
+  case BRANCH_MISPREDICT:
+    bubbles = pl->branch_penalty;
+    break;
+  }
+  if (bubbles) {
+    pl->next_ex += bubbles;
+    pipeline_charge(pl, pc, STALL_CONTROL, bubbles);
+  }
+  if (memory_cycles) {
+    pl->next_ex += memory_cycles;
+    pipeline_charge(pl, pc, STALL_MEMORY, memory_cycles);
+  }
+  if (extra_cycles) {
+    pl->next_ex += extra_cycles;
+    pipeline_charge(pl, pc, STALL_DEVICE, extra_cycles);
+  }
+}
+
+/**
+ * Total cycles until the last instruction leaves WB
+ */
+uint64_t pipeline_cycles(const Pipeline *pl) {
+  return pl->instructions ? pl->last_ex + PIPELINE_DEPTH - 2 : 0;
+}
+
+/**
+ * Print CPI, the stall breakdown and the instructions that stalled most
+ */
+void pipeline_report(const Pipeline *pl, const CPU *cpu) {
+  static const char *const cause_names[STALL_CAUSES] = {
+      "data", "load-use", "control", "memory", "device"};
+  uint64_t cycles = pipeline_cycles(pl);
+
+  printf("\n=== Pipeline Timing (%s forwarding) ===\n",
+         pl->forwarding ? "with" : "no");
+  printf("Instructions: %llu\n", (unsigned long long)pl->instructions);
+  printf("Cycles:       %llu (CPI %.2f)\n", (unsigned long long)cycles,
+         pl->instructions ? (double)cycles / pl->instructions : 0.0);
+  for (int c = 0; c < STALL_CAUSES; c++) {
+    printf("  %-9s %8llu stall cycles (%.1f%%)\n", cause_names[c],
+           (unsigned long long)pl->stalls[c],
+           cycles ? 100.0 * pl->stalls[c] / cycles : 0.0);
+  }
+
+  // Selection of the worst instructions; the table is small enough to scan
+  uint32_t top[PIPELINE_TOP_PCS];
+  uint64_t top_total[PIPELINE_TOP_PCS];
+  int found = 0;
+  for (uint32_t i = 0; i < MEMORY_SIZE / 2; i++) {
+    uint64_t total = 0;
+    for (int c = 0; c < STALL_CAUSES; c++) {
+      total += pl->pc_stalls[i][c];
+    }
+    if (total != 0) {
+      found = cpu_top_insert(top, top_total, found, PIPELINE_TOP_PCS, i, total);
+    }
+  }
+
+  if (found > 0) {
+    printf("Stalls by instruction:\n");
+    printf("  PC      Opcode   data  load-use  control  memory  device\n");
+  }
+  for (int t = 0; t < found; t++) {
+    uint16_t pc = (uint16_t)(top[t] << 1);
+    uint16_t raw = mem_peek_word(cpu, pc);
+    const uint32_t *s = pl->pc_stalls[top[t]];
+    printf("  0x%04X  %-6s %6u %9u %8u %7u %7u\n", pc,
+           cpu_opcode_to_string(decode_instruction(raw).opcode),
+           s[STALL_DATA], s[STALL_LOAD_USE], s[STALL_CONTROL],
+           s[STALL_MEMORY], s[STALL_DEVICE]);
+  }
+}
@@ -0,0 +1,192 @@
+#include "../include/predictor.h"
+#include "../include/decoder.h"
+#include "../include/memory.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * ============================================================================
+ * BRANCH PREDICTION
+ * ============================================================================
+ * All predictors run side by side on the same stream of conditional
+ * branches so their accuracy can be compared in one run. Unconditional
+ * BRANCH, CALL and returns are not predicted and keep the pipeline's
+ * default flush.
+ */
+
+#define TABLE_MASK ((1u << PREDICTOR_TABLE_BITS) - 1)
+#define HISTORY_MASK ((1u << PREDICTOR_HISTORY_BITS) - 1)
+
+static const char *const predictor_names[PREDICTOR_COUNT] = {
+    "nt", "btfn", "bimodal", "gshare", "btb"};
+
+/**
+ * Initialize all predictors; counters start weakly not-taken
+ */
+bool predictor_init(BranchStudy *study, PredictorKind selected) {
+  memset(study, 0, sizeof(BranchStudy));
+  study->pc_stats = calloc(MEMORY_SIZE / 2, sizeof(BranchStats));
+  if (!study->pc_stats) {
+    return false;
+  }
+  study->selected = selected;
+  memset(study->bimodal, 1, sizeof(study->bimodal));
+  memset(study->gshare, 1, sizeof(study->gshare));
+  return true;
+}
+
+/**
+ * Free the per-branch statistics
+ */
+void predictor_free(BranchStudy *study) {
+  free(study->pc_stats);
+  study->pc_stats = NULL;
+}
+
+/**
+ * Look up a predictor by its command-line name
+ */
+bool predictor_parse(const char *name, PredictorKind *kind) {
+  for (int k = 0; k < PREDICTOR_COUNT; k++) {
+    if (strcmp(name, predictor_names[k]) == 0) {
+      *kind = (PredictorKind)k;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Move a two-bit saturating counter towards the outcome
+ */
+static void predictor_train(uint8_t *counter, bool taken) {
+  if (taken && *counter < 3) {
+    (*counter)++;
+  } else if (!taken && *counter > 0) {
+    (*counter)--;
+  }
+}
+
+/**
+ * Predict and train on one retired instruction
+ */
+BranchOutcome predictor_observe(BranchStudy *study, uint16_t pc, uint16_t raw,
+                                uint8_t flags) {
+  Instruction inst = decode_instruction(raw);
+
+  // Decided by the condition, not the next PC: a zero offset is still taken
+  bool taken;
+  switch (inst.opcode) {
+  case OP_BEQ:
+    taken = (flags & FLAG_ZERO) != 0;
+    break;
+  case OP_BNE:
+    taken = (flags & FLAG_ZERO) == 0;
+    break;
+  case OP_BLT:
+    taken = (flags & FLAG_NEGATIVE) != 0;
+    break;
+  default:
+    return BRANCH_NONE;
+  }
+  uint16_t target = pc + 2 + inst.imm12;
+
+  // Each predictor's guess for this branch
+  bool guess[PREDICTOR_COUNT];
+  uint32_t bimodal = (pc >> 1) & TABLE_MASK;
+  uint32_t gshare = ((pc >> 1) ^ study->history) & TABLE_MASK;
+  BTBEntry *entry = &study->btb[(pc >> 1) % PREDICTOR_BTB_ENTRIES];
+  bool btb_hit = entry->valid && entry->pc == pc;
+
+  guess[PRED_NOT_TAKEN] = false;
+  guess[PRED_BACKWARD] = inst.imm12 < 0;
+  guess[PRED_BIMODAL] = study->bimodal[bimodal] >= 2;
+  guess[PRED_GSHARE] = study->gshare[gshare] >= 2;
+  guess[PRED_BTB] = btb_hit && entry->counter >= 2;
+
+  BranchStats *stats = &study->pc_stats[pc >> 1];
+  study->branches++;
+  study->taken += taken;
+  stats->executed++;
+  stats->taken += taken;
+  for (int k = 0; k < PREDICTOR_COUNT; k++) {
+    bool correct = guess[k] == taken;
+    study->correct[k] += correct;
+    stats->correct[k] += correct;
+  }
+
+  // Only the BTB knows the target at fetch; the others find it in ID
+  BranchOutcome outcome;
+  if (guess[study->selected] != taken) {
+    outcome = BRANCH_MISPREDICT;
+  } else if (taken && study->selected != PRED_BTB) {
+    outcome = BRANCH_CORRECT_DECODE;
+  } else {
+    outcome = BRANCH_CORRECT;
+  }
+
+  // Train
+  predictor_train(&study->bimodal[bimodal], taken);
+  predictor_train(&study->gshare[gshare], taken);
+  study->history = ((study->history << 1) | taken) & HISTORY_MASK;
+  if (btb_hit) {
+    predictor_train(&entry->counter, taken);
+  } else if (taken) {
+    entry->pc = pc;
+    entry->target = target;
+    entry->counter = 2;
+    entry->valid = true;
+  }
+  return outcome;
+}
+
+/**
+ * Print accuracy per predictor and per branch
+ */
+void predictor_report(const BranchStudy *study, const CPU *cpu) {
+  printf("\n=== Branch Prediction (pipeline uses %s) ===\n",
+         predictor_names[study->selected]);
+  printf("Conditional branches: %llu (%.1f%% taken)\n",
+         (unsigned long long)study->branches,
+         study->branches ? 100.0 * study->taken / study->branches : 0.0);
+  for (int k = 0; k < PREDICTOR_COUNT; k++) {
+    printf("  %-8s %6.2f%% correct (%llu mispredicted)\n", predictor_names[k],
+           study->branches ? 100.0 * study->correct[k] / study->branches : 0.0,
+           (unsigned long long)(study->branches - study->correct[k]));
+  }
+
+  // Branches with the most mispredictions under the selected predictor
+  uint32_t top[PREDICTOR_TOP_PCS];
+  uint64_t top_missed[PREDICTOR_TOP_PCS];
+  int found = 0;
+  for (uint32_t i = 0; i < MEMORY_SIZE / 2; i++) {
+    const BranchStats *s = &study->pc_stats[i];
+    if (s->executed != 0) {
+      uint32_t missed = s->executed - s->correct[study->selected];
+      found = cpu_top_insert(top, top_missed, found, PREDICTOR_TOP_PCS, i,
+                             missed);
+    }
+  }
+
+  if (found > 0) {
+    printf("Accuracy by branch:\n");
+    printf("  PC      Opcode    count  taken");
+    for (int k = 0; k < PREDICTOR_COUNT; k++) {
+      printf(" %8s", predictor_names[k]);
+    }
+    printf("\n");
+  }
+  for (int t = 0; t < found; t++) {
+    uint16_t pc = (uint16_t)(top[t] << 1);
+    uint16_t raw = mem_peek_word(cpu, pc);
+    const BranchStats *s = &study->pc_stats[top[t]];
+    printf("  0x%04X  %-6s %8u %5.0f%%", pc,
+           cpu_opcode_to_string(decode_instruction(raw).opcode), s->executed,
+           100.0 * s->taken / s->executed);
+    for (int k = 0; k < PREDICTOR_COUNT; k++) {
+      printf(" %7.1f%%", 100.0 * s->correct[k] / s->executed);
+    }
+    printf("\n");
+  }
+}
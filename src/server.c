@@ -0,0 +1,816 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../include/server.h"
+#include "../include/buffer_host.h"
+#include "../include/memory.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * ============================================================================
+ * EMULATOR SERVER
+ * ============================================================================
+ * Programs are loaded once into a prototype CPU; a request that sends an
+ * image already loaded gets the existing copy. When the table is full, the
+ * least recently used program that no run holds is unloaded to make room,
+ * and its id stops working (the slot's generation is part of the id). Each
+ * worker thread owns one CPU allocated at startup and restores it from the
+ * prototype before every run, so a request costs copying back the pages
+ * the previous run wrote (the whole CPU when the program changes) plus the
+ * guest's own instructions.
+ *
+ * The main thread accepts connections into a bounded queue that the
+ * workers drain, one connection per worker at a time. When the queue is
+ * full it stops accepting, so further clients wait in the listen backlog
+ * and then in connect(). A client that sends nothing for the idle limit
+ * (or stops reading responses) is disconnected, so idle connections cannot
+ * hold every worker. A stop signal writes to a self-pipe that the
+ * accept loop polls alongside the socket, so it is never missed between a
+ * check of the flag and a blocking call.
+ */
+
+#define SERVER_SPACE_WAIT_MS 100 // Recheck for a signal while the queue is full
+#define SERVER_NO_PROGRAM UINT32_MAX
+
+typedef struct {
+  uint64_t hash;
+  uint32_t size;
+  uint32_t id;   // Slot, plus SERVER_MAX_PROGRAMS per reuse of the slot
+  uint32_t refs; // Requests using the program; the preload keeps one
+  uint64_t used; // Table clock at the last use, for eviction
+  CPU *cpu;      // Loaded image every run starts from (NULL: slot unused)
+} ServerProgram;
+
+// State shared by every worker
+typedef struct {
+  ServerProgram programs[SERVER_MAX_PROGRAMS];
+  uint32_t program_count;  // Slots in use
+  uint64_t clock;          // Ticks on every program use
+  pthread_mutex_t load;    // Program table
+  pthread_mutex_t lock;    // Connection queue and active connections
+  pthread_cond_t queued;   // A connection is waiting
+  pthread_cond_t space;    // The queue has room again
+  int *queue;              // Ring of accepted connections
+  uint32_t queue_size;
+  uint32_t queue_head;
+  uint32_t queue_count;
+  uint32_t idle; // Seconds before a silent client is disconnected
+  bool stop;
+  uint64_t requests;
+  uint64_t run_ns;
+} Server;
+
+// One worker thread and its warm machine
+typedef struct {
+  Server *srv;
+  pthread_t thread;
+  int fd;    // Connection being served, -1 when idle
+  CPU *cpu;  // Restored from a program before each run
+  uint32_t last; // Program cpu was last restored from (SERVER_NO_PROGRAM)
+  BufferHost host; // Console of the current run, into output
+  uint8_t output[SERVER_MAX_OUTPUT];
+  uint8_t image[IO_START];
+  uint8_t input_buf[SERVER_MAX_INPUT];
+} ServerWorker;
+
+static volatile sig_atomic_t server_signalled;
+static int server_wake[2] = {-1, -1}; // Self-pipe written by the handler
+
+/*
+ * ============================================================================
+ * WIRE FORMAT
+ * ============================================================================
+ */
+
+/**
+ * Store little-endian values
+ */
+static void put16(uint8_t *p, uint16_t v) {
+  p[0] = v & 0xFF;
+  p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+  put16(p, v & 0xFFFF);
+  put16(p + 2, v >> 16);
+}
+
+static void put64(uint8_t *p, uint64_t v) {
+  put32(p, (uint32_t)v);
+  put32(p + 4, (uint32_t)(v >> 32));
+}
+
+/**
+ * Load little-endian values
+ */
+static uint16_t get16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+
+static uint32_t get32(const uint8_t *p) {
+  return get16(p) | ((uint32_t)get16(p + 2) << 16);
+}
+
+static uint64_t get64(const uint8_t *p) {
+  return get32(p) | ((uint64_t)get32(p + 4) << 32);
+}
+
+/**
+ * Read exactly len bytes; false on end of stream or error
+ */
+static bool server_read(int fd, void *buf, size_t len) {
+  uint8_t *p = buf;
+  while (len > 0) {
+    ssize_t n = read(fd, p, len);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    len -= (size_t)n;
+  }
+  return true;
+}
+
+/**
+ * Write exactly len bytes without raising SIGPIPE
+ */
+static bool server_write(int fd, const void *buf, size_t len) {
+  const uint8_t *p = buf;
+  while (len > 0) {
+    ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    len -= (size_t)n;
+  }
+  return true;
+}
+
+/**
+ * Nanoseconds on the monotonic clock
+ */
+static uint64_t server_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * ============================================================================
+ * PROGRAMS
+ * ============================================================================
+ */
+
+/**
+ * Slot to load a new program into: an unused one, else the least recently
+ * used program that nothing holds. NULL when every program is in use.
+ */
+static ServerProgram *server_victim(Server *srv) {
+  ServerProgram *victim = NULL;
+  for (uint32_t i = 0; i < SERVER_MAX_PROGRAMS; i++) {
+    ServerProgram *p = &srv->programs[i];
+    if (!p->cpu) {
+      p->id = i;
+      return p;
+    }
+    if (p->refs == 0 && (!victim || p->used < victim->used)) {
+      victim = p;
+    }
+  }
+  return victim;
+}
+
+/**
+ * Add a prepared CPU to the table, or find the program already holding
+ * the same image. Returns SERVER_OK with the id and a reference that
+ * server_release gives back, SERVER_ERR_FULL when every program is in use,
+ * or SERVER_ERR_REQUEST when the CPU cannot be allocated.
+ */
+static ServerStatus server_add(Server *srv, const CPU *prototype,
+                               uint32_t size, uint32_t *id) {
+  uint64_t hash = buffer_hash(prototype->memory, size);
+  ServerStatus status = SERVER_OK;
+
+  pthread_mutex_lock(&srv->load);
+  ServerProgram *p = NULL;
+  for (uint32_t i = 0; i < SERVER_MAX_PROGRAMS && !p; i++) {
+    ServerProgram *q = &srv->programs[i];
+    if (q->cpu && q->hash == hash && q->size == size &&
+        memcmp(q->cpu->ram, prototype->memory, size) == 0) {
+      p = q;
+    }
+  }
+  if (!p) {
+    p = server_victim(srv);
+    CPU *cpu = !p ? NULL : p->cpu ? p->cpu : malloc(sizeof(CPU));
+    if (!cpu) {
+      status = p ? SERVER_ERR_REQUEST : SERVER_ERR_FULL;
+      p = NULL;
+    } else {
+      if (p->cpu) {
+        p->id += SERVER_MAX_PROGRAMS; // Old id now finds nothing
+      } else {
+        srv->program_count++;
+      }
+      cpu_clone(cpu, prototype);
+      if (cpu->memory != cpu->ram) {
+        memcpy(cpu->ram, prototype->memory, MEMORY_SIZE);
+        cpu->memory = cpu->ram;
+        mem_map_pages(cpu);
+      }
+      cpu->host = NULL;
+      cpu->io_trace = NULL;
+      cpu->debug = false;
+      p->hash = hash;
+      p->size = size;
+      p->cpu = cpu;
+    }
+  }
+  if (p) {
+    p->refs++;
+    p->used = ++srv->clock;
+    *id = p->id;
+  }
+  pthread_mutex_unlock(&srv->load);
+  return status;
+}
+
+/**
+ * Take a reference to a loaded program; NULL if the id is unknown or its
+ * program was unloaded
+ */
+static const CPU *server_acquire(Server *srv, uint32_t id) {
+  pthread_mutex_lock(&srv->load);
+  ServerProgram *p = &srv->programs[id % SERVER_MAX_PROGRAMS];
+  const CPU *cpu = NULL;
+  if (p->cpu && p->id == id) {
+    p->refs++;
+    p->used = ++srv->clock;
+    cpu = p->cpu;
+  }
+  pthread_mutex_unlock(&srv->load);
+  return cpu;
+}
+
+/**
+ * Give back a reference from server_add or server_acquire
+ */
+static void server_release(Server *srv, uint32_t id) {
+  pthread_mutex_lock(&srv->load);
+  srv->programs[id % SERVER_MAX_PROGRAMS].refs--;
+  pthread_mutex_unlock(&srv->load);
+}
+
+/**
+ * Load an image sent by a client
+ */
+static ServerStatus server_load(ServerWorker *w, uint32_t size,
+                                uint32_t *id) {
+  CPU *cpu = w->cpu;
+  w->last = SERVER_NO_PROGRAM;
+  cpu_init(cpu);
+  if (cpu_load_program(cpu, w->image, (uint16_t)size, 0x0000) != CPU_OK) {
+    return SERVER_ERR_REQUEST;
+  }
+  return server_add(w->srv, cpu, size, id);
+}
+
+/*
+ * ============================================================================
+ * WORKERS
+ * ============================================================================
+ */
+
+/**
+ * Milliseconds on the monotonic clock, for the guest's timer register
+ */
+static uint64_t server_clock_ms(void *ctx) {
+  (void)ctx;
+  return server_now_ns() / 1000000;
+}
+
+/**
+ * Restore the worker's CPU from a program and run it to a stop
+ */
+static void server_exec(ServerWorker *w, uint32_t id, const CPU *prototype,
+                        uint32_t input_len, uint64_t max_cycles,
+                        uint8_t *response) {
+  // Another run of the same program only needs the pages it wrote back. A
+  // reloaded slot has a new id, so this never restores from another image.
+  CPU *cpu = w->cpu;
+  if (w->last == id) {
+    cpu_restore(cpu, prototype);
+  } else {
+    cpu_clone(cpu, prototype);
+    w->last = id;
+  }
+  cpu->host = &w->host.host;
+  buffer_host_reset(&w->host, w->input_buf, input_len);
+
+  uint64_t start = server_now_ns();
+  while (!cpu->halted && cpu->cycle_count < max_cycles) {
+    cpu_step(cpu);
+  }
+  uint64_t run_ns = server_now_ns() - start;
+
+  ServerStop stop = !cpu->halted                   ? SERVER_STOP_LIMIT
+                    : cpu->stop == CPU_STOP_FAULT ? SERVER_STOP_FAULT
+                                                  : SERVER_STOP_HALT;
+  response[5] = stop;
+  response[6] = w->host.truncated;
+  response[7] = cpu->flags;
+  for (int r = 0; r < NUM_REGISTERS; r++) {
+    put16(response + 12 + 2 * r, cpu->registers[r]);
+  }
+  put16(response + 28, cpu->pc);
+  put16(response + 30, cpu->sp);
+  if (stop == SERVER_STOP_FAULT) {
+    put16(response + 32, cpu->fault.cause);
+    put16(response + 34, cpu->fault.pc);
+    put16(response + 36, cpu->fault.address);
+  }
+  put64(response + 40, cpu->cycle_count);
+  put64(response + 48, run_ns);
+  put32(response + 56, w->host.output_len);
+
+  __atomic_add_fetch(&w->srv->requests, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&w->srv->run_ns, run_ns, __ATOMIC_RELAXED);
+}
+
+/**
+ * Answer requests on a connection until the client closes it. A request
+ * that cannot be parsed gets an error and ends the connection, since the
+ * stream can no longer be followed.
+ */
+static void server_serve(ServerWorker *w, int fd) {
+  uint8_t request[SERVER_REQUEST_SIZE];
+  while (server_read(fd, request, sizeof(request))) {
+    uint8_t response[SERVER_RESPONSE_SIZE] = {0};
+    uint8_t kind = request[4];
+    uint32_t id = get32(request + 8);
+    uint32_t image_len = get32(request + 12);
+    uint32_t input_len = get32(request + 16);
+    uint64_t max_cycles = get32(request + 20);
+    ServerStatus status = SERVER_OK;
+
+    put32(response, SERVER_RESPONSE_MAGIC);
+    if (get32(request) != SERVER_REQUEST_MAGIC ||
+        (kind != SERVER_LOAD && kind != SERVER_RUN) || image_len > IO_START ||
+        input_len > SERVER_MAX_INPUT) {
+      response[4] = SERVER_ERR_REQUEST;
+      server_write(fd, response, sizeof(response));
+      break;
+    }
+    if (!server_read(fd, w->image, image_len) ||
+        !server_read(fd, w->input_buf, input_len)) {
+      break;
+    }
+
+    // The program is held until the response is built, so it cannot be
+    // unloaded under the run
+    const CPU *prototype = NULL;
+    if (image_len > 0) {
+      status = server_load(w, image_len, &id);
+      if (status == SERVER_OK) {
+        prototype = w->srv->programs[id % SERVER_MAX_PROGRAMS].cpu;
+      }
+    } else if (!(prototype = server_acquire(w->srv, id))) {
+      status = SERVER_ERR_PROGRAM;
+    }
+    response[4] = status;
+    put32(response + 8, id);
+    if (prototype) {
+      if (kind == SERVER_RUN) {
+        server_exec(w, id, prototype, input_len,
+                    max_cycles ? max_cycles : SERVER_DEFAULT_CYCLES,
+                    response);
+      }
+      server_release(w->srv, id);
+    }
+
+    uint32_t output_len = get32(response + 56);
+    if (!server_write(fd, response, sizeof(response)) ||
+        !server_write(fd, w->output, output_len)) {
+      break;
+    }
+  }
+}
+
+/**
+ * Worker thread: take connections off the queue until the server stops
+ */
+static void *server_thread(void *arg) {
+  ServerWorker *w = arg;
+  Server *srv = w->srv;
+
+  for (;;) {
+    pthread_mutex_lock(&srv->lock);
+    while (srv->queue_count == 0 && !srv->stop) {
+      pthread_cond_wait(&srv->queued, &srv->lock);
+    }
+    if (srv->stop) {
+      pthread_mutex_unlock(&srv->lock);
+      return NULL;
+    }
+    w->fd = srv->queue[srv->queue_head];
+    srv->queue_head = (srv->queue_head + 1) % srv->queue_size;
+    srv->queue_count--;
+    pthread_cond_signal(&srv->space);
+    pthread_mutex_unlock(&srv->lock);
+
+    // Reads and writes that stall past the idle limit end the connection
+    struct timeval idle = {.tv_sec = srv->idle};
+    setsockopt(w->fd, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
+    setsockopt(w->fd, SOL_SOCKET, SO_SNDTIMEO, &idle, sizeof(idle));
+    server_serve(w, w->fd);
+
+    pthread_mutex_lock(&srv->lock);
+    close(w->fd);
+    w->fd = -1;
+    pthread_mutex_unlock(&srv->lock);
+  }
+}
+
+/*
+ * ============================================================================
+ * LISTENER
+ * ============================================================================
+ */
+
+/**
+ * Note SIGINT/SIGTERM and wake the accept loop's poll()
+ */
+static void server_on_signal(int sig) {
+  (void)sig;
+  int saved = errno;
+  server_signalled = 1;
+  if (write(server_wake[1], "", 1) < 0) {
+    // Full pipe: a wakeup is already pending
+  }
+  errno = saved;
+}
+
+/**
+ * Create the listening socket, replacing a stale socket file but nothing
+ * else
+ */
+static int server_listen(const char *path, int backlog) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Error: Socket path too long: %s\n", path);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  struct stat st;
+  if (lstat(path, &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      fprintf(stderr, "Error: %s exists and is not a socket\n", path);
+      return -1;
+    }
+    unlink(path);
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(fd, backlog) != 0 ||
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0) {
+    fprintf(stderr, "Error: Cannot listen on %s: %s\n", path,
+            strerror(errno));
+    if (fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+  return fd;
+}
+
+/**
+ * Accept connections into the queue, waiting while it is full. The listening
+ * socket is non-blocking, so a client that gives up between poll() and
+ * accept() cannot stall the loop.
+ */
+static void server_accept_loop(Server *srv, int listen_fd) {
+  while (!server_signalled) {
+    // Signals cannot wake a condition wait, so wait in short slices
+    pthread_mutex_lock(&srv->lock);
+    while (srv->queue_count == srv->queue_size && !server_signalled) {
+      struct timespec until;
+      clock_gettime(CLOCK_REALTIME, &until);
+      until.tv_nsec += SERVER_SPACE_WAIT_MS * 1000000L;
+      if (until.tv_nsec >= 1000000000L) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000L;
+      }
+      pthread_cond_timedwait(&srv->space, &srv->lock, &until);
+    }
+    pthread_mutex_unlock(&srv->lock);
+
+    struct pollfd pfd[2] = {{.fd = listen_fd, .events = POLLIN},
+                            {.fd = server_wake[0], .events = POLLIN}};
+    if (poll(pfd, 2, -1) < 0 && errno != EINTR) {
+      fprintf(stderr, "Error: poll failed: %s\n", strerror(errno));
+      return;
+    }
+    if (server_signalled || !(pfd[0].revents & POLLIN)) {
+      continue;
+    }
+
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) {
+      if (errno != EINTR && errno != ECONNABORTED && errno != EAGAIN &&
+          errno != EWOULDBLOCK) {
+        fprintf(stderr, "Error: accept failed: %s\n", strerror(errno));
+        return;
+      }
+      continue;
+    }
+
+    pthread_mutex_lock(&srv->lock);
+    srv->queue[(srv->queue_head + srv->queue_count) % srv->queue_size] = fd;
+    srv->queue_count++;
+    pthread_cond_signal(&srv->queued);
+    pthread_mutex_unlock(&srv->lock);
+  }
+}
+
+/**
+ * Serve until SIGINT or SIGTERM
+ */
+bool server_run(const ServerConfig *config, const CPU *preload) {
+  if (preload && preload->bank_count) {
+    fprintf(stderr, "Error: The server does not support extended memory\n");
+    return false;
+  }
+
+  uint32_t threads = config->threads;
+  if (threads == 0) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = online > 0 ? (uint32_t)online : 1;
+  }
+
+  uint32_t queue_size = config->queue ? config->queue : SERVER_DEFAULT_QUEUE;
+  Server *srv = calloc(1, sizeof(Server));
+  ServerWorker *workers = calloc(threads, sizeof(ServerWorker));
+  int *queue = calloc(queue_size, sizeof(int));
+  if (!srv || !workers || !queue) {
+    fprintf(stderr, "Error: Out of memory for %u server workers\n", threads);
+    free(srv);
+    free(workers);
+    free(queue);
+    return false;
+  }
+  srv->queue = queue;
+  srv->queue_size = queue_size;
+  srv->idle = config->idle ? config->idle : SERVER_DEFAULT_IDLE;
+  pthread_mutex_init(&srv->load, NULL);
+  pthread_mutex_init(&srv->lock, NULL);
+  pthread_cond_init(&srv->queued, NULL);
+  pthread_cond_init(&srv->space, NULL);
+
+  // The preload's reference is never given back, so it stays loaded
+  uint32_t id;
+  if (preload) {
+    server_add(srv, preload, IO_START, &id);
+  }
+
+  // Every worker's CPU is allocated and initialised before the first
+  // request, so no request pays for it. Workers block SIGINT and SIGTERM
+  // so that the handler runs in this thread.
+  sigset_t stop_signals;
+  sigset_t old_mask;
+  sigemptyset(&stop_signals);
+  sigaddset(&stop_signals, SIGINT);
+  sigaddset(&stop_signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stop_signals, &old_mask);
+  bool ok = true;
+  uint32_t started = 0;
+  for (; started < threads; started++) {
+    ServerWorker *w = &workers[started];
+    w->srv = srv;
+    w->fd = -1;
+    w->last = SERVER_NO_PROGRAM;
+    buffer_host_init(&w->host, w->output, sizeof(w->output));
+    w->host.host.clock_ms = server_clock_ms;
+    w->cpu = malloc(sizeof(CPU));
+    if (!w->cpu) {
+      fprintf(stderr, "Error: Out of memory for server CPU %u\n", started);
+      ok = false;
+      break;
+    }
+    cpu_init(w->cpu);
+    if (pthread_create(&w->thread, NULL, server_thread, w) != 0) {
+      fprintf(stderr, "Error: Cannot start server thread %u\n", started);
+      free(w->cpu);
+      ok = false;
+      break;
+    }
+  }
+
+  pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+  if (ok && (pipe(server_wake) != 0 ||
+             fcntl(server_wake[1], F_SETFL, O_NONBLOCK) != 0)) {
+    fprintf(stderr, "Error: Cannot create the signal pipe: %s\n",
+            strerror(errno));
+    ok = false;
+  }
+
+  struct sigaction sa;
+  struct sigaction old_int;
+  struct sigaction old_term;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = server_on_signal;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, &old_int);
+  sigaction(SIGTERM, &sa, &old_term);
+
+  int listen_fd = ok ? server_listen(config->socket, (int)srv->queue_size)
+                     : -1;
+  if (listen_fd >= 0) {
+    printf("Listening on %s (%u threads, queue %u, idle limit %us, %u "
+           "programs loaded)\n",
+           config->socket, threads, srv->queue_size, srv->idle,
+           srv->program_count);
+    fflush(stdout);
+    server_accept_loop(srv, listen_fd);
+    close(listen_fd);
+    unlink(config->socket);
+  } else {
+    ok = false;
+  }
+  sigaction(SIGINT, &old_int, NULL);
+  sigaction(SIGTERM, &old_term, NULL);
+  for (int i = 0; i < 2; i++) {
+    if (server_wake[i] >= 0) {
+      close(server_wake[i]);
+      server_wake[i] = -1;
+    }
+  }
+
+  // Wake idle workers and cut off clients still connected
+  pthread_mutex_lock(&srv->lock);
+  srv->stop = true;
+  pthread_cond_broadcast(&srv->queued);
+  for (uint32_t i = 0; i < started; i++) {
+    if (workers[i].fd >= 0) {
+      shutdown(workers[i].fd, SHUT_RDWR);
+    }
+  }
+  pthread_mutex_unlock(&srv->lock);
+  for (uint32_t i = 0; i < started; i++) {
+    pthread_join(workers[i].thread, NULL);
+    free(workers[i].cpu);
+  }
+  for (uint32_t i = 0; i < srv->queue_count; i++) {
+    close(srv->queue[(srv->queue_head + i) % srv->queue_size]);
+  }
+
+  if (listen_fd >= 0) {
+    printf("\nServed %llu requests, mean run time %.1f us\n",
+           (unsigned long long)srv->requests,
+           srv->requests ? srv->run_ns / 1000.0 / srv->requests : 0.0);
+  }
+  for (uint32_t i = 0; i < SERVER_MAX_PROGRAMS; i++) {
+    free(srv->programs[i].cpu);
+  }
+  pthread_mutex_destroy(&srv->load);
+  pthread_mutex_destroy(&srv->lock);
+  pthread_cond_destroy(&srv->queued);
+  pthread_cond_destroy(&srv->space);
+  free(srv->queue);
+  free(srv);
+  free(workers);
+  return ok;
+}
+
+/*
+ * ============================================================================
+ * CLIENT
+ * ============================================================================
+ */
+
+/**
+ * Send a program, then print what the first run produced and how long the
+ * round trips took
+ */
+bool server_send(const ClientConfig *config, const uint8_t *image,
+                 uint32_t size) {
+  static uint8_t input[SERVER_MAX_INPUT];
+  uint32_t input_len = 0;
+  if (config->input) {
+    FILE *file = fopen(config->input, "rb");
+    if (!file) {
+      fprintf(stderr, "Error: Cannot open console input %s\n", config->input);
+      return false;
+    }
+    input_len = (uint32_t)fread(input, 1, sizeof(input), file);
+    fclose(file);
+  }
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, config->socket, sizeof(addr.sun_path) - 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    fprintf(stderr, "Error: Cannot connect to %s: %s\n", config->socket,
+            strerror(errno));
+    if (fd >= 0) {
+      close(fd);
+    }
+    return false;
+  }
+
+  static uint8_t output[SERVER_MAX_OUTPUT];
+  uint8_t response[SERVER_RESPONSE_SIZE];
+  uint32_t repeat = config->repeat ? config->repeat : 1;
+  uint32_t id = 0;
+  uint64_t first_ns = 0;
+  uint64_t rest_ns = 0;
+  bool ok = true;
+
+  for (uint32_t i = 0; i < repeat && ok; i++) {
+    uint8_t request[SERVER_REQUEST_SIZE] = {0};
+    uint32_t image_len = i == 0 ? size : 0;
+    put32(request, SERVER_REQUEST_MAGIC);
+    request[4] = SERVER_RUN;
+    put32(request + 8, id);
+    put32(request + 12, image_len);
+    put32(request + 16, input_len);
+    put32(request + 20, config->max_cycles);
+
+    uint64_t start = server_now_ns();
+    ok = server_write(fd, request, sizeof(request)) &&
+         server_write(fd, image, image_len) &&
+         server_write(fd, input, input_len) &&
+         server_read(fd, response, sizeof(response)) &&
+         get32(response) == SERVER_RESPONSE_MAGIC &&
+         get32(response + 56) <= SERVER_MAX_OUTPUT &&
+         server_read(fd, output, get32(response + 56));
+    uint64_t elapsed = server_now_ns() - start;
+    if (!ok) {
+      fprintf(stderr, "Error: Connection to %s failed\n", config->socket);
+      break;
+    }
+    if (response[4] != SERVER_OK) {
+      fprintf(stderr, "Error: Server rejected the request (status %u)\n",
+              response[4]);
+      ok = false;
+      break;
+    }
+    if (i == 0) {
+      id = get32(response + 8);
+      first_ns = elapsed;
+      fwrite(output, 1, get32(response + 56), stdout);
+    } else {
+      rest_ns += elapsed;
+    }
+  }
+  close(fd);
+  if (!ok) {
+    return false;
+  }
+
+  static const char *stops[] = {"halted", "faulted", "hit the cycle limit"};
+  printf("\n\n==================\n");
+  printf("Program %u %s after %llu cycles (%.1f us)%s\n", id,
+         stops[response[5] <= SERVER_STOP_LIMIT ? response[5] : 0],
+         (unsigned long long)get64(response + 40), get64(response + 48) / 1e3,
+         response[6] ? ", output truncated" : "");
+  if (response[5] == SERVER_STOP_FAULT) {
+    printf("Fault %u at PC=0x%04X (address 0x%04X)\n", get16(response + 32),
+           get16(response + 34), get16(response + 36));
+  }
+  for (int r = 0; r < NUM_REGISTERS; r++) {
+    printf("R%d=0x%04X%s", r, get16(response + 12 + 2 * r),
+           r == NUM_REGISTERS - 1 ? "\n" : " ");
+  }
+  printf("PC=0x%04X SP=0x%04X FLAGS=0x%02X\n", get16(response + 28),
+         get16(response + 30), response[7]);
+  printf("Round trip: %.1f us with the image", first_ns / 1e3);
+  if (repeat > 1) {
+    printf(", %.1f us mean over %u by id", rest_ns / 1e3 / (repeat - 1),
+           repeat - 1);
+  }
+  printf("\n");
+  return true;
+}
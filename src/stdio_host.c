@@ -0,0 +1,124 @@
+#include "../include/stdio_host.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+/*
+ * ============================================================================
+ * STDIO HOST
+ * ============================================================================
+ * The command-line emulator's CpuHost. Embedders supply their own.
+ */
+
+/**
+ * Write one console byte to stdout, unbuffered
+ */
+static void stdio_console_write(void *ctx, uint8_t ch) {
+  (void)ctx;
+  putchar(ch);
+  fflush(stdout);
+}
+
+/**
+ * Refill the input buffer with one large read. Without wait, only input
+ * that is already available is taken. Only end of file or a read error
+ * ends input; a signal or a non-blocking descriptor with nothing to read
+ * leaves it empty.
+ */
+static void stdio_input_fill(StdioHost *sh, bool wait) {
+  if (sh->head < sh->tail || sh->eof) {
+    return;
+  }
+
+  struct pollfd pfd = {.fd = sh->input_fd, .events = POLLIN};
+  int ready;
+  do {
+    ready = poll(&pfd, 1, wait ? -1 : 0);
+  } while (ready < 0 && errno == EINTR);
+  if (ready <= 0) {
+    return;
+  }
+  ssize_t got;
+  do {
+    got = read(sh->input_fd, sh->input, sizeof(sh->input));
+  } while (got < 0 && errno == EINTR);
+  if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return;
+  }
+  sh->head = 0;
+  sh->tail = got > 0 ? (uint32_t)got : 0;
+  sh->eof = got <= 0;
+}
+
+/**
+ * Hand out the next buffered console byte
+ */
+static int stdio_console_read(void *ctx) {
+  StdioHost *sh = ctx;
+  pthread_mutex_lock(&sh->lock);
+  stdio_input_fill(sh, sh->blocking);
+  int ch = sh->eof ? CPU_CONSOLE_EOF : CPU_CONSOLE_EMPTY;
+  if (sh->head < sh->tail) {
+    ch = sh->input[sh->head++];
+  }
+  pthread_mutex_unlock(&sh->lock);
+  return ch;
+}
+
+/**
+ * Report buffered input and end of input, reading ahead if the buffer is
+ * empty
+ */
+static uint16_t stdio_console_status(void *ctx, bool wait) {
+  StdioHost *sh = ctx;
+  pthread_mutex_lock(&sh->lock);
+  stdio_input_fill(sh, wait && sh->blocking);
+  uint16_t status = (sh->head < sh->tail ? CONSOLE_STATUS_READY : 0) |
+                    (sh->eof ? CONSOLE_STATUS_EOF : 0);
+  pthread_mutex_unlock(&sh->lock);
+  return status;
+}
+
+/**
+ * Milliseconds of wall-clock time
+ */
+static uint64_t stdio_clock_ms(void *ctx) {
+  (void)ctx;
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return ((uint64_t)tv.tv_sec * 1000) + (tv.tv_usec / 1000);
+}
+
+/**
+ * Print a log message as one line
+ */
+static void stdio_log(void *ctx, CpuLogLevel level, const char *message) {
+  (void)ctx;
+  if (level == CPU_LOG_ERROR) {
+    fprintf(stderr, "Error: %s\n", message);
+  } else {
+    printf("%s\n", message);
+  }
+}
+
+/**
+ * Set up a host reading console input from input_fd
+ */
+void stdio_host_init(StdioHost *sh, int input_fd, bool blocking) {
+  sh->host = (CpuHost){
+      .ctx = sh,
+      .console_write = stdio_console_write,
+      .console_read = stdio_console_read,
+      .console_status = stdio_console_status,
+      .clock_ms = stdio_clock_ms,
+      .log = stdio_log,
+  };
+  pthread_mutex_init(&sh->lock, NULL); // Lives as long as the process
+  sh->input_fd = input_fd;
+  sh->blocking = blocking;
+  sh->eof = false;
+  sh->head = 0;
+  sh->tail = 0;
+}
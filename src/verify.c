@@ -0,0 +1,205 @@
+#include "../include/verify.h"
+#include "../include/batch.h"
+#include "../include/memory.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * ============================================================================
+ * LOCKSTEP VERIFICATION
+ * ============================================================================
+ * The fast engine (a one-lane batch) runs a dynamic basic block first and
+ * records every MMIO read; the reference interpreter then runs the same
+ * number of instructions replaying those reads. PC and cycle count are
+ * checked after every block, full state only on sampled blocks.
+ */
+
+/**
+ * Fold a block of memory into a hash 8 bytes at a time
+ */
+static uint64_t verify_hash_block(uint64_t hash, const uint8_t *data,
+                                  size_t size) {
+  for (size_t offset = 0; offset < size; offset += 8) {
+    uint64_t chunk;
+    memcpy(&chunk, &data[offset], sizeof(chunk));
+    hash = (hash ^ chunk) * 0x100000001B3ULL;
+    hash ^= hash >> 29;
+  }
+  return hash;
+}
+
+/**
+ * Hash the memory image: RAM, extended memory and the page table's bank
+ * selects
+ */
+uint64_t verify_hash_memory(const CPU *cpu) {
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  hash = verify_hash_block(hash, cpu->memory, MEMORY_SIZE);
+  hash = verify_hash_block(hash, cpu->banks,
+                           (size_t)cpu->bank_count * MEM_PAGE_SIZE);
+  return verify_hash_block(hash, (const uint8_t *)cpu->bank_select,
+                           sizeof(cpu->bank_select));
+}
+
+/**
+ * Append one line to the report's diff text
+ */
+static void verify_note(VerifyReport *report, const char *format, ...) {
+  size_t used = strlen(report->diff);
+  if (used >= VERIFY_DIFF_LENGTH - 1) {
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  vsnprintf(report->diff + used, VERIFY_DIFF_LENGTH - used, format, args);
+  va_end(args);
+}
+
+/**
+ * Compare two CPUs, recording each difference. Memory is only hashed when
+ * full is set; on a hash mismatch the first differing byte is located.
+ */
+static bool verify_compare(const CPU *ref, const CPU *fast, bool full,
+                           VerifyReport *report) {
+  bool same = true;
+
+  if (ref->pc != fast->pc) {
+    verify_note(report, "PC: ref=0x%04X fast=0x%04X\n", ref->pc, fast->pc);
+    same = false;
+  }
+  if (ref->cycle_count != fast->cycle_count) {
+    verify_note(report, "Cycles: ref=%llu fast=%llu\n",
+                (unsigned long long)ref->cycle_count,
+                (unsigned long long)fast->cycle_count);
+    same = false;
+  }
+  if (ref->halted != fast->halted) {
+    verify_note(report, "Halted: ref=%d fast=%d\n", ref->halted, fast->halted);
+    same = false;
+  }
+  if (!full) {
+    return same;
+  }
+
+  for (int r = 0; r < NUM_REGISTERS; r++) {
+    if (ref->registers[r] != fast->registers[r]) {
+      verify_note(report, "R%d: ref=0x%04X fast=0x%04X\n", r,
+                  ref->registers[r], fast->registers[r]);
+      same = false;
+    }
+  }
+  if (ref->flags != fast->flags) {
+    verify_note(report, "FLAGS: ref=0x%02X fast=0x%02X\n", ref->flags,
+                fast->flags);
+    same = false;
+  }
+  if (verify_hash_memory(ref) != verify_hash_memory(fast)) {
+    uint32_t first = 0;
+    uint32_t count = 0;
+    for (uint32_t addr = 0; addr < MEMORY_SIZE; addr++) {
+      if (ref->memory[addr] != fast->memory[addr] && count++ == 0) {
+        first = addr;
+      }
+    }
+    if (count > 0) {
+      verify_note(report,
+                  "Mem[0x%04X]: ref=0x%02X fast=0x%02X (%u bytes differ)\n",
+                  first, ref->memory[first], fast->memory[first], count);
+    }
+    for (int page = 0; page < MEM_PAGES; page++) {
+      if (ref->bank_select[page] != fast->bank_select[page]) {
+        verify_note(report, "Bank at 0x%04X: ref=%u fast=%u\n",
+                    page * MEM_PAGE_SIZE, ref->bank_select[page],
+                    fast->bank_select[page]);
+        count++;
+      }
+    }
+    if (count == 0) {
+      verify_note(report, "Extended memory differs\n");
+    }
+    same = false;
+  }
+  return same;
+}
+
+/**
+ * Advance the fast engine by one dynamic basic block.
+ * Returns the number of instructions executed.
+ */
+static uint32_t verify_fast_block(Batch *fast, const IOTrace *trace) {
+  uint32_t executed = 0;
+  while (fast->running && executed < VERIFY_MAX_BLOCK) {
+    uint16_t pc = fast->pc[0];
+    batch_step(fast);
+    executed++;
+
+    // Any control transfer (taken branch, halt) ends the block, as does a
+    // recording buffer that could not hold another block's worth of reads
+    if (fast->pc[0] != (uint16_t)(pc + 2) || !fast->running ||
+        trace->count >= IO_TRACE_CAPACITY - 1) {
+      break;
+    }
+  }
+  return executed;
+}
+
+/**
+ * Run both engines from the same state until the guest halts or they
+ * disagree. Returns false only if the fast engine could not be created.
+ */
+bool verify_run(CPU *cpu, const VerifyConfig *config, VerifyReport *report) {
+  memset(report, 0, sizeof(VerifyReport));
+
+  Batch fast;
+  IOTrace *trace = calloc(1, sizeof(IOTrace));
+  if (!trace || !batch_init(&fast, 1, cpu)) {
+    free(trace);
+    return false;
+  }
+  fast.cpus[0].io_trace = trace;
+  cpu->io_trace = trace;
+
+  uint32_t rate = config->sample_rate ? config->sample_rate : 1;
+  uint64_t rng = config->seed ? config->seed : 0x9E3779B97F4A7C15ULL;
+
+  while (fast.running && !cpu->halted) {
+    uint64_t block_cycle = cpu->cycle_count;
+    uint16_t block_pc = cpu->pc;
+
+    trace->replay = false;
+    trace->count = 0;
+    trace->next = 0;
+    uint32_t executed = verify_fast_block(&fast, trace);
+
+    trace->replay = true;
+    for (uint32_t i = 0; i < executed && !cpu->halted; i++) {
+      cpu_step(cpu);
+    }
+    report->blocks++;
+
+    // xorshift64: cheap enough to draw once per block
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    bool full = rate == 1 || rng % rate == 0 || cpu->halted;
+    report->full_checks += full;
+
+    if (trace->underflow) {
+      verify_note(report, "I/O: reference made more MMIO reads than recorded\n");
+    }
+    if (!verify_compare(cpu, batch_lane_cpu(&fast, 0), full, report) ||
+        trace->underflow) {
+      report->diverged = true;
+      report->cycle = block_cycle;
+      report->pc = block_pc;
+      break;
+    }
+  }
+
+  cpu->io_trace = NULL;
+  batch_free(&fast);
+  free(trace);
+  return true;
+}